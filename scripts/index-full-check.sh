@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+# Check that a set still finds a free index entry when the index is full
+# and the oldest disk slab holds no live item, so that evicting it frees
+# no index entry. Run against a fatcache with a 1 MB index, a memory
+# small enough for slabs to reach disk and a device large enough not to
+# be evicted from before the index fills up:
+#
+#   fatcache -D /tmp/fc.img -m 8 -i 1 -t 1 -p 22122 &
+#   scripts/index-full-check.sh localhost 22122
+#
+
+host=${1:-localhost}
+port=${2:-22122}
+len=400
+nold=3000
+nnew=25000
+val=`head -c $len /dev/zero | tr '\0' 'v'`
+
+exec 3<>/dev/tcp/$host/$port || exit 1
+trap '' PIPE
+
+# read one response line from the server, without the trailing \r
+line() {
+    local l
+
+    read -r -u 3 -t 30 l
+    printf "%s" "${l%$'\r'}"
+}
+
+# store keys $1$2 .. $1$3 without waiting for their replies
+fill() {
+    local i
+
+    for i in `seq $2 $3`; do
+        printf "set $1$i 0 0 $len noreply\r\n$val\r\n" || return 1
+    done >&3
+}
+
+# the first copies of these keys fill the first slabs to reach disk, and
+# storing them again leaves those slabs with no live item
+fill old 1 $nold || exit 1
+fill old 1 $nold || exit 1
+
+# more keys than the index holds make every later set evict
+fill new 1 $nnew || exit 1
+
+printf "get new$nnew\r\n" >&3
+l=`line`
+if [ "$l" != "VALUE new$nnew 0 $len" ]; then
+    echo "get new$nnew: expected 'VALUE new$nnew 0 $len', got '$l'"
+    exit 1
+fi
+exec 3>&-
+
+echo "index full ok"
@@ -0,0 +1,92 @@
+#!/bin/bash
+#
+# Check that a get whose item is read from disk sees none of the requests
+# pipelined after it on the same connection. Run against a fatcache with
+# a small memory, so that key1 is on disk by the time it is read back:
+#
+#   fatcache -D /tmp/fc.img -m 8 -p 22122 &
+#   scripts/pipeline-check.sh localhost 22122
+#
+
+host=${1:-localhost}
+port=${2:-22122}
+len=400000
+val=`head -c $len /dev/zero | tr '\0' 'v'`
+fail=0
+
+exec 3<>/dev/tcp/$host/$port || exit 1
+
+# read one response line from the server, without the trailing \r
+line() {
+    local l
+
+    read -r -u 3 -t 30 l
+    printf "%s" "${l%$'\r'}"
+}
+
+# read one response, a value being summed up by its length and last bytes
+rsp() {
+    local l v
+
+    l=`line`
+    case "$l" in
+    VALUE*)
+        set -- $l
+        read -r -u 3 -t 30 -N $(($4 + 2)) v
+        v=${v%$'\r\n'}
+        l=`line`
+        printf "VALUE %d %s" ${#v} "${v:$((${#v} > 2 ? ${#v} - 2 : 0))}"
+        ;;
+    *)
+        printf "%s" "$l"
+        ;;
+    esac
+}
+
+# store key1 and then enough values after it to push it out to disk
+push() {
+    local i
+
+    printf "set key1 0 0 $len\r\n$val\r\n" >&3
+    rsp >/dev/null
+    for i in `seq 1 120`; do
+        printf "set fill$i 0 0 $len\r\n$val\r\n" >&3
+        rsp >/dev/null
+    done
+}
+
+# compare the next response with the expected one
+expect() {
+    local r
+
+    r=`rsp`
+    if [ "$r" != "$1" ]; then
+        echo "$2: expected '$1', got '$r'"
+        fail=1
+    fi
+}
+
+push
+printf "get key1\r\ndelete key1\r\n" >&3
+expect "VALUE $len vv" "get,delete"
+expect "DELETED" "get,delete"
+
+push
+printf "get key1\r\nappend key1 0 0 2\r\nzz\r\nget key1\r\n" >&3
+expect "VALUE $len vv" "get,append,get"
+expect "STORED" "get,append,get"
+expect "VALUE $(($len + 2)) zz" "get,append,get"
+
+push
+printf "get key1\r\nget key1\r\nset key1 0 0 1\r\nx\r\nget key1\r\n" >&3
+expect "VALUE $len vv" "get,get,set,get"
+expect "VALUE $len vv" "get,get,set,get"
+expect "STORED" "get,get,set,get"
+expect "VALUE 1 x" "get,get,set,get"
+
+exec 3>&-
+
+if [ $fail -ne 0 ]; then
+    exit 1
+fi
+echo "pipeline ok"
@@ -54,6 +54,27 @@
 #define FC_SERVER_ID        0
 #define FC_SERVER_N         1
 
+#define FC_AIO_DEPTH        AIO_DEPTH
+#define FC_FLUSH_WATERMARK  4
+#define FC_EVICT            SLAB_EVICT_FIFO
+
+#define FC_THREADS          1
+
+#define FC_INDEX_ENGINE     ITEMX_ENGINE_CHAIN
+#define FC_USE_CAS          true
+
+#define FC_KEY_HASH         ITEM_KEY_HASH_SHA1
+
+#define FC_RECOVER          0
+
+#define FC_EVENT_MODE       EVENT_MODE_TOGGLE
+#define FC_BUSY_POLL        0
+
+#define FC_UDP_PORT         0
+
+#define FC_TRACE_SAMPLE     1
+#define FC_TRACE_SIZE       (64 * MB)
+
 struct settings settings;          /* fatcache settings */
 static int show_help;              /* show fatcache help? */
 static int show_version;           /* show fatcache version? */
@@ -70,6 +91,8 @@ static struct option long_options[] = {
     { "verbosity",            required_argument,  NULL,   'v' }, /* log verbosity level */
     { "port",                 required_argument,  NULL,   'p' }, /* port number to listen on */
     { "addr",                 required_argument,  NULL,   'a' }, /* address to listen on */
+    { "udp-port",             required_argument,  NULL,   'U' }, /* udp port number to listen on */
+    { "unix-socket",          required_argument,  NULL,   'u' }, /* unix socket path to listen on */
     { "hash-power",           required_argument,  NULL,   'e' }, /* item index hash table size as power of two */
     { "factor",               required_argument,  NULL,   'f' }, /* growth factor for slab items */
     { "min-item-chunk-size",  required_argument,  NULL,   'n' }, /* min item chunk size */
@@ -79,6 +102,20 @@ static struct option long_options[] = {
     { "slab-profile",         required_argument,  NULL,   'z' }, /* profile of slab item sizes */
     { "ssd-device",           required_argument,  NULL,   'D' }, /* path to ssd device file */
     { "server-id",            required_argument,  NULL,   's' }, /* server instance id */
+    { "aio-depth",            required_argument,  NULL,   'A' }, /* io_uring queue depth for disk reads */
+    { "flush-watermark",      required_argument,  NULL,   'W' }, /* free memory slabs kept by the flusher */
+    { "evict",                required_argument,  NULL,   'E' }, /* disk slab eviction policy */
+    { "threads",              required_argument,  NULL,   't' }, /* # worker threads */
+    { "index-engine",         required_argument,  NULL,   'x' }, /* item index engine */
+    { "disable-cas",          no_argument,        NULL,   'C' }, /* disable cas */
+    { "key-hash",             required_argument,  NULL,   'k' }, /* key digest */
+    { "checkpoint",           required_argument,  NULL,   'P' }, /* path to checkpoint file */
+    { "recover",              required_argument,  NULL,   'R' }, /* # crash recovery reader threads */
+    { "event-mode",           required_argument,  NULL,   'M' }, /* when responses are sent */
+    { "busy-poll",            required_argument,  NULL,   'B' }, /* busy poll time in usec */
+    { "trace",                required_argument,  NULL,   'T' }, /* path to workload trace file */
+    { "trace-sample",         required_argument,  NULL,   'g' }, /* trace 1 in N keys */
+    { "trace-size",           required_argument,  NULL,   'G' }, /* max workload trace size in MB */
     { NULL,                   0,                  NULL,    0  }
 };
 
@@ -91,6 +128,8 @@ static char short_options[] =
     "v:" /* log verbosity level */
     "p:" /* port number to listen on */
     "a:" /* address to listen on */
+    "U:" /* udp port number to listen on */
+    "u:" /* unix socket path to listen on */
     "e:" /* item index hash table size as power of two */
     "f:" /* growth factor for slab items */
     "n:" /* min item size */
@@ -100,17 +139,37 @@ static char short_options[] =
     "z:" /* profile of slab item sizes */
     "D:" /* path to ssd device file */
     "s:" /* server instance id */
+    "A:" /* io_uring queue depth for disk reads */
+    "W:" /* free memory slabs kept by the flusher */
+    "E:" /* disk slab eviction policy */
+    "t:" /* # worker threads */
+    "x:" /* item index engine */
+    "C"  /* disable cas */
+    "k:" /* key digest */
+    "P:" /* path to checkpoint file */
+    "R:" /* # crash recovery reader threads */
+    "M:" /* when responses are sent */
+    "B:" /* busy poll time in usec */
+    "T:" /* path to workload trace file */
+    "g:" /* trace 1 in N keys */
+    "G:" /* max workload trace size in MB */
     ;
 
 static void
 fc_show_usage(void)
 {
     log_stderr(
-        "Usage: fatcache [-?hVdS] [-o output file] [-v verbosity level]" CRLF
-        "           [-p port] [-a addr] [-e hash power]" CRLF
+        "Usage: fatcache [-?hVdSC] [-o output file] [-v verbosity level]" CRLF
+        "           [-p port] [-a addr] [-U udp port] [-u unix socket]" CRLF
+        "           [-e hash power]" CRLF
         "           [-f factor] [-n min item chunk size] [-I slab size]" CRLF
         "           [-i max index memory[ [-m max slab memory]" CRLF
         "           [-z slab profile] [-D ssd device] [-s server id]" CRLF
+        "           [-A aio depth] [-W flush watermark] [-t threads]" CRLF
+        "           [-x index engine] [-k key hash] [-P checkpoint]" CRLF
+        "           [-R recovery threads] [-E evict policy]" CRLF
+        "           [-M event mode] [-B busy poll]" CRLF
+        "           [-T trace] [-g trace sample] [-G trace size]" CRLF
         " ");
 
     log_stderr(
@@ -118,19 +177,26 @@ fc_show_usage(void)
         "  -h, --help                  : this help" CRLF
         "  -V, --version               : show version and exit" CRLF
         "  -d, --daemonize             : run as a daemon" CRLF
-        "  -S, --show-sizes            : print slab, item and index sizes and exit"
+        "  -S, --show-sizes            : print slab, item and index sizes and exit" CRLF
+        "  -C, --disable-cas           : disable use of cas, which drops the cas table of the compact index"
         "");
 
     log_stderr(
         "  -o, --output=S              : set the logging file (default: %s)" CRLF
         "  -v, --verbosity=N           : set the logging level (default: %d, min: %d, max: %d)" CRLF
         "  -p, --port=N                : set the port to listen on (default: %d)" CRLF
-        "  -a, --addr=S                : set the address to listen on (default: %s)" CRLF
-        "  -e, --hash-power=N          : set the item index hash table size as a power of two (default: %d)"
+        "  -a, --addr=S                : set the address to listen on (default: %s)"
         "",
         FC_LOG_FILE != NULL ? FC_LOG_FILE : "stderr",
         FC_LOG_DEFAULT, FC_LOG_MIN, FC_LOG_MAX,
-        FC_PORT, FC_ADDR,
+        FC_PORT, FC_ADDR);
+
+    log_stderr(
+        "  -U, --udp-port=N            : set the udp port to listen on, 0 for none (default: %d)" CRLF
+        "  -u, --unix-socket=S         : set the absolute path of a unix domain socket to listen on (default: n/a)" CRLF
+        "  -e, --hash-power=N          : set the item index hash table size as a power of two (default: %d)"
+        "",
+        FC_UDP_PORT,
         FC_HASH_POWER);
 
     log_stderr(
@@ -149,8 +215,34 @@ fc_show_usage(void)
         "  -z, --slab-profile=S        : set the profile of slab item chunk sizes (default: n/a)" CRLF
         "  -D, --ssd-device=S          : set the path to the ssd device file (default: n/a)" CRLF
         "  -s, --server-id=I/N         : set fatcache instance to be I out of total N instances (default: %d/%d)" CRLF
+        "  -A, --aio-depth=N           : set the io_uring queue depth for disk reads, 0 for sync reads (default: %d)" CRLF
+        "  -W, --flush-watermark=N     : set the # free memory slabs the flusher thread keeps, 0 for inline flush (default: %d)" CRLF
+        "  -t, --threads=N             : set the # worker threads, each with its own shard of index, slabs and disk (default: %d)"
+        "",
+        FC_SERVER_ID, FC_SERVER_N, FC_AIO_DEPTH, FC_FLUSH_WATERMARK,
+        FC_THREADS);
+    log_stderr(
+        "  -x, --index-engine=S        : set the item index engine, chain or compact (default: %s)" CRLF
+        "  -k, --key-hash=S            : set the key digest, sha1 or murmur3 (default: %s)" CRLF
+        "  -P, --checkpoint=S          : set the path to the checkpoint file written on SIGTERM / SIGUSR1 for a warm restart (default: n/a)" CRLF
+        "  -R, --recover=N             : set the # threads that recover items from the ssd device without a checkpoint, which can bring back keys deleted or updated since they were flushed, 0 for a cold start (default: %d)" CRLF
+        "  -E, --evict=S               : set how a full ssd device frees a disk slab, fifo to evict the oldest or gc to compact the one with the fewest live items (default: %s)"
+        "",
+        FC_INDEX_ENGINE == ITEMX_ENGINE_CHAIN ? "chain" : "compact",
+        FC_KEY_HASH == ITEM_KEY_HASH_SHA1 ? "sha1" : "murmur3",
+        FC_RECOVER, FC_EVICT == SLAB_EVICT_FIFO ? "fifo" : "gc");
+    log_stderr(
+        "  -M, --event-mode=S          : set when responses are sent, toggle to arm EPOLLOUT for each of them or edge to send them inline at the end of each event loop iteration (default: %s)" CRLF
+        "  -B, --busy-poll=N           : set the usec to busy poll sockets and spin on epoll before sleeping, 0 to always sleep (default: %d)"
+        "",
+        FC_EVENT_MODE == EVENT_MODE_TOGGLE ? "toggle" : "edge",
+        FC_BUSY_POLL);
+    log_stderr(
+        "  -T, --trace=S               : set the path to the file that a trace of the requests is written to, for offline replay (default: n/a)" CRLF
+        "  -g, --trace-sample=N        : set the trace to sample 1 in N keys (default: %d)" CRLF
+        "  -G, --trace-size=N          : set the maximum trace size in MB, past which the oldest requests are overwritten (default: %d MB)"
         "",
-        FC_SERVER_ID, FC_SERVER_N);
+        FC_TRACE_SAMPLE, FC_TRACE_SIZE / MB);
 }
 
 static rstatus_t
@@ -263,6 +355,8 @@ fc_set_default_options(void)
 
     settings.port = FC_PORT;
     settings.addr = FC_ADDR;
+    settings.udp_port = FC_UDP_PORT;
+    settings.unix_path = NULL;
     settings.hash_power = FC_HASH_POWER;
 
     settings.factor = FC_FACTOR;
@@ -278,6 +372,28 @@ fc_set_default_options(void)
 
     settings.server_id = FC_SERVER_ID;
     settings.server_n = FC_SERVER_N;
+
+    settings.aio_depth = FC_AIO_DEPTH;
+    settings.flush_watermark = FC_FLUSH_WATERMARK;
+    settings.evict = FC_EVICT;
+
+    settings.threads = FC_THREADS;
+
+    settings.index_engine = FC_INDEX_ENGINE;
+    settings.use_cas = FC_USE_CAS;
+
+    settings.key_hash = FC_KEY_HASH;
+    settings.md_size = SHA1_DIGEST_SIZE;
+
+    settings.checkpoint = NULL;
+    settings.recover = FC_RECOVER;
+
+    settings.event_mode = FC_EVENT_MODE;
+    settings.busy_poll = FC_BUSY_POLL;
+
+    settings.trace = NULL;
+    settings.trace_sample = FC_TRACE_SAMPLE;
+    settings.trace_size = FC_TRACE_SIZE;
 }
 
 static rstatus_t
@@ -343,6 +459,32 @@ fc_get_options(int argc, char **argv)
             settings.port = value;
             break;
 
+        case 'U':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("fatcache: option -U requires a number");
+                return FC_ERROR;
+            }
+
+            if (value != 0 && !fc_valid_port(value)) {
+                log_stderr("fatcache: option -U value %d is not a valid port",
+                           value);
+                return FC_ERROR;
+            }
+
+            settings.udp_port = value;
+            break;
+
+        case 'u':
+            if (optarg[0] != '/') {
+                log_stderr("fatcache: option -u value '%s' is not an absolute "
+                           "path", optarg);
+                return FC_ERROR;
+            }
+
+            settings.unix_path = optarg;
+            break;
+
         case 'a':
             settings.addr = optarg;
             break;
@@ -470,10 +612,157 @@ fc_get_options(int argc, char **argv)
 
             break;
 
+        case 'A':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("fatcache: option -A requires a number");
+                return FC_ERROR;
+            }
+
+            if (value > AIO_MAX_DEPTH) {
+                log_stderr("fatcache: aio depth cannot be larger than %d",
+                           AIO_MAX_DEPTH);
+                return FC_ERROR;
+            }
+
+            settings.aio_depth = (uint32_t)value;
+            break;
+
+        case 'W':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("fatcache: option -W requires a number");
+                return FC_ERROR;
+            }
+
+            settings.flush_watermark = (uint32_t)value;
+            break;
+
+        case 'E':
+            if (strcmp(optarg, "fifo") == 0) {
+                settings.evict = SLAB_EVICT_FIFO;
+            } else if (strcmp(optarg, "gc") == 0) {
+                settings.evict = SLAB_EVICT_GC;
+            } else {
+                log_stderr("fatcache: option -E value '%s' is not fifo or gc",
+                           optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 't':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value <= 0) {
+                log_stderr("fatcache: option -t requires a non-zero number");
+                return FC_ERROR;
+            }
+
+            if (value > SHARD_MAX_N) {
+                log_stderr("fatcache: threads cannot be larger than %d",
+                           SHARD_MAX_N);
+                return FC_ERROR;
+            }
+
+            settings.threads = (uint32_t)value;
+            break;
+
+        case 'x':
+            if (strcmp(optarg, "chain") == 0) {
+                settings.index_engine = ITEMX_ENGINE_CHAIN;
+            } else if (strcmp(optarg, "compact") == 0) {
+                settings.index_engine = ITEMX_ENGINE_COMPACT;
+            } else {
+                log_stderr("fatcache: option -x value '%s' is not chain or "
+                           "compact", optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'C':
+            settings.use_cas = false;
+            break;
+
+        case 'k':
+            if (strcmp(optarg, "sha1") == 0) {
+                settings.key_hash = ITEM_KEY_HASH_SHA1;
+                settings.md_size = SHA1_DIGEST_SIZE;
+            } else if (strcmp(optarg, "murmur3") == 0) {
+                settings.key_hash = ITEM_KEY_HASH_MURMUR3;
+                settings.md_size = MURMUR3_DIGEST_SIZE;
+            } else {
+                log_stderr("fatcache: option -k value '%s' is not sha1 or "
+                           "murmur3", optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'P':
+            settings.checkpoint = optarg;
+            break;
+
+        case 'R':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("fatcache: option -R requires a number");
+                return FC_ERROR;
+            }
+
+            settings.recover = (uint32_t)value;
+            break;
+
+        case 'M':
+            if (strcmp(optarg, "toggle") == 0) {
+                settings.event_mode = EVENT_MODE_TOGGLE;
+            } else if (strcmp(optarg, "edge") == 0) {
+                settings.event_mode = EVENT_MODE_EDGE;
+            } else {
+                log_stderr("fatcache: option -M value '%s' is not toggle or "
+                           "edge", optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'B':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("fatcache: option -B requires a number");
+                return FC_ERROR;
+            }
+
+            settings.busy_poll = (uint32_t)value;
+            break;
+
+        case 'T':
+            settings.trace = optarg;
+            break;
+
+        case 'g':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value <= 0) {
+                log_stderr("fatcache: option -g requires a non-zero number");
+                return FC_ERROR;
+            }
+
+            settings.trace_sample = (uint32_t)value;
+            break;
+
+        case 'G':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value <= 0) {
+                log_stderr("fatcache: option -G requires a non-zero number");
+                return FC_ERROR;
+            }
+
+            settings.trace_size = (size_t)value * MB;
+            break;
+
         case '?':
             switch (optopt) {
             case 'o':
             case 'D':
+            case 'P':
+            case 'u':
+            case 'T':
                 log_stderr("fatcache: option -%c requires a file name", optopt);
                 break;
 
@@ -485,12 +774,24 @@ fc_get_options(int argc, char **argv)
             case 'I':
             case 'i':
             case 'm':
+            case 'A':
+            case 'W':
+            case 't':
+            case 'R':
+            case 'B':
+            case 'U':
+            case 'g':
+            case 'G':
                 log_stderr("fatcache: option -%c requires a number", optopt);
                 break;
 
             case 'a':
             case 'z':
             case 's':
+            case 'x':
+            case 'k':
+            case 'E':
+            case 'M':
                 log_stderr("fatcache: option -%c requires a string", optopt);
                 break;
 
@@ -668,6 +969,7 @@ static void
 fc_print_sizes(void)
 {
     log_stderr("itemx_size %zu", sizeof(struct itemx));
+    log_stderr("itemx_slot_size %zu", sizeof(struct itemx_slot));
 
     log_stderr("item_hdr_size %zu", ITEM_HDR_SIZE);
     log_stderr("item_chunk_size %zu", settings.chunk_size);
@@ -695,6 +997,7 @@ main(int argc, char **argv)
 {
     rstatus_t status;
     struct context ctx;
+    uint32_t id;
 
     fc_set_default_options();
 
@@ -737,19 +1040,34 @@ main(int argc, char **argv)
 
     fc_print();
 
+    /* the main thread runs worker 0 */
+    for (id = 1; id < settings.threads; id++) {
+        status = core_spawn(id);
+        if (status != FC_OK) {
+            exit(1);
+        }
+    }
+
+    ctx.id = 0;
     status = core_start(&ctx);
     if (status != FC_OK) {
         exit(1);
     }
 
-    for (;;) {
+    signal_unblock_stop();
+
+    while (!signal_stop()) {
         status = core_loop(&ctx);
         if (status != FC_OK) {
             break;
         }
     }
 
+    if (status == FC_OK) {
+        status = core_shutdown();
+    }
+
     core_stop(&ctx);
 
-    return 0;
+    return status == FC_OK ? 0 : 1;
 }
@@ -0,0 +1,785 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fc_core.h>
+#include <fc_aio.h>
+#include <fc_stats.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+extern struct settings settings;
+
+/*
+ * Disk reads of GET requests are issued through an io_uring instance
+ * instead of a blocking pread(), so that an SSD hit no longer stalls the
+ * event loop. Reads are queued while the events of an event loop iteration
+ * are processed, which for a multiget means after the index entries of
+ * all of its keys were looked up. aio_submit() then sorts them by disk
+ * offset, merges the ones that are close together into a single read,
+ * and hands the batch to the kernel at once. Completions are
+ * signalled on an eventfd that is registered with the ring and polled by
+ * the event loop like any other descriptor.
+ *
+ * A request whose read is in flight stays in its connection's outstanding
+ * request q with done unset, so rsp_send_next() holds back every response
+ * queued behind it. That keeps responses in order on each connection even
+ * though reads complete out of order. The requests after it, but for other
+ * gets, are deferred until its read completes, so that it does not see
+ * the writes that came in after it.
+ */
+
+#define AIO_SECTOR_SIZE 512
+
+struct aio_ring {
+    int                 fd;          /* io_uring descriptor */
+    unsigned            *sq_head;    /* sq head (kernel) */
+    unsigned            *sq_tail;    /* sq tail (us) */
+    unsigned            *sq_mask;    /* sq ring mask */
+    unsigned            *sq_entries; /* # sq entries */
+    unsigned            *sq_array;   /* sq index array */
+    struct io_uring_sqe *sqes;       /* sq entries */
+    unsigned            *cq_head;    /* cq head (us) */
+    unsigned            *cq_tail;    /* cq tail (kernel) */
+    unsigned            *cq_mask;    /* cq ring mask */
+    struct io_uring_cqe *cqes;       /* cq entries */
+    void                *sq_ptr;     /* sq ring mapping */
+    size_t              sq_len;      /* sq ring mapping length */
+    void                *cq_ptr;     /* cq ring mapping */
+    size_t              cq_len;      /* cq ring mapping length */
+    size_t              sqes_len;    /* sq entries mapping length */
+};
+
+/*
+ * Every worker thread owns a ring of its own, so all of the ring state
+ * below is thread local; only the in-flight count is process wide.
+ */
+static __thread struct aio_ring ring;       /* io_uring instance */
+static __thread int efd;                    /* completion eventfd */
+static __thread struct conn aio_conn;       /* eventfd connection */
+static __thread bool enabled;               /* async reads enabled? */
+static __thread uint32_t ndepth;            /* queue depth */
+static __thread uint32_t nqueued;           /* # sqe queued, not yet submitted */
+static __thread struct aio_req *reqs;       /* read request table */
+static __thread struct aio_reqhq free_reqq; /* free read request q */
+static __thread struct aio_req **batch;     /* reads queued, not yet in sq */
+static __thread uint32_t nbatch;            /* # read in batch */
+static uint32_t ninflight;                  /* # read in flight */
+static uint64_t nmerged;                    /* # read merged into a run */
+
+static int
+aio_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+aio_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+static int
+aio_register(int fd, unsigned opcode, void *arg, unsigned nargs)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+static rstatus_t
+aio_ring_init(uint32_t entries)
+{
+    struct io_uring_params p;
+    uint8_t *sq, *cq;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+
+    fd = aio_setup(entries, &p);
+    if (fd < 0) {
+        log_warn("io_uring setup with %"PRIu32" entries failed: %s", entries,
+                 strerror(errno));
+        return FC_ERROR;
+    }
+    ring.fd = fd;
+
+    ring.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.sq_len = MAX(ring.sq_len, ring.cq_len);
+        ring.cq_len = ring.sq_len;
+    }
+
+    ring.sq_ptr = mmap(NULL, ring.sq_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ptr == MAP_FAILED) {
+        log_error("mmap io_uring sq ring failed: %s", strerror(errno));
+        return FC_ERROR;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ptr = ring.sq_ptr;
+    } else {
+        ring.cq_ptr = mmap(NULL, ring.cq_len, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ptr == MAP_FAILED) {
+            log_error("mmap io_uring cq ring failed: %s", strerror(errno));
+            return FC_ERROR;
+        }
+    }
+
+    ring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        log_error("mmap io_uring sqes failed: %s", strerror(errno));
+        return FC_ERROR;
+    }
+
+    sq = ring.sq_ptr;
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    cq = ring.cq_ptr;
+    ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return FC_OK;
+}
+
+static void
+aio_ring_deinit(void)
+{
+    if (ring.sqes != NULL && ring.sqes != MAP_FAILED) {
+        munmap(ring.sqes, ring.sqes_len);
+    }
+    if (ring.cq_ptr != NULL && ring.cq_ptr != MAP_FAILED &&
+        ring.cq_ptr != ring.sq_ptr) {
+        munmap(ring.cq_ptr, ring.cq_len);
+    }
+    if (ring.sq_ptr != NULL && ring.sq_ptr != MAP_FAILED) {
+        munmap(ring.sq_ptr, ring.sq_len);
+    }
+    if (ring.fd >= 0) {
+        close(ring.fd);
+    }
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+}
+
+static struct io_uring_sqe *
+aio_get_sqe(void)
+{
+    struct io_uring_sqe *sqe;
+    unsigned head, tail, idx;
+
+    head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    tail = *ring.sq_tail;
+    if (tail - head >= *ring.sq_entries) {
+        return NULL;
+    }
+
+    idx = tail & *ring.sq_mask;
+    sqe = &ring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[idx] = idx;
+
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    nqueued++;
+
+    return sqe;
+}
+
+/*
+ * Return the item that the completed read r brought in, or NULL if there
+ * is none. Moved is set if the index no longer points at the item that
+ * was read, which happens when the slab was evicted, or the key was
+ * updated or deleted by another connection while the read was in flight.
+ * Otherwise a NULL item is one that is not on disk where the index says
+ * it is.
+ */
+static struct item *
+aio_read_item_done(struct aio_req *r, bool *moved)
+{
+    struct msg *msg = r->msg;
+    struct itemx *itx;
+    struct item *it;
+    off_t off;
+    size_t size;
+
+    itx = itemx_getx(msg->hash, msg->md);
+    *moved = itx == NULL || itx->sid != r->sid || itx->offset != r->addr ||
+             itx->cas != r->cas;
+    if (*moved) {
+        return NULL;
+    }
+
+    if (slab_item_extent(r->sid, r->addr, &off, &size) < 0 ||
+        off != r->off || size != r->size) {
+        return NULL;
+    }
+
+    /*
+     * Disk slabs are slab_size aligned, so the item sits at the same
+     * sector offset in the read buffer as it does in its slab.
+     */
+    it = (struct item *)(r->data + (r->addr % AIO_SECTOR_SIZE));
+    if (it->magic != ITEM_MAGIC || it->sid != r->sid ||
+        it->offset != r->addr || memcmp(it->md, msg->md, sizeof(it->md))) {
+        return NULL;
+    }
+
+    return it;
+}
+
+static void
+aio_complete(struct context *ctx, struct aio_req *r, int res)
+{
+    struct msg *msg = r->msg;
+    struct conn *conn;
+    struct item *it;
+    uint32_t sid;
+    bool moved;
+    int err;
+
+    ASSERT(ninflight > 0);
+    __atomic_sub_fetch(&ninflight, 1, __ATOMIC_RELAXED);
+
+    if (msg->swallow) {
+        /* client went away while the read was in flight */
+        log_debug(LOG_INFO, "swallow aio req %"PRIu64"", msg->id);
+        req_put(msg);
+        goto done;
+    }
+
+    sid = shard_id(msg->md);
+    shard_lock(sid);
+
+    it = NULL;
+    moved = false;
+    err = 0;
+    if (res < 0) {
+        err = -res;
+        log_error("aio read %zu bytes at offset %"PRIu64" failed: %s",
+                  r->size, (uint64_t)r->off, strerror(err));
+    } else if ((size_t)res < r->size) {
+        err = EIO;
+        log_error("aio read %zu bytes at offset %"PRIu64" returned %d",
+                  r->size, (uint64_t)r->off, res);
+    } else {
+        it = aio_read_item_done(r, &moved);
+        if (it == NULL && !moved) {
+            /*
+             * Reading it again would find the same bytes, so the index
+             * entry that leads to them is dropped and the get misses.
+             */
+            log_warn("aio req %"PRIu64" found no item at sid %"PRIu32" "
+                     "offset %"PRIu32", removing it from the index", msg->id,
+                     r->sid, r->addr);
+            itemx_removex(msg->hash, msg->md);
+        }
+    }
+
+    log_debug(LOG_VERB, "aio req %"PRIu64" done res %d it %p", msg->id, res,
+              it);
+
+    conn = msg->owner;
+    req_process_get_done(ctx, conn, msg, it, r->cas, err, moved);
+
+    shard_unlock(sid);
+
+    /* requests held back behind the read run with no shard locked */
+    req_process_deferred(ctx, conn);
+
+done:
+    r->msg = NULL;
+    STAILQ_INSERT_HEAD(&free_reqq, r, tqe);
+}
+
+/*
+ * Complete every read of the run of leader lead, which read res bytes
+ * from the offset of the leader. The leader goes last, as the reads of
+ * its run point into its buffer. The bytes the run transferred are
+ * accounted to the leader, so that merged reads are not counted twice.
+ */
+static void
+aio_complete_run(struct context *ctx, struct aio_req *lead, int res)
+{
+    struct aio_req *r, *next;
+    int64_t nsec;
+    int avail;
+
+    nsec = fc_nsec_now() - lead->stime;
+    if (res >= 0) {
+        stats_io_record(lead->cid, STATS_IO_READ, lead->nbyte,
+                        lead->iov.iov_len, nsec);
+    }
+
+    for (r = lead->run; r != NULL; r = next) {
+        next = r->run;
+        r->run = NULL;
+        r->data = lead->buf + (r->off - lead->off);
+        if (res >= 0) {
+            stats_io_record(r->cid, STATS_IO_READ, r->nbyte, 0, nsec);
+        }
+
+        if (res < 0) {
+            aio_complete(ctx, r, res);
+            continue;
+        }
+        avail = MAX(res - (int)(r->off - lead->off), 0);
+        aio_complete(ctx, r, MIN(avail, (int)r->size));
+    }
+
+    lead->run = NULL;
+    lead->data = lead->buf;
+    aio_complete(ctx, lead, res < 0 ? res : MIN(res, (int)lead->size));
+}
+
+static rstatus_t
+aio_recv(struct context *ctx, struct conn *conn)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head, tail;
+    uint64_t val;
+    ssize_t n;
+
+    ASSERT(conn == &aio_conn);
+
+    n = fc_read(efd, &val, sizeof(val));
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        log_error("read eventfd %d failed: %s", efd, strerror(errno));
+    }
+
+    head = *ring.cq_head;
+    for (;;) {
+        tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+
+        cqe = &ring.cqes[head & *ring.cq_mask];
+        head++;
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+        aio_complete_run(ctx, (struct aio_req *)(uintptr_t)cqe->user_data,
+                         cqe->res);
+    }
+
+    /* completions may have queued retries */
+    aio_submit();
+
+    return FC_OK;
+}
+
+static int
+aio_req_cmp(const void *a, const void *b)
+{
+    const struct aio_req *x = *(struct aio_req * const *)a;
+    const struct aio_req *y = *(struct aio_req * const *)b;
+
+    if (x->fd != y->fd) {
+        return x->fd < y->fd ? -1 : 1;
+    }
+
+    if (x->off != y->off) {
+        return x->off < y->off ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Turn the batch of queued reads into sqes. Reads are sorted by disk
+ * offset, and a read that starts in the page where the run before it
+ * ends, or in the next page, joins that run as long as the run stays
+ * within AIO_RUN_SIZE. Reads that find no free sqe stay in the batch.
+ */
+static void
+aio_batch(void)
+{
+    struct io_uring_sqe *sqe;
+    struct aio_req *lead, *r, **tail;
+    off_t end, next;
+    uint32_t i, j;
+    uint8_t *buf;
+
+    if (nbatch == 0) {
+        return;
+    }
+
+    qsort(batch, nbatch, sizeof(*batch), aio_req_cmp);
+
+    for (i = 0; i < nbatch; i = j) {
+        sqe = aio_get_sqe();
+        if (sqe == NULL) {
+            break;
+        }
+
+        lead = batch[i];
+        end = lead->off + (off_t)lead->size;
+        tail = &lead->run;
+        for (j = i + 1; j < nbatch; j++) {
+            r = batch[j];
+            if (r->fd != lead->fd || ROUND_DOWN(r->off, AIO_PAGE_SIZE) >
+                ROUND_DOWN(end - 1, AIO_PAGE_SIZE) + AIO_PAGE_SIZE) {
+                break;
+            }
+
+            next = MAX(end, r->off + (off_t)r->size);
+            if (next - lead->off > AIO_RUN_SIZE) {
+                break;
+            }
+
+            if (lead->nbuf < (size_t)(next - lead->off)) {
+                buf = fc_memalign(AIO_SECTOR_SIZE, AIO_RUN_SIZE);
+                if (buf == NULL) {
+                    break;
+                }
+                fc_free(lead->buf);
+                lead->buf = buf;
+                lead->nbuf = AIO_RUN_SIZE;
+            }
+
+            *tail = r;
+            tail = &r->run;
+            end = next;
+            __atomic_add_fetch(&nmerged, 1, __ATOMIC_RELAXED);
+        }
+        *tail = NULL;
+
+        lead->iov.iov_base = lead->buf;
+        lead->iov.iov_len = (size_t)(end - lead->off);
+        lead->stime = fc_nsec_now();
+
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = lead->fd;
+        sqe->off = (uint64_t)lead->off;
+        sqe->addr = (uint64_t)(uintptr_t)&lead->iov;
+        sqe->len = 1;
+        sqe->user_data = (uint64_t)(uintptr_t)lead;
+
+        log_debug(LOG_VERB, "aio read %zu bytes at offset %"PRIu64" for %"
+                  PRIu32" reqs", lead->iov.iov_len, (uint64_t)lead->off, j - i);
+    }
+
+    nbatch -= i;
+    memmove(batch, batch + i, nbatch * sizeof(*batch));
+}
+
+void
+aio_submit(void)
+{
+    int n;
+
+    if (!enabled) {
+        return;
+    }
+
+    aio_batch();
+
+    if (nqueued == 0) {
+        return;
+    }
+
+    for (;;) {
+        n = aio_enter(ring.fd, nqueued, 0, 0);
+        if (n >= 0) {
+            break;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+
+        /* EAGAIN / EBUSY: leave sqes queued for the next iteration */
+        log_warn("io_uring enter with %"PRIu32" sqes failed: %s", nqueued,
+                 strerror(errno));
+        return;
+    }
+
+    log_debug(LOG_VVERB, "aio submitted %d of %"PRIu32" sqes", n, nqueued);
+
+    ASSERT((uint32_t)n <= nqueued);
+    nqueued -= (uint32_t)n;
+}
+
+/*
+ * Park request msg on an asynchronous read of the item with address
+ * [sid, addr] from a disk slab. Return FC_OK if the read was queued, in
+ * which case the response is sent once the read completes. Otherwise the
+ * caller is expected to fall back to a synchronous read. The read is
+ * only issued by the next aio_submit(), along with the rest of the batch.
+ */
+rstatus_t
+aio_read_item(struct msg *msg, uint32_t sid, uint32_t addr, uint64_t cas)
+{
+    struct aio_req *r;
+    off_t off;
+    size_t size;
+    int fd;
+
+    if (!enabled || STAILQ_EMPTY(&free_reqq)) {
+        return FC_EAGAIN;
+    }
+
+    fd = slab_item_extent(sid, addr, &off, &size);
+    if (fd < 0) {
+        /* memory slab, nothing to wait for */
+        return FC_EAGAIN;
+    }
+
+    r = STAILQ_FIRST(&free_reqq);
+    if (r->nbuf < size) {
+        uint8_t *buf;
+
+        buf = fc_memalign(AIO_SECTOR_SIZE, size);
+        if (buf == NULL) {
+            return FC_ENOMEM;
+        }
+        if (r->buf != NULL) {
+            fc_free(r->buf);
+        }
+        r->buf = buf;
+        r->nbuf = size;
+    }
+
+    STAILQ_REMOVE_HEAD(&free_reqq, tqe);
+
+    r->msg = msg;
+    r->sid = sid;
+    r->addr = addr;
+    r->cas = cas;
+    r->fd = fd;
+    r->off = off;
+    r->size = size;
+    r->cid = slab_get_cid(sid);
+    r->nbyte = cid_to_size(r->cid);
+    r->run = NULL;
+    r->data = NULL;
+
+    ASSERT(nbatch < ndepth);
+    batch[nbatch++] = r;
+
+    __atomic_add_fetch(&ninflight, 1, __ATOMIC_RELAXED);
+
+    log_debug(LOG_VERB, "aio req %"PRIu64" queued read %zu bytes at offset %"
+              PRIu64"", msg->id, size, (uint64_t)off);
+
+    return FC_OK;
+}
+
+rstatus_t
+aio_init(void)
+{
+    rstatus_t status;
+    uint32_t i;
+
+    enabled = false;
+    ndepth = settings.aio_depth;
+    nqueued = 0;
+    reqs = NULL;
+    batch = NULL;
+    nbatch = 0;
+    STAILQ_INIT(&free_reqq);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+    efd = -1;
+
+    if (ndepth == 0) {
+        log_debug(LOG_NOTICE, "aio disabled, disk reads are synchronous");
+        return FC_OK;
+    }
+
+    status = aio_ring_init(ndepth);
+    if (status != FC_OK) {
+        log_warn("aio unavailable, falling back to synchronous disk reads");
+        aio_ring_deinit();
+        return FC_OK;
+    }
+
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0) {
+        log_error("eventfd failed: %s", strerror(errno));
+        aio_ring_deinit();
+        return FC_ERROR;
+    }
+
+    if (aio_register(ring.fd, IORING_REGISTER_EVENTFD, &efd, 1) < 0) {
+        log_error("io_uring register eventfd %d failed: %s", efd,
+                  strerror(errno));
+        aio_deinit();
+        return FC_ERROR;
+    }
+
+    reqs = fc_calloc(ndepth, sizeof(*reqs));
+    batch = fc_calloc(ndepth, sizeof(*batch));
+    if (reqs == NULL || batch == NULL) {
+        aio_deinit();
+        return FC_ENOMEM;
+    }
+    for (i = 0; i < ndepth; i++) {
+        STAILQ_INSERT_TAIL(&free_reqq, &reqs[i], tqe);
+    }
+
+    enabled = true;
+
+    log_debug(LOG_NOTICE, "aio enabled with depth %"PRIu32" on ring %d "
+              "eventfd %d", ndepth, ring.fd, efd);
+
+    return FC_OK;
+}
+
+void
+aio_deinit(void)
+{
+    uint32_t i;
+
+    if (reqs != NULL) {
+        for (i = 0; i < ndepth; i++) {
+            if (reqs[i].buf != NULL) {
+                fc_free(reqs[i].buf);
+            }
+        }
+        fc_free(reqs);
+        reqs = NULL;
+    }
+
+    if (batch != NULL) {
+        fc_free(batch);
+        batch = NULL;
+    }
+
+    if (efd >= 0) {
+        close(efd);
+        efd = -1;
+    }
+
+    aio_ring_deinit();
+    enabled = false;
+}
+
+rstatus_t
+aio_start(struct context *ctx)
+{
+    rstatus_t status;
+
+    if (!enabled) {
+        return FC_OK;
+    }
+
+    memset(&aio_conn, 0, sizeof(aio_conn));
+    aio_conn.sd = efd;
+    aio_conn.recv = aio_recv;
+    TAILQ_INIT(&aio_conn.omsg_q);
+
+    status = event_add_conn(ctx->ep, &aio_conn);
+    if (status < 0) {
+        log_error("event add conn e %d aio %d failed: %s", ctx->ep, efd,
+                  strerror(errno));
+        return FC_ERROR;
+    }
+
+    status = event_del_out(ctx->ep, &aio_conn);
+    if (status != FC_OK) {
+        log_error("event del out e %d aio %d failed: %s", ctx->ep, efd,
+                  strerror(errno));
+        return status;
+    }
+
+    return FC_OK;
+}
+
+bool
+aio_enabled(void)
+{
+    return enabled;
+}
+
+uint32_t
+aio_ninflight(void)
+{
+    return __atomic_load_n(&ninflight, __ATOMIC_RELAXED);
+}
+
+uint64_t
+aio_nmerged(void)
+{
+    return __atomic_load_n(&nmerged, __ATOMIC_RELAXED);
+}
+
+#else
+
+rstatus_t
+aio_init(void)
+{
+    return FC_OK;
+}
+
+void
+aio_deinit(void)
+{
+}
+
+rstatus_t
+aio_start(struct context *ctx)
+{
+    return FC_OK;
+}
+
+bool
+aio_enabled(void)
+{
+    return false;
+}
+
+rstatus_t
+aio_read_item(struct msg *msg, uint32_t sid, uint32_t addr, uint64_t cas)
+{
+    return FC_EAGAIN;
+}
+
+void
+aio_submit(void)
+{
+}
+
+uint32_t
+aio_ninflight(void)
+{
+    return 0;
+}
+
+uint64_t
+aio_nmerged(void)
+{
+    return 0;
+}
+
+#endif
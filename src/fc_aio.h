@@ -0,0 +1,71 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FC_AIO_H_
+#define _FC_AIO_H_
+
+#include <sys/uio.h>
+
+#define AIO_DEPTH       128
+#define AIO_MAX_DEPTH   4096
+
+#define AIO_PAGE_SIZE   (4 * KB)    /* reads in the same or next page merge */
+#define AIO_RUN_SIZE    (128 * KB)  /* max size of a merged read */
+
+/*
+ * An asynchronous read of an item from a disk slab on behalf of a parked
+ * request. The item address [sid, addr] and the aligned extent are
+ * captured at submission, so that the completion can tell whether the
+ * slab was evicted or recycled while the read was in flight.
+ *
+ * Reads queued in the same event loop iteration are sorted by disk offset
+ * and the ones close together are merged into a run, which the first
+ * read of the run (the leader) issues into its buffer on behalf of all.
+ */
+struct aio_req {
+    STAILQ_ENTRY(aio_req) tqe;   /* link in free q */
+    struct msg            *msg;  /* parked request */
+    uint32_t              sid;   /* item slab id */
+    uint32_t              addr;  /* item offset from slab base */
+    uint64_t              cas;   /* item cas */
+    int                   fd;    /* disk descriptor */
+    off_t                 off;   /* aligned disk offset */
+    size_t                size;  /* aligned read size */
+    uint8_t               cid;   /* item slab class */
+    size_t                nbyte; /* item chunk size */
+    int64_t               stime; /* submit time of the run, in nsec */
+    struct aio_req        *run;  /* next read of the run of this leader */
+    uint8_t               *data; /* extent in the leader buffer, once read */
+    uint8_t               *buf;  /* aligned read buffer */
+    size_t                nbuf;  /* read buffer capacity */
+    struct iovec          iov;   /* read vector */
+};
+
+STAILQ_HEAD(aio_reqhq, aio_req);
+
+rstatus_t aio_init(void);
+void aio_deinit(void);
+rstatus_t aio_start(struct context *ctx);
+
+bool aio_enabled(void);
+rstatus_t aio_read_item(struct msg *msg, uint32_t sid, uint32_t addr, uint64_t cas);
+void aio_submit(void);
+
+uint32_t aio_ninflight(void);
+uint64_t aio_nmerged(void);
+
+#endif
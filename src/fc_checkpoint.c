@@ -0,0 +1,265 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include <fc_core.h>
+
+extern struct settings settings;
+
+/*
+ * A checkpoint lets the server come back warm after a clean shutdown. On
+ * SIGTERM or SIGUSR1 the slab table, the slabinfo q and lru order, the
+ * memory slabs in use and the item index of every shard are written to
+ * the checkpoint file, once all memory slabs on their way to disk have
+ * reached it. On the next start with the same configuration and device,
+ * they are read back in place of a cold start, and the checkpoint file is
+ * removed, as the device is about to diverge from it.
+ */
+
+static void
+checkpoint_hdr_init(struct checkpoint_hdr *hdr)
+{
+    size_t size;
+
+    if (fc_device_size(settings.ssd_device, &size) != FC_OK) {
+        size = 0;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = CHECKPOINT_MAGIC;
+    hdr->version = CHECKPOINT_VERSION;
+    hdr->slab_size = settings.slab_size;
+    hdr->device_size = size;
+    hdr->nshard = shard_n();
+    hdr->server_id = settings.server_id;
+    hdr->server_n = settings.server_n;
+    hdr->key_hash = settings.key_hash;
+    hdr->nprofile = settings.profile_last_id + 1;
+    hdr->index_engine = settings.index_engine;
+    hdr->cas_id = item_cas_id();
+    hdr->gen = slab_gen();
+    hdr->saved = (int64_t)time(NULL);
+}
+
+/*
+ * Return true if the checkpoint with header hdr and slab profile profile
+ * was written by a server with the same configuration and device.
+ */
+static bool
+checkpoint_hdr_match(struct checkpoint_hdr *hdr, uint64_t *profile)
+{
+    struct checkpoint_hdr cur;
+    uint8_t cid;
+
+    checkpoint_hdr_init(&cur);
+
+    if (hdr->slab_size != cur.slab_size ||
+        hdr->device_size != cur.device_size || hdr->nshard != cur.nshard ||
+        hdr->server_id != cur.server_id || hdr->server_n != cur.server_n ||
+        hdr->key_hash != cur.key_hash || hdr->nprofile != cur.nprofile ||
+        hdr->index_engine != cur.index_engine) {
+        return false;
+    }
+
+    for (cid = SLABCLASS_MIN_ID; cid < hdr->nprofile; cid++) {
+        if (profile[cid] != settings.profile[cid]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Write the checkpoint. The caller holds the lock of every shard, so that
+ * the workers are kept off the index and slabs for good.
+ */
+rstatus_t
+checkpoint_save(void)
+{
+    rstatus_t status;
+    struct checkpoint_hdr hdr;
+    char path[PATH_MAX];
+    uint64_t profile;
+    uint32_t magic, id;
+    uint8_t cid;
+    int64_t start;
+    FILE *f;
+
+    if (settings.checkpoint == NULL) {
+        return FC_OK;
+    }
+
+    start = fc_usec_now();
+
+    /* write aside and rename, so that a checkpoint is either whole or absent */
+    fc_snprintf(path, sizeof(path), "%s.tmp", settings.checkpoint);
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        log_error("open checkpoint '%s' failed: %s", path, strerror(errno));
+        return FC_ERROR;
+    }
+
+    checkpoint_hdr_init(&hdr);
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    for (cid = SLABCLASS_MIN_ID; cid < hdr.nprofile; cid++) {
+        profile = settings.profile[cid];
+        fwrite(&profile, sizeof(profile), 1, f);
+    }
+
+    for (id = 0; id < hdr.nshard; id++) {
+        itemx_select(id);
+        slab_select(id);
+
+        status = slab_checkpoint(f);
+        if (status != FC_OK) {
+            goto error;
+        }
+
+        status = itemx_checkpoint(f);
+        if (status != FC_OK) {
+            goto error;
+        }
+    }
+
+    magic = CHECKPOINT_MAGIC;
+    fwrite(&magic, sizeof(magic), 1, f);
+
+    if (fflush(f) != 0 || fsync(fileno(f)) < 0) {
+        goto error;
+    }
+    fclose(f);
+
+    if (rename(path, settings.checkpoint) < 0) {
+        log_error("rename checkpoint '%s' to '%s' failed: %s", path,
+                  settings.checkpoint, strerror(errno));
+        unlink(path);
+        return FC_ERROR;
+    }
+
+    loga("checkpoint '%s' written in %"PRId64" msec", settings.checkpoint,
+         (fc_usec_now() - start) / 1000);
+
+    return FC_OK;
+
+error:
+    log_error("write checkpoint '%s' failed: %s", path, strerror(errno));
+    fclose(f);
+    unlink(path);
+    return FC_ERROR;
+}
+
+/*
+ * Restore the index and slabs from the checkpoint, if there is one, and
+ * tell whether it was restored. A checkpoint of a different
+ * configuration is discarded and the server starts cold, while a corrupt
+ * one fails the start.
+ */
+rstatus_t
+checkpoint_load(bool *restored)
+{
+    rstatus_t status;
+    struct checkpoint_hdr hdr;
+    uint64_t profile[SLABCLASS_MAX_IDS];
+    uint32_t magic, id;
+    int64_t start;
+    FILE *f;
+
+    *restored = false;
+
+    if (settings.checkpoint == NULL) {
+        return FC_OK;
+    }
+
+    start = fc_usec_now();
+
+    f = fopen(settings.checkpoint, "r");
+    if (f == NULL) {
+        if (errno == ENOENT) {
+            log_debug(LOG_NOTICE, "no checkpoint '%s', starting cold",
+                      settings.checkpoint);
+            return FC_OK;
+        }
+        log_error("open checkpoint '%s' failed: %s", settings.checkpoint,
+                  strerror(errno));
+        return FC_ERROR;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        hdr.magic != CHECKPOINT_MAGIC || hdr.version != CHECKPOINT_VERSION ||
+        fread(profile, sizeof(profile[0]), hdr.nprofile, f) != hdr.nprofile ||
+        fseeko(f, -(off_t)sizeof(magic), SEEK_END) < 0 ||
+        fread(&magic, sizeof(magic), 1, f) != 1 ||
+        magic != CHECKPOINT_MAGIC) {
+        log_warn("checkpoint '%s' is incomplete, starting cold",
+                 settings.checkpoint);
+        goto cold;
+    }
+
+    if (!checkpoint_hdr_match(&hdr, profile)) {
+        log_warn("checkpoint '%s' does not match the configuration or device, "
+                 "starting cold", settings.checkpoint);
+        goto cold;
+    }
+
+    fseeko(f, (off_t)(sizeof(hdr) + sizeof(profile[0]) * hdr.nprofile),
+           SEEK_SET);
+
+    status = FC_OK;
+    for (id = 0; id < hdr.nshard; id++) {
+        itemx_select(id);
+        slab_select(id);
+
+        status = slab_restore(f);
+        if (status != FC_OK) {
+            break;
+        }
+
+        status = itemx_restore(f);
+        if (status != FC_OK) {
+            break;
+        }
+    }
+    itemx_select(0);
+    slab_select(0);
+
+    fclose(f);
+    unlink(settings.checkpoint);
+
+    if (status != FC_OK) {
+        log_error("checkpoint '%s' is corrupt and was removed",
+                  settings.checkpoint);
+        return status;
+    }
+
+    item_set_cas_id(hdr.cas_id);
+    slab_set_gen(hdr.gen);
+    *restored = true;
+
+    loga("checkpoint '%s' of %"PRId64" secs ago restored in %"PRId64" msec",
+         settings.checkpoint, (int64_t)time(NULL) - hdr.saved,
+         (fc_usec_now() - start) / 1000);
+
+    return FC_OK;
+
+cold:
+    fclose(f);
+    unlink(settings.checkpoint);
+    return FC_OK;
+}
@@ -0,0 +1,49 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FC_CHECKPOINT_H_
+#define _FC_CHECKPOINT_H_
+
+#define CHECKPOINT_MAGIC    0xc0ffee11
+#define CHECKPOINT_VERSION  1
+
+/*
+ * Checkpoint file header. It is followed by the slab profile, then by the
+ * slab and item index state of every shard in turn, and ends with the
+ * magic once more, so that a truncated checkpoint is never loaded.
+ */
+struct checkpoint_hdr {
+    uint32_t magic;       /* checkpoint magic */
+    uint32_t version;     /* checkpoint format version */
+    uint64_t slab_size;   /* slab size */
+    uint64_t device_size; /* ssd device size */
+    uint32_t nshard;      /* # shard */
+    uint32_t server_id;   /* server id */
+    uint32_t server_n;    /* # server */
+    uint8_t  key_hash;    /* key digest */
+    uint8_t  nprofile;    /* # slab profile entry */
+    uint8_t  index_engine; /* item index engine */
+    uint8_t  unused;      /* unused */
+    uint64_t cas_id;      /* last cas */
+    uint64_t gen;         /* generation of slab content */
+    int64_t  saved;       /* unix time of the checkpoint */
+} __attribute__ ((__packed__));
+
+rstatus_t checkpoint_load(bool *restored);
+rstatus_t checkpoint_save(void);
+
+#endif
@@ -26,6 +26,11 @@ client_active(struct conn *conn)
         return true;
     }
 
+    if (!TAILQ_EMPTY(&conn->dmsg_q)) {
+        log_debug(LOG_VVERB, "c %d is active", conn->sd);
+        return true;
+    }
+
     if (conn->rmsg != NULL) {
         log_debug(LOG_VVERB, "c %d is active", conn->sd);
         return true;
@@ -68,6 +73,16 @@ client_close(struct context *ctx, struct conn *conn)
 
     ASSERT(conn->smsg == NULL);
 
+    while ((msg = TAILQ_FIRST(&conn->dmsg_q)) != NULL) {
+        TAILQ_REMOVE(&conn->dmsg_q, msg, c_tqe);
+
+        log_debug(LOG_INFO, "close c %d discarding deferred req %"PRIu64" "
+                  "len %"PRIu32" type %d", conn->sd, msg->id, msg->mlen,
+                  msg->type);
+
+        req_put(msg);
+    }
+
     for (msg = TAILQ_FIRST(&conn->omsg_q); msg != NULL; msg = nmsg) {
         nmsg = TAILQ_NEXT(msg, c_tqe);
 
@@ -93,9 +108,13 @@ client_close(struct context *ctx, struct conn *conn)
     }
     ASSERT(TAILQ_EMPTY(&conn->omsg_q));
 
-    status = close(conn->sd);
-    if (status < 0) {
-        log_error("close c %d failed, ignored: %s", conn->sd, strerror(errno));
+    /* the requests of a udp datagram share the socket of their listener */
+    if (!conn->dgram) {
+        status = close(conn->sd);
+        if (status < 0) {
+            log_error("close c %d failed, ignored: %s", conn->sd,
+                      strerror(errno));
+        }
     }
     conn->sd = -1;
 
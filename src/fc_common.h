@@ -20,6 +20,7 @@ typedef int err_t;     /* error type */
 #include <fcntl.h>
 #include <errno.h>
 #include <time.h>
+#include <stdio.h>
 #include <limits.h>
 
 #include <sys/types.h>
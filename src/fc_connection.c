@@ -18,12 +18,18 @@
 #include <fc_core.h>
 #include <fc_server.h>
 #include <fc_client.h>
+#include <fc_stats.h>
 
 extern struct settings settings;
 
+/*
+ * Connections never move between worker threads, so each worker keeps
+ * its own free conn q. Only the counters are process wide.
+ */
 static uint32_t nalloc_conn;              /* total conn num */
 static uint32_t nfree_connq;              /* # free conn q */
-static struct conn_tqh free_connq;        /* free conn q */
+static uint32_t nserver_conn;             /* # listening conn */
+static __thread struct conn_tqh free_connq; /* free conn q */
 
 static void conn_free(struct conn *conn);
 
@@ -31,8 +37,6 @@ void
 conn_init(void)
 {
     log_debug(LOG_DEBUG, "conn size %d", sizeof(struct conn));
-    nfree_connq = 0;
-    nalloc_conn = 0;
     TAILQ_INIT(&free_connq);
 }
 
@@ -41,13 +45,12 @@ conn_deinit(void)
 {
     struct conn *conn, *nconn; /* current and next connection */
 
-    for (conn = TAILQ_FIRST(&free_connq); conn != NULL;
-         conn = nconn, nfree_connq--) {
+    for (conn = TAILQ_FIRST(&free_connq); conn != NULL; conn = nconn) {
         ASSERT(nfree_connq > 0);
         nconn = TAILQ_NEXT(conn, tqe);
+        __atomic_sub_fetch(&nfree_connq, 1, __ATOMIC_RELAXED);
         conn_free(conn);
     }
-    ASSERT(nfree_connq == 0);
 }
 
 ssize_t
@@ -69,6 +72,7 @@ conn_recv(struct conn *conn, void *buf, size_t size)
                 conn->recv_ready = 0;
             }
             conn->recv_bytes += (size_t)n;
+            stats_listener(conn->listener, STATS_LISTENER_RECV, (uint64_t)n);
             return n;
         }
 
@@ -120,6 +124,7 @@ conn_sendv(struct conn *conn, struct array *sendv, size_t nsend)
                 conn->send_ready = 0;
             }
             conn->send_bytes += (size_t)n;
+            stats_listener(conn->listener, STATS_LISTENER_SEND, (uint64_t)n);
             return n;
         }
 
@@ -163,7 +168,7 @@ conn_put(struct conn *conn)
 
     log_debug(LOG_VVERB, "put conn %p", conn);
 
-    nfree_connq++;
+    __atomic_add_fetch(&nfree_connq, 1, __ATOMIC_RELAXED);
     TAILQ_INSERT_HEAD(&free_connq, conn, tqe);
 }
 
@@ -176,19 +181,21 @@ _conn_get(void)
         ASSERT(nfree_connq > 0);
 
         conn = TAILQ_FIRST(&free_connq);
-        nfree_connq--;
+        __atomic_sub_fetch(&nfree_connq, 1, __ATOMIC_RELAXED);
         TAILQ_REMOVE(&free_connq, conn, tqe);
     } else {
         conn = fc_alloc(sizeof(*conn));
         if (conn == NULL) {
             return NULL;
         }
-        ++nalloc_conn;
+        __atomic_add_fetch(&nalloc_conn, 1, __ATOMIC_RELAXED);
     }
 
     /* extra stuff */
 
     TAILQ_INIT(&conn->omsg_q);
+    TAILQ_INIT(&conn->dmsg_q);
+    conn->nread = 0;
     conn->rmsg = NULL;
     conn->smsg = NULL;
 
@@ -206,11 +213,19 @@ _conn_get(void)
     conn->recv_ready = 0;
     conn->send_active = 0;
     conn->send_ready = 0;
+    conn->send_pending = 0;
+    conn->corked = 0;
 
     conn->client = 0;
     conn->eof = 0;
     conn->done = 0;
     conn->noreply = 0;
+    conn->detected = 0;
+    conn->binary = 0;
+    conn->dgram = 0;
+    conn->listener = SERVER_TCP;
+    conn->peerlen = 0;
+    conn->dgram_id = 0;
 
     return conn;
 }
@@ -237,6 +252,7 @@ conn_get(int sd, bool client)
         c->send = NULL;
         c->close = NULL;
         c->active = NULL;
+        __atomic_add_fetch(&nserver_conn, 1, __ATOMIC_RELAXED);
     }
 
     log_debug(LOG_VVERB, "get conn %p c %d", c, c->sd);
@@ -244,20 +260,27 @@ conn_get(int sd, bool client)
     return c;
 }
 
+/*
+ * Return the # client connections; the listening connections of every
+ * worker, which are never put back, are not counted.
+ */
 uint32_t
 conn_total(void)
 {
-    return nalloc_conn - 1;
+    return __atomic_load_n(&nalloc_conn, __ATOMIC_RELAXED) -
+           __atomic_load_n(&nserver_conn, __ATOMIC_RELAXED);
 }
 
 uint32_t
 conn_nused(void)
 {
-    return nalloc_conn - nfree_connq - 1;
+    return __atomic_load_n(&nalloc_conn, __ATOMIC_RELAXED) -
+           __atomic_load_n(&nfree_connq, __ATOMIC_RELAXED) -
+           __atomic_load_n(&nserver_conn, __ATOMIC_RELAXED);
 }
 
 uint32_t
 conn_nfree(void)
 {
-    return nfree_connq;
+    return __atomic_load_n(&nfree_connq, __ATOMIC_RELAXED);
 }
@@ -30,8 +30,11 @@ typedef bool (*conn_active_t)(struct conn *);
 struct conn {
     int                sd;             /* socket descriptor */
     TAILQ_ENTRY(conn)  tqe;            /* link in free q */
+    TAILQ_ENTRY(conn)  s_tqe;          /* link in send q */
 
     struct msg_tqh     omsg_q;         /* outstanding request Q */
+    struct msg_tqh     dmsg_q;         /* request Q deferred behind disk reads */
+    uint32_t           nread;          /* # request parked on a disk read */
     struct msg         *rmsg;          /* current request being rcvd */
     struct msg         *smsg;          /* current response being sent */
 
@@ -40,6 +43,10 @@ struct conn {
     conn_close_t       close;          /* close handler */
     conn_active_t      active;         /* active? handler */
 
+    struct sockaddr_storage peer;      /* udp peer address */
+    socklen_t          peerlen;        /* udp peer address length */
+    uint16_t           dgram_id;       /* udp request id */
+
     size_t             recv_bytes;     /* received (read) bytes */
     size_t             send_bytes;     /* sent (written) bytes */
 
@@ -49,11 +56,17 @@ struct conn {
     unsigned           recv_ready:1;   /* recv ready? */
     unsigned           send_active:1;  /* send active? */
     unsigned           send_ready:1;   /* send ready? */
+    unsigned           send_pending:1; /* in send q? */
+    unsigned           corked:1;       /* responses held for the send q? */
 
     unsigned           client:1;       /* client? */
     unsigned           eof:1;          /* eof? aka passive close? */
     unsigned           done:1;         /* done? aka close? */
     unsigned           noreply:1;      /* noreply? */
+    unsigned           detected:1;     /* protocol detected? */
+    unsigned           binary:1;       /* binary protocol? */
+    unsigned           dgram:1;        /* requests of a udp datagram? */
+    unsigned           listener:2;     /* listener type, SERVER_* */
 };
 
 TAILQ_HEAD(conn_tqh, conn);
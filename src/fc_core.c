@@ -20,13 +20,18 @@
 
 #include <fc_core.h>
 #include <fc_server.h>
+#include <fc_stats.h>
 
 extern struct settings settings;
 
+static pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t spawn_cond = PTHREAD_COND_INITIALIZER;
+
 rstatus_t
 core_init(void)
 {
     rstatus_t status;
+    bool warm;
 
     status = log_init(settings.verbose, settings.log_filename);
     if (status != FC_OK) {
@@ -43,24 +48,49 @@ core_init(void)
         return status;
     }
 
+    status = shard_init();
+    if (status != FC_OK) {
+        return status;
+    }
+
     status = itemx_init();
     if (status != FC_OK) {
         return status;
     }
 
-    conn_init();
+    item_init();
 
-    mbuf_init();
+    memcache_init();
 
-    msg_init();
+    status = slab_init();
+    if (status != FC_OK) {
+        return status;
+    }
 
-    item_init();
+    status = stats_init();
+    if (status != FC_OK) {
+        return status;
+    }
 
-    status = slab_init();
+    status = trace_init(settings.trace, settings.trace_size,
+                        settings.trace_sample, settings.key_hash,
+                        MAX(settings.threads, 1));
+    if (status != FC_OK) {
+        return status;
+    }
+
+    status = checkpoint_load(&warm);
     if (status != FC_OK) {
         return status;
     }
 
+    if (!warm) {
+        status = recover_scan();
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
     return FC_OK;
 }
 
@@ -162,6 +192,13 @@ core_core(struct context *ctx, struct conn *conn, uint32_t events)
     }
 
     if (events & EPOLLOUT) {
+        if (settings.event_mode == EVENT_MODE_EDGE && conn->client) {
+            /* the socket has room again; send with the rest of the batch */
+            conn->send_ready = 1;
+            event_add_out(ctx->ep, conn);
+            return;
+        }
+
         status = core_send(ctx, conn);
         if (status != FC_OK || conn->done || conn->err) {
             core_close(ctx, conn);
@@ -170,11 +207,34 @@ core_core(struct context *ctx, struct conn *conn, uint32_t events)
     }
 }
 
+/*
+ * Start worker ctx->id on the calling thread. Connection, message, mbuf
+ * and aio state is thread local and is set up here, on the thread that
+ * owns it.
+ */
 rstatus_t
 core_start(struct context *ctx)
 {
     rstatus_t status;
 
+    ctx->tid = pthread_self();
+
+    stats_worker_init(ctx->id);
+    trace_worker_init(ctx->id);
+
+    conn_init();
+
+    mbuf_init();
+
+    msg_init();
+
+    req_init();
+
+    status = aio_init();
+    if (status != FC_OK) {
+        return status;
+    }
+
     ctx->ep = -1;
     ctx->nevent = 1024;
     ctx->max_timeout = -1;
@@ -191,6 +251,11 @@ core_start(struct context *ctx)
         return status;
     }
 
+    status = aio_start(ctx);
+    if (status != FC_OK) {
+        return status;
+    }
+
     return FC_OK;
 }
 
@@ -199,12 +264,141 @@ core_stop(struct context *ctx)
 {
 }
 
+/*
+ * Shut down cleanly, on behalf of the main thread. The lock of every
+ * shard is taken and never released, so that the other workers are held
+ * off until the process exits, and the trace and checkpoint are written.
+ */
+rstatus_t
+core_shutdown(void)
+{
+    uint32_t id;
+
+    for (id = 0; id < shard_n(); id++) {
+        shard_lock(id);
+    }
+
+    trace_flush();
+
+    return checkpoint_save();
+}
+
+static void *
+core_worker(void *arg)
+{
+    struct context *ctx = arg;
+    rstatus_t status;
+
+    status = core_start(ctx);
+
+    pthread_mutex_lock(&spawn_lock);
+    ctx->status = status;
+    ctx->started = true;
+    pthread_cond_signal(&spawn_cond);
+    pthread_mutex_unlock(&spawn_lock);
+
+    if (status != FC_OK) {
+        return NULL;
+    }
+
+    for (;;) {
+        status = core_loop(ctx);
+        if (status != FC_OK) {
+            break;
+        }
+    }
+
+    core_stop(ctx);
+
+    /* the listener of a dead worker would still be handed connections */
+    log_error("worker %"PRIu32" event loop failed, exiting", ctx->id);
+    exit(1);
+
+    return NULL;
+}
+
+/*
+ * Start worker id with an event loop on a thread of its own. Workers are
+ * started one at a time, and the call returns once the worker is ready
+ * to accept connections or has failed to start.
+ */
+rstatus_t
+core_spawn(uint32_t id)
+{
+    struct context *ctx;
+    int err;
+
+    ctx = fc_alloc(sizeof(*ctx));
+    if (ctx == NULL) {
+        return FC_ENOMEM;
+    }
+    ctx->id = id;
+    ctx->status = FC_OK;
+    ctx->started = false;
+
+    err = pthread_create(&ctx->tid, NULL, core_worker, ctx);
+    if (err != 0) {
+        log_error("worker %"PRIu32" create failed: %s", id, strerror(err));
+        fc_free(ctx);
+        return FC_ERROR;
+    }
+
+    pthread_mutex_lock(&spawn_lock);
+    while (!ctx->started) {
+        pthread_cond_wait(&spawn_cond, &spawn_lock);
+    }
+    pthread_mutex_unlock(&spawn_lock);
+
+    if (ctx->status != FC_OK) {
+        log_error("worker %"PRIu32" start failed", id);
+        return ctx->status;
+    }
+
+    log_debug(LOG_NOTICE, "worker %"PRIu32" started", id);
+
+    return FC_OK;
+}
+
+/*
+ * Send the responses left on the send q by the last batch of events. In
+ * edge mode, a connection whose socket filled up is skipped, and its
+ * responses go out on the next EPOLLOUT edge. In toggle mode, EPOLLOUT
+ * is armed for whatever the send leaves behind.
+ */
+static void
+core_flush(struct context *ctx)
+{
+    rstatus_t status;
+    struct conn *conn;
+
+    while ((conn = event_next_send()) != NULL) {
+        if (settings.event_mode == EVENT_MODE_EDGE && !conn->send_ready) {
+            continue;
+        }
+
+        status = core_send(ctx, conn);
+        if (status == FC_OK && !conn->send_ready &&
+            settings.event_mode == EVENT_MODE_TOGGLE) {
+            status = event_add_out(ctx->ep, conn);
+        }
+        if (status != FC_OK || conn->done || conn->err) {
+            core_close(ctx, conn);
+        }
+    }
+}
+
 rstatus_t
 core_loop(struct context *ctx)
 {
-    int i, nsd;
+    int i, nsd, timeout;
 
-    nsd = event_wait(ctx->ep, ctx->event, ctx->nevent, ctx->timeout);
+    nsd = 0;
+    if (settings.busy_poll != 0) {
+        nsd = event_spin(ctx->ep, ctx->event, ctx->nevent, settings.busy_poll);
+    }
+    if (nsd == 0) {
+        nsd = event_wait(ctx->ep, ctx->event, ctx->nevent, ctx->timeout);
+    }
     if (nsd < 0) {
         return nsd;
     }
@@ -215,6 +409,15 @@ core_loop(struct context *ctx)
         core_core(ctx, ev->data.ptr, ev->events);
     }
 
+    /* hand disk reads queued by this batch of events to the kernel */
+    aio_submit();
+
+    core_flush(ctx);
+
+    /* wake up in time to give up the items of stalled values */
+    timeout = req_recv_item_expire();
+    ctx->timeout = timeout < 0 ? ctx->max_timeout : timeout;
+
     return FC_OK;
 }
 
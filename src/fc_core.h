@@ -58,6 +58,7 @@ struct msg_tqh;
 struct mbuf;
 struct mhdr;
 struct item;
+struct itemx;
 struct slab;
 struct slabclass;
 #include "fc_common.h"
@@ -67,10 +68,11 @@ struct slabclass;
 #include <fc_queue.h>
 #include <fc_log.h>
 #include <fc_mbuf.h>
-#include <fc_memcache.h>
 #include <fc_message.h>
+#include <fc_memcache.h>
 
 #include <fc_sha1.h>
+#include <fc_murmur3.h>
 #include <fc_time.h>
 #include <fc_util.h>
 #include <fc_event.h>
@@ -80,8 +82,17 @@ struct slabclass;
 #include <fc_itemx.h>
 #include <fc_item.h>
 #include <fc_signal.h>
+#include <fc_aio.h>
+#include <fc_shard.h>
+#include <fc_checkpoint.h>
+#include <fc_recover.h>
+#include <fc_trace.h>
 
 struct context {
+    uint32_t           id;          /* worker id */
+    pthread_t          tid;         /* worker thread */
+    rstatus_t          status;      /* worker start status */
+    bool               started;     /* worker started? */
     int                ep;          /* epoll device */
     int                nevent;      /* # epoll event */
     int                max_timeout; /* epoll wait max timeout in msec */
@@ -95,7 +106,9 @@ rstatus_t core_init(void);
 void core_deinit(void);
 
 rstatus_t core_start(struct context *ctx);
+rstatus_t core_spawn(uint32_t id);
 void core_stop(struct context *ctx);
+rstatus_t core_shutdown(void);
 rstatus_t core_loop(struct context *ctx);
 
 #endif
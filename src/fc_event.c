@@ -21,6 +21,22 @@
 #include <fc_core.h>
 #include <fc_event.h>
 
+extern struct settings settings;
+
+/*
+ * In edge mode, EPOLLOUT of a client connection is armed once, when it
+ * is added, and never toggled. A connection with responses to send is
+ * put on the send q instead, and the event loop sends them inline after
+ * its batch of events. Only a send that fills up the socket waits for
+ * the next EPOLLOUT edge.
+ *
+ * In toggle mode, the same goes for the responses to the requests of a
+ * read, while the connection is corked, and for the responses to a udp
+ * datagram. EPOLLOUT is only armed for what the inline send leaves
+ * behind.
+ */
+static __thread struct conn_tqh sendq; /* conns with responses to send */
+
 int
 event_init(struct context *ctx, int size)
 {
@@ -49,6 +65,8 @@ event_init(struct context *ctx, int size)
     ctx->ep = ep;
     ctx->event = event;
 
+    TAILQ_INIT(&sendq);
+
     log_debug(LOG_INFO, "e %d with nevent %d timeout %d", ctx->ep,
               ctx->nevent, ctx->timeout);
 
@@ -82,6 +100,15 @@ event_add_out(int ep, struct conn *c)
     ASSERT(c->sd > 0);
     ASSERT(c->recv_active);
 
+    if (c->client &&
+        (settings.event_mode == EVENT_MODE_EDGE || c->corked || c->dgram)) {
+        if (!c->send_pending) {
+            TAILQ_INSERT_TAIL(&sendq, c, s_tqe);
+            c->send_pending = 1;
+        }
+        return 0;
+    }
+
     if (c->send_active) {
         return 0;
     }
@@ -111,6 +138,10 @@ event_del_out(int ep, struct conn *c)
     ASSERT(c->sd > 0);
     ASSERT(c->recv_active);
 
+    if (c->client && (settings.event_mode == EVENT_MODE_EDGE || c->dgram)) {
+        return 0;
+    }
+
     if (!c->send_active) {
         return 0;
     }
@@ -163,6 +194,18 @@ event_del_conn(int ep, struct conn *c)
     ASSERT(c != NULL);
     ASSERT(c->sd > 0);
 
+    if (c->send_pending) {
+        TAILQ_REMOVE(&sendq, c, s_tqe);
+        c->send_pending = 0;
+    }
+
+    /* the requests of a udp datagram are not registered on their own */
+    if (c->dgram) {
+        c->recv_active = 0;
+        c->send_active = 0;
+        return 0;
+    }
+
     status = epoll_ctl(ep, EPOLL_CTL_DEL, c->sd, NULL);
     if (status < 0) {
         log_error("epoll ctl on e %d sd %d failed: %s", ep, c->sd,
@@ -175,6 +218,25 @@ event_del_conn(int ep, struct conn *c)
     return status;
 }
 
+/*
+ * Return the next connection on the send q, taking it off the q, or NULL
+ * when there is none.
+ */
+struct conn *
+event_next_send(void)
+{
+    struct conn *c;
+
+    c = TAILQ_FIRST(&sendq);
+    if (c != NULL) {
+        ASSERT(c->send_pending);
+        TAILQ_REMOVE(&sendq, c, s_tqe);
+        c->send_pending = 0;
+    }
+
+    return c;
+}
+
 int
 event_wait(int ep, struct epoll_event *event, int nevent, int timeout)
 {
@@ -201,7 +263,8 @@ event_wait(int ep, struct epoll_event *event, int nevent, int timeout)
         }
 
         if (errno == EINTR) {
-            continue;
+            /* let the caller see what the signal asked for */
+            return 0;
         }
 
         log_error("epoll wait on e %d with %d events failed: %s", ep, nevent,
@@ -212,3 +275,24 @@ event_wait(int ep, struct epoll_event *event, int nevent, int timeout)
 
     NOT_REACHED();
 }
+
+/*
+ * Poll for events without sleeping for up to usec. Returns the # events
+ * as soon as there are any, or 0 once the time is up.
+ */
+int
+event_spin(int ep, struct epoll_event *event, int nevent, uint32_t usec)
+{
+    int64_t end;
+    int nsd;
+
+    end = fc_usec_now() + usec;
+    do {
+        nsd = event_wait(ep, event, nevent, 0);
+        if (nsd != 0) {
+            return nsd;
+        }
+    } while (fc_usec_now() < end);
+
+    return 0;
+}
@@ -20,6 +20,9 @@
 
 #include <fc_core.h>
 
+#define EVENT_MODE_TOGGLE   0   /* arm EPOLLOUT while responses are pending */
+#define EVENT_MODE_EDGE     1   /* keep EPOLLOUT armed, send inline */
+
 int event_init(struct context *ctx, int size);
 void event_deinit(struct context *ctx);
 
@@ -27,6 +30,9 @@ int event_add_out(int ep, struct conn *c);
 int event_del_out(int ep, struct conn *c);
 int event_add_conn(int ep, struct conn *c);
 int event_del_conn(int ep, struct conn *c);
+struct conn *event_next_send(void);
+
+int event_spin(int ep, struct epoll_event *event, int nevent, uint32_t usec);
 
 int event_wait(int ep, struct epoll_event *event, int nevent, int timeout);
 
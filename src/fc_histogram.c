@@ -0,0 +1,107 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fc_core.h>
+#include <fc_histogram.h>
+
+/*
+ * Return the bucket of latency nsec. Latencies below 2^HISTOGRAM_SUB_BITS
+ * nsec get a bucket each; above that, the bucket is made of the position
+ * of the most significant bit and the next HISTOGRAM_SUB_BITS bits.
+ */
+static uint32_t
+histogram_bucket(uint64_t nsec)
+{
+    uint32_t msb;
+
+    if (nsec < (1ULL << HISTOGRAM_SUB_BITS)) {
+        return (uint32_t)nsec;
+    }
+
+    msb = 63 - (uint32_t)__builtin_clzll(nsec);
+    if (msb >= HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_NBUCKET - 1;
+    }
+
+    return ((msb - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) |
+           (uint32_t)((nsec >> (msb - HISTOGRAM_SUB_BITS)) &
+                      ((1ULL << HISTOGRAM_SUB_BITS) - 1));
+}
+
+/*
+ * Return the smallest latency in nsec that falls in bucket idx.
+ */
+static uint64_t
+histogram_floor(uint32_t idx)
+{
+    uint32_t msb;
+
+    if (idx < (1U << HISTOGRAM_SUB_BITS)) {
+        return idx;
+    }
+
+    msb = (idx >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+
+    return ((1ULL << HISTOGRAM_SUB_BITS) |
+            (idx & ((1U << HISTOGRAM_SUB_BITS) - 1))) <<
+           (msb - HISTOGRAM_SUB_BITS);
+}
+
+void
+histogram_add(struct histogram *h, uint64_t nsec)
+{
+    h->count++;
+    h->sum += nsec;
+    h->max = MAX(h->max, nsec);
+    h->bucket[histogram_bucket(nsec)]++;
+}
+
+void
+histogram_merge(struct histogram *sum, const struct histogram *h)
+{
+    uint32_t i;
+
+    sum->count += h->count;
+    sum->sum += h->sum;
+    sum->max = MAX(sum->max, h->max);
+    for (i = 0; i < HISTOGRAM_NBUCKET; i++) {
+        sum->bucket[i] += h->bucket[i];
+    }
+}
+
+/*
+ * Return the latency in nsec at permille q of histogram h, as the largest
+ * latency of the bucket it falls in.
+ */
+uint64_t
+histogram_quantile(const struct histogram *h, uint32_t q)
+{
+    uint64_t rank, n;
+    uint32_t i;
+
+    ASSERT(h->count > 0);
+
+    rank = MAX((h->count * q + 999) / 1000, 1);
+    for (n = 0, i = 0; i < HISTOGRAM_NBUCKET - 1; i++) {
+        n += h->bucket[i];
+        if (n >= rank) {
+            return MIN(histogram_floor(i + 1) - 1, h->max);
+        }
+    }
+
+    return h->max;
+}
@@ -0,0 +1,45 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FC_HISTOGRAM_H_
+#define _FC_HISTOGRAM_H_
+
+#include <fc_common.h>
+
+/*
+ * Log-linear histogram of latencies: each power of two of nanoseconds is
+ * split into 2^HISTOGRAM_SUB_BITS linear buckets, which bounds the error
+ * of a reported percentile to 1/2^HISTOGRAM_SUB_BITS. Latencies at or
+ * above 2^HISTOGRAM_MAX_BITS nsec fall in the last bucket.
+ */
+#define HISTOGRAM_SUB_BITS  4
+#define HISTOGRAM_MAX_BITS  36
+#define HISTOGRAM_NBUCKET   \
+    ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+struct histogram {
+    uint64_t count;                     /* # latency */
+    uint64_t sum;                       /* sum of latencies in nsec */
+    uint64_t max;                       /* max latency in nsec */
+    uint64_t bucket[HISTOGRAM_NBUCKET]; /* # latency by bucket */
+};
+
+void histogram_add(struct histogram *h, uint64_t nsec);
+void histogram_merge(struct histogram *sum, const struct histogram *h);
+uint64_t histogram_quantile(const struct histogram *h, uint32_t q);
+
+#endif
@@ -60,11 +60,15 @@ item_slabcid(uint8_t nkey, uint32_t ndata)
     return cid;
 }
 
-//insert a item, "bool update" indicates is a update op or not
-//param update is used for data hotness detection
+/*
+ * Allocate the chunk of an item with key and ndata bytes of data in slab
+ * class cid, without indexing it, so that its data can be filled in before
+ * item_publish() makes it visible. "bool update" indicates is a update op
+ * or not, and is used for data hotness detection.
+ */
 struct item *
-item_get(uint8_t *key, uint8_t nkey, uint8_t cid, uint32_t ndata,
-         rel_time_t expiry, uint32_t flags, uint8_t *md, uint32_t hash, bool update)
+item_alloc(uint8_t *key, uint8_t nkey, uint8_t cid, uint32_t ndata,
+           rel_time_t expiry, uint32_t flags, uint8_t *md, uint32_t hash, bool update)
 {
     struct item *it;
 
@@ -84,6 +88,8 @@ item_get(uint8_t *key, uint8_t nkey, uint8_t cid, uint32_t ndata,
     it->nkey = nkey;
     it->ndata = ndata;
     it->flags = flags;
+    /* recovery from disk needs an expiry that outlives the process */
+    it->expiry = expiry == 0 ? 0 : (uint32_t)(time_started() + expiry);
     fc_memcpy(it->md, md, sizeof(it->md));
     it->hash = hash;
     /* part of end[] that stores the key string is initialized here */
@@ -93,7 +99,37 @@ item_get(uint8_t *key, uint8_t nkey, uint8_t cid, uint32_t ndata,
               " expiry %u", it->nkey, item_key(it), it->offset, it->cid,
               expiry);
 
-    itemx_putx(it->hash, it->md, it->sid, it->offset, expiry, ++cas_id);
+    return it;
+}
+
+/*
+ * Index item it allocated by item_alloc() with a new cas and the given
+ * relative expiry, which is also stored in the item.
+ */
+void
+item_publish(struct item *it, rel_time_t expiry)
+{
+    ASSERT(it->magic == ITEM_MAGIC);
+
+    it->expiry = expiry == 0 ? 0 : (uint32_t)(time_started() + expiry);
+
+    itemx_putx(it->hash, it->md, it->sid, it->offset, expiry, item_next_cas());
+}
+
+//insert a item, "bool update" indicates is a update op or not
+//param update is used for data hotness detection
+struct item *
+item_get(uint8_t *key, uint8_t nkey, uint8_t cid, uint32_t ndata,
+         rel_time_t expiry, uint32_t flags, uint8_t *md, uint32_t hash, bool update)
+{
+    struct item *it;
+
+    it = item_alloc(key, nkey, cid, ndata, expiry, flags, md, hash, update);
+    if (it == NULL) {
+        return NULL;
+    }
+
+    item_publish(it, expiry);
 
     return it;
 }
@@ -106,6 +142,28 @@ item_put(struct item *it)
     slab_put_item(it);
 }
 
+/*
+ * Return a new cas, or 0 if cas is disabled.
+ */
+uint64_t
+item_next_cas(void)
+{
+    /* items of different shards are allocated concurrently */
+    return settings.use_cas ? __atomic_add_fetch(&cas_id, 1, __ATOMIC_RELAXED) : 0;
+}
+
+uint64_t
+item_cas_id(void)
+{
+    return __atomic_load_n(&cas_id, __ATOMIC_RELAXED);
+}
+
+void
+item_set_cas_id(uint64_t id)
+{
+    __atomic_store_n(&cas_id, id, __ATOMIC_RELAXED);
+}
+
 void
 item_init(void)
 {
@@ -29,12 +29,16 @@ struct item {
     uint8_t           nkey;       /* key length */
     uint32_t          ndata;      /* date length */
     uint32_t          flags;      /* flags opaque to the server */
+    uint32_t          expiry;     /* absolute expiry in secs, or 0 */
     uint8_t           md[20];     /* key message digest */
     uint32_t          hash;       /* key hash */
     uint8_t           end[1];     /* item data */
 };
 
 #define ITEM_MAGIC      0xfeedface
+
+#define ITEM_KEY_HASH_SHA1      0   /* sha1 key digest */
+#define ITEM_KEY_HASH_MURMUR3   1   /* murmur3 x64 128-bit key digest */
 #define ITEM_HDR_SIZE   offsetof(struct item, end)
 
 /*
@@ -90,9 +94,15 @@ item_data(struct item *it)
 struct slab *item_to_slab(struct item *it);
 uint8_t item_slabcid(uint8_t nkey, uint32_t ndata);
 
+struct item *item_alloc(uint8_t *key, uint8_t nkey, uint8_t cid, uint32_t ndata, rel_time_t expiry, uint32_t dataflags, uint8_t *md, uint32_t hash, bool update);
+void item_publish(struct item *it, rel_time_t expiry);
 struct item *item_get(uint8_t *key, uint8_t nkey, uint8_t cid, uint32_t ndata, rel_time_t expiry, uint32_t dataflags,  uint8_t *md, uint32_t hash, bool update);
 void item_put(struct item *it);
 
+uint64_t item_next_cas(void);
+uint64_t item_cas_id(void);
+void item_set_cas_id(uint64_t id);
+
 void item_init(void);
 void item_deinit(void);
 #endif
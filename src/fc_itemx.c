@@ -17,24 +17,68 @@
 
 #include <fc_core.h>
 #include <stdlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #define HASHSIZE(_n) (1ULL << (_n))
 #define HASHMASK(_n) (HASHSIZE(_n) - 1)
 
 #define USE_HOTRING 1
 #define HR_QUERY_THRESHOLD 5 /* hot ring itemx chains query threshold, to triger head reposition */
 
+#define ITEMX_CTRL_EMPTY    ((int8_t)-128) /* ctrl of a free slot */
+#define ITEMX_CTRL_DELETED  ((int8_t)-2)   /* ctrl of a removed slot */
+#define ITEMX_CTRL_NCLONE   32             /* # ctrl mirrored past the end */
+#define ITEMX_GROUP_MASK    ((1U << ITEMX_GROUP_NSLOT) - 1)
+
 extern struct settings settings;
 
-static uint64_t nitx; /* # item index */
-static uint64_t nitx_table; /* # item index table entries */
-static struct itemx_tqh* itx_table; /* item index table WARNING: After using hot ring, no more tail pointer*/
+/*
+ * The item index is split into shards, one per worker thread. A key is
+ * always indexed in the shard picked by shard_id(), whose lock the caller
+ * holds; itemx_select() makes that shard the current one for the calling
+ * thread.
+ */
+struct itemx_shard {
+    uint64_t         nitx;         /* # item index */
+    uint64_t         nitx_table;   /* # item index table entries */
+    uint32_t         hash_power;   /* item index table size as power of two */
+    struct itemx_tqh *itx_table;   /* item index table WARNING: After using hot ring, no more tail pointer*/
+
+    uint64_t         nalloc_itemx; /* # nalloc itemx */
+    uint64_t         nfree_itemxq; /* # free itemx q */
+    struct itemx_tqh free_itemxq;  /* free itemx q */
+
+    struct itemx     *istart;      /* itemx memory start */
+    struct itemx     *iend;        /* itemx memory end */
+    size_t           ispace;       /* itemx memory space */
+
+    struct itemx_slot *slots;      /* compact index slots */
+    int8_t           *ctrl;        /* compact index slot tags */
+    uint64_t         *cas_table;   /* compact index cas side table */
+    uint64_t         nslot;        /* # compact index slots */
+    uint64_t         nslot_max;    /* max # used compact index slots */
+    uint64_t         ndeleted;     /* # removed compact index slots */
+    uint64_t         vslot;        /* slot of view */
+    struct itemx     view;         /* itemx of the last compact index lookup */
+};
+
+static uint32_t nshard;                      /* # item index shard */
+static struct itemx_shard *shards;           /* item index shards */
+static __thread struct itemx_shard *shard;   /* current item index shard */
+
+static uint8_t engine;                       /* index engine */
+static uint32_t idx_bits;                    /* # chunk index bits in addr */
 
-static uint64_t nalloc_itemx; /* # nalloc itemx */
-static uint64_t nfree_itemxq; /* # free itemx q */
-static struct itemx_tqh free_itemxq; /* free itemx q */
+/*
+ * Match tag against the ctrl of the match_width slots from ctrl, and
+ * return the mask of slots that may hold it. The mask of free slots is
+ * returned in empty.
+ */
+typedef uint32_t (*itemx_match_t)(const int8_t *ctrl, int8_t tag, uint32_t *empty);
 
-static struct itemx* istart; /* itemx memory start */
-static struct itemx* iend; /* itemx memory end */
+static itemx_match_t itemx_match;            /* tag matcher */
+static uint32_t match_width;                 /* # slots matched at once */
 
 /*
  * Return true if the itemx has expired, otherwise return false. Itemx
@@ -61,12 +105,16 @@ bool itemx_expired(struct itemx* itx)
  */
 bool itemx_empty(void)
 {
-    if (STAILQ_EMPTY(&free_itemxq)) {
-        ASSERT(nfree_itemxq == 0);
+    if (engine == ITEMX_ENGINE_COMPACT) {
+        return shard->nitx >= shard->nslot_max;
+    }
+
+    if (STAILQ_EMPTY(&shard->free_itemxq)) {
+        ASSERT(shard->nfree_itemxq == 0);
         return true;
     }
 
-    ASSERT(nfree_itemxq > 0);
+    ASSERT(shard->nfree_itemxq > 0);
 
     return false;
 }
@@ -79,9 +127,9 @@ itemx_get(void)
 
     ASSERT(!itemx_empty());
 
-    itx = STAILQ_FIRST(&free_itemxq);
-    nfree_itemxq--;
-    STAILQ_REMOVE_HEAD(&free_itemxq, tqe);
+    itx = STAILQ_FIRST(&shard->free_itemxq);
+    shard->nfree_itemxq--;
+    STAILQ_REMOVE_HEAD(&shard->free_itemxq, tqe);
 
     STAILQ_NEXT(itx, tqe) = NULL;
     /* md[] is left uninitialized */
@@ -99,58 +147,251 @@ itemx_put(struct itemx* itx)
 {
     log_debug(LOG_VVERB, "put itx %p", itx);
 
-    nfree_itemxq++;
-    STAILQ_INSERT_HEAD(&free_itemxq, itx, tqe);
+    shard->nfree_itemxq++;
+    STAILQ_INSERT_HEAD(&shard->free_itemxq, itx, tqe);
 }
 
-rstatus_t
-itemx_init(void)
+/*
+ * The compact index is an open addressing table of 16 byte slots, laid
+ * out after swiss tables. Next to the slots, a ctrl byte per slot holds
+ * either a 7 bit tag of the digest or a free / removed marker. A key is
+ * probed for linearly from its home slot, in groups of 16 slots whose
+ * ctrl bytes are matched at once, so that a miss is mostly answered from
+ * the ctrl bytes alone. The table is kept at most 7/8 full.
+ */
+static rstatus_t
+itemx_slot_init_shard(void)
+{
+    size_t size;
+
+    size = sizeof(struct itemx_slot) + sizeof(int8_t);
+    if (settings.use_cas) {
+        size += sizeof(uint64_t);
+    }
+
+    shard->nslot = shard->ispace / size;
+    shard->nslot -= shard->nslot % ITEMX_GROUP_NSLOT;
+    if (shard->nslot < ITEMX_CTRL_NCLONE) {
+        log_error("index memory of %zu bytes is too small", shard->ispace);
+        return FC_ERROR;
+    }
+    shard->nslot_max = shard->nslot - shard->nslot / 8;
+    shard->ndeleted = 0;
+
+    log_debug(LOG_DEBUG, "index memory info: %zu, size of itemx_slot %zu",
+        shard->ispace, sizeof(struct itemx_slot));
+
+    shard->slots = fc_mmap(shard->nslot * sizeof(struct itemx_slot));
+    if (shard->slots == NULL) {
+        return FC_ENOMEM;
+    }
+
+    /*
+     * The ctrl of the first slots is mirrored past the end, so that the
+     * ctrl of a group can always be loaded at once.
+     */
+    shard->ctrl = fc_mmap(shard->nslot + ITEMX_CTRL_NCLONE);
+    if (shard->ctrl == NULL) {
+        return FC_ENOMEM;
+    }
+    memset(shard->ctrl, ITEMX_CTRL_EMPTY, shard->nslot + ITEMX_CTRL_NCLONE);
+
+    if (settings.use_cas) {
+        shard->cas_table = fc_mmap(shard->nslot * sizeof(uint64_t));
+        if (shard->cas_table == NULL) {
+            return FC_ENOMEM;
+        }
+    }
+
+    shard->nalloc_itemx = shard->nslot_max;
+
+    return FC_OK;
+}
+
+static uint32_t
+itemx_match_scalar(const int8_t *ctrl, int8_t tag, uint32_t *empty)
+{
+    uint32_t i, match;
+
+    match = 0;
+    *empty = 0;
+    for (i = 0; i < ITEMX_GROUP_NSLOT; i++) {
+        if (ctrl[i] == tag) {
+            match |= 1U << i;
+        } else if (ctrl[i] == ITEMX_CTRL_EMPTY) {
+            *empty |= 1U << i;
+        }
+    }
+
+    return match;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__ ((target("sse2"))) static uint32_t
+itemx_match_sse2(const int8_t *ctrl, int8_t tag, uint32_t *empty)
+{
+    __m128i group;
+
+    group = _mm_loadu_si128((const __m128i *)ctrl);
+    *empty = (uint32_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(group, _mm_set1_epi8(ITEMX_CTRL_EMPTY)));
+
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+}
+
+__attribute__ ((target("avx2"))) static uint32_t
+itemx_match_avx2(const int8_t *ctrl, int8_t tag, uint32_t *empty)
+{
+    __m256i group;
+
+    /* two consecutive groups */
+    group = _mm256_loadu_si256((const __m256i *)ctrl);
+    *empty = (uint32_t)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(group, _mm256_set1_epi8(ITEMX_CTRL_EMPTY)));
+
+    return (uint32_t)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(group, _mm256_set1_epi8(tag)));
+}
+#endif
+
+/*
+ * Pick the widest tag matcher supported by the cpu we run on.
+ */
+static void
+itemx_match_init(void)
+{
+    itemx_match = itemx_match_scalar;
+    match_width = ITEMX_GROUP_NSLOT;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        itemx_match = itemx_match_avx2;
+        match_width = 2 * ITEMX_GROUP_NSLOT;
+        log_debug(LOG_INFO, "compact index matches tags with avx2");
+        return;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        itemx_match = itemx_match_sse2;
+        log_debug(LOG_INFO, "compact index matches tags with sse2");
+        return;
+    }
+#endif
+
+    log_debug(LOG_INFO, "compact index matches tags with scalar");
+}
+
+static rstatus_t
+itemx_init_shard(void)
 {
     struct itemx* itx; /* item index */
     uint64_t n; /* # item index */
     uint64_t i; /* item index iterator */
 
-    nitx = 0ULL;
-    nitx_table = 0ULL;
-    itx_table = NULL;
+    shard->nitx = 0ULL;
+    shard->nitx_table = 0ULL;
+    shard->itx_table = NULL;
 
-    nfree_itemxq = 0;
-    STAILQ_INIT(&free_itemxq);
+    shard->nfree_itemxq = 0;
+    STAILQ_INIT(&shard->free_itemxq);
 
-    istart = NULL;
-    iend = NULL;
+    shard->istart = NULL;
+    shard->iend = NULL;
+
+    /*
+     * Each shard sees only 1/nshard of the keys, so it gets a matching
+     * fraction of the index table and index memory.
+     */
+    shard->hash_power = settings.hash_power;
+    for (n = 2; n <= nshard && shard->hash_power > 1; n <<= 1) {
+        shard->hash_power--;
+    }
+    shard->ispace = settings.max_index_memory / nshard;
+
+    if (engine == ITEMX_ENGINE_COMPACT) {
+        return itemx_slot_init_shard();
+    }
 
     /* init item index table */
-    nitx_table = HASHSIZE(settings.hash_power);
-    itx_table = fc_alloc(sizeof(*itx_table) * nitx_table);
-    if (itx_table == NULL) {
+    shard->nitx_table = HASHSIZE(shard->hash_power);
+    shard->itx_table = fc_alloc(sizeof(*shard->itx_table) * shard->nitx_table);
+    if (shard->itx_table == NULL) {
         return FC_ENOMEM;
     }
-    for (i = 0ULL; i < nitx_table; i++) {
-        STAILQ_INIT(&itx_table[i]);
-        (&itx_table[i])->nhr_queries = 0;
+    for (i = 0ULL; i < shard->nitx_table; i++) {
+        STAILQ_INIT(&shard->itx_table[i]);
+        (&shard->itx_table[i])->nhr_queries = 0;
     }
 
-    log_debug(LOG_DEBUG, "index memory info: %ld, size of itemx %ld",
-        settings.max_index_memory, sizeof(struct itemx));
+    log_debug(LOG_DEBUG, "index memory info: %zu, size of itemx %zu",
+        shard->ispace, sizeof(struct itemx));
 
-    n = settings.max_index_memory / sizeof(struct itemx);
+    n = shard->ispace / sizeof(struct itemx);
     /* init item index memory */
-    itx = fc_mmap(settings.max_index_memory);
+    itx = fc_mmap(shard->ispace);
     if (itx == NULL) {
         return FC_ENOMEM;
     }
-    istart = itx;
-    iend = itx + n;
+    shard->istart = itx;
+    shard->iend = itx + n;
 
-    for (itx = istart; itx < iend; itx++) {
+    for (itx = shard->istart; itx < shard->iend; itx++) {
         itemx_put(itx);
     }
-    nalloc_itemx = n;
+    shard->nalloc_itemx = n;
 
     return FC_OK;
 }
 
+rstatus_t
+itemx_init(void)
+{
+    rstatus_t status;
+    uint32_t i;
+
+    nshard = MAX(settings.threads, 1);
+    engine = settings.index_engine;
+
+    /* addr needs room for the # chunks in a slab of the smallest class */
+    if (engine == ITEMX_ENGINE_COMPACT) {
+        itemx_match_init();
+        for (idx_bits = 1; idx_bits < 31; idx_bits++) {
+            if ((slab_data_size() / settings.profile[SLABCLASS_MIN_ID]) <=
+                (1ULL << idx_bits)) {
+                break;
+            }
+        }
+    }
+
+    shards = fc_calloc(nshard, sizeof(*shards));
+    if (shards == NULL) {
+        return FC_ENOMEM;
+    }
+
+    for (i = 0; i < nshard; i++) {
+        shard = &shards[i];
+        status = itemx_init_shard();
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    shard = &shards[0];
+
+    return FC_OK;
+}
+
+/*
+ * Make shard id the current item index shard of the calling thread.
+ */
+void
+itemx_select(uint32_t id)
+{
+    ASSERT(id < nshard);
+
+    shard = &shards[id];
+}
+
 // void
 // itemx_deinit(void)
 // {
@@ -180,17 +421,322 @@ itemx_bucket(uint32_t hash)
     struct itemx_tqh* bucket;
     uint64_t idx;
 
-    idx = hash & HASHMASK(settings.hash_power);
-    bucket = &itx_table[idx];
+    idx = hash & HASHMASK(shard->hash_power);
+    bucket = &shard->itx_table[idx];
 
     return bucket;
 }
 
+/*
+ * Truncate digest md to the bytes kept in a slot: the leading bytes that
+ * sha1_hash() is computed from, and the trailing bytes.
+ */
+static void
+itemx_slot_md(uint8_t *md, uint8_t *smd)
+{
+    fc_memcpy(smd, md, ITEMX_SLOT_MD_SIZE / 2);
+    fc_memcpy(smd + ITEMX_SLOT_MD_SIZE / 2,
+              md + settings.md_size - ITEMX_SLOT_MD_SIZE / 2,
+              ITEMX_SLOT_MD_SIZE / 2);
+}
+
+static int8_t
+itemx_slot_tag(uint8_t *smd)
+{
+    /* the tag bits are disjoint from the hash bits picking the home slot */
+    return (int8_t)(smd[ITEMX_SLOT_MD_SIZE - 1] & 0x7f);
+}
+
+static uint64_t
+itemx_slot_home(uint32_t hash)
+{
+    return ((uint64_t)hash * shard->nslot) >> 32;
+}
+
+static uint64_t
+itemx_slot_next(uint64_t i, uint64_t n)
+{
+    i += n;
+
+    return i >= shard->nslot ? i - shard->nslot : i;
+}
+
+static void
+itemx_slot_set_ctrl(uint64_t i, int8_t ctrl)
+{
+    shard->ctrl[i] = ctrl;
+    if (i < ITEMX_CTRL_NCLONE) {
+        shard->ctrl[shard->nslot + i] = ctrl;
+    }
+}
+
+static uint32_t
+itemx_slot_addr(uint32_t sid, uint32_t offset)
+{
+    uint32_t idx;
+
+    idx = (offset - SLAB_HDR_SIZE) / cid_to_size(slab_get_cid(sid));
+
+    ASSERT(sid < itemx_nsid());
+    ASSERT(idx < (1U << idx_bits));
+
+    return sid << idx_bits | idx;
+}
+
+/*
+ * Return the slot holding md, or nslot if there is none. The probe stops
+ * at the first group with a free slot.
+ */
+static uint64_t
+itemx_slot_find(uint32_t hash, uint8_t *md)
+{
+    uint64_t i, j;
+    uint32_t match, empty, m, k;
+    uint8_t smd[ITEMX_SLOT_MD_SIZE];
+    int8_t tag;
+
+    itemx_slot_md(md, smd);
+    tag = itemx_slot_tag(smd);
+
+    for (i = itemx_slot_home(hash); ; i = itemx_slot_next(i, match_width)) {
+        match = itemx_match(&shard->ctrl[i], tag, &empty);
+
+        for (k = 0; k < match_width; k += ITEMX_GROUP_NSLOT) {
+            for (m = (match >> k) & ITEMX_GROUP_MASK; m != 0; m &= m - 1) {
+                j = itemx_slot_next(i, k + (uint32_t)__builtin_ctz(m));
+                if (memcmp(shard->slots[j].md, smd, sizeof(smd)) == 0) {
+                    return j;
+                }
+            }
+
+            if (((empty >> k) & ITEMX_GROUP_MASK) != 0) {
+                return shard->nslot;
+            }
+        }
+    }
+}
+
+/*
+ * Return the first free or removed slot on the probe of hash.
+ */
+static uint64_t
+itemx_slot_find_free(uint32_t hash)
+{
+    uint64_t i;
+    uint32_t k;
+
+    for (i = itemx_slot_home(hash); ; i = itemx_slot_next(i, ITEMX_GROUP_NSLOT)) {
+        for (k = 0; k < ITEMX_GROUP_NSLOT; k++) {
+            /* both free and removed ctrl have the sign bit set */
+            if (shard->ctrl[i + k] < 0) {
+                return itemx_slot_next(i, k);
+            }
+        }
+    }
+}
+
+static void
+itemx_slot_move(uint64_t dst, uint64_t src)
+{
+    shard->slots[dst] = shard->slots[src];
+    if (shard->cas_table != NULL) {
+        shard->cas_table[dst] = shard->cas_table[src];
+    }
+}
+
+static void
+itemx_slot_swap(uint64_t a, uint64_t b)
+{
+    struct itemx_slot tmp;
+    uint64_t tcas;
+
+    tmp = shard->slots[a];
+    shard->slots[a] = shard->slots[b];
+    shard->slots[b] = tmp;
+    if (shard->cas_table != NULL) {
+        tcas = shard->cas_table[a];
+        shard->cas_table[a] = shard->cas_table[b];
+        shard->cas_table[b] = tcas;
+    }
+}
+
+/*
+ * Rehash the table in place to turn removed slots back into free slots.
+ * Every used slot is first marked removed, and then either kept, moved to
+ * a free slot or swapped with a slot that is still to be rehashed.
+ */
+static void
+itemx_slot_rehash(void)
+{
+    uint64_t i, j, home;
+    uint32_t hash;
+
+    log_debug(LOG_VERB, "rehash compact index with %"PRIu64" removed slots",
+              shard->ndeleted);
+
+    for (i = 0; i < shard->nslot; i++) {
+        shard->ctrl[i] = shard->ctrl[i] < 0 ? ITEMX_CTRL_EMPTY :
+                         ITEMX_CTRL_DELETED;
+    }
+    fc_memcpy(shard->ctrl + shard->nslot, shard->ctrl, ITEMX_CTRL_NCLONE);
+
+    for (i = 0; i < shard->nslot; i++) {
+        if (shard->ctrl[i] != ITEMX_CTRL_DELETED) {
+            continue;
+        }
+
+        hash = sha1_hash(shard->slots[i].md);
+        home = itemx_slot_home(hash);
+        j = itemx_slot_find_free(hash);
+
+        /* slot is already in the first group with room on its probe */
+        if ((i + shard->nslot - home) % shard->nslot / ITEMX_GROUP_NSLOT ==
+            (j + shard->nslot - home) % shard->nslot / ITEMX_GROUP_NSLOT) {
+            itemx_slot_set_ctrl(i, itemx_slot_tag(shard->slots[i].md));
+            continue;
+        }
+
+        if (shard->ctrl[j] == ITEMX_CTRL_EMPTY) {
+            itemx_slot_move(j, i);
+            itemx_slot_set_ctrl(i, ITEMX_CTRL_EMPTY);
+        } else {
+            /* j was still to be rehashed, so rehash it from i next */
+            itemx_slot_swap(i, j);
+            i--;
+        }
+        itemx_slot_set_ctrl(j, itemx_slot_tag(shard->slots[j].md));
+    }
+
+    shard->ndeleted = 0;
+}
+
+/*
+ * Decode the used slot i into the shard's view. The digest bytes that the
+ * slot does not keep are zero in the view.
+ */
+static struct itemx *
+itemx_slot_view(uint64_t i)
+{
+    struct itemx_slot *slot;
+    struct itemx *itx;
+    uint32_t sid, idx;
+
+    slot = &shard->slots[i];
+
+    sid = slot->addr >> idx_bits;
+    idx = slot->addr & ((1U << idx_bits) - 1);
+
+    itx = &shard->view;
+    memset(itx->md, 0, sizeof(itx->md));
+    fc_memcpy(itx->md, slot->md, ITEMX_SLOT_MD_SIZE / 2);
+    fc_memcpy(itx->md + settings.md_size - ITEMX_SLOT_MD_SIZE / 2,
+              slot->md + ITEMX_SLOT_MD_SIZE / 2, ITEMX_SLOT_MD_SIZE / 2);
+    itx->sid = sid;
+    itx->offset = SLAB_HDR_SIZE + idx * cid_to_size(slab_get_cid(sid));
+    itx->expiry = slot->expiry;
+    itx->cas = shard->cas_table != NULL ? shard->cas_table[i] : 0;
+    shard->vslot = i;
+
+    return itx;
+}
+
+/*
+ * Return the itemx of md decoded into the shard's view. The view is only
+ * valid until the next index call on the shard.
+ */
+static struct itemx *
+itemx_slot_getx(uint32_t hash, uint8_t *md)
+{
+    uint64_t i;
+
+    i = itemx_slot_find(hash, md);
+    if (i == shard->nslot) {
+        return NULL;
+    }
+
+    return itemx_slot_view(i);
+}
+
+static void
+itemx_slot_putx(uint32_t hash, uint8_t *md, uint32_t sid, uint32_t offset,
+                rel_time_t expiry, uint64_t cas)
+{
+    struct itemx_slot *slot;
+    uint8_t smd[ITEMX_SLOT_MD_SIZE];
+    uint64_t i;
+
+    ASSERT(itemx_slot_find(hash, md) == shard->nslot);
+
+    /*
+     * Removed slots lengthen the probes like used slots do, so rehash
+     * once they and the used slots fill 15/16 of the table.
+     */
+    if (shard->nitx + shard->ndeleted >= shard->nslot - shard->nslot / 16) {
+        itemx_slot_rehash();
+    }
+
+    i = itemx_slot_find_free(hash);
+    if (shard->ctrl[i] == ITEMX_CTRL_DELETED) {
+        shard->ndeleted--;
+    }
+    itemx_slot_md(md, smd);
+    itemx_slot_set_ctrl(i, itemx_slot_tag(smd));
+
+    slot = &shard->slots[i];
+    fc_memcpy(slot->md, smd, sizeof(slot->md));
+    slot->addr = itemx_slot_addr(sid, offset);
+    slot->expiry = expiry;
+    if (shard->cas_table != NULL) {
+        shard->cas_table[i] = cas;
+    }
+}
+
+static uint32_t
+itemx_slot_empty(uint64_t i)
+{
+    uint32_t k, empty;
+
+    for (empty = 0, k = 0; k < ITEMX_GROUP_NSLOT; k++) {
+        if (shard->ctrl[i + k] == ITEMX_CTRL_EMPTY) {
+            empty |= 1U << k;
+        }
+    }
+
+    return empty;
+}
+
+static void
+itemx_slot_remove(uint64_t i)
+{
+    uint32_t before, after;
+
+    /*
+     * A removed slot can only be marked free if no probe ever went past
+     * it, that is if no group it is part of has ever been without a
+     * free slot. That holds when the run of used and removed slots
+     * around it is shorter than a group.
+     */
+    before = itemx_slot_empty(itemx_slot_next(i, shard->nslot - ITEMX_GROUP_NSLOT));
+    after = itemx_slot_empty(i);
+    if (before != 0 && after != 0 &&
+        (uint32_t)__builtin_clz(before << (32 - ITEMX_GROUP_NSLOT)) +
+        (uint32_t)__builtin_ctz(after) < ITEMX_GROUP_NSLOT) {
+        itemx_slot_set_ctrl(i, ITEMX_CTRL_EMPTY);
+    } else {
+        itemx_slot_set_ctrl(i, ITEMX_CTRL_DELETED);
+        shard->ndeleted++;
+    }
+}
+
 struct itemx*
 itemx_getx(uint32_t hash, uint8_t* md)
 {
     struct itemx_tqh* bucket = NULL;
     struct itemx* itx = NULL;
+    if (engine == ITEMX_ENGINE_COMPACT) {
+        return itemx_slot_getx(hash, md);
+    }
+
     bucket = itemx_bucket(hash);
 
     //遍历冲突链来寻找
@@ -217,6 +763,13 @@ void itemx_putx(uint32_t hash, uint8_t* md, uint32_t sid, uint32_t offset,
 
     ASSERT(!itemx_empty());
 
+    if (engine == ITEMX_ENGINE_COMPACT) {
+        itemx_slot_putx(hash, md, sid, offset, expiry, cas);
+        shard->nitx++;
+        slab_incr_chunks_by_sid(sid, 1);
+        return;
+    }
+
     itx = itemx_get();
     itx->sid = sid;
     itx->offset = offset;
@@ -229,7 +782,7 @@ void itemx_putx(uint32_t hash, uint8_t* md, uint32_t sid, uint32_t offset,
     ASSERT(itemx_getx(hash, md) == NULL);
 
     bucket = itemx_bucket(hash);
-    nitx++;
+    shard->nitx++;
     if (USE_HOTRING) {
         hotring_insert(bucket, itx); //插入在头结点的后一个
     } else {
@@ -248,40 +801,31 @@ bool itemx_removex(uint32_t hash, uint8_t* md)
         return false; //set数据的指令会从这里返回
     }
 
-    bucket = itemx_bucket(hash);
-    nitx--;
+    shard->nitx--;
 
     //删除之后去slabinfo做一个标记
     // struct slabclass *c;    /* slab class */ //unused warnning
     struct slabinfo* sinfo;
     sinfo = sid_to_sinfo(itx->sid);
 
-    //删除索引后维护一下hole queue
+    //删除索引后维护一下hole bitmap
     if (sinfo->mem) {
-        //删除的item在slab中是第几个
-        uint16_t index_it = itx->offset / cid_to_size(sinfo->cid);
-
-        log_debug(LOG_VERB, "delete itemx in sid: %" PRIu32 ", index_it: %" PRIu16 "",
-            itx->sid, index_it);
-
-        hole_item* hitem = (hole_item*)malloc(sizeof(hole_item));
-        hitem->hole_index = index_it;
-        hitem->next = NULL;
-        //simple insert to hole queue
-        if (sinfo->hole_head) {
-            hitem->next = sinfo->hole_head;
-            sinfo->hole_head = hitem;
-        } else {
-            sinfo->hole_head = hitem;
-        }
-        //原始的更新是异地更新，所以不做nalloc的自减
-        sinfo->nalloc--;
-    }
+        log_debug(LOG_VERB, "delete itemx in sid: %" PRIu32 ", offset: %" PRIu32 "",
+            itx->sid, itx->offset);
 
-    STAILQ_REMOVE(bucket, itx, itemx, tqe); //hotring的删除逻辑和之前一样
+        slab_put_hole(sinfo, itx->offset);
+    }
 
     slab_incr_chunks_by_sid(itx->sid, -1); //stat
 
+    if (engine == ITEMX_ENGINE_COMPACT) {
+        itemx_slot_remove(shard->vslot);
+        return true;
+    }
+
+    bucket = itemx_bucket(hash);
+    STAILQ_REMOVE(bucket, itx, itemx, tqe); //hotring的删除逻辑和之前一样
+
     itemx_put(itx);
 
     return true;
@@ -290,13 +834,131 @@ bool itemx_removex(uint32_t hash, uint8_t* md)
 uint64_t
 itemx_nalloc(void)
 {
-    return nalloc_itemx;
+    return shard->nalloc_itemx;
 }
 
 uint64_t
 itemx_nfree(void)
 {
-    return nfree_itemxq;
+    if (engine == ITEMX_ENGINE_COMPACT) {
+        return shard->nslot_max - shard->nitx;
+    }
+
+    return shard->nfree_itemxq;
+}
+
+/*
+ * Return the # slab ids that the item index can address.
+ */
+uint32_t
+itemx_nsid(void)
+{
+    if (engine == ITEMX_ENGINE_COMPACT) {
+        return 1U << (32 - idx_bits);
+    }
+
+    return UINT32_MAX;
+}
+
+/*
+ * Entry of the item index in a checkpoint. Expiry is kept as absolute
+ * unix time, as the relative time restarts from zero with the process.
+ */
+struct itemx_ckpt {
+    uint8_t  md[20]; /* key message digest */
+    uint32_t sid;    /* owner slab id */
+    uint32_t offset; /* item offset from owner slab base */
+    int64_t  expiry; /* absolute expiry in secs, or 0 */
+    uint64_t cas;    /* cas */
+} __attribute__ ((__packed__));
+
+static void
+itemx_checkpoint_itx(FILE *f, struct itemx *itx)
+{
+    struct itemx_ckpt ic;
+
+    fc_memcpy(ic.md, itx->md, sizeof(ic.md));
+    ic.sid = itx->sid;
+    ic.offset = itx->offset;
+    ic.expiry = itx->expiry == 0 ? 0 : (int64_t)time_started() + itx->expiry;
+    ic.cas = itx->cas;
+
+    fwrite(&ic, sizeof(ic), 1, f);
+}
+
+/*
+ * Write the entries of the current item index shard to f. The compact
+ * index writes only the digest bytes that its slots keep, so that the
+ * checkpoint is restored by the same index engine alone.
+ */
+rstatus_t
+itemx_checkpoint(FILE *f)
+{
+    struct itemx *itx;
+    uint64_t i, n;
+
+    fwrite(&shard->nitx, sizeof(shard->nitx), 1, f);
+
+    n = 0;
+    if (engine == ITEMX_ENGINE_COMPACT) {
+        for (i = 0; i < shard->nslot; i++) {
+            if (shard->ctrl[i] < 0) {
+                continue;
+            }
+            itemx_checkpoint_itx(f, itemx_slot_view(i));
+            n++;
+        }
+    } else {
+        for (i = 0; i < shard->nitx_table; i++) {
+            for (itx = shard->itx_table[i].stqh_first; itx != NULL;
+                 itx = itx->tqe.stqe_next) {
+                itemx_checkpoint_itx(f, itx);
+                n++;
+            }
+        }
+    }
+    ASSERT(n == shard->nitx);
+
+    return ferror(f) ? FC_ERROR : FC_OK;
+}
+
+/*
+ * Index the entries written by itemx_checkpoint() in the current item
+ * index shard, dropping the ones that expired in the meantime. The slab
+ * shard must already be restored.
+ */
+rstatus_t
+itemx_restore(FILE *f)
+{
+    struct itemx_ckpt ic;
+    uint64_t i, n, nexpired;
+
+    if (fread(&n, sizeof(n), 1, f) != 1) {
+        return FC_ERROR;
+    }
+
+    for (nexpired = 0, i = 0; i < n; i++) {
+        if (fread(&ic, sizeof(ic), 1, f) != 1) {
+            return FC_ERROR;
+        }
+
+        if (ic.expiry != 0 && ic.expiry <= (int64_t)time_now_abs()) {
+            nexpired++;
+            continue;
+        }
+
+        if (ic.sid >= itemx_nsid() || itemx_empty()) {
+            return FC_ERROR;
+        }
+
+        itemx_putx(sha1_hash(ic.md), ic.md, ic.sid, ic.offset,
+                   ic.expiry == 0 ? 0 : time_reltime(ic.expiry), ic.cas);
+    }
+
+    log_debug(LOG_INFO, "restored %"PRIu64" of %"PRIu64" itemx, %"PRIu64
+              " expired", n - nexpired, n, nexpired);
+
+    return FC_OK;
 }
 
 /**
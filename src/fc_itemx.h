@@ -20,7 +20,11 @@
 
 #define ITEMX_HASH_POWER    20
 
-#define USE_HOTRING 1
+#define ITEMX_ENGINE_CHAIN      0   /* chained hash table of itemx */
+#define ITEMX_ENGINE_COMPACT    1   /* open addressing table of itemx_slot */
+
+#define ITEMX_GROUP_NSLOT   16      /* # itemx_slot probed at once */
+#define ITEMX_SLOT_MD_SIZE  8       /* # digest bytes kept in itemx_slot */
 
 struct itemx {
     STAILQ_ENTRY(itemx) tqe;    /* link in index / free q */
@@ -31,6 +35,17 @@ struct itemx {
     uint64_t            cas;    /* cas */
 } __attribute__ ((__packed__));
 
+/*
+ * Entry of the compact index. Only the leading and trailing 4 bytes of the
+ * digest are kept, the slab id and the chunk index within the slab are
+ * packed into addr, and the cas lives in an optional side table, so that
+ * four entries fill a cache line.
+ */
+struct itemx_slot {
+    uint8_t             md[ITEMX_SLOT_MD_SIZE]; /* truncated message digest */
+    uint32_t            addr;   /* packed owner slab id and chunk index */
+    rel_time_t          expiry; /* expiry in secs */
+} __attribute__ ((__packed__));
 
 // redesign itemx bucket info
 struct itemx_tqh {                                                           
@@ -43,6 +58,7 @@ struct itemx_tqh {
 
 rstatus_t itemx_init(void);
 void itemx_deinit(void);
+void itemx_select(uint32_t id);
 
 bool itemx_empty(void);
 bool itemx_expired(struct itemx *itx);
@@ -54,6 +70,10 @@ void hotring_insert(struct itemx_tqh * bucket, struct itemx* new);
 struct itemx* hotring_get(struct itemx_tqh* bucket, uint8_t* query_md);
 struct itemx* _hotring_get(struct itemx* now, uint8_t* query_md, bool rm);
 
+rstatus_t itemx_checkpoint(FILE *f);
+rstatus_t itemx_restore(FILE *f);
+
+uint32_t itemx_nsid(void);
 uint64_t itemx_nalloc(void);
 uint64_t itemx_nfree(void);
 #endif
@@ -20,30 +20,33 @@
 
 #include <fc_core.h>
 
-static uint32_t nfree_mbufq;   /* # free mbuf */
-static struct mhdr free_mbufq; /* free mbuf q */
+static __thread uint32_t nfree_mbufq[MBUF_NCLASS];   /* # free mbuf per class */
+static __thread struct mhdr free_mbufq[MBUF_NCLASS]; /* free mbuf q per class */
 
-static size_t mbuf_chunk_size; /* mbuf chunk size - header + data (const) */
-static size_t mbuf_offset;     /* mbuf offset in chunk (const) */
+static size_t mbuf_chunk_size[MBUF_NCLASS]; /* mbuf chunk size - header + data (const) */
+static size_t mbuf_offset[MBUF_NCLASS];     /* mbuf offset in chunk (const) */
 
 static struct mbuf *
-_mbuf_get(void)
+_mbuf_get(uint8_t cid)
 {
     struct mbuf *mbuf;
     uint8_t *buf;
 
-    if (!STAILQ_EMPTY(&free_mbufq)) {
-        ASSERT(nfree_mbufq > 0);
+    ASSERT(cid < MBUF_NCLASS);
 
-        mbuf = STAILQ_FIRST(&free_mbufq);
-        nfree_mbufq--;
-        STAILQ_REMOVE_HEAD(&free_mbufq, next);
+    if (!STAILQ_EMPTY(&free_mbufq[cid])) {
+        ASSERT(nfree_mbufq[cid] > 0);
+
+        mbuf = STAILQ_FIRST(&free_mbufq[cid]);
+        nfree_mbufq[cid]--;
+        STAILQ_REMOVE_HEAD(&free_mbufq[cid], next);
 
         ASSERT(mbuf->magic == MBUF_MAGIC);
+        ASSERT(mbuf->cid == cid);
         goto done;
     }
 
-    buf = fc_alloc(mbuf_chunk_size);
+    buf = fc_alloc(mbuf_chunk_size[cid]);
     if (buf == NULL) {
         return NULL;
     }
@@ -67,36 +70,94 @@ _mbuf_get(void)
      *                        mbuf->last (one byte past valid byte)
      *
      */
-    mbuf = (struct mbuf *)(buf + mbuf_offset);
+    mbuf = (struct mbuf *)(buf + mbuf_offset[cid]);
     mbuf->magic = MBUF_MAGIC;
+    mbuf->cid = cid;
 
 done:
     STAILQ_NEXT(mbuf, next) = NULL;
     return mbuf;
 }
 
-struct mbuf *
-mbuf_get(void)
+static struct mbuf *
+mbuf_get_class(uint8_t cid)
 {
     struct mbuf *mbuf;
     uint8_t *buf;
 
-    mbuf = _mbuf_get();
+    mbuf = _mbuf_get(cid);
     if (mbuf == NULL) {
         return NULL;
     }
 
-    buf = (uint8_t *)mbuf - mbuf_offset;
+    buf = (uint8_t *)mbuf - mbuf_offset[cid];
     mbuf->start = buf;
-    mbuf->end = buf + mbuf_offset;
+    mbuf->end = buf + mbuf_offset[cid];
 
-    ASSERT(mbuf->end - mbuf->start == (int)mbuf_offset);
+    ASSERT(mbuf->end - mbuf->start == (int)mbuf_offset[cid]);
     ASSERT(mbuf->start < mbuf->end);
 
     mbuf->pos = mbuf->start;
     mbuf->last = mbuf->start;
+    mbuf->release = NULL;
+    mbuf->arg = NULL;
 
-    log_debug(LOG_VVERB, "get mbuf %p", mbuf);
+    log_debug(LOG_VVERB, "get mbuf %p cid %"PRIu8"", mbuf, cid);
+
+    return mbuf;
+}
+
+struct mbuf *
+mbuf_get(void)
+{
+    return mbuf_get_class(0);
+}
+
+/*
+ * Get an mbuf of the smallest size class with room for size bytes of
+ * data, or of the largest size class if none has.
+ */
+struct mbuf *
+mbuf_get_size(size_t size)
+{
+    uint8_t cid;
+
+    for (cid = 0; cid < MBUF_NCLASS - 1; cid++) {
+        if (mbuf_offset[cid] >= size) {
+            break;
+        }
+    }
+
+    return mbuf_get_class(cid);
+}
+
+/*
+ * Get an mbuf that refers to size bytes at pos owned by someone else,
+ * instead of holding a copy of them. The mbuf is full, so nothing is
+ * ever copied into the referenced buffer, and release(arg) is invoked
+ * once the mbuf is put back.
+ */
+struct mbuf *
+mbuf_get_ref(uint8_t *pos, size_t size, mbuf_release_t release, void *arg)
+{
+    struct mbuf *mbuf;
+
+    ASSERT(size > 0);
+    ASSERT(release != NULL);
+
+    mbuf = _mbuf_get(0);
+    if (mbuf == NULL) {
+        return NULL;
+    }
+
+    mbuf->start = pos;
+    mbuf->end = pos + size;
+    mbuf->pos = mbuf->start;
+    mbuf->last = mbuf->end;
+    mbuf->release = release;
+    mbuf->arg = arg;
+
+    log_debug(LOG_VVERB, "get ref mbuf %p len %zu", mbuf, size);
 
     return mbuf;
 }
@@ -111,7 +172,7 @@ mbuf_free(struct mbuf *mbuf)
     ASSERT(STAILQ_NEXT(mbuf, next) == NULL);
     ASSERT(mbuf->magic == MBUF_MAGIC);
 
-    buf = (uint8_t *)mbuf - mbuf_offset;
+    buf = (uint8_t *)mbuf - mbuf_offset[mbuf->cid];
     fc_free(buf);
 }
 
@@ -123,8 +184,14 @@ mbuf_put(struct mbuf *mbuf)
     ASSERT(STAILQ_NEXT(mbuf, next) == NULL);
     ASSERT(mbuf->magic == MBUF_MAGIC);
 
-    nfree_mbufq++;
-    STAILQ_INSERT_HEAD(&free_mbufq, mbuf, next);
+    if (mbuf->release != NULL) {
+        mbuf->release(mbuf->arg);
+        mbuf->release = NULL;
+        mbuf->arg = NULL;
+    }
+
+    nfree_mbufq[mbuf->cid]++;
+    STAILQ_INSERT_HEAD(&free_mbufq[mbuf->cid], mbuf, next);
 }
 
 /*
@@ -169,7 +236,7 @@ mbuf_size(struct mbuf *mbuf)
 size_t
 mbuf_data_size(void)
 {
-    return mbuf_offset;
+    return mbuf_offset[0];
 }
 
 /*
@@ -330,7 +397,19 @@ mbuf_split(struct mhdr *h, uint8_t *pos, mbuf_copy_t cb, void *cbarg)
     mbuf = STAILQ_LAST(h, mbuf, next);
     ASSERT(pos >= mbuf->pos && pos <= mbuf->last);
 
-    nbuf = mbuf_get();
+    size = (size_t)(mbuf->last - pos);
+
+    /*
+     * Data split off an mbuf of the first size class fits in another one,
+     * along with the precopy. Data split off a larger mbuf gets an mbuf
+     * of the smallest size class it fits in.
+     */
+    if (mbuf->cid == 0) {
+        nbuf = mbuf_get();
+    } else {
+        ASSERT(cb == NULL);
+        nbuf = mbuf_get_size(size);
+    }
     if (nbuf == NULL) {
         return NULL;
     }
@@ -341,7 +420,6 @@ mbuf_split(struct mhdr *h, uint8_t *pos, mbuf_copy_t cb, void *cbarg)
     }
 
     /* copy data from mbuf to nbuf */
-    size = (size_t)(mbuf->last - pos);
     mbuf_copy(nbuf, pos, size);
 
     /* adjust mbuf */
@@ -357,24 +435,35 @@ mbuf_split(struct mhdr *h, uint8_t *pos, mbuf_copy_t cb, void *cbarg)
 void
 mbuf_init(void)
 {
-    nfree_mbufq = 0;
-    STAILQ_INIT(&free_mbufq);
+    uint8_t cid;
+
+    for (cid = 0; cid < MBUF_NCLASS; cid++) {
+        nfree_mbufq[cid] = 0;
+        STAILQ_INIT(&free_mbufq[cid]);
 
-    mbuf_chunk_size = MBUF_SIZE;
-    mbuf_offset = mbuf_chunk_size - MBUF_HSIZE;
+        mbuf_chunk_size[cid] = cid == 0 ? MBUF_SIZE :
+                               mbuf_chunk_size[cid - 1] * MBUF_CLASS_FACTOR;
+        mbuf_offset[cid] = mbuf_chunk_size[cid] - MBUF_HSIZE;
 
-    log_debug(LOG_DEBUG, "mbuf hsize %d chunk size %zu offset %zu length %zu",
-              MBUF_HSIZE, mbuf_chunk_size, mbuf_offset, mbuf_offset);
+        log_debug(LOG_DEBUG, "mbuf cid %"PRIu8" hsize %d chunk size %zu "
+                  "offset %zu length %zu", cid, MBUF_HSIZE,
+                  mbuf_chunk_size[cid], mbuf_offset[cid], mbuf_offset[cid]);
+    }
 }
 
 void
 mbuf_deinit(void)
 {
-    while (!STAILQ_EMPTY(&free_mbufq)) {
-        struct mbuf *mbuf = STAILQ_FIRST(&free_mbufq);
-        mbuf_remove(&free_mbufq, mbuf);
-        mbuf_free(mbuf);
-        nfree_mbufq--;
+    struct mbuf *mbuf;
+    uint8_t cid;
+
+    for (cid = 0; cid < MBUF_NCLASS; cid++) {
+        while (!STAILQ_EMPTY(&free_mbufq[cid])) {
+            mbuf = STAILQ_FIRST(&free_mbufq[cid]);
+            mbuf_remove(&free_mbufq[cid], mbuf);
+            mbuf_free(mbuf);
+            nfree_mbufq[cid]--;
+        }
+        ASSERT(nfree_mbufq[cid] == 0);
     }
-    ASSERT(nfree_mbufq == 0);
 }
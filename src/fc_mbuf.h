@@ -21,6 +21,7 @@
 #include <fc_core.h>
 
 typedef void (*mbuf_copy_t)(struct mbuf *, void *);
+typedef void (*mbuf_release_t)(void *);
 
 struct mbuf {
     uint32_t           magic;   /* mbuf magic (const) */
@@ -29,6 +30,9 @@ struct mbuf {
     uint8_t            *last;   /* recv marker (write) */
     uint8_t            *start;  /* start of buffer (const) */
     uint8_t            *end;    /* end of buffer (const) */
+    mbuf_release_t     release; /* release handler of referenced buffer */
+    void               *arg;    /* release handler argument */
+    uint8_t            cid;     /* size class id (const) */
 };
 
 STAILQ_HEAD(mhdr, mbuf);
@@ -39,6 +43,15 @@ STAILQ_HEAD(mhdr, mbuf);
 #define MBUF_SIZE       8192
 #define MBUF_HSIZE      sizeof(struct mbuf)
 
+/*
+ * Mbufs come in size classes, each one MBUF_CLASS_FACTOR times the size of
+ * the previous one, starting at MBUF_SIZE. Only the first class is used
+ * for requests and responses in general; the larger ones receive the
+ * values of large storage requests.
+ */
+#define MBUF_NCLASS         5
+#define MBUF_CLASS_FACTOR   4
+
 static inline bool
 mbuf_empty(struct mbuf *mbuf)
 {
@@ -54,6 +67,8 @@ mbuf_full(struct mbuf *mbuf)
 void mbuf_init(void);
 void mbuf_deinit(void);
 struct mbuf *mbuf_get(void);
+struct mbuf *mbuf_get_size(size_t size);
+struct mbuf *mbuf_get_ref(uint8_t *pos, size_t size, mbuf_release_t release, void *arg);
 void mbuf_put(struct mbuf *mbuf);
 void mbuf_rewind(struct mbuf *mbuf);
 uint32_t mbuf_length(struct mbuf *mbuf);
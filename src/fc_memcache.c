@@ -16,21 +16,28 @@
  */
 
 #include <ctype.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include <fc_core.h>
 #include <fc_memcache.h>
 
 /*
- * From memcache protocol specification:
- *
- * Data stored by memcached is identified with the help of a key. A key
- * is a text string which should uniquely identify the data for clients
- * that are interested in storing and retrieving it.  Currently the
- * length limit of a key is set at 250 characters (of course, normally
- * clients wouldn't need to use such long keys); the key must not include
- * control characters or whitespace.
+ * Debug builds parse every request taken by the fast path once more with
+ * the state machine, and assert that both reach the same result.
  */
-#define MEMCACHE_MAX_KEY_LENGTH 250
+#if (defined FC_ASSERT_PANIC && FC_ASSERT_PANIC == 1) || \
+    (defined FC_ASSERT_LOG && FC_ASSERT_LOG == 1)
+#define MEMCACHE_PARSE_CHECK 1
+#else
+#define MEMCACHE_PARSE_CHECK 0
+#endif
+
+/* return the first space or CR in [p, end), or end if there is none */
+typedef uint8_t *(*memcache_delim_t)(uint8_t *p, uint8_t *end);
+
+static memcache_delim_t memcache_delim;
 
 /*
  * Return true, if the memcache command is a storage command, otherwise
@@ -183,8 +190,457 @@ memcache_stats(struct msg *r)
     return r->type == MSG_REQ_STATS;
 }
 
+/*
+ * Parse the flag token [m, p) of meta command r. A flag is a single letter
+ * followed by its argument, if it takes one. Return flags only ask for a
+ * piece of the response, while the others set an argument of the command
+ * that a classic command would have taken in place.
+ */
+static rstatus_t
+memcache_parse_meta_flag(struct msg *r, uint8_t *m, uint8_t *p)
+{
+    uint8_t *arg;   /* flag argument */
+    size_t narg;    /* flag argument length */
+    uint64_t num;   /* numeric flag argument */
+
+    ASSERT(r->meta && p > m);
+
+    arg = m + 1;
+    narg = (size_t)(p - arg);
+
+    switch (*m) {
+    case 'q':
+        r->quiet = 1;
+        return narg == 0 ? FC_OK : FC_ERROR;
+
+    case 'k':
+        r->mflags |= MSG_META_KEY;
+        return narg == 0 ? FC_OK : FC_ERROR;
+
+    case 'O':
+        if (narg == 0 || narg > MEMCACHE_MAX_OPAQUE_LENGTH) {
+            return FC_ERROR;
+        }
+        r->mflags |= MSG_META_OPAQUE;
+        r->opaque_start = arg;
+        r->opaque_end = p;
+        return FC_OK;
+
+    case 'v':
+    case 't':
+        if (narg != 0 || !(memcache_retrieval(r) || memcache_arithmetic(r))) {
+            return FC_ERROR;
+        }
+        r->mflags |= *m == 'v' ? MSG_META_VALUE : MSG_META_TTL;
+        return FC_OK;
+
+    case 'c':
+        if (narg != 0 || memcache_delete(r)) {
+            return FC_ERROR;
+        }
+        r->mflags |= MSG_META_CAS;
+        return FC_OK;
+
+    case 'f':
+    case 's':
+        if (narg != 0 || !memcache_retrieval(r)) {
+            return FC_ERROR;
+        }
+        r->mflags |= *m == 'f' ? MSG_META_FLAGS : MSG_META_SIZE;
+        return FC_OK;
+
+    case 'M':
+        if (narg != 1) {
+            return FC_ERROR;
+        }
+        if (memcache_storage(r)) {
+            switch (*arg) {
+            case 'E':
+                r->type = MSG_REQ_ADD;
+                return FC_OK;
+            case 'A':
+                r->type = MSG_REQ_APPEND;
+                return FC_OK;
+            case 'P':
+                r->type = MSG_REQ_PREPEND;
+                return FC_OK;
+            case 'R':
+                r->type = MSG_REQ_REPLACE;
+                return FC_OK;
+            case 'S':
+                r->type = MSG_REQ_SET;
+                return FC_OK;
+            }
+        } else if (memcache_arithmetic(r)) {
+            switch (*arg) {
+            case 'I':
+            case '+':
+                r->type = MSG_REQ_INCR;
+                return FC_OK;
+            case 'D':
+            case '-':
+                r->type = MSG_REQ_DECR;
+                return FC_OK;
+            }
+        }
+        return FC_ERROR;
+
+    default:
+        break;
+    }
+
+    /* the remaining flags take a number */
+    if (narg == 0 || fc_atou64(arg, narg, &num) != FC_OK) {
+        return FC_ERROR;
+    }
+
+    switch (*m) {
+    case 'T':
+        if (!memcache_storage(r) || num > UINT32_MAX) {
+            return FC_ERROR;
+        }
+        r->expiry = (uint32_t)num;
+        return FC_OK;
+
+    case 'F':
+        if (!memcache_storage(r) || num > UINT32_MAX) {
+            return FC_ERROR;
+        }
+        r->flags = (uint32_t)num;
+        return FC_OK;
+
+    case 'C':
+        if (!memcache_storage(r) && !memcache_delete(r)) {
+            return FC_ERROR;
+        }
+        r->cas = num;
+        return FC_OK;
+
+    case 'D':
+        if (!memcache_arithmetic(r)) {
+            return FC_ERROR;
+        }
+        r->num = num;
+        return FC_OK;
+
+    default:
+        break;
+    }
+
+    return FC_ERROR;
+}
+
+static uint8_t *
+memcache_delim_scalar(uint8_t *p, uint8_t *end)
+{
+    for (; p < end; p++) {
+        if (*p == ' ' || *p == CR) {
+            break;
+        }
+    }
+
+    return p;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__ ((target("sse2"))) static uint8_t *
+memcache_delim_sse2(uint8_t *p, uint8_t *end)
+{
+    __m128i block;
+    uint32_t mask;
+
+    for (; end - p >= 16; p += 16) {
+        block = _mm_loadu_si128((const __m128i *)p);
+        mask = (uint32_t)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+                         _mm_cmpeq_epi8(block, _mm_set1_epi8(CR))));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+
+    return memcache_delim_scalar(p, end);
+}
+
+__attribute__ ((target("avx2"))) static uint8_t *
+memcache_delim_avx2(uint8_t *p, uint8_t *end)
+{
+    __m256i block;
+    uint32_t mask;
+
+    for (; end - p >= 32; p += 32) {
+        block = _mm256_loadu_si256((const __m256i *)p);
+        mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(block, _mm256_set1_epi8(CR))));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+
+    return memcache_delim_sse2(p, end);
+}
+#endif
+
+/*
+ * Pick the widest delimiter scan supported by the cpu we run on.
+ */
 void
-memcache_parse_req(struct msg *r)
+memcache_init(void)
+{
+    memcache_delim = memcache_delim_scalar;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        memcache_delim = memcache_delim_avx2;
+        log_debug(LOG_INFO, "ascii parser scans for delimiters with avx2");
+        return;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        memcache_delim = memcache_delim_sse2;
+        log_debug(LOG_INFO, "ascii parser scans for delimiters with sse2");
+        return;
+    }
+#endif
+
+    log_debug(LOG_INFO, "ascii parser scans for delimiters with scalar");
+}
+
+/*
+ * Parse the token [p, q) as a decimal number the way the state machine
+ * does, so that both overflow alike.
+ */
+static bool
+memcache_parse_num32(uint8_t *p, uint8_t *q, uint32_t *num)
+{
+    uint32_t n;
+
+    if (p == q) {
+        return false;
+    }
+
+    for (n = 0; p < q; p++) {
+        if (!isdigit(*p)) {
+            return false;
+        }
+        n = n * 10 + (uint32_t)(*p - '0');
+    }
+    *num = n;
+
+    return true;
+}
+
+static bool
+memcache_parse_num64(uint8_t *p, uint8_t *q, uint64_t *num)
+{
+    uint64_t n;
+
+    if (p == q) {
+        return false;
+    }
+
+    for (n = 0; p < q; p++) {
+        if (!isdigit(*p)) {
+            return false;
+        }
+        n = n * 10ULL + (uint64_t)(*p - '0');
+    }
+    *num = n;
+
+    return true;
+}
+
+/*
+ * Fast path of the request parser for the common case of a whole get,
+ * gets, delete or storage request, value included, in the last mbuf of r.
+ * Spaces and CR are found a block at a time by memcache_delim and each
+ * token is only looked at once. Return FC_OK with r parsed, as the state
+ * machine would have, or FC_ERROR without touching r for anything else:
+ * other commands, multiple keys, extra spaces, malformed and partial
+ * requests are all left to the state machine.
+ */
+rstatus_t
+memcache_parse_req_fast(struct msg *r)
+{
+    struct mbuf *b;
+    uint8_t *p, *q, *end;
+    uint8_t *key_start, *key_end, *value;
+    msg_type_t type;
+    uint32_t flags, expiry, vlen;
+    uint64_t cas;
+    bool storage, noreply;
+
+    b = STAILQ_LAST(&r->mhdr, mbuf, next);
+    p = r->pos;
+    end = b->last;
+
+    /* command */
+    q = memcache_delim(p, end);
+    if (q == end || *q != ' ') {
+        return FC_ERROR;
+    }
+
+    switch (q - p) {
+    case 3:
+        if (str4cmp(p, 'g', 'e', 't', ' ')) {
+            type = MSG_REQ_GET;
+        } else if (str4cmp(p, 's', 'e', 't', ' ')) {
+            type = MSG_REQ_SET;
+        } else if (str4cmp(p, 'a', 'd', 'd', ' ')) {
+            type = MSG_REQ_ADD;
+        } else if (str4cmp(p, 'c', 'a', 's', ' ')) {
+            type = MSG_REQ_CAS;
+        } else {
+            return FC_ERROR;
+        }
+        break;
+
+    case 4:
+        if (str4cmp(p, 'g', 'e', 't', 's')) {
+            type = MSG_REQ_GETS;
+        } else {
+            return FC_ERROR;
+        }
+        break;
+
+    case 6:
+        if (str6cmp(p, 'd', 'e', 'l', 'e', 't', 'e')) {
+            type = MSG_REQ_DELETE;
+        } else if (str6cmp(p, 'a', 'p', 'p', 'e', 'n', 'd')) {
+            type = MSG_REQ_APPEND;
+        } else {
+            return FC_ERROR;
+        }
+        break;
+
+    case 7:
+        if (str7cmp(p, 'p', 'r', 'e', 'p', 'e', 'n', 'd')) {
+            type = MSG_REQ_PREPEND;
+        } else if (str7cmp(p, 'r', 'e', 'p', 'l', 'a', 'c', 'e')) {
+            type = MSG_REQ_REPLACE;
+        } else {
+            return FC_ERROR;
+        }
+        break;
+
+    default:
+        return FC_ERROR;
+    }
+
+    /* key */
+    p = q + 1;
+    q = memcache_delim(p, end);
+    if (q == end || q == p || q - p > MEMCACHE_MAX_KEY_LENGTH) {
+        return FC_ERROR;
+    }
+    key_start = p;
+    key_end = q;
+
+    storage = type != MSG_REQ_GET && type != MSG_REQ_GETS &&
+              type != MSG_REQ_DELETE;
+    flags = 0;
+    expiry = 0;
+    vlen = 0;
+    cas = 0;
+    noreply = false;
+
+    if (storage) {
+        /* <flags> <exptime> <bytes> [<cas unique>] */
+        if (*q != ' ') {
+            return FC_ERROR;
+        }
+        p = q + 1;
+        q = memcache_delim(p, end);
+        if (q == end || *q != ' ' || !memcache_parse_num32(p, q, &flags)) {
+            return FC_ERROR;
+        }
+        p = q + 1;
+        q = memcache_delim(p, end);
+        if (q == end || *q != ' ' || !memcache_parse_num32(p, q, &expiry)) {
+            return FC_ERROR;
+        }
+        p = q + 1;
+        q = memcache_delim(p, end);
+        if (q == end || !memcache_parse_num32(p, q, &vlen)) {
+            return FC_ERROR;
+        }
+        if (type == MSG_REQ_CAS) {
+            if (*q != ' ') {
+                return FC_ERROR;
+            }
+            p = q + 1;
+            q = memcache_delim(p, end);
+            if (q == end || !memcache_parse_num64(p, q, &cas)) {
+                return FC_ERROR;
+            }
+        }
+    }
+
+    /* [noreply] */
+    if (*q == ' ') {
+        if (type == MSG_REQ_GET || type == MSG_REQ_GETS) {
+            return FC_ERROR;
+        }
+        p = q + 1;
+        q = memcache_delim(p, end);
+        if (q == end || *q != CR || q - p != 7 ||
+            !str7cmp(p, 'n', 'o', 'r', 'e', 'p', 'l', 'y')) {
+            return FC_ERROR;
+        }
+        noreply = true;
+    }
+
+    /* crlf */
+    ASSERT(*q == CR);
+    if (end - q < 2 || q[1] != LF) {
+        return FC_ERROR;
+    }
+    p = q + 1;
+
+    /* <data block>\r\n */
+    value = NULL;
+    if (storage) {
+        value = p + 1;
+        if ((size_t)(end - value) < (size_t)vlen + CRLF_LEN ||
+            !strcrlf(value + vlen)) {
+            return FC_ERROR;
+        }
+        p = value + vlen + 1;
+    }
+
+    r->type = type;
+    r->key_start = key_start;
+    r->key_end = key_end;
+    if (storage) {
+        r->flags = flags;
+        r->expiry = expiry;
+        r->vlen = vlen;
+        r->rvlen = vlen;
+        r->value = value;
+        if (type == MSG_REQ_CAS) {
+            r->cas = cas;
+        }
+    }
+    if (noreply) {
+        r->noreply = 1;
+    }
+
+    ASSERT(*p == LF);
+    r->pos = p + 1;
+    ASSERT(r->pos <= b->last);
+    r->state = 0;
+    r->result = MSG_PARSE_OK;
+
+    return FC_OK;
+}
+
+/*
+ * State machine of the request parser, which parses a byte at a time and
+ * resumes where it stopped when a request spans reads or mbufs.
+ */
+void
+memcache_parse_req_fsa(struct msg *r)
 {
     struct mbuf *b;
     uint8_t *p, *m;
@@ -212,6 +668,7 @@ memcache_parse_req(struct msg *r)
         SW_NOREPLY,
         SW_AFTER_NOREPLY,
         SW_ALMOST_DONE,
+        SW_META_FLAGS,
         SW_SENTINEL
     } state;
 
@@ -256,6 +713,24 @@ memcache_parse_req(struct msg *r)
 
                 switch (p - m) {
 
+                case 2:
+                    /* meta commands, which map onto the classic commands */
+                    if (str2cmp(m, 'm', 'g')) {
+                        r->type = MSG_REQ_GET;
+                    } else if (str2cmp(m, 'm', 's')) {
+                        r->type = MSG_REQ_SET;
+                    } else if (str2cmp(m, 'm', 'd')) {
+                        r->type = MSG_REQ_DELETE;
+                    } else if (str2cmp(m, 'm', 'a')) {
+                        r->type = MSG_REQ_INCR;
+                        r->num = 1;
+                    } else if (str2cmp(m, 'm', 'n')) {
+                        r->type = MSG_REQ_VERSION;
+                    }
+                    r->meta = r->type != MSG_UNKNOWN ? 1 : 0;
+
+                    break;
+
                 case 3:
                     if (str4cmp(m, 'g', 'e', 't', ' ')) {
                         r->type = MSG_REQ_GET;
@@ -381,6 +856,14 @@ memcache_parse_req(struct msg *r)
             }
 
             if (ch == ' ' || ch == CR) {
+                /*
+                 * The key of a stats request runs to the end of the line,
+                 * so that a stats subcommand can take an argument.
+                 */
+                if (ch == ' ' && memcache_stats(r)) {
+                    break;
+                }
+
                 if ((p - r->key_start) > MEMCACHE_MAX_KEY_LENGTH) {
                     log_error("parsed bad req %"PRIu64" of type %d with key "
                               "prefix '%.*s...' and length %d that exceeds "
@@ -392,7 +875,9 @@ memcache_parse_req(struct msg *r)
                 r->token = NULL;
 
                 /* get next state */
-                if (memcache_storage(r)) {
+                if (r->meta) {
+                    state = memcache_storage(r) ? SW_SPACES_BEFORE_VLEN : SW_META_FLAGS;
+                } else if (memcache_storage(r)) {
                     state = SW_SPACES_BEFORE_FLAGS;
                 } else if (memcache_arithmetic(r)) {
                     state = SW_SPACES_BEFORE_NUM;
@@ -405,7 +890,8 @@ memcache_parse_req(struct msg *r)
                 }
 
                 if (ch == CR) {
-                    if (memcache_storage(r) || memcache_arithmetic(r)) {
+                    if (memcache_storage(r) ||
+                        (memcache_arithmetic(r) && !r->meta)) {
                         goto error;
                     }
                     p = p - 1; /* go back by 1 byte */
@@ -511,6 +997,15 @@ memcache_parse_req(struct msg *r)
 
             if (isdigit(ch)) {
                 r->vlen = r->vlen * 10 + (uint32_t)(ch - '0');
+            } else if (r->meta) {
+                if (ch != ' ' && ch != CR) {
+                    goto error;
+                }
+                /* vlen_end <- p - 1 */
+                r->rvlen = r->vlen;
+                p = p - 1; /* go back by 1 byte */
+                r->token = NULL;
+                state = SW_META_FLAGS;
             } else if (memcache_cas(r)) {
                 if (ch != ' ') {
                     goto error;
@@ -732,6 +1227,43 @@ memcache_parse_req(struct msg *r)
 
             break;
 
+        case SW_META_FLAGS:
+            if (ch != ' ' && ch != CR) {
+                if (r->token == NULL) {
+                    /* flag_start <- p */
+                    r->token = p;
+                }
+                break;
+            }
+
+            if (r->token != NULL) {
+                /* flag_end <- p - 1 */
+                if (memcache_parse_meta_flag(r, r->token, p) != FC_OK) {
+                    log_error("parsed bad req %"PRIu64" of type %d with bad "
+                              "meta flag '%.*s'", r->id, r->type,
+                              MIN(p - r->token, 16), r->token);
+                    goto error;
+                }
+                r->token = NULL;
+            }
+
+            if (ch == CR) {
+                if (memcache_storage(r)) {
+                    /* a set with a cas compare is a cas */
+                    if (r->cas != 0) {
+                        if (r->type != MSG_REQ_SET) {
+                            goto error;
+                        }
+                        r->type = MSG_REQ_CAS;
+                    }
+                    state = SW_RUNTO_VAL;
+                } else {
+                    state = SW_ALMOST_DONE;
+                }
+            }
+
+            break;
+
         case SW_SENTINEL:
         default:
             NOT_REACHED();
@@ -756,6 +1288,7 @@ memcache_parse_req(struct msg *r)
     ASSERT(p == b->last);
     r->pos = p;
     r->state = state;
+    r->vwait = state == SW_VAL ? 1 : 0;
 
     if (b->last == b->end && r->token != NULL) {
         r->pos = r->token;
@@ -805,6 +1338,48 @@ error:
                 r->state);
 }
 
+/*
+ * Parse the request r from its parsing marker on, with the fast path when
+ * a new request starts there, and with the state machine otherwise or when
+ * the fast path gives up.
+ */
+void
+memcache_parse_req(struct msg *r)
+{
+#if MEMCACHE_PARSE_CHECK == 1
+    struct msg pre, fast;
+#endif
+
+    if (r->state != 0) {
+        memcache_parse_req_fsa(r);
+        return;
+    }
+
+#if MEMCACHE_PARSE_CHECK == 1
+    pre = *r;
+#endif
+
+    if (memcache_parse_req_fast(r) != FC_OK) {
+        memcache_parse_req_fsa(r);
+        return;
+    }
+
+#if MEMCACHE_PARSE_CHECK == 1
+    fast = *r;
+    *r = pre;
+    memcache_parse_req_fsa(r);
+
+    ASSERT(r->result == fast.result && r->state == fast.state);
+    ASSERT(r->pos == fast.pos && r->token == fast.token);
+    ASSERT(r->type == fast.type);
+    ASSERT(r->key_start == fast.key_start && r->key_end == fast.key_end);
+    ASSERT(r->value == fast.value);
+    ASSERT(r->vlen == fast.vlen && r->rvlen == fast.rvlen);
+    ASSERT(r->flags == fast.flags && r->expiry == fast.expiry);
+    ASSERT(r->cas == fast.cas && r->noreply == fast.noreply);
+#endif
+}
+
 /*
  * Pre-split copy handler invoked when the request is a multi vector -
  * 'get' or 'gets' request and is about to be split into two requests
@@ -23,6 +23,9 @@
 #define strcrlf(m)                                                                          \
     (*(m) == '\r' && *((m) + 1) == '\n')
 
+#define str2cmp(m, c0, c1)                                                                  \
+    ((m)[0] == c0 && (m)[1] == c1)
+
 #ifdef FC_LITTLE_ENDIAN
 
 #define str4cmp(m, c0, c1, c2, c3)                                                          \
@@ -87,8 +90,84 @@
 
 #endif
 
+/*
+ * From memcache protocol specification:
+ *
+ * Data stored by memcached is identified with the help of a key. A key
+ * is a text string which should uniquely identify the data for clients
+ * that are interested in storing and retrieving it.  Currently the
+ * length limit of a key is set at 250 characters (of course, normally
+ * clients wouldn't need to use such long keys); the key must not include
+ * control characters or whitespace.
+ */
+#define MEMCACHE_MAX_KEY_LENGTH 250
+
+/* max length of the opaque token of a meta command */
+#define MEMCACHE_MAX_OPAQUE_LENGTH 32
+
+/*
+ * Every binary protocol packet starts with a 24 byte header, whose magic
+ * byte tells requests from responses and from ASCII commands.
+ */
+#define MEMCACHE_BIN_REQ_MAGIC  0x80
+#define MEMCACHE_BIN_RSP_MAGIC  0x81
+#define MEMCACHE_BIN_HDR_SIZE   24
+
+typedef enum memcache_bin_opcode {
+    MEMCACHE_BIN_GET        = 0x00,
+    MEMCACHE_BIN_SET        = 0x01,
+    MEMCACHE_BIN_ADD        = 0x02,
+    MEMCACHE_BIN_REPLACE    = 0x03,
+    MEMCACHE_BIN_DELETE     = 0x04,
+    MEMCACHE_BIN_INCREMENT  = 0x05,
+    MEMCACHE_BIN_DECREMENT  = 0x06,
+    MEMCACHE_BIN_QUIT       = 0x07,
+    MEMCACHE_BIN_FLUSH      = 0x08,
+    MEMCACHE_BIN_GETQ       = 0x09,
+    MEMCACHE_BIN_NOOP       = 0x0a,
+    MEMCACHE_BIN_VERSION    = 0x0b,
+    MEMCACHE_BIN_GETK       = 0x0c,
+    MEMCACHE_BIN_GETKQ      = 0x0d,
+    MEMCACHE_BIN_APPEND     = 0x0e,
+    MEMCACHE_BIN_PREPEND    = 0x0f,
+    MEMCACHE_BIN_STAT       = 0x10,
+    MEMCACHE_BIN_SETQ       = 0x11,
+    MEMCACHE_BIN_ADDQ       = 0x12,
+    MEMCACHE_BIN_REPLACEQ   = 0x13,
+    MEMCACHE_BIN_DELETEQ    = 0x14,
+    MEMCACHE_BIN_INCREMENTQ = 0x15,
+    MEMCACHE_BIN_DECREMENTQ = 0x16,
+    MEMCACHE_BIN_QUITQ      = 0x17,
+    MEMCACHE_BIN_FLUSHQ     = 0x18,
+    MEMCACHE_BIN_APPENDQ    = 0x19,
+    MEMCACHE_BIN_PREPENDQ   = 0x1a,
+    MEMCACHE_BIN_NOPCODE
+} memcache_bin_opcode_t;
+
+typedef enum memcache_bin_status {
+    MEMCACHE_BIN_OK           = 0x00,
+    MEMCACHE_BIN_KEY_ENOENT   = 0x01,
+    MEMCACHE_BIN_KEY_EEXISTS  = 0x02,
+    MEMCACHE_BIN_E2BIG        = 0x03,
+    MEMCACHE_BIN_EINVAL       = 0x04,
+    MEMCACHE_BIN_NOT_STORED   = 0x05,
+    MEMCACHE_BIN_DELTA_BADVAL = 0x06,
+    MEMCACHE_BIN_UNKNOWN_CMD  = 0x81,
+    MEMCACHE_BIN_ENOMEM       = 0x82,
+    MEMCACHE_BIN_EINTERNAL    = 0x84,
+} memcache_bin_status_t;
+
+void memcache_init(void);
 void memcache_parse_req(struct msg *r);
+rstatus_t memcache_parse_req_fast(struct msg *r);
+void memcache_parse_req_fsa(struct msg *r);
 void memcache_pre_splitcopy(struct mbuf *mbuf, void *arg);
 rstatus_t memcache_post_splitcopy(struct msg *r);
 
+void memcache_parse_bin_req(struct msg *r);
+uint16_t memcache_bin_status(struct msg *r, msg_type_t rsp_type, int err);
+struct string *memcache_bin_strstatus(uint16_t status);
+rstatus_t memcache_bin_rsp(struct msg *r, struct msg *pmsg, uint16_t status, uint64_t cas, uint8_t *extras, uint8_t nextras, uint8_t *key, uint16_t nkey, uint32_t nvalue);
+rstatus_t memcache_bin_rsp_stats(struct msg *r, struct msg *pmsg, struct string *str);
+
 #endif
@@ -0,0 +1,499 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <arpa/inet.h>
+#include <endian.h>
+
+#include <fc_core.h>
+#include <fc_memcache.h>
+
+/*
+ * Request type of each binary protocol opcode, together with the extras,
+ * key and value that it takes. Opcodes without a type are not supported.
+ */
+struct memcache_bin_cmd {
+    msg_type_t type;     /* request type */
+    uint8_t    nextras;  /* # extras byte */
+    unsigned   key:1;    /* key required? */
+    unsigned   value:1;  /* value allowed? */
+    unsigned   quiet:1;  /* quiet? */
+};
+
+#define BIN_CMD(_op, _type, _nextras, _key, _value, _quiet)                 \
+    [MEMCACHE_BIN_##_op] = { MSG_##_type, _nextras, _key, _value, _quiet }
+
+static const struct memcache_bin_cmd memcache_bin_cmds[MEMCACHE_BIN_NOPCODE] = {
+    BIN_CMD( GET,         REQ_GET,      0, 1, 0, 0 ),
+    BIN_CMD( GETQ,        REQ_GET,      0, 1, 0, 1 ),
+    BIN_CMD( GETK,        REQ_GET,      0, 1, 0, 0 ),
+    BIN_CMD( GETKQ,       REQ_GET,      0, 1, 0, 1 ),
+    BIN_CMD( SET,         REQ_SET,      8, 1, 1, 0 ),
+    BIN_CMD( SETQ,        REQ_SET,      8, 1, 1, 1 ),
+    BIN_CMD( ADD,         REQ_ADD,      8, 1, 1, 0 ),
+    BIN_CMD( ADDQ,        REQ_ADD,      8, 1, 1, 1 ),
+    BIN_CMD( REPLACE,     REQ_REPLACE,  8, 1, 1, 0 ),
+    BIN_CMD( REPLACEQ,    REQ_REPLACE,  8, 1, 1, 1 ),
+    BIN_CMD( DELETE,      REQ_DELETE,   0, 1, 0, 0 ),
+    BIN_CMD( DELETEQ,     REQ_DELETE,   0, 1, 0, 1 ),
+    BIN_CMD( INCREMENT,   REQ_INCR,    20, 1, 0, 0 ),
+    BIN_CMD( INCREMENTQ,  REQ_INCR,    20, 1, 0, 1 ),
+    BIN_CMD( DECREMENT,   REQ_DECR,    20, 1, 0, 0 ),
+    BIN_CMD( DECREMENTQ,  REQ_DECR,    20, 1, 0, 1 ),
+    BIN_CMD( APPEND,      REQ_APPEND,   0, 1, 1, 0 ),
+    BIN_CMD( APPENDQ,     REQ_APPEND,   0, 1, 1, 1 ),
+    BIN_CMD( PREPEND,     REQ_PREPEND,  0, 1, 1, 0 ),
+    BIN_CMD( PREPENDQ,    REQ_PREPEND,  0, 1, 1, 1 ),
+    BIN_CMD( QUIT,        REQ_QUIT,     0, 0, 0, 0 ),
+    BIN_CMD( QUITQ,       REQ_QUIT,     0, 0, 0, 1 ),
+    BIN_CMD( NOOP,        REQ_VERSION,  0, 0, 0, 0 ),
+    BIN_CMD( VERSION,     REQ_VERSION,  0, 0, 0, 0 ),
+    BIN_CMD( STAT,        REQ_STATS,    0, 0, 0, 0 ),
+};
+
+#undef BIN_CMD
+
+#define DEFINE_ACTION(_status, _str) [MEMCACHE_BIN_##_status] = string(_str),
+static struct string memcache_bin_strings[] = {
+    DEFINE_ACTION( KEY_ENOENT,   "Not found"           )
+    DEFINE_ACTION( KEY_EEXISTS,  "Data exists for key" )
+    DEFINE_ACTION( E2BIG,        "Too large"           )
+    DEFINE_ACTION( EINVAL,       "Invalid arguments"   )
+    DEFINE_ACTION( NOT_STORED,   "Not stored"          )
+    DEFINE_ACTION( DELTA_BADVAL, "Non-numeric value"   )
+    DEFINE_ACTION( UNKNOWN_CMD,  "Unknown command"     )
+    DEFINE_ACTION( ENOMEM,       "Out of memory"       )
+    DEFINE_ACTION( EINTERNAL,    "Internal error"      )
+};
+#undef DEFINE_ACTION
+
+static uint16_t
+memcache_bin_get16(uint8_t *p)
+{
+    uint16_t v;
+
+    fc_memcpy(&v, p, sizeof(v));
+    return ntohs(v);
+}
+
+static uint32_t
+memcache_bin_get32(uint8_t *p)
+{
+    uint32_t v;
+
+    fc_memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+static uint64_t
+memcache_bin_get64(uint8_t *p)
+{
+    uint64_t v;
+
+    fc_memcpy(&v, p, sizeof(v));
+    return be64toh(v);
+}
+
+static void
+memcache_bin_set16(uint8_t *p, uint16_t v)
+{
+    v = htons(v);
+    fc_memcpy(p, &v, sizeof(v));
+}
+
+static void
+memcache_bin_set32(uint8_t *p, uint32_t v)
+{
+    v = htonl(v);
+    fc_memcpy(p, &v, sizeof(v));
+}
+
+static void
+memcache_bin_set64(uint8_t *p, uint64_t v)
+{
+    v = htobe64(v);
+    fc_memcpy(p, &v, sizeof(v));
+}
+
+/*
+ * Parse the binary protocol request r. Its header, extras and key must
+ * be contiguous, while its value can span any number of mbufs, as the
+ * value is copied out of them by marker, like that of an ASCII request.
+ *
+ *   +---------+--------+--------+------------------------------+
+ *   | header  | extras |  key   |            value             |
+ *   | 24 byte |        |        |                              |
+ *   +---------+--------+--------+------------------------------+
+ *   ^                                                          ^
+ *   |                                                          |
+ *   r->pos (SW_START)                  r->pos when parsed (done)
+ */
+void
+memcache_parse_bin_req(struct msg *r)
+{
+    const struct memcache_bin_cmd *cmd;
+    struct mbuf *b;
+    uint8_t *p;
+    uint8_t opcode, nextras;
+    uint16_t nkey;
+    uint32_t nbody;
+    size_t n;
+    enum {
+        SW_START,
+        SW_VAL,
+        SW_SENTINEL
+    } state;
+
+    state = r->state;
+    b = STAILQ_LAST(&r->mhdr, mbuf, next);
+
+    ASSERT(r->request && r->binary);
+    ASSERT(state >= SW_START && state < SW_SENTINEL);
+    ASSERT(b != NULL);
+    ASSERT(b->pos <= b->last);
+
+    /* validate the parsing maker */
+    ASSERT(r->pos != NULL);
+    ASSERT(r->pos >= b->pos && r->pos <= b->last);
+
+    p = r->pos;
+
+    switch (state) {
+    case SW_START:
+        if (b->last - p < MEMCACHE_BIN_HDR_SIZE) {
+            goto again;
+        }
+
+        if (p[0] != MEMCACHE_BIN_REQ_MAGIC || p[5] != 0) {
+            goto error;
+        }
+
+        opcode = p[1];
+        nkey = memcache_bin_get16(p + 2);
+        nextras = p[4];
+        nbody = memcache_bin_get32(p + 8);
+
+        if (opcode >= MEMCACHE_BIN_NOPCODE ||
+            memcache_bin_cmds[opcode].type == MSG_UNKNOWN) {
+            log_error("parsed bad req %"PRIu64" with unsupported binary "
+                      "opcode 0x%02x", r->id, opcode);
+            goto error;
+        }
+        cmd = &memcache_bin_cmds[opcode];
+
+        if (nextras != cmd->nextras || (uint32_t)nkey + nextras > nbody) {
+            goto error;
+        }
+
+        if (nkey > MEMCACHE_MAX_KEY_LENGTH ||
+            (cmd->key && nkey == 0) ||
+            (!cmd->key && nkey != 0 && cmd->type != MSG_REQ_STATS)) {
+            goto error;
+        }
+
+        if (!cmd->value && nbody != (uint32_t)nkey + nextras) {
+            goto error;
+        }
+
+        /* header, extras and key are parsed in one go */
+        if ((size_t)(b->last - p) < MEMCACHE_BIN_HDR_SIZE + nextras + nkey) {
+            goto again;
+        }
+
+        r->type = cmd->type;
+        r->opcode = opcode;
+        r->quiet = cmd->quiet;
+        r->quit = cmd->type == MSG_REQ_QUIT ? 1 : 0;
+        fc_memcpy(&r->opaque, p + 12, sizeof(r->opaque));
+        r->cas = memcache_bin_get64(p + 16);
+
+        switch (cmd->type) {
+        case MSG_REQ_SET:
+        case MSG_REQ_REPLACE:
+            /* a set or replace with a cas stores only if the cas matches */
+            if (r->cas != 0) {
+                r->type = MSG_REQ_CAS;
+            }
+            /* fall through */
+
+        case MSG_REQ_ADD:
+            r->flags = memcache_bin_get32(p + MEMCACHE_BIN_HDR_SIZE);
+            r->expiry = memcache_bin_get32(p + MEMCACHE_BIN_HDR_SIZE + 4);
+            break;
+
+        case MSG_REQ_INCR:
+        case MSG_REQ_DECR:
+            /* initial value and expiry of a missing key are not supported */
+            r->num = memcache_bin_get64(p + MEMCACHE_BIN_HDR_SIZE);
+            break;
+
+        default:
+            break;
+        }
+
+        p += MEMCACHE_BIN_HDR_SIZE + nextras;
+        if (nkey != 0) {
+            r->key_start = p;
+            r->key_end = p + nkey;
+            p += nkey;
+        }
+
+        r->vlen = nbody - nkey - nextras;
+        r->rvlen = r->vlen;
+        if (r->rvlen == 0) {
+            goto done;
+        }
+        state = SW_VAL;
+
+        /* fall through */
+
+    case SW_VAL:
+        if (p == b->last) {
+            goto again;
+        }
+
+        if (r->value == NULL) {
+            r->value = p;
+        }
+
+        n = MIN(r->rvlen, (size_t)(b->last - p));
+        p += n;
+        r->rvlen -= (uint32_t)n;
+        if (r->rvlen != 0) {
+            goto again;
+        }
+
+        goto done;
+
+    case SW_SENTINEL:
+    default:
+        NOT_REACHED();
+        break;
+    }
+
+again:
+    /*
+     * A header that was cut short by a full mbuf is copied into a new mbuf
+     * and parsed again once more data has been read. Requests start at the
+     * beginning of an mbuf, which always holds a complete header, extras
+     * and key.
+     */
+    r->pos = p;
+    r->state = state;
+
+    if (state == SW_START && b->last == b->end) {
+        if (p == b->start) {
+            goto error;
+        }
+        r->result = MSG_PARSE_REPAIR;
+    } else {
+        r->result = MSG_PARSE_AGAIN;
+    }
+
+    log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "parsed bin req %"PRIu64" "
+                "res %d type %d state %d rpos %d of %d", r->id, r->result,
+                r->type, r->state, r->pos - b->pos, b->last - b->pos);
+    return;
+
+done:
+    ASSERT(r->type > MSG_UNKNOWN && r->type < MSG_SENTINEL);
+    r->pos = p;
+    ASSERT(r->pos <= b->last);
+    r->state = SW_START;
+    r->result = MSG_PARSE_OK;
+
+    log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "parsed bin req %"PRIu64" "
+                "res %d type %d state %d rpos %d of %d", r->id, r->result,
+                r->type, r->state, r->pos - b->pos, b->last - b->pos);
+    return;
+
+error:
+    r->result = MSG_PARSE_ERROR;
+    r->state = state;
+    errno = EINVAL;
+
+    log_hexdump(LOG_INFO, b->pos, mbuf_length(b), "parsed bad bin req %"PRIu64" "
+                "res %d type %d state %d", r->id, r->result, r->type,
+                r->state);
+}
+
+/*
+ * Return the binary protocol status of response rsp_type, or of errno err
+ * for a server error, to request r.
+ */
+uint16_t
+memcache_bin_status(struct msg *r, msg_type_t rsp_type, int err)
+{
+    ASSERT(r->binary);
+
+    switch (rsp_type) {
+    case MSG_RSP_NUM:
+    case MSG_RSP_VALUE:
+    case MSG_RSP_STORED:
+    case MSG_RSP_DELETED:
+    case MSG_RSP_VERSION:
+        return MEMCACHE_BIN_OK;
+
+    case MSG_RSP_END:
+    case MSG_RSP_NOT_FOUND:
+        return MEMCACHE_BIN_KEY_ENOENT;
+
+    case MSG_RSP_EXISTS:
+        return MEMCACHE_BIN_KEY_EEXISTS;
+
+    case MSG_RSP_NOT_STORED:
+        if (r->type == MSG_REQ_ADD) {
+            return MEMCACHE_BIN_KEY_EEXISTS;
+        }
+        if (r->type == MSG_REQ_REPLACE) {
+            return MEMCACHE_BIN_KEY_ENOENT;
+        }
+        return MEMCACHE_BIN_NOT_STORED;
+
+    case MSG_RSP_CLIENT_ERROR:
+        if (r->type == MSG_REQ_INCR || r->type == MSG_REQ_DECR) {
+            return MEMCACHE_BIN_DELTA_BADVAL;
+        }
+        /* the only other client error is an item too large for any slab */
+        return MEMCACHE_BIN_E2BIG;
+
+    case MSG_RSP_SERVER_ERROR:
+        return err == ENOMEM ? MEMCACHE_BIN_ENOMEM : MEMCACHE_BIN_EINTERNAL;
+
+    default:
+        break;
+    }
+
+    NOT_REACHED();
+    return MEMCACHE_BIN_EINTERNAL;
+}
+
+/*
+ * Return the message sent as value of a response with failure status.
+ */
+struct string *
+memcache_bin_strstatus(uint16_t status)
+{
+    ASSERT(status != MEMCACHE_BIN_OK);
+    ASSERT(status < NELEMS(memcache_bin_strings));
+
+    return &memcache_bin_strings[status];
+}
+
+/*
+ * Append the header of a binary protocol response to request r, followed
+ * by its extras and key, to response pmsg. The nvalue bytes of value that
+ * complete the body are left for the caller to append.
+ */
+rstatus_t
+memcache_bin_rsp(struct msg *r, struct msg *pmsg, uint16_t status,
+                 uint64_t cas, uint8_t *extras, uint8_t nextras,
+                 uint8_t *key, uint16_t nkey, uint32_t nvalue)
+{
+    rstatus_t ret;
+    uint8_t hdr[MEMCACHE_BIN_HDR_SIZE];
+
+    ASSERT(r->binary);
+    ASSERT(!pmsg->request);
+
+    hdr[0] = MEMCACHE_BIN_RSP_MAGIC;
+    hdr[1] = r->opcode;
+    memcache_bin_set16(hdr + 2, nkey);
+    hdr[4] = nextras;
+    hdr[5] = 0;
+    memcache_bin_set16(hdr + 6, status);
+    memcache_bin_set32(hdr + 8, (uint32_t)nextras + nkey + nvalue);
+    fc_memcpy(hdr + 12, &r->opaque, sizeof(r->opaque));
+    memcache_bin_set64(hdr + 16, cas);
+
+    ret = mbuf_copy_from(&pmsg->mhdr, hdr, sizeof(hdr));
+    if (ret != FC_OK) {
+        return ret;
+    }
+    pmsg->mlen += sizeof(hdr);
+
+    ret = mbuf_copy_from(&pmsg->mhdr, extras, nextras);
+    if (ret != FC_OK) {
+        return ret;
+    }
+    pmsg->mlen += nextras;
+
+    ret = mbuf_copy_from(&pmsg->mhdr, key, nkey);
+    if (ret != FC_OK) {
+        return ret;
+    }
+    pmsg->mlen += nkey;
+
+    return FC_OK;
+}
+
+/*
+ * Append the ASCII stats in str, made of "STAT <name> <value>\r\n" lines,
+ * to response pmsg as binary protocol stat responses to request r, with
+ * the name as key and the value as value. A response without key and
+ * value ends them.
+ */
+rstatus_t
+memcache_bin_rsp_stats(struct msg *r, struct msg *pmsg, struct string *str)
+{
+    rstatus_t status;
+    struct string stat = string("STAT ");
+    uint8_t *p, *end, *name, *value, *eol;
+    size_t nname, nvalue;
+
+    p = str->data;
+    end = str->data + str->len;
+
+    while (p < end) {
+        eol = fc_strchr(p, end, LF);
+        if (eol == NULL) {
+            eol = end;
+        }
+
+        if ((size_t)(eol - p) > stat.len &&
+            fc_strncmp(p, stat.data, stat.len) == 0) {
+            name = p + stat.len;
+            value = fc_strchr(name, eol, ' ');
+            if (value == NULL) {
+                value = eol;
+            }
+            nname = MIN((size_t)(value - name), MEMCACHE_MAX_KEY_LENGTH);
+
+            value = value < eol ? value + 1 : eol;
+            nvalue = eol - value;
+            if (nvalue > 0 && value[nvalue - 1] == CR) {
+                nvalue--;
+            }
+
+            status = memcache_bin_rsp(r, pmsg, MEMCACHE_BIN_OK, 0, NULL, 0,
+                                      name, (uint16_t)nname, (uint32_t)nvalue);
+            if (status != FC_OK) {
+                return status;
+            }
+
+            status = mbuf_copy_from(&pmsg->mhdr, value, nvalue);
+            if (status != FC_OK) {
+                return status;
+            }
+            pmsg->mlen += nvalue;
+        }
+
+        p = eol + 1;
+    }
+
+    return memcache_bin_rsp(r, pmsg, MEMCACHE_BIN_OK, 0, NULL, 0, NULL, 0, 0);
+}
@@ -21,12 +21,10 @@
 #include <sys/uio.h>
 
 #include <fc_core.h>
+#include <fc_stats.h>
+#include <fc_server.h>
 
-#if (IOV_MAX > 128)
-#define FC_IOV_MAX 128
-#else
 #define FC_IOV_MAX IOV_MAX
-#endif
 
 #define DEFINE_ACTION(_hash, _name) string(_name),
 struct string msg_strings[] = {
@@ -35,10 +33,10 @@ struct string msg_strings[] = {
 };
 #undef DEFINE_ACTION
 
-static uint64_t msg_id;          /* message id counter */
-static uint64_t frag_id;         /* fragment id counter */
-static uint32_t nfree_msgq;      /* # free msg q */
-static struct msg_tqh free_msgq; /* free msg q */
+static __thread uint64_t msg_id;          /* message id counter */
+static __thread uint64_t frag_id;         /* fragment id counter */
+static __thread uint32_t nfree_msgq;      /* # free msg q */
+static __thread struct msg_tqh free_msgq; /* free msg q */
 
 static struct msg *
 _msg_get(void)
@@ -87,9 +85,22 @@ done:
     msg->vlen = 0;
     msg->rvlen = 0;
     msg->value = NULL;
+    msg->vit = NULL;
+    msg->vpin = NULL;
+    msg->vtime = 0;
     msg->cas = 0;
     msg->num = 0;
 
+    msg->stime = 0;
+    msg->tier = 0;
+
+    msg->opcode = 0;
+    msg->opaque = 0;
+
+    msg->mflags = 0;
+    msg->opaque_start = NULL;
+    msg->opaque_end = NULL;
+
     msg->frag_owner = NULL;
     msg->nfrag = 0;
     msg->frag_id = 0;
@@ -103,6 +114,11 @@ done:
     msg->first_fragment = 0;
     msg->last_fragment = 0;
     msg->swallow = 0;
+    msg->binary = 0;
+    msg->quiet = 0;
+    msg->meta = 0;
+    msg->vwait = 0;
+    msg->vmbuf = 0;
 
     return msg;
 }
@@ -119,6 +135,10 @@ msg_get(struct conn *conn, bool request)
 
     msg->owner = conn;
     msg->request = request ? 1 : 0;
+    if (request && conn->binary) {
+        msg->binary = 1;
+        msg->parser = memcache_parse_bin_req;
+    }
 
     log_debug(LOG_VVERB, "get msg %p id %"PRIu64" request %d owner sd %d",
               msg, msg->id, msg->request, conn->sd);
@@ -310,6 +330,20 @@ msg_parse(struct context *ctx, struct conn *conn, struct msg *msg)
         return FC_OK;
     }
 
+    /*
+     * The protocol of a connection is told by the first byte that it
+     * sends, as every binary request starts with a magic byte that no
+     * ASCII command starts with.
+     */
+    if (!conn->detected) {
+        conn->detected = 1;
+        if (*msg->pos == MEMCACHE_BIN_REQ_MAGIC) {
+            conn->binary = 1;
+            msg->binary = 1;
+            msg->parser = memcache_parse_bin_req;
+        }
+    }
+
     msg->parser(msg);
 
     switch (msg->result) {
@@ -338,18 +372,103 @@ msg_parse(struct context *ctx, struct conn *conn, struct msg *msg)
     return conn->err != 0 ? FC_ERROR : status;
 }
 
+/*
+ * Receive the rest of the value of request msg into its item. The parser
+ * is left waiting on it, and parses the trailing crlf once it is in.
+ */
 static rstatus_t
-msg_recv_chain(struct context *ctx, struct conn *conn, struct msg *msg)
+msg_recv_value(struct conn *conn, struct msg *msg)
+{
+    ssize_t n;
+
+    ASSERT(msg->vwait && msg->rvlen > 0);
+    ASSERT(msg->rvlen <= msg->vlen);
+
+    n = conn_recv(conn, item_data(msg->vit) + (msg->vlen - msg->rvlen),
+                  msg->rvlen);
+    if (n < 0) {
+        if (n == FC_EAGAIN) {
+            return FC_OK;
+        }
+        return FC_ERROR;
+    }
+
+    /* client initiate close? */
+    if (n == 0) {
+        conn->done = 1;
+        log_debug(LOG_INFO, "c %d is done", conn->sd);
+        return FC_OK;
+    }
+
+    msg->rvlen -= (uint32_t)n;
+
+    return FC_OK;
+}
+
+/*
+ * Parse the data received into request msg, and into the requests split
+ * off it, until no complete request is left.
+ */
+static rstatus_t
+msg_parse_chain(struct context *ctx, struct conn *conn, struct msg *msg)
 {
     rstatus_t status;
     struct msg *nmsg;
+
+    for (;;) {
+        status = msg_parse(ctx, conn, msg);
+        if (status != FC_OK) {
+            return status;
+        }
+
+        /* get next request to parse */
+        nmsg = req_recv_next(ctx, conn, false);
+        if (nmsg == NULL || nmsg == msg) {
+            /* no more data to parse */
+            break;
+        }
+
+        msg = nmsg;
+    }
+
+    return FC_OK;
+}
+
+static rstatus_t
+msg_recv_chain(struct context *ctx, struct conn *conn, struct msg *msg)
+{
     struct mbuf *mbuf;
     size_t msize;
     ssize_t n;
 
+    /*
+     * The rest of the value of a large set is received straight into the
+     * item that stores it, once the parser waits on nothing but the value,
+     * unless too many items are already being received into or the item
+     * was given up for taking too long.
+     */
+    if (msg->vwait && msg->vit == NULL && !msg->vmbuf &&
+        msg->rvlen > mbuf_data_size()) {
+        req_recv_item(ctx, conn, msg);
+    }
+    if (msg->vit != NULL && msg->rvlen > 0) {
+        return msg_recv_value(conn, msg);
+    }
+
+    /*
+     * The rest of the value of a large storage request, whose length the
+     * parser already knows, is received into a single mbuf of a larger
+     * size class instead of a chain of small ones. Only the rest of the
+     * value and its crlf are read into it, so that no pipelined request
+     * after it has to be split off into a copy.
+     */
     mbuf = STAILQ_LAST(&msg->mhdr, mbuf, next);
     if (mbuf == NULL || mbuf_full(mbuf)) {
-        mbuf = mbuf_get();
+        if (msg->rvlen + CRLF_LEN > mbuf_data_size()) {
+            mbuf = mbuf_get_size(msg->rvlen + CRLF_LEN);
+        } else {
+            mbuf = mbuf_get();
+        }
         if (mbuf == NULL) {
             return FC_ENOMEM;
         }
@@ -359,6 +478,9 @@ msg_recv_chain(struct context *ctx, struct conn *conn, struct msg *msg)
     ASSERT(mbuf->end - mbuf->last > 0);
 
     msize = mbuf_size(mbuf);
+    if (mbuf->cid != 0) {
+        msize = MIN(msize, msg->rvlen + CRLF_LEN);
+    }
 
     n = conn_recv(conn, mbuf->last, msize);
     if (n < 0) {
@@ -379,23 +501,7 @@ msg_recv_chain(struct context *ctx, struct conn *conn, struct msg *msg)
     mbuf->last += n;
     msg->mlen += (uint32_t)n;
 
-    for (;;) {
-        status = msg_parse(ctx, conn, msg);
-        if (status != FC_OK) {
-            return status;
-        }
-
-        /* get next request to parse */
-        nmsg = req_recv_next(ctx, conn, false);
-        if (nmsg == NULL || nmsg == msg) {
-            /* no more data to parse */
-            break;
-        }
-
-        msg = nmsg;
-    }
-
-    return FC_OK;
+    return msg_parse_chain(ctx, conn, msg);
 }
 
 rstatus_t
@@ -407,19 +513,28 @@ msg_recv(struct context *ctx, struct conn *conn)
     ASSERT(conn->client);
     ASSERT(conn->recv_active);
 
+    /*
+     * Responses to the requests of this read are corked: they are sent
+     * together once the event loop is done with its batch of events.
+     */
+    conn->corked = 1;
+
     conn->recv_ready = 1;
     do {
         msg = req_recv_next(ctx, conn, true);
         if (msg == NULL) {
-            return FC_OK;
+            break;
         }
 
         status = msg_recv_chain(ctx, conn, msg);
         if (status != FC_OK) {
+            conn->corked = 0;
             return status;
         }
     } while (conn->recv_ready);
 
+    conn->corked = 0;
+
     return FC_OK;
 }
 
@@ -435,6 +550,7 @@ msg_send_chain(struct context *ctx, struct conn *conn, struct msg *msg)
     size_t nsend, nsent;                 /* bytes to send; bytes sent */
     size_t limit;                        /* bytes to send limit */
     ssize_t n;                           /* bytes sent by sendv */
+    uint32_t nbatch;                     /* # messages in send_msgq */
 
     TAILQ_INIT(&send_msgq);
 
@@ -443,6 +559,7 @@ msg_send_chain(struct context *ctx, struct conn *conn, struct msg *msg)
     /* preprocess - build iovec */
 
     nsend = 0;
+    nbatch = 0;
     /*
      * readv() and writev() returns EINVAL if the sum of the iov_len values
      * overflows an ssize_t value Or, the vector count iovcnt is less than
@@ -454,6 +571,7 @@ msg_send_chain(struct context *ctx, struct conn *conn, struct msg *msg)
         ASSERT(conn->smsg == msg);
 
         TAILQ_INSERT_TAIL(&send_msgq, msg, m_tqe);
+        nbatch++;
 
         for (mbuf = STAILQ_FIRST(&msg->mhdr);
              mbuf != NULL && array_n(&sendv) < FC_IOV_MAX && nsend < limit;
@@ -490,10 +608,15 @@ msg_send_chain(struct context *ctx, struct conn *conn, struct msg *msg)
 
     conn->smsg = NULL;
 
+    /*
+     * A batch can be entirely made up of empty responses, for instance
+     * the intermediate fragments of a multiget that missed, followed by
+     * a fragment that is still waiting on a disk read.
+     */
     if (nsend != 0) {
         n = conn_sendv(conn, &sendv, nsend);
+        stats_send_batch(nbatch);
     } else {
-        NOT_REACHED();
         n = 0;
     }
     nsent = n > 0 ? (size_t)n : 0;
@@ -549,6 +672,148 @@ msg_send_chain(struct context *ctx, struct conn *conn, struct msg *msg)
     return (n == FC_EAGAIN) ? FC_OK : FC_ERROR;
 }
 
+/*
+ * Receive the len bytes of data of a udp datagram as the requests of
+ * conn. A request that the datagram ends in the middle of is discarded.
+ */
+rstatus_t
+msg_recv_dgram(struct context *ctx, struct conn *conn, uint8_t *data,
+               size_t len)
+{
+    rstatus_t status;
+    struct msg *msg;
+    struct mbuf *mbuf;
+
+    ASSERT(conn->dgram);
+
+    msg = req_recv_next(ctx, conn, true);
+    if (msg == NULL) {
+        return FC_ENOMEM;
+    }
+
+    if (len > mbuf_data_size()) {
+        mbuf = mbuf_get_size(len);
+    } else {
+        mbuf = mbuf_get();
+    }
+    if (mbuf == NULL) {
+        return FC_ENOMEM;
+    }
+    mbuf_insert(&msg->mhdr, mbuf);
+    msg->pos = mbuf->pos;
+
+    mbuf_copy(mbuf, data, len);
+    msg->mlen = (uint32_t)len;
+
+    conn->corked = 1;
+    status = msg_parse_chain(ctx, conn, msg);
+    conn->corked = 0;
+    if (status != FC_OK) {
+        return status;
+    }
+
+    conn->eof = 1;
+    req_recv_next(ctx, conn, false);
+
+    return FC_OK;
+}
+
+/*
+ * Send the responses to the requests of udp datagram conn, once all of
+ * them are done, in datagrams of up to SERVER_DGRAM_MTU bytes. Each one
+ * starts with a frame header of the id of the request, its sequence #
+ * and the # datagrams. Datagrams that the socket has no room for are
+ * dropped.
+ */
+rstatus_t
+msg_send_dgram(struct context *ctx, struct conn *conn)
+{
+    struct msg *pmsg;                   /* request */
+    struct mbuf *mbuf;                  /* current mbuf */
+    uint8_t buf[SERVER_DGRAM_MTU];      /* datagram */
+    size_t nleft, len, size;            /* bytes left; datagram length */
+    uint32_t ndgram, seq;               /* # datagram; sequence # */
+    ssize_t n;
+
+    ASSERT(conn->dgram);
+
+    nleft = 0;
+    TAILQ_FOREACH(pmsg, &conn->omsg_q, c_tqe) {
+        if (!pmsg->done) {
+            return FC_OK;
+        }
+        if (pmsg->peer == NULL) {
+            continue;
+        }
+        STAILQ_FOREACH(mbuf, &pmsg->peer->mhdr, next) {
+            nleft += mbuf_length(mbuf);
+        }
+    }
+
+    size = SERVER_DGRAM_MTU - SERVER_DGRAM_HDR;
+    ndgram = (uint32_t)((nleft + size - 1) / size);
+    if (ndgram > UINT16_MAX) {
+        log_warn("drop rsp of %zu bytes to udp req %"PRIu16"", nleft,
+                 conn->dgram_id);
+        ndgram = 0;
+    }
+
+    pmsg = NULL;
+    mbuf = NULL;
+    for (seq = 0; seq < ndgram; seq++) {
+        buf[0] = (uint8_t)(conn->dgram_id >> 8);
+        buf[1] = (uint8_t)conn->dgram_id;
+        buf[2] = (uint8_t)(seq >> 8);
+        buf[3] = (uint8_t)seq;
+        buf[4] = (uint8_t)(ndgram >> 8);
+        buf[5] = (uint8_t)ndgram;
+        buf[6] = 0;
+        buf[7] = 0;
+        len = SERVER_DGRAM_HDR;
+
+        while (len < SERVER_DGRAM_MTU && nleft > 0) {
+            /* move on to the next mbuf with data, across responses */
+            while (mbuf == NULL || mbuf_empty(mbuf)) {
+                if (mbuf != NULL) {
+                    mbuf = STAILQ_NEXT(mbuf, next);
+                    continue;
+                }
+                pmsg = pmsg == NULL ? TAILQ_FIRST(&conn->omsg_q) :
+                                      TAILQ_NEXT(pmsg, c_tqe);
+                ASSERT(pmsg != NULL);
+                if (pmsg->peer != NULL) {
+                    mbuf = STAILQ_FIRST(&pmsg->peer->mhdr);
+                }
+            }
+
+            size = MIN(mbuf_length(mbuf), SERVER_DGRAM_MTU - len);
+            fc_memcpy(buf + len, mbuf->pos, size);
+            mbuf->pos += size;
+            len += size;
+            nleft -= size;
+        }
+
+        n = sendto(conn->sd, buf, len, 0, (struct sockaddr *)&conn->peer,
+                   conn->peerlen);
+        if (n < 0) {
+            log_debug(LOG_INFO, "sendto of udp rsp %"PRIu16" on sd %d "
+                      "failed: %s", conn->dgram_id, conn->sd, strerror(errno));
+            stats_listener(SERVER_UDP, STATS_LISTENER_DROP, 1);
+            break;
+        }
+        stats_listener(SERVER_UDP, STATS_LISTENER_SEND, (uint64_t)n);
+    }
+
+    while ((pmsg = TAILQ_FIRST(&conn->omsg_q)) != NULL) {
+        req_dequeue_omsgq(ctx, conn, pmsg);
+        req_put(pmsg);
+    }
+
+    conn->done = 1;
+
+    return FC_OK;
+}
+
 rstatus_t
 msg_send(struct context *ctx, struct conn *conn)
 {
@@ -556,7 +821,6 @@ msg_send(struct context *ctx, struct conn *conn)
     struct msg *msg;
 
     ASSERT(conn->client);
-    ASSERT(conn->send_active);
 
     conn->send_ready = 1;
     do {
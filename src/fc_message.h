@@ -49,6 +49,13 @@ typedef void (*msg_parse_t)(struct msg *);
     ACTION( RSP_CLIENT_ERROR,   "CLIENT_ERROR "        ) \
     ACTION( RSP_SERVER_ERROR,   "SERVER_ERROR "        ) \
     ACTION( RSP_VERSION,        "VERSION fatcache\r\n" ) \
+    ACTION( RSP_VA,             "VA "                  ) \
+    ACTION( RSP_HD,             "HD"                   ) \
+    ACTION( RSP_EN,             "EN"                   ) \
+    ACTION( RSP_NF,             "NF"                   ) \
+    ACTION( RSP_NS,             "NS"                   ) \
+    ACTION( RSP_EX,             "EX"                   ) \
+    ACTION( RSP_MN,             "MN"                   ) \
     ACTION( CRLF,               "\r\n" /* empty */     ) \
     ACTION( EMPTY,              "" /* empty */         ) \
 
@@ -59,6 +66,27 @@ typedef enum msg_type {
 } msg_type_t;
 #undef DEFINE_ACTION
 
+/*
+ * Return flags of a meta command, each asking for a piece of the item or
+ * of the request to be returned with the response.
+ */
+#define MSG_META_VALUE  (1 << 0)    /* v: value */
+#define MSG_META_TTL    (1 << 1)    /* t: remaining ttl */
+#define MSG_META_CAS    (1 << 2)    /* c: cas */
+#define MSG_META_FLAGS  (1 << 3)    /* f: client flags */
+#define MSG_META_SIZE   (1 << 4)    /* s: value size */
+#define MSG_META_KEY    (1 << 5)    /* k: key */
+#define MSG_META_OPAQUE (1 << 6)    /* O: opaque token */
+
+/* return flags that are answered from the item, rather than the index */
+#define MSG_META_ITEM   (MSG_META_VALUE | MSG_META_FLAGS | MSG_META_SIZE)
+
+/*
+ * Msec that the rest of a value may take to be received into the item
+ * reserved for it, before it is received into mbufs instead.
+ */
+#define MSG_VALUE_TIMEOUT   5000
+
 typedef enum msg_parse_result {
     MSG_PARSE_OK,                         /* parsing ok */
     MSG_PARSE_ERROR,                      /* parsing error */
@@ -70,6 +98,7 @@ typedef enum msg_parse_result {
 struct msg {
     TAILQ_ENTRY(msg)     c_tqe;           /* link in connection q */
     TAILQ_ENTRY(msg)     m_tqe;           /* link in send q / free q */
+    TAILQ_ENTRY(msg)     v_tqe;           /* link in value receive q */
 
     uint64_t             id;              /* message id */
     struct msg           *peer;           /* message peer */
@@ -98,9 +127,22 @@ struct msg {
     uint32_t             vlen;            /* value length */
     uint32_t             rvlen;           /* running vlen used by parsing fsa */
     uint8_t              *value;          /* value marker */
+    struct item          *vit;            /* item the value is received into */
+    void                 *vpin;           /* pinned slab of vit */
+    int64_t              vtime;           /* usec vit was reserved at */
     uint64_t             cas;             /* cas */
     uint64_t             num;             /* number */
 
+    int64_t              stime;           /* processing start time in nsec */
+    uint8_t              tier;            /* tier that served the request */
+
+    uint8_t              opcode;          /* binary protocol opcode */
+    uint32_t             opaque;          /* binary protocol opaque, as sent */
+
+    uint32_t             mflags;          /* meta command return flags */
+    uint8_t              *opaque_start;   /* meta command opaque start */
+    uint8_t              *opaque_end;     /* meta command opaque end */
+
     struct msg           *frag_owner;     /* owner of fragment message */
     uint32_t             nfrag;           /* # fragment */
     uint64_t             frag_id;         /* id of fragmented message */
@@ -114,16 +156,27 @@ struct msg {
     unsigned             first_fragment:1;/* first fragment? */
     unsigned             last_fragment:1; /* last fragment? */
     unsigned             swallow:1;       /* swallow response? */
+    unsigned             binary:1;        /* binary protocol? */
+    unsigned             quiet:1;         /* binary or meta quiet command? */
+    unsigned             meta:1;          /* meta command? */
+    unsigned             vwait:1;         /* parser waits on the value? */
+    unsigned             vmbuf:1;         /* value received into mbufs only? */
 };
 
 TAILQ_HEAD(msg_tqh, msg);
 
 bool msg_empty(struct msg *msg);
 rstatus_t msg_recv(struct context *ctx, struct conn *conn);
+rstatus_t msg_recv_dgram(struct context *ctx, struct conn *conn, uint8_t *data, size_t len);
+rstatus_t msg_send_dgram(struct context *ctx, struct conn *conn);
 rstatus_t msg_send(struct context *ctx, struct conn *conn);
 
 struct msg *req_get(struct conn *conn);
 void req_put(struct msg *msg);
+void req_latency(struct msg *msg);
+void req_recv_item(struct context *ctx, struct conn *conn, struct msg *msg);
+int req_recv_item_expire(void);
+void req_init(void);
 struct msg *req_recv_next(struct context *ctx, struct conn *conn, bool alloc);
 
 struct msg *msg_get(struct conn *conn, bool request);
@@ -144,6 +197,8 @@ void rsp_send_done(struct context *ctx, struct conn *conn, struct msg *msg);
 void req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg, struct msg *nmsg);
 
 void req_process_error(struct context *ctx, struct conn *conn, struct msg *msg, int err);
+void req_process_get_done(struct context *ctx, struct conn *conn, struct msg *msg, struct item *it, uint64_t cas, int err, bool moved);
+void req_process_deferred(struct context *ctx, struct conn *conn);
 
 
 void rsp_send_status(struct context *ctx, struct conn *conn, struct msg *msg, msg_type_t rsp_type);
@@ -151,5 +206,6 @@ void rsp_send_error(struct context *ctx, struct conn *conn, struct msg *msg, msg
 void rsp_send_value(struct context *ctx, struct conn *conn, struct msg *msg, struct item *it, uint64_t cas);
 void rsp_send_num(struct context *ctx, struct conn *conn, struct msg *msg, struct item *it);
 void rsp_send_string(struct context *ctx, struct conn *conn, struct msg *msg, struct string *str);
+void rsp_send_meta_hit(struct context *ctx, struct conn *conn, struct msg *msg, struct itemx *itx);
 
 #endif
@@ -0,0 +1,125 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * MurmurHash3 x64 128-bit variant. MurmurHash3 was written by Austin
+ * Appleby, and is placed in the public domain.
+ */
+
+#include <fc_core.h>
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return k;
+}
+
+static inline uint64_t
+getblock64(const uint8_t *p)
+{
+    uint64_t k;
+
+    /* little endian load, which x86 and arm do without alignment fixups */
+    memcpy(&k, p, sizeof(k));
+
+    return k;
+}
+
+/*
+ * Compute the 16 byte digest of len bytes from key into md.
+ */
+void
+murmur3_128(const uint8_t *key, size_t len, uint32_t seed, uint8_t *md)
+{
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const uint8_t *tail;
+    size_t i, nblocks;
+    uint64_t h1, h2, k1, k2;
+
+    nblocks = len / 16;
+    h1 = seed;
+    h2 = seed;
+
+    /* body */
+    for (i = 0; i < nblocks; i++) {
+        k1 = getblock64(key + i * 16);
+        k2 = getblock64(key + i * 16 + 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    /* tail */
+    tail = key + nblocks * 16;
+    k1 = 0;
+    k2 = 0;
+
+    switch (len & 15) {
+    case 15: k2 ^= ((uint64_t)tail[14]) << 48; /* fall through */
+    case 14: k2 ^= ((uint64_t)tail[13]) << 40; /* fall through */
+    case 13: k2 ^= ((uint64_t)tail[12]) << 32; /* fall through */
+    case 12: k2 ^= ((uint64_t)tail[11]) << 24; /* fall through */
+    case 11: k2 ^= ((uint64_t)tail[10]) << 16; /* fall through */
+    case 10: k2 ^= ((uint64_t)tail[9]) << 8;   /* fall through */
+    case  9: k2 ^= ((uint64_t)tail[8]) << 0;
+             k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+             /* fall through */
+    case  8: k1 ^= ((uint64_t)tail[7]) << 56;  /* fall through */
+    case  7: k1 ^= ((uint64_t)tail[6]) << 48;  /* fall through */
+    case  6: k1 ^= ((uint64_t)tail[5]) << 40;  /* fall through */
+    case  5: k1 ^= ((uint64_t)tail[4]) << 32;  /* fall through */
+    case  4: k1 ^= ((uint64_t)tail[3]) << 24;  /* fall through */
+    case  3: k1 ^= ((uint64_t)tail[2]) << 16;  /* fall through */
+    case  2: k1 ^= ((uint64_t)tail[1]) << 8;   /* fall through */
+    case  1: k1 ^= ((uint64_t)tail[0]) << 0;
+             k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    /* finalization */
+    h1 ^= (uint64_t)len;
+    h2 ^= (uint64_t)len;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    memcpy(md, &h1, sizeof(h1));
+    memcpy(md + sizeof(h1), &h2, sizeof(h2));
+}
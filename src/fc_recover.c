@@ -0,0 +1,485 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <fc_core.h>
+
+extern struct settings settings;
+
+/*
+ * Crash recovery rebuilds the slab table and the item index from the
+ * disk slabs when there is no checkpoint to come back from. Disk slabs
+ * are self describing: a slab carries its id, class, generation and
+ * flush sequence number, and an item its digest, slab id, offset and
+ * absolute expiry. Only slabs of the latest generation are trusted, and
+ * when a slab id or a key is found more than once, the latest flush wins.
+ *
+ * The device is scanned by a pool of reader threads with O_DIRECT reads,
+ * in two passes: first the header of every disk slab, a small fraction of
+ * the device, to settle which slab lives where, and then the slabs in
+ * large sequential reads of several slabs at once, to index their items.
+ *
+ * Items that were only in memory are lost, and recovered data can be
+ * stale: a key removed or updated after its item reached the disk comes
+ * back with the value on disk, unless the update was flushed too. Items
+ * removed while their memory slab was being flushed are marked on disk
+ * once the flush completes (see slab_put_hole), and do not come back.
+ */
+
+struct recover_shard {
+    uint32_t          ndslab;  /* # disk slab */
+    uint32_t          nstable; /* # slab id */
+    struct slab_found *found;  /* slab found at each disk address */
+    uint64_t          *gen;    /* generation of the slab at each disk address */
+    uint64_t          *seq;    /* flush sequence number of each slab id */
+};
+
+struct recover_worker {
+    pthread_t tid;      /* reader thread */
+    rstatus_t status;   /* reader status */
+    uint64_t  nitem;    /* # item indexed */
+    uint64_t  nexpired; /* # item expired */
+    uint64_t  nskip;    /* # item not indexed */
+};
+
+static uint32_t nshard;                 /* # shard */
+static struct recover_shard *rshards;   /* per shard recovery state */
+static uint32_t nslab_read;             /* # slab per read */
+static uint32_t nunit;                  /* # unit of work per shard */
+static uint64_t next_unit;              /* next unit of work */
+
+/*
+ * Claim the next unit of work of the current pass, that is the run of
+ * nslab_read disk slabs from addr in shard id.
+ */
+static bool
+recover_next(uint32_t *id, uint32_t *addr)
+{
+    uint64_t unit;
+
+    unit = __atomic_fetch_add(&next_unit, 1, __ATOMIC_RELAXED);
+    if (unit >= (uint64_t)nunit * nshard) {
+        return false;
+    }
+
+    *id = (uint32_t)(unit / nunit);
+    *addr = (uint32_t)(unit % nunit) * nslab_read;
+
+    return true;
+}
+
+static int
+recover_open(void)
+{
+    int fd;
+
+    fd = open(settings.ssd_device, O_RDONLY | O_DIRECT, 0644);
+    if (fd < 0) {
+        log_error("open '%s' failed: %s", settings.ssd_device, strerror(errno));
+    }
+
+    return fd;
+}
+
+/*
+ * Read the header of every disk slab.
+ */
+static void *
+recover_scan_hdr(void *arg)
+{
+    struct recover_worker *w = arg;
+    struct recover_shard *rs;
+    struct slab *slab;
+    uint32_t id, addr, end;
+    off_t off;
+    ssize_t n;
+    int fd;
+
+    fd = recover_open();
+    slab = fc_mmap(RECOVER_HDR_SIZE);
+    if (fd < 0 || slab == NULL) {
+        w->status = FC_ERROR;
+        goto done;
+    }
+
+    while (recover_next(&id, &addr)) {
+        slab_select(id);
+        rs = &rshards[id];
+
+        for (end = MIN(addr + nslab_read, rs->ndslab); addr < end; addr++) {
+            rs->found[addr].sid = SLAB_FOUND_NONE;
+
+            off = slab_disk_offset(addr);
+            n = pread(fd, slab, RECOVER_HDR_SIZE, off);
+            if (n < RECOVER_HDR_SIZE) {
+                log_warn("pread fd %d %d bytes at offset %"PRId64" failed, "
+                         "slab skipped: %s", fd, RECOVER_HDR_SIZE, (int64_t)off,
+                         n < 0 ? strerror(errno) : "short read");
+                continue;
+            }
+
+            if (slab->magic != SLAB_MAGIC || slab->gen == 0 ||
+                slab->sid >= rs->nstable || slab->cid >= slab_max_cid()) {
+                continue;
+            }
+
+            rs->found[addr].sid = slab->sid;
+            rs->found[addr].cid = slab->cid;
+            rs->found[addr].seq = slab->seq;
+            rs->gen[addr] = slab->gen;
+        }
+    }
+
+done:
+    if (slab != NULL) {
+        fc_munmap(slab, RECOVER_HDR_SIZE);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+/*
+ * Index the items of disk slab slab, found as f in shard id, unless a
+ * later flush of the same key has already been indexed. The caller holds
+ * the shard lock.
+ */
+static void
+recover_slab(struct recover_worker *w, uint32_t id, struct slab *slab,
+             struct slab_found *f)
+{
+    struct recover_shard *rs = &rshards[id];
+    struct slabclass *c;
+    struct item *it;
+    struct itemx *itx;
+    uint32_t idx, offset;
+    time_t now;
+
+    if (slab->magic != SLAB_MAGIC || slab->sid != f->sid ||
+        slab->cid != f->cid) {
+        return;
+    }
+
+    c = slab_get_class_by_cid(f->cid);
+    now = time_now_abs();
+
+    for (idx = 0; idx < c->nitem; idx++) {
+        offset = SLAB_HDR_SIZE + idx * c->size;
+        it = (struct item *)((uint8_t *)slab + offset);
+
+        /* removed items and chunks never allocated are skipped */
+        if (it->magic != ITEM_MAGIC || it->sid != f->sid ||
+            it->cid != f->cid || it->offset != offset ||
+            shard_id(it->md) != id) {
+            continue;
+        }
+
+        if (it->expiry != 0 && (time_t)it->expiry <= now) {
+            w->nexpired++;
+            continue;
+        }
+
+        itx = itemx_getx(it->hash, it->md);
+        if (itx != NULL) {
+            if (rs->seq[itx->sid] >= f->seq) {
+                continue;
+            }
+            itemx_removex(it->hash, it->md);
+            w->nitem--;
+        }
+
+        if (itemx_empty()) {
+            w->nskip++;
+            continue;
+        }
+
+        itemx_putx(it->hash, it->md, f->sid, offset,
+                   it->expiry == 0 ? 0 : time_reltime(it->expiry),
+                   item_next_cas());
+        w->nitem++;
+    }
+}
+
+/*
+ * Read the disk slabs that were found, several at once, and index their
+ * items.
+ */
+static void *
+recover_scan_slab(void *arg)
+{
+    struct recover_worker *w = arg;
+    struct recover_shard *rs;
+    uint8_t *buf;
+    size_t size;
+    uint32_t id, addr, first, last, end;
+    off_t off;
+    ssize_t n;
+    int fd;
+
+    size = (size_t)nslab_read * settings.slab_size;
+    fd = recover_open();
+    buf = fc_mmap(size);
+    if (fd < 0 || buf == NULL) {
+        w->status = FC_ERROR;
+        goto done;
+    }
+
+    while (recover_next(&id, &addr)) {
+        slab_select(id);
+        rs = &rshards[id];
+
+        /* read the run from its first to its last found slab at once */
+        end = MIN(addr + nslab_read, rs->ndslab);
+        for (first = addr; first < end; first++) {
+            if (rs->found[first].sid != SLAB_FOUND_NONE) {
+                break;
+            }
+        }
+        if (first == end) {
+            continue;
+        }
+        for (last = end - 1; rs->found[last].sid == SLAB_FOUND_NONE; last--) {
+        }
+
+        off = slab_disk_offset(first);
+        size = (size_t)(last - first + 1) * settings.slab_size;
+        n = pread(fd, buf, size, off);
+        if (n < (ssize_t)size) {
+            log_warn("pread fd %d %zu bytes at offset %"PRId64" failed, "
+                     "slabs skipped: %s", fd, size, (int64_t)off,
+                     n < 0 ? strerror(errno) : "short read");
+            continue;
+        }
+
+        shard_lock(id);
+        for (addr = first; addr <= last; addr++) {
+            if (rs->found[addr].sid == SLAB_FOUND_NONE) {
+                continue;
+            }
+            recover_slab(w, id, (struct slab *)(buf + (size_t)(addr - first) *
+                         settings.slab_size), &rs->found[addr]);
+        }
+        shard_unlock(id);
+    }
+
+done:
+    if (buf != NULL) {
+        fc_munmap(buf, (size_t)nslab_read * settings.slab_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+/*
+ * Run one pass over the disk slabs of all shards with settings.recover
+ * reader threads.
+ */
+static rstatus_t
+recover_pass(struct recover_worker *workers, void *(*scan)(void *))
+{
+    rstatus_t status;
+    uint32_t i;
+    int err;
+
+    next_unit = 0;
+
+    status = FC_OK;
+    for (i = 0; i < settings.recover; i++) {
+        workers[i].status = FC_OK;
+        err = pthread_create(&workers[i].tid, NULL, scan, &workers[i]);
+        if (err != 0) {
+            log_error("recovery reader create failed: %s", strerror(err));
+            status = FC_ERROR;
+            break;
+        }
+    }
+
+    while (i > 0) {
+        i--;
+        pthread_join(workers[i].tid, NULL);
+        if (workers[i].status != FC_OK) {
+            status = workers[i].status;
+        }
+    }
+
+    return status;
+}
+
+/*
+ * Keep the disk slabs of generation gen only, and of those found with the
+ * same slab id, the one flushed last.
+ */
+static rstatus_t
+recover_settle(struct recover_shard *rs, uint64_t gen)
+{
+    struct slab_found *f;
+    uint32_t *owner; /* disk address of the slab kept for each slab id */
+    uint32_t addr, sid;
+
+    owner = fc_alloc(sizeof(*owner) * rs->nstable);
+    if (owner == NULL) {
+        return FC_ENOMEM;
+    }
+    for (sid = 0; sid < rs->nstable; sid++) {
+        owner[sid] = SLAB_FOUND_NONE;
+    }
+
+    for (addr = 0; addr < rs->ndslab; addr++) {
+        f = &rs->found[addr];
+        if (f->sid == SLAB_FOUND_NONE) {
+            continue;
+        }
+
+        if (rs->gen[addr] != gen) {
+            f->sid = SLAB_FOUND_NONE;
+        } else if (owner[f->sid] == SLAB_FOUND_NONE) {
+            owner[f->sid] = addr;
+        } else if (rs->found[owner[f->sid]].seq < f->seq) {
+            rs->found[owner[f->sid]].sid = SLAB_FOUND_NONE;
+            owner[f->sid] = addr;
+        } else {
+            f->sid = SLAB_FOUND_NONE;
+        }
+    }
+
+    for (sid = 0; sid < rs->nstable; sid++) {
+        rs->seq[sid] = owner[sid] == SLAB_FOUND_NONE ? 0 :
+                       rs->found[owner[sid]].seq;
+    }
+
+    fc_free(owner);
+
+    return FC_OK;
+}
+
+/*
+ * Recover the slabs and item index of every shard from the device, with
+ * settings.recover reader threads.
+ */
+rstatus_t
+recover_scan(void)
+{
+    rstatus_t status;
+    struct recover_worker *workers;
+    struct recover_shard *rs;
+    uint64_t gen, nitem, nexpired, nskip, nslab;
+    uint32_t id, addr;
+    int64_t start;
+
+    if (settings.recover == 0) {
+        return FC_OK;
+    }
+
+    start = fc_usec_now();
+
+    nshard = shard_n();
+    rshards = fc_calloc(nshard, sizeof(*rshards));
+    workers = fc_calloc(settings.recover, sizeof(*workers));
+    if (rshards == NULL || workers == NULL) {
+        return FC_ENOMEM;
+    }
+
+    for (id = 0; id < nshard; id++) {
+        rs = &rshards[id];
+        slab_select(id);
+
+        rs->ndslab = slab_dsinfo_nalloc();
+        rs->nstable = slab_msinfo_nalloc() + rs->ndslab;
+        rs->found = fc_alloc(sizeof(*rs->found) * rs->ndslab);
+        rs->gen = fc_calloc(rs->ndslab, sizeof(*rs->gen));
+        rs->seq = fc_alloc(sizeof(*rs->seq) * rs->nstable);
+        if (rs->found == NULL || rs->gen == NULL || rs->seq == NULL) {
+            return FC_ENOMEM;
+        }
+    }
+
+    /* shards have equal parts of the disk */
+    nslab_read = 1;
+    nunit = rshards[0].ndslab;
+
+    status = recover_pass(workers, recover_scan_hdr);
+    if (status != FC_OK) {
+        return status;
+    }
+
+    for (gen = 0, nslab = 0, id = 0; id < nshard; id++) {
+        rs = &rshards[id];
+        for (addr = 0; addr < rs->ndslab; addr++) {
+            if (rs->found[addr].sid != SLAB_FOUND_NONE) {
+                gen = MAX(gen, rs->gen[addr]);
+            }
+        }
+    }
+
+    if (gen == 0) {
+        log_debug(LOG_NOTICE, "no disk slabs to recover, starting cold");
+        goto done;
+    }
+
+    for (id = 0; id < nshard; id++) {
+        rs = &rshards[id];
+        slab_select(id);
+
+        status = recover_settle(rs, gen);
+        if (status != FC_OK) {
+            return status;
+        }
+
+        status = slab_recover(rs->found);
+        if (status != FC_OK) {
+            return status;
+        }
+        nslab += slab_dsinfo_nfull();
+    }
+    slab_set_gen(gen);
+
+    nslab_read = MAX(RECOVER_READ_SIZE / settings.slab_size, 1);
+    nunit = (rshards[0].ndslab + nslab_read - 1) / nslab_read;
+
+    status = recover_pass(workers, recover_scan_slab);
+    if (status != FC_OK) {
+        return status;
+    }
+    slab_select(0);
+    itemx_select(0);
+
+    for (nitem = 0, nexpired = 0, nskip = 0, id = 0; id < settings.recover; id++) {
+        nitem += workers[id].nitem;
+        nexpired += workers[id].nexpired;
+        nskip += workers[id].nskip;
+    }
+
+    loga("recovered %"PRIu64" items from %"PRIu64" disk slabs in %"PRId64" "
+         "msec, %"PRIu64" expired, %"PRIu64" over the index capacity", nitem,
+         nslab, (fc_usec_now() - start) / 1000, nexpired, nskip);
+
+done:
+    for (id = 0; id < nshard; id++) {
+        rs = &rshards[id];
+        fc_free(rs->found);
+        fc_free(rs->gen);
+        fc_free(rs->seq);
+    }
+    fc_free(rshards);
+    fc_free(workers);
+
+    return FC_OK;
+}
@@ -23,8 +23,17 @@
 #include <fc_event.h>
 #include <fc_stats.h>
 
+extern struct settings settings;
 extern struct string msg_strings[];
 
+static __thread struct msg_tqh recv_itemq; /* requests with an item reserved for their value */
+
+void
+req_init(void)
+{
+    TAILQ_INIT(&recv_itemq);
+}
+
 struct msg *
 req_get(struct conn *conn)
 {
@@ -38,6 +47,22 @@ req_get(struct conn *conn)
     return msg;
 }
 
+/*
+ * Release the item reserved for the value of request msg, once the item
+ * is either indexed or left behind as a dead chunk.
+ */
+static void
+req_recv_item_put(struct msg *msg)
+{
+    ASSERT(msg->vit != NULL);
+
+    TAILQ_REMOVE(&recv_itemq, msg, v_tqe);
+    slab_unpin(msg->vpin);
+    slab_recv_release(shard_id(msg->md));
+    msg->vit = NULL;
+    msg->vpin = NULL;
+}
+
 void
 req_put(struct msg *msg)
 {
@@ -45,6 +70,11 @@ req_put(struct msg *msg)
 
     ASSERT(msg->request);
 
+    /* noreply request is done once it has been processed */
+    if (msg->noreply) {
+        req_latency(msg);
+    }
+
     pmsg = msg->peer;
     if (pmsg != NULL) {
         ASSERT(!pmsg->request && pmsg->peer == msg);
@@ -53,9 +83,39 @@ req_put(struct msg *msg)
         rsp_put(pmsg);
     }
 
+    /*
+     * An item whose value was received into, but that was never indexed,
+     * is left behind as a dead chunk, which needs no shard lock. Its
+     * slab is flushed to disk without it.
+     */
+    if (msg->vit != NULL) {
+        msg->vit->magic = 0;
+        req_recv_item_put(msg);
+    }
+
     msg_put(msg);
 }
 
+/*
+ * Record the latency of request msg, from the time it started to be
+ * processed to the time its response is done, under its command and the
+ * tier that served it, and trace it. Only the first call for a request
+ * records.
+ */
+void
+req_latency(struct msg *msg)
+{
+    ASSERT(msg->request);
+
+    if (msg->stime == 0) {
+        return;
+    }
+
+    stats_latency_record(msg->type, msg->tier, fc_nsec_now() - msg->stime);
+    trace_request(msg);
+    msg->stime = 0;
+}
+
 /*
  * Return true if request is done, false otherwise
  */
@@ -169,6 +229,56 @@ req_filter(struct context *ctx, struct conn *conn, struct msg *msg)
     return false;
 }
 
+/*
+ * Compute the digest of the key with the configured key hash into md. A
+ * digest shorter than md is zero padded, so that md always compares
+ * equal for equal keys.
+ */
+static void
+req_digest(uint8_t *key, size_t keylen, uint8_t *md)
+{
+    switch (settings.key_hash) {
+    case ITEM_KEY_HASH_MURMUR3:
+        murmur3_128(key, keylen, 0, md);
+        memset(md + MURMUR3_DIGEST_SIZE, 0, SHA1_DIGEST_SIZE - MURMUR3_DIGEST_SIZE);
+        break;
+
+    case ITEM_KEY_HASH_SHA1:
+    default:
+        sha1(key, keylen, md);
+        break;
+    }
+}
+
+/*
+ * Return true if item it was stored under the key of msg. Distinct keys
+ * can share a digest, which only a comparison of the keys tells apart.
+ */
+static bool
+req_match_key(struct msg *msg, struct item *it)
+{
+    return it->nkey == (uint8_t)(msg->key_end - msg->key_start) &&
+           memcmp(item_key(it), msg->key_start, it->nkey) == 0;
+}
+
+static void
+req_send_miss(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    msg_type_t type;
+
+    /*
+     * On a miss, we send a "END\r\n" response, unless the request
+     * is an intermediate fragment in a fragmented request.
+     */
+    if (msg->frag_id == 0 || msg->last_fragment) {
+        type = MSG_RSP_END;
+    } else {
+        type = MSG_EMPTY;
+    }
+
+    rsp_send_status(ctx, conn, msg, type);
+}
+
 static void
 req_process_get(struct context *ctx, struct conn *conn, struct msg *msg)
 {
@@ -178,26 +288,48 @@ req_process_get(struct context *ctx, struct conn *conn, struct msg *msg)
     //去找索引
     itx = itemx_getx(msg->hash, msg->md);
     if (itx == NULL) {
-        msg_type_t type;
-
-        /*
-         * On a miss, we send a "END\r\n" response, unless the request
-         * is an intermediate fragment in a fragmented request.
-         */
-        if (msg->frag_id == 0 || msg->last_fragment) {
-            type = MSG_RSP_END;
-        } else {
-            type = MSG_EMPTY;
-        }
-
-        rsp_send_status(ctx, conn, msg, type);
+        msg->tier = STATS_TIER_MISS;
+        req_send_miss(ctx, conn, msg);
         return;
     }
 
     if (itemx_expired(itx)) {
+        msg->tier = STATS_TIER_MISS;
         rsp_send_status(ctx, conn, msg, MSG_RSP_NOT_FOUND);
         return;
     }
+
+    /*
+     * A meta get that asks for nothing of the item itself is an existence
+     * check, which the index alone answers without reading the item.
+     */
+    if (msg->meta && !(msg->mflags & MSG_META_ITEM)) {
+        STATS_HIT_INCR(msg->type);
+        rsp_send_meta_hit(ctx, conn, msg, itx);
+        return;
+    }
+
+    /*
+     * An item in a memory slab is responded from in place, without first
+     * copying it into the read buffer.
+     */
+    it = slab_peek_item(itx->sid, itx->offset);
+    if (it != NULL) {
+        goto found;
+    }
+
+    /*
+     * An item in a disk slab is read asynchronously when possible. The
+     * request stays parked on the outstanding q until the read completes
+     * in req_process_get_done(), and the requests after it that are not
+     * reads are deferred until then.
+     */
+    msg->tier = STATS_TIER_DISK;
+    if (aio_read_item(msg, itx->sid, itx->offset, itx->cas) == FC_OK) {
+        conn->nread++;
+        return;
+    }
+
     /*
      * On a hit, we read the item with address [sid, offset] and respond
      * with item value if the item hasn't expired yet.
@@ -209,6 +341,13 @@ req_process_get(struct context *ctx, struct conn *conn, struct msg *msg)
         return;
     }
 
+found:
+
+    if (!req_match_key(msg, it)) {
+        req_send_miss(ctx, conn, msg);
+        return;
+    }
+
     log_debug(LOG_VERB, "get it at offset %"PRIu32"", it->offset);
 
     STATS_HIT_INCR(msg->type);
@@ -216,6 +355,52 @@ req_process_get(struct context *ctx, struct conn *conn, struct msg *msg)
     rsp_send_value(ctx, conn, msg, it, itx->cas);
 }
 
+/*
+ * Finish a get request that was parked on an asynchronous disk read. A
+ * NULL item that moved while the read was in flight, which only another
+ * connection can have done, is looked up again; any other NULL item is a
+ * miss. Called with the shard of the request key locked.
+ */
+void
+req_process_get_done(struct context *ctx, struct conn *conn, struct msg *msg,
+                     struct item *it, uint64_t cas, int err, bool moved)
+{
+    ASSERT(msg->request && !msg->done && !msg->swallow);
+    ASSERT(msg->owner == conn);
+    ASSERT(conn->nread > 0);
+
+    conn->nread--;
+
+    if (err != 0) {
+        rsp_send_error(ctx, conn, msg, MSG_RSP_SERVER_ERROR, err);
+        return;
+    }
+
+    if (it == NULL && moved) {
+        log_debug(LOG_VERB, "retry get req %"PRIu64" on c %d", msg->id,
+                  conn->sd);
+        req_process_get(ctx, conn, msg);
+        return;
+    }
+
+    if (it == NULL) {
+        msg->tier = STATS_TIER_MISS;
+        req_send_miss(ctx, conn, msg);
+        return;
+    }
+
+    if (!req_match_key(msg, it)) {
+        req_send_miss(ctx, conn, msg);
+        return;
+    }
+
+    log_debug(LOG_VERB, "get it at offset %"PRIu32"", it->offset);
+
+    STATS_HIT_INCR(msg->type);
+    SC_STATS_INCR(it->cid, msg->type);
+    rsp_send_value(ctx, conn, msg, it, cas);
+}
+
 static void
 req_process_delete(struct context *ctx, struct conn *conn, struct msg *msg)
 {
@@ -224,9 +409,16 @@ req_process_delete(struct context *ctx, struct conn *conn, struct msg *msg)
 
     itx = itemx_getx(msg->hash, msg->md);
     if (itx == NULL) {
+        msg->tier = STATS_TIER_MISS;
         rsp_send_status(ctx, conn, msg, MSG_RSP_NOT_FOUND);
         return;
     }
+
+    if (msg->cas != 0 && msg->cas != itx->cas) {
+        rsp_send_status(ctx, conn, msg, MSG_RSP_EXISTS);
+        return;
+    }
+
     cid = slab_get_cid(itx->sid);
     itemx_removex(msg->hash, msg->md);
 
@@ -235,12 +427,217 @@ req_process_delete(struct context *ctx, struct conn *conn, struct msg *msg)
     rsp_send_status(ctx, conn, msg, MSG_RSP_DELETED);
 }
 
+/*
+ * Reserve the item that the rest of the value of large storage request
+ * msg is received into by the connection, and copy the part of the value
+ * already received into it. The item is only indexed once the request is
+ * processed; until then its slab stays pinned, so that it is neither
+ * drained to disk nor has the chunk of the item handed out again. Past
+ * the cap on such pins, the value is received into mbufs instead.
+ */
+void
+req_recv_item(struct context *ctx, struct conn *conn, struct msg *msg)
+{
+    uint8_t *key, nkey, cid;
+    uint32_t sid;
+    struct item *it;
+    struct slabinfo *sinfo;
+
+    ASSERT(msg->request && msg->vwait);
+    ASSERT(msg->vit == NULL);
+
+    switch (msg->type) {
+    case MSG_REQ_SET:
+    case MSG_REQ_ADD:
+    case MSG_REQ_REPLACE:
+    case MSG_REQ_CAS:
+        break;
+
+    default:
+        return;
+    }
+
+    key = msg->key_start;
+    nkey = (uint8_t)(msg->key_end - msg->key_start);
+
+    req_digest(key, nkey, msg->md);
+    msg->hash = sha1_hash(msg->md);
+
+    sid = shard_id(msg->md);
+    shard_lock(sid);
+
+    cid = item_slabcid(nkey, msg->vlen);
+    if (cid == SLABCLASS_INVALID_ID) {
+        shard_unlock(sid);
+        return;
+    }
+
+    if (!slab_recv_reserve()) {
+        shard_unlock(sid);
+        log_debug(LOG_VERB, "recv value of req %"PRIu64" into mbufs, as "
+                  "too many items are being received into", msg->id);
+        msg->vmbuf = 1;
+        return;
+    }
+
+    it = item_alloc(key, nkey, cid, msg->vlen, time_reltime(msg->expiry),
+                    msg->flags, msg->md, msg->hash,
+                    itemx_getx(msg->hash, msg->md) != NULL);
+    if (it == NULL) {
+        shard_unlock(sid);
+        slab_recv_release(sid);
+        return;
+    }
+
+    /* a chunk is never handed out of a slab that is being drained */
+    sinfo = slab_pin_item(it);
+    shard_unlock(sid);
+    if (sinfo == NULL) {
+        it->magic = 0;
+        slab_recv_release(sid);
+        return;
+    }
+
+    log_debug(LOG_VERB, "recv value of req %"PRIu64" with %"PRIu32" of "
+              "%"PRIu32" bytes left into it at offset %"PRIu32" of sid "
+              "%"PRIu32"", msg->id, msg->rvlen, msg->vlen, it->offset, it->sid);
+
+    mbuf_copy_to(&msg->mhdr, msg->value, item_data(it),
+                 msg->vlen - msg->rvlen);
+
+    msg->vit = it;
+    msg->vpin = sinfo;
+    msg->vtime = fc_usec_now();
+    TAILQ_INSERT_TAIL(&recv_itemq, msg, v_tqe);
+}
+
+/*
+ * Give up the item reserved for the value of request msg, whose sender
+ * took too long to send it. The part of the value received into the item
+ * is copied out into mbufs, after the part that the request was parsed
+ * with, and the rest of it is received into mbufs too.
+ */
+static rstatus_t
+req_recv_item_drop(struct msg *msg)
+{
+    rstatus_t status;
+    struct mbuf *mbuf, *last;
+    uint32_t nmbuf, nitem; /* value bytes received into mbufs; into item */
+    bool found;
+
+    ASSERT(msg->vit != NULL && msg->rvlen > 0);
+
+    nmbuf = 0;
+    found = false;
+    STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+        if (found) {
+            nmbuf += mbuf_length(mbuf);
+        } else if (msg->value != NULL && mbuf_contains(mbuf, msg->value)) {
+            nmbuf += (uint32_t)(mbuf->last - msg->value);
+            found = true;
+        }
+    }
+    nitem = msg->vlen - msg->rvlen - nmbuf;
+
+    last = STAILQ_LAST(&msg->mhdr, mbuf, next);
+    ASSERT(last != NULL);
+
+    mbuf = mbuf_get_size(nitem + msg->rvlen + CRLF_LEN);
+    if (mbuf == NULL) {
+        return FC_ENOMEM;
+    }
+    mbuf_insert(&msg->mhdr, mbuf);
+
+    status = mbuf_copy_from(&msg->mhdr, item_data(msg->vit) + nmbuf, nitem);
+    if (status != FC_OK) {
+        while ((mbuf = STAILQ_NEXT(last, next)) != NULL) {
+            mbuf_remove(&msg->mhdr, mbuf);
+            mbuf_put(mbuf);
+        }
+        return status;
+    }
+
+    if (msg->value == NULL && nitem > 0) {
+        msg->value = mbuf->pos;
+    }
+
+    /* the parser resumes after the bytes it already counted off rvlen */
+    msg->pos = STAILQ_LAST(&msg->mhdr, mbuf, next)->last;
+
+    msg->vit->magic = 0;
+    req_recv_item_put(msg);
+    msg->vmbuf = 1;
+
+    return FC_OK;
+}
+
+/*
+ * Give up the items reserved for values that are not received in full
+ * MSG_VALUE_TIMEOUT msec after they were reserved, so that a stalled
+ * sender does not hold a pinned slab for good. Return the msec until the
+ * next item is due to be given up, or -1 if no item is being received
+ * into.
+ */
+int
+req_recv_item_expire(void)
+{
+    struct msg *msg, *nmsg;
+    int64_t now, left;
+
+    if (TAILQ_EMPTY(&recv_itemq)) {
+        return -1;
+    }
+
+    now = fc_usec_now();
+
+    for (msg = TAILQ_FIRST(&recv_itemq); msg != NULL; msg = nmsg) {
+        nmsg = TAILQ_NEXT(msg, v_tqe);
+
+        /* a value received in full only waits on being processed */
+        if (msg->rvlen == 0) {
+            continue;
+        }
+
+        left = msg->vtime + MSG_VALUE_TIMEOUT * 1000LL - now;
+        if (left > 0) {
+            /* items are reserved in order, so the rest are due later */
+            return (int)((left + 999) / 1000);
+        }
+
+        log_warn("recv value of req %"PRIu64" on c %d into mbufs, after "
+                 "%"PRIu32" of %"PRIu32" bytes in %d msec", msg->id,
+                 msg->owner->sd, msg->vlen - msg->rvlen, msg->vlen,
+                 MSG_VALUE_TIMEOUT);
+
+        if (req_recv_item_drop(msg) != FC_OK) {
+            /* try again once another timeout is up */
+            msg->vtime = now;
+            TAILQ_REMOVE(&recv_itemq, msg, v_tqe);
+            TAILQ_INSERT_TAIL(&recv_itemq, msg, v_tqe);
+        }
+    }
+
+    return TAILQ_EMPTY(&recv_itemq) ? -1 : MSG_VALUE_TIMEOUT;
+}
+
 static void
 req_process_set(struct context *ctx, struct conn *conn, struct msg *msg)
 {
     uint8_t *key, nkey, cid;
     struct item *it;
 
+    /* the value was received into its item, which only needs indexing */
+    if (msg->vit != NULL) {
+        it = msg->vit;
+        itemx_removex(msg->hash, msg->md);
+        item_publish(it, time_reltime(msg->expiry));
+        req_recv_item_put(msg);
+
+        SC_STATS_INCR(it->cid, msg->type);
+        rsp_send_status(ctx, conn, msg, MSG_RSP_STORED);
+        return;
+    }
+
     key = msg->key_start;
     nkey = (uint8_t)(msg->key_end - msg->key_start);
 
@@ -289,6 +686,7 @@ req_process_replace(struct context *ctx, struct conn *conn, struct msg *msg)
     /*  replace, only replaces if the mapping is present */
     itx = itemx_getx(msg->hash, msg->md);
     if (itx == NULL || itemx_expired(itx)) {
+        msg->tier = STATS_TIER_MISS;
         rsp_send_status(ctx, conn, msg, MSG_RSP_NOT_STORED);
         return;
     }
@@ -313,6 +711,7 @@ req_process_cas(struct context *ctx, struct conn *conn, struct msg *msg)
          * NOT_FOUND indicates that the item you are trying to store
          * with a cas does not exist.
          */
+        msg->tier = STATS_TIER_MISS;
         rsp_send_status(ctx, conn, msg, MSG_RSP_NOT_FOUND);
         return;
     }
@@ -345,17 +744,26 @@ req_process_concat(struct context *ctx, struct conn *conn, struct msg *msg)
     itx = itemx_getx(msg->hash, msg->md);
     if (itx == NULL || itemx_expired(itx)) {
         /* 2a). miss -> return NOT_STORED */
+        msg->tier = STATS_TIER_MISS;
         rsp_send_status(ctx, conn, msg, MSG_RSP_NOT_STORED);
         return;
     }
 
     /* 2b). hit -> read existing item into oit */
+    if (slab_peek_item(itx->sid, itx->offset) == NULL) {
+        msg->tier = STATS_TIER_DISK;
+    }
     oit = slab_read_item(itx->sid, itx->offset);
     if (oit == NULL) {
         rsp_send_error(ctx, conn, msg, MSG_RSP_SERVER_ERROR, errno);
         return;
     }
 
+    if (!req_match_key(msg, oit)) {
+        rsp_send_status(ctx, conn, msg, MSG_RSP_NOT_STORED);
+        return;
+    }
+
     ndata = msg->vlen + oit->ndata;
     cid = item_slabcid(nkey, ndata);
     if (cid == SLABCLASS_INVALID_ID) {
@@ -412,17 +820,26 @@ req_process_num(struct context *ctx, struct conn *conn, struct msg *msg)
     itx = itemx_getx(msg->hash, msg->md);
     if (itx == NULL || itemx_expired(itx)) {
         /* 2a). miss -> return NOT_FOUND */
+        msg->tier = STATS_TIER_MISS;
         rsp_send_status(ctx, conn, msg, MSG_RSP_NOT_FOUND);
         return;
     }
 
     /* 2b). hit -> read existing item into it */
+    if (slab_peek_item(itx->sid, itx->offset) == NULL) {
+        msg->tier = STATS_TIER_DISK;
+    }
     it = slab_read_item(itx->sid, itx->offset);
     if (it == NULL) {
         rsp_send_error(ctx, conn, msg, MSG_RSP_SERVER_ERROR, errno);
         return;
     }
 
+    if (!req_match_key(msg, it)) {
+        rsp_send_status(ctx, conn, msg, MSG_RSP_NOT_FOUND);
+        return;
+    }
+
     /* 3). sanity check item data to be a number */
     status = fc_atou64(item_data(it), it->ndata, &cnum);
     if (status != FC_OK) {
@@ -465,6 +882,7 @@ req_process_num(struct context *ctx, struct conn *conn, struct msg *msg)
 
 static void req_process_stats(struct context *ctx, struct conn *conn, struct msg *msg)
 {
+    static struct string reset = string("RESET\r\n");
     int nkey;
     uint8_t *key;
     struct string str;
@@ -477,6 +895,15 @@ static void req_process_stats(struct context *ctx, struct conn *conn, struct msg
         buf = stats_settings();
     } else if (fc_strlen("slabs") == nkey && !fc_strncmp("slabs", key, nkey)) {
         buf = stats_slabs();
+    } else if (fc_strlen("io") == nkey && !fc_strncmp("io", key, nkey)) {
+        buf = stats_io();
+    } else if (fc_strlen("latency") == nkey && !fc_strncmp("latency", key, nkey)) {
+        buf = stats_latency();
+    } else if (fc_strlen("latency reset") == nkey &&
+               !fc_strncmp("latency reset", key, nkey)) {
+        stats_latency_reset();
+        rsp_send_string(ctx, conn, msg, &reset);
+        return;
     } else {
         buf = stats_server();
     }
@@ -498,6 +925,7 @@ req_process_error(struct context *ctx, struct conn *conn, struct msg *msg,
 
     /* mark request as done and error */
     msg->done = 1;
+    req_latency(msg);
     msg->error = 1;
     msg->err = err != 0 ? err : errno;
 
@@ -524,10 +952,14 @@ req_process(struct context *ctx, struct conn *conn, struct msg *msg)
 {
     uint8_t *key;
     size_t keylen;
+    uint32_t sid;
+    bool locked;
 
     ASSERT(msg->request);
     ASSERT(msg->type >= MSG_REQ_GET && msg->type < MSG_REQ_QUIT);
 
+    msg->stime = fc_nsec_now();
+
     /* enqueue request into outq, if response is expected */
     if (!msg->noreply) {
         req_enqueue_omsgq(ctx, conn, msg);
@@ -543,10 +975,23 @@ req_process(struct context *ctx, struct conn *conn, struct msg *msg)
      * CPU by storing the result in msg struct and doing this computation
      * only once over the lifetime of this request.
      */
-    sha1(key, keylen, msg->md);
+    req_digest(key, keylen, msg->md);
     msg->hash = sha1_hash(msg->md);
 
     STATS_INCR(msg->type);
+
+    /*
+     * Every command that carries a key works on the index and slabs of
+     * the shard that owns the key, with that shard locked for the whole
+     * command. The request may be recycled once its response is out, so
+     * whether the shard was locked is remembered up front.
+     */
+    sid = shard_id(msg->md);
+    locked = msg->type < MSG_REQ_STATS;
+    if (locked) {
+        shard_lock(sid);
+    }
+
     switch (msg->type) {
     case MSG_REQ_GET:
     case MSG_REQ_GETS:
@@ -594,6 +1039,46 @@ req_process(struct context *ctx, struct conn *conn, struct msg *msg)
     default:
         NOT_REACHED();
     }
+
+    if (locked) {
+        shard_unlock(sid);
+    }
+}
+
+/*
+ * Return true if request msg has to wait for the disk reads parked on
+ * connection conn. Requests of a connection run in the order they came
+ * in, but a get can run while the gets before it wait on the disk, as
+ * neither sees the other. Any other request is deferred until they are
+ * done, and so is every request after it.
+ */
+static bool
+req_wait_read(struct conn *conn, struct msg *msg)
+{
+    if (conn->nread == 0) {
+        return false;
+    }
+
+    return msg->type != MSG_REQ_GET && msg->type != MSG_REQ_GETS;
+}
+
+/*
+ * Run the requests deferred on connection conn, in order, up to the first
+ * one that still has to wait on a disk read. Called with no shard locked.
+ */
+void
+req_process_deferred(struct context *ctx, struct conn *conn)
+{
+    struct msg *msg;
+
+    while ((msg = TAILQ_FIRST(&conn->dmsg_q)) != NULL) {
+        if (req_wait_read(conn, msg)) {
+            break;
+        }
+
+        TAILQ_REMOVE(&conn->dmsg_q, msg, c_tqe);
+        req_process(ctx, conn, msg);
+    }
 }
 
 void
@@ -612,5 +1097,14 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
         return;
     }
 
+    stats_listener(conn->listener, STATS_LISTENER_REQ, 1);
+
+    if (!TAILQ_EMPTY(&conn->dmsg_q) || req_wait_read(conn, msg)) {
+        log_debug(LOG_VERB, "defer req %"PRIu64" on c %d behind %"PRIu32" "
+                  "disk reads", msg->id, conn->sd, conn->nread);
+        TAILQ_INSERT_TAIL(&conn->dmsg_q, msg, c_tqe);
+        return;
+    }
+
     req_process(ctx, conn, msg);
 }
@@ -16,9 +16,13 @@
  */
 
 #include <stdio.h>
+#include <arpa/inet.h>
+#include <endian.h>
 
 #include <fc_core.h>
 
+#define RSP_REF_MIN_SIZE    1024    /* min value size sent by reference */
+
 extern struct string msg_strings[];
 
 struct msg *
@@ -126,15 +130,372 @@ void rsp_send_string(struct context *ctx, struct conn *conn, struct msg *msg,
     ASSERT(!msg->done);
     ASSERT(!pmsg->request);
 
-    status = mbuf_copy_from(&pmsg->mhdr, str->data, str->len);
+    if (msg->binary) {
+        status = memcache_bin_rsp_stats(msg, pmsg, str);
+    } else {
+        status = mbuf_copy_from(&pmsg->mhdr, str->data, str->len);
+        if (status == FC_OK) {
+            pmsg->mlen += str->len;
+        }
+    }
+    if (status != FC_OK) {
+        req_process_error(ctx, conn, msg, errno);
+        return;
+    }
+
+    /* mark response as done */
+    msg->done = 1;
+    req_latency(msg);
+    msg->peer = pmsg;
+    pmsg->peer = msg;
+
+    status = event_add_out(ctx->ep, conn);
+    if (status != FC_OK) {
+        req_process_error(ctx, conn, msg, errno);
+        return;
+    }
+}
+
+/*
+ * Copy the data of item it to response pmsg. A large value in a memory
+ * slab is sent by reference to the slab memory instead of being copied.
+ * The slab stays pinned until the response is put after it was sent.
+ */
+static rstatus_t
+rsp_value_data(struct msg *pmsg, struct item *it)
+{
+    rstatus_t status;       /* return status */
+    struct slabinfo *sinfo; /* pinned memory slab */
+    struct mbuf *mbuf;      /* data reference mbuf */
+
+    sinfo = it->ndata >= RSP_REF_MIN_SIZE ? slab_pin_item(it) : NULL;
+    if (sinfo != NULL) {
+        mbuf = mbuf_get_ref(item_data(it), it->ndata, slab_unpin, sinfo);
+        if (mbuf == NULL) {
+            slab_unpin(sinfo);
+            return FC_ENOMEM;
+        }
+        mbuf_insert(&pmsg->mhdr, mbuf);
+    } else {
+        status = mbuf_copy_from(&pmsg->mhdr, item_data(it), it->ndata);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+    pmsg->mlen += it->ndata;
+
+    return FC_OK;
+}
+
+/*
+ * Send the binary protocol response with status rsp_type, or errno err for
+ * a server error, to request msg. A failure carries its message as value.
+ * A quiet request that succeeded or missed gets an empty response, which
+ * only holds its place in the outstanding q.
+ */
+static void
+rsp_send_bin_status(struct context *ctx, struct conn *conn, struct msg *msg,
+                    msg_type_t rsp_type, int err)
+{
+    rstatus_t status;   /* return status */
+    struct msg *pmsg;   /* peer response */
+    struct string *str; /* response value */
+    struct string ver;  /* version string */
+    struct itemx *itx;  /* stored item index */
+    uint16_t bstatus;   /* binary response status */
+    uint64_t cas;       /* stored item cas */
+
+    pmsg = rsp_get(conn);
+    if (pmsg == NULL) {
+        req_process_error(ctx, conn, msg, ENOMEM);
+        return;
+    }
+
+    ASSERT(msg->request && msg->binary);
+    ASSERT(msg->peer == NULL);
+    ASSERT(!msg->done);
+    ASSERT(!pmsg->request);
+
+    bstatus = memcache_bin_status(msg, rsp_type, err);
+    if (msg->quiet && (bstatus == MEMCACHE_BIN_OK ||
+                       (msg->type == MSG_REQ_GET &&
+                        bstatus == MEMCACHE_BIN_KEY_ENOENT))) {
+        goto done;
+    }
+
+    cas = 0;
+    str = NULL;
+    if (bstatus != MEMCACHE_BIN_OK) {
+        str = memcache_bin_strstatus(bstatus);
+    } else if (rsp_type == MSG_RSP_STORED) {
+        itx = itemx_getx(msg->hash, msg->md);
+        cas = itx != NULL ? itx->cas : 0;
+    } else if (msg->opcode == MEMCACHE_BIN_VERSION) {
+        string_set_raw(&ver, FC_VERSION_STRING);
+        str = &ver;
+    }
+
+    status = memcache_bin_rsp(msg, pmsg, bstatus, cas, NULL, 0, NULL, 0,
+                              str != NULL ? str->len : 0);
+    if (status == FC_OK && str != NULL) {
+        status = mbuf_copy_from(&pmsg->mhdr, str->data, str->len);
+        pmsg->mlen += str->len;
+    }
+    if (status != FC_OK) {
+        err = errno;
+        rsp_put(pmsg);
+        req_process_error(ctx, conn, msg, err);
+        return;
+    }
+
+done:
+    /* mark response as done */
+    msg->done = 1;
+    req_latency(msg);
+    msg->peer = pmsg;
+    pmsg->peer = msg;
+
+    status = event_add_out(ctx->ep, conn);
     if (status != FC_OK) {
         req_process_error(ctx, conn, msg, errno);
         return;
     }
+}
+
+/*
+ * Copy the number flag <c><num> of a meta response to pmsg, preceded by a
+ * single space.
+ */
+static rstatus_t
+rsp_meta_num(struct msg *pmsg, char c, int64_t num)
+{
+    rstatus_t status;                   /* return status */
+    uint8_t buf[FC_UINTMAX_MAXLEN + 3]; /* space, flag and number string */
+    size_t n;                           /* returned bytes */
+
+    n = fc_scnprintf(buf, sizeof(buf), " %c%"PRId64"", c, num);
+    status = mbuf_copy_from(&pmsg->mhdr, buf, n);
+    if (status != FC_OK) {
+        return status;
+    }
+    pmsg->mlen += n;
+
+    return FC_OK;
+}
+
+/*
+ * Copy the string flag <c><str> of a meta response to pmsg, preceded by a
+ * single space.
+ */
+static rstatus_t
+rsp_meta_str(struct msg *pmsg, char c, uint8_t *str, size_t len)
+{
+    rstatus_t status; /* return status */
+    uint8_t buf[2];   /* space and flag */
+
+    buf[0] = ' ';
+    buf[1] = (uint8_t)c;
+    status = mbuf_copy_from(&pmsg->mhdr, buf, sizeof(buf));
+    if (status != FC_OK) {
+        return status;
+    }
+    pmsg->mlen += sizeof(buf);
+
+    status = mbuf_copy_from(&pmsg->mhdr, str, len);
+    if (status != FC_OK) {
+        return status;
+    }
+    pmsg->mlen += len;
+
+    return FC_OK;
+}
+
+/*
+ * Copy the "<code> [<size>] <flags>*\r\n" header of the response to meta
+ * request msg to pmsg. Only a VA header carries the size of item it. The
+ * return flags of the item, ttl and cas are copied for a hit, and the key
+ * and opaque are echoed for every response that asks for them.
+ */
+static rstatus_t
+rsp_meta_header(struct msg *msg, struct msg *pmsg, msg_type_t code,
+                struct item *it, bool hit, int64_t ttl, uint64_t cas)
+{
+    rstatus_t status;                   /* return status */
+    struct string *str;                 /* response string */
+    uint8_t num[FC_UINTMAX_MAXLEN + 1]; /* number string */
+    size_t n;                           /* returned bytes */
+    uint32_t mflags;                    /* requested return flags */
+
+    ASSERT(msg->meta);
+    ASSERT(code != MSG_RSP_VA || it != NULL);
+
+    str = &msg_strings[code];
+    status = mbuf_copy_from(&pmsg->mhdr, str->data, str->len);
+    if (status != FC_OK) {
+        return status;
+    }
     pmsg->mlen += str->len;
 
+    if (code == MSG_RSP_VA) {
+        n = fc_scnprintf(num, sizeof(num), "%"PRIu32"", it->ndata);
+        status = mbuf_copy_from(&pmsg->mhdr, num, n);
+        if (status != FC_OK) {
+            return status;
+        }
+        pmsg->mlen += n;
+    }
+
+    mflags = hit ? msg->mflags : msg->mflags & (MSG_META_KEY | MSG_META_OPAQUE);
+
+    if (it != NULL && (mflags & MSG_META_FLAGS)) {
+        status = rsp_meta_num(pmsg, 'f', it->flags);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    if (it != NULL && (mflags & MSG_META_SIZE)) {
+        status = rsp_meta_num(pmsg, 's', it->ndata);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    if (mflags & MSG_META_TTL) {
+        status = rsp_meta_num(pmsg, 't', ttl);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    if (mflags & MSG_META_CAS) {
+        status = rsp_meta_num(pmsg, 'c', (int64_t)cas);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    if (mflags & MSG_META_KEY) {
+        status = rsp_meta_str(pmsg, 'k', msg->key_start,
+                              (size_t)(msg->key_end - msg->key_start));
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    if (mflags & MSG_META_OPAQUE) {
+        status = rsp_meta_str(pmsg, 'O', msg->opaque_start,
+                              (size_t)(msg->opaque_end - msg->opaque_start));
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    str = &msg_strings[MSG_CRLF];
+    status = mbuf_copy_from(&pmsg->mhdr, str->data, str->len);
+    if (status != FC_OK) {
+        return status;
+    }
+    pmsg->mlen += str->len;
+
+    return FC_OK;
+}
+
+/*
+ * Return true if the response code to meta request msg is suppressed by
+ * its quiet flag. Quiet mode only reports failures, so that a pipeline of
+ * quiet requests ends with a "mn" to learn that all of them were done.
+ */
+static bool
+rsp_meta_quiet(struct msg *msg, msg_type_t code)
+{
+    if (!msg->quiet) {
+        return false;
+    }
+
+    switch (code) {
+    case MSG_RSP_HD:
+        return true;
+
+    case MSG_RSP_EN:
+        return msg->type == MSG_REQ_GET;
+
+    case MSG_RSP_NF:
+        return msg->type == MSG_REQ_DELETE;
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Return the remaining ttl in secs of an item with relative expiry, or -1
+ * for an item that never expires.
+ */
+static int64_t
+rsp_meta_ttl(rel_time_t expiry)
+{
+    if (expiry == 0) {
+        return -1;
+    }
+
+    return expiry > time_now() ? (int64_t)(expiry - time_now()) : 0;
+}
+
+/*
+ * Send the meta response with code to meta request msg, for item it of a
+ * hit with the given ttl and cas, or without an item for a status.
+ */
+static void
+rsp_send_meta(struct context *ctx, struct conn *conn, struct msg *msg,
+              msg_type_t code, struct item *it, bool hit, int64_t ttl,
+              uint64_t cas)
+{
+    rstatus_t status;   /* return status */
+    struct msg *pmsg;   /* peer response */
+    struct string *str; /* response string */
+    err_t err;          /* errno on failure */
+
+    pmsg = rsp_get(conn);
+    if (pmsg == NULL) {
+        req_process_error(ctx, conn, msg, ENOMEM);
+        return;
+    }
+
+    ASSERT(msg->request && msg->meta);
+    ASSERT(msg->peer == NULL);
+    ASSERT(!msg->done);
+    ASSERT(!pmsg->request);
+
+    if (rsp_meta_quiet(msg, code)) {
+        goto done;
+    }
+
+    status = rsp_meta_header(msg, pmsg, code, it, hit, ttl, cas);
+    if (status != FC_OK) {
+        goto error;
+    }
+
+    if (code == MSG_RSP_VA) {
+        status = rsp_value_data(pmsg, it);
+        if (status != FC_OK) {
+            goto error;
+        }
+
+        str = &msg_strings[MSG_CRLF];
+        status = mbuf_copy_from(&pmsg->mhdr, str->data, str->len);
+        if (status != FC_OK) {
+            goto error;
+        }
+        pmsg->mlen += str->len;
+    }
+
+done:
     /* mark response as done */
     msg->done = 1;
+    req_latency(msg);
     msg->peer = pmsg;
     pmsg->peer = msg;
 
@@ -143,6 +504,68 @@ void rsp_send_string(struct context *ctx, struct conn *conn, struct msg *msg,
         req_process_error(ctx, conn, msg, errno);
         return;
     }
+    return;
+
+error:
+    err = errno;
+    rsp_put(pmsg);
+    req_process_error(ctx, conn, msg, err);
+}
+
+/*
+ * Send the meta response for status rsp_type of a classic command to meta
+ * request msg.
+ */
+static void
+rsp_send_meta_status(struct context *ctx, struct conn *conn, struct msg *msg,
+                     msg_type_t rsp_type)
+{
+    struct itemx *itx; /* stored item index */
+    msg_type_t code;   /* meta response code */
+
+    switch (rsp_type) {
+    case MSG_RSP_END:
+    case MSG_RSP_NOT_FOUND:
+        code = msg->type == MSG_REQ_GET ? MSG_RSP_EN : MSG_RSP_NF;
+        break;
+
+    case MSG_RSP_STORED:
+        itx = itemx_getx(msg->hash, msg->md);
+        rsp_send_meta(ctx, conn, msg, MSG_RSP_HD, NULL, true, -1,
+                      itx != NULL ? itx->cas : 0);
+        return;
+
+    case MSG_RSP_DELETED:
+        code = MSG_RSP_HD;
+        break;
+
+    case MSG_RSP_NOT_STORED:
+        code = MSG_RSP_NS;
+        break;
+
+    case MSG_RSP_EXISTS:
+        code = MSG_RSP_EX;
+        break;
+
+    case MSG_RSP_VERSION:
+        code = MSG_RSP_MN;
+        break;
+
+    default:
+        NOT_REACHED();
+        code = rsp_type;
+        break;
+    }
+
+    rsp_send_meta(ctx, conn, msg, code, NULL, false, -1, 0);
+}
+
+void
+rsp_send_meta_hit(struct context *ctx, struct conn *conn, struct msg *msg,
+                  struct itemx *itx)
+{
+    rsp_send_meta(ctx, conn, msg, MSG_RSP_HD, NULL, true,
+                  rsp_meta_ttl(itx->expiry), itx->cas);
 }
 
 void
@@ -162,6 +585,16 @@ rsp_send_status(struct context *ctx, struct conn *conn, struct msg *msg,
         return;
     }
 
+    if (msg->binary) {
+        rsp_send_bin_status(ctx, conn, msg, rsp_type, 0);
+        return;
+    }
+
+    if (msg->meta) {
+        rsp_send_meta_status(ctx, conn, msg, rsp_type);
+        return;
+    }
+
     pmsg = rsp_get(conn);
     if (pmsg == NULL) {
         req_process_error(ctx, conn, msg, ENOMEM);
@@ -184,6 +617,7 @@ rsp_send_status(struct context *ctx, struct conn *conn, struct msg *msg,
 
     /* mark response as done */
     msg->done = 1;
+    req_latency(msg);
     msg->peer = pmsg;
     pmsg->peer = msg;
 
@@ -206,6 +640,11 @@ rsp_send_error(struct context *ctx, struct conn *conn, struct msg *msg,
     ASSERT(rsp_type == MSG_RSP_CLIENT_ERROR ||
            rsp_type == MSG_RSP_SERVER_ERROR);
 
+    if (msg->binary) {
+        rsp_send_bin_status(ctx, conn, msg, rsp_type, err);
+        return;
+    }
+
     pmsg = rsp_get(conn);
     if (pmsg == NULL) {
         req_process_error(ctx, conn, msg, ENOMEM);
@@ -248,6 +687,7 @@ rsp_send_error(struct context *ctx, struct conn *conn, struct msg *msg,
 
     /* mark response as done */
     msg->done = 1;
+    req_latency(msg);
     msg->peer = pmsg;
     pmsg->peer = msg;
 
@@ -258,41 +698,31 @@ rsp_send_error(struct context *ctx, struct conn *conn, struct msg *msg,
     }
 }
 
-void
-rsp_send_value(struct context *ctx, struct conn *conn, struct msg *msg,
-               struct item *it, uint64_t cas)
+/*
+ * Copy the "VALUE <key> <flags> <bytes> [<cas>]\r\n" header of the value
+ * of item it to response pmsg of ASCII request msg.
+ */
+static rstatus_t
+rsp_value_header(struct msg *msg, struct msg *pmsg, struct item *it,
+                 uint64_t cas)
 {
     rstatus_t status;                   /* return status */
-    struct msg *pmsg;                   /* peer response */
     struct string *str;                 /* response string */
     uint8_t num[FC_UINTMAX_MAXLEN + 1]; /* number string and single space */
     size_t n;                           /* returned bytes */
 
-    pmsg = rsp_get(conn);
-    if (pmsg == NULL) {
-        req_process_error(ctx, conn, msg, ENOMEM);
-        return;
-    }
-
-    ASSERT(msg->request);
-    ASSERT(msg->peer == NULL);
-    ASSERT(!msg->done);
-    ASSERT(!pmsg->request);
-
     /* copy string "VALUE " to pmsg mbuf */
     str = &msg_strings[MSG_RSP_VALUE];
     status = mbuf_copy_from(&pmsg->mhdr, str->data, str->len);
     if (status != FC_OK) {
-        req_process_error(ctx, conn, msg, errno);
-        return;
+        return status;
     }
     pmsg->mlen += str->len;
 
     /* copy key to pmsg mbuf */
     status = mbuf_copy_from(&pmsg->mhdr, item_key(it), it->nkey);
     if (status != FC_OK) {
-        req_process_error(ctx, conn, msg, errno);
-        return;
+        return status;
     }
     pmsg->mlen += it->nkey;
 
@@ -300,8 +730,7 @@ rsp_send_value(struct context *ctx, struct conn *conn, struct msg *msg,
     n = fc_scnprintf(num, sizeof(num), " %"PRIu32"", it->flags);
     status = mbuf_copy_from(&pmsg->mhdr, num, n);
     if (status != FC_OK) {
-        req_process_error(ctx, conn, msg, errno);
-        return;
+        return status;
     }
     pmsg->mlen += n;
 
@@ -309,8 +738,7 @@ rsp_send_value(struct context *ctx, struct conn *conn, struct msg *msg,
     n = fc_scnprintf(num, sizeof(num), " %"PRIu32"", it->ndata);
     status = mbuf_copy_from(&pmsg->mhdr, num, n);
     if (status != FC_OK) {
-        req_process_error(ctx, conn, msg, errno);
-        return;
+        return status;
     }
     pmsg->mlen += n;
 
@@ -319,8 +747,7 @@ rsp_send_value(struct context *ctx, struct conn *conn, struct msg *msg,
         n = fc_scnprintf(num, sizeof(num), " %"PRIu64"", cas);
         status = mbuf_copy_from(&pmsg->mhdr, num, n);
         if (status != FC_OK) {
-            req_process_error(ctx, conn, msg, errno);
-            return;
+            return status;
         }
         pmsg->mlen += n;
     }
@@ -329,25 +756,88 @@ rsp_send_value(struct context *ctx, struct conn *conn, struct msg *msg,
     str = &msg_strings[MSG_CRLF];
     status = mbuf_copy_from(&pmsg->mhdr, str->data, str->len);
     if (status != FC_OK) {
-        req_process_error(ctx, conn, msg, errno);
-        return;
+        return status;
     }
     pmsg->mlen += str->len;
 
-    /* copy data to pmsg mbuf */
-    status = mbuf_copy_from(&pmsg->mhdr, item_data(it), it->ndata);
-    if (status != FC_OK) {
-        req_process_error(ctx, conn, msg, errno);
+    return FC_OK;
+}
+
+/*
+ * Copy the header, flags and key of the value of item it to response pmsg
+ * of binary request msg. Only getk and getkq respond with the key.
+ */
+static rstatus_t
+rsp_bin_value_header(struct msg *msg, struct msg *pmsg, struct item *it,
+                     uint64_t cas)
+{
+    uint8_t extras[4]; /* flags */
+    uint32_t flags;    /* flags in network byte order */
+    uint16_t nkey;     /* key length */
+
+    flags = htonl(it->flags);
+    fc_memcpy(extras, &flags, sizeof(flags));
+
+    if (msg->opcode == MEMCACHE_BIN_GETK || msg->opcode == MEMCACHE_BIN_GETKQ) {
+        nkey = it->nkey;
+    } else {
+        nkey = 0;
+    }
+
+    return memcache_bin_rsp(msg, pmsg, MEMCACHE_BIN_OK, cas, extras,
+                            sizeof(extras), item_key(it), nkey, it->ndata);
+}
+
+void
+rsp_send_value(struct context *ctx, struct conn *conn, struct msg *msg,
+               struct item *it, uint64_t cas)
+{
+    rstatus_t status;                   /* return status */
+    struct msg *pmsg;                   /* peer response */
+    struct string *str;                 /* response string */
+    err_t err;                          /* errno on failure */
+
+    if (msg->meta) {
+        rsp_send_meta(ctx, conn, msg,
+                      (msg->mflags & MSG_META_VALUE) ? MSG_RSP_VA : MSG_RSP_HD,
+                      it, true, rsp_meta_ttl(time_reltime(it->expiry)), cas);
+        return;
+    }
+
+    pmsg = rsp_get(conn);
+    if (pmsg == NULL) {
+        req_process_error(ctx, conn, msg, ENOMEM);
         return;
     }
-    pmsg->mlen += it->ndata;
+
+    ASSERT(msg->request);
+    ASSERT(msg->peer == NULL);
+    ASSERT(!msg->done);
+    ASSERT(!pmsg->request);
+
+    if (msg->binary) {
+        status = rsp_bin_value_header(msg, pmsg, it, cas);
+    } else {
+        status = rsp_value_header(msg, pmsg, it, cas);
+    }
+    if (status != FC_OK) {
+        goto error;
+    }
+
+    status = rsp_value_data(pmsg, it);
+    if (status != FC_OK) {
+        goto error;
+    }
+
+    if (msg->binary) {
+        goto done;
+    }
 
     /* copy end of dataa crlf to pmsg mbuf */
     str = &msg_strings[MSG_CRLF];
     status = mbuf_copy_from(&pmsg->mhdr, str->data, str->len);
     if (status != FC_OK) {
-        req_process_error(ctx, conn, msg, errno);
-        return;
+        goto error;
     }
     pmsg->mlen += str->len;
 
@@ -359,14 +849,15 @@ rsp_send_value(struct context *ctx, struct conn *conn, struct msg *msg,
         str = &msg_strings[MSG_RSP_END];
         status = mbuf_copy_from(&pmsg->mhdr, str->data, str->len);
         if (status != FC_OK) {
-            req_process_error(ctx, conn, msg, errno);
-            return;
+            goto error;
         }
         pmsg->mlen += str->len;
     }
 
+done:
     /* mark response as done */
     msg->done = 1;
+    req_latency(msg);
     msg->peer = pmsg;
     pmsg->peer = msg;
 
@@ -375,6 +866,52 @@ rsp_send_value(struct context *ctx, struct conn *conn, struct msg *msg,
         req_process_error(ctx, conn, msg, errno);
         return;
     }
+    return;
+
+error:
+    err = errno;
+    rsp_put(pmsg);
+    req_process_error(ctx, conn, msg, err);
+}
+
+/*
+ * Copy the new value of the item it of an incr or decr to response pmsg of
+ * binary request msg, as a 64-bit number in network byte order. Nothing
+ * is copied for a quiet request.
+ */
+static rstatus_t
+rsp_bin_num(struct msg *msg, struct msg *pmsg, struct item *it)
+{
+    rstatus_t status; /* return status */
+    struct itemx *itx; /* item index */
+    uint64_t num;     /* number */
+    uint8_t value[8]; /* number in network byte order */
+
+    if (msg->quiet) {
+        return FC_OK;
+    }
+
+    status = fc_atou64(item_data(it), it->ndata, &num);
+    ASSERT(status == FC_OK);
+    num = htobe64(num);
+    fc_memcpy(value, &num, sizeof(num));
+
+    itx = itemx_getx(msg->hash, msg->md);
+
+    status = memcache_bin_rsp(msg, pmsg, MEMCACHE_BIN_OK,
+                              itx != NULL ? itx->cas : 0, NULL, 0, NULL, 0,
+                              sizeof(value));
+    if (status != FC_OK) {
+        return status;
+    }
+
+    status = mbuf_copy_from(&pmsg->mhdr, value, sizeof(value));
+    if (status != FC_OK) {
+        return status;
+    }
+    pmsg->mlen += sizeof(value);
+
+    return FC_OK;
 }
 
 void
@@ -384,6 +921,17 @@ rsp_send_num(struct context *ctx, struct conn *conn, struct msg *msg,
     rstatus_t status;   /* return status */
     struct msg *pmsg;   /* peer response */
     struct string *str; /* response string */
+    err_t err;          /* errno on failure */
+    struct itemx *itx;  /* item index */
+
+    if (msg->meta) {
+        itx = itemx_getx(msg->hash, msg->md);
+        rsp_send_meta(ctx, conn, msg,
+                      (msg->mflags & MSG_META_VALUE) ? MSG_RSP_VA : MSG_RSP_HD,
+                      it, true, rsp_meta_ttl(time_reltime(it->expiry)),
+                      itx != NULL ? itx->cas : 0);
+        return;
+    }
 
     pmsg = rsp_get(conn);
     if (pmsg == NULL) {
@@ -396,6 +944,17 @@ rsp_send_num(struct context *ctx, struct conn *conn, struct msg *msg,
     ASSERT(!msg->done);
     ASSERT(!pmsg->request);
 
+    if (msg->binary) {
+        status = rsp_bin_num(msg, pmsg, it);
+        if (status != FC_OK) {
+            err = errno;
+            rsp_put(pmsg);
+            req_process_error(ctx, conn, msg, err);
+            return;
+        }
+        goto done;
+    }
+
     /* copy number string to pmsg mbuf */
     status = mbuf_copy_from(&pmsg->mhdr, item_data(it), it->ndata);
     if (status != FC_OK) {
@@ -412,8 +971,10 @@ rsp_send_num(struct context *ctx, struct conn *conn, struct msg *msg,
     }
     pmsg->mlen += str->len;
 
+done:
     /* mark response as done */
     msg->done = 1;
+    req_latency(msg);
     msg->peer = pmsg;
     pmsg->peer = msg;
 
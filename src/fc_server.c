@@ -17,11 +17,15 @@
 
 #include <fc_core.h>
 #include <fc_server.h>
+#include <fc_stats.h>
 
 extern struct settings settings;
 
 #define SERVER_BACKLOG 1024
 
+static int unix_sd = -1;                /* unix socket shared by all workers */
+static __thread uint8_t *dgram_buf;     /* udp request datagram */
+
 static rstatus_t
 server_accept(struct context *ctx, struct conn *s)
 {
@@ -71,16 +75,29 @@ server_accept(struct context *ctx, struct conn *s)
         return FC_ERROR;
     }
 
-    status = fc_set_tcpnodelay(c->sd);
-    if (status < 0) {
-        log_warn("set tcp nodely on c %d failed, ignored: %s", sd,
-                 strerror(errno));
+    c->listener = s->listener;
+    stats_listener(s->listener, STATS_LISTENER_CONN, 1);
+
+    if (s->listener == SERVER_TCP) {
+        status = fc_set_tcpnodelay(c->sd);
+        if (status < 0) {
+            log_warn("set tcp nodely on c %d failed, ignored: %s", sd,
+                     strerror(errno));
+        }
+
+        status = fc_set_keepalive(c->sd);
+        if (status < 0) {
+            log_warn("set tcp keepalive on c %d failed, ignored: %s", sd,
+                     strerror(errno));
+        }
     }
 
-    status = fc_set_keepalive(c->sd);
-    if (status < 0) {
-        log_warn("set tcp keepalive on c %d failed, ignored: %s", sd,
-                 strerror(errno));
+    if (settings.busy_poll != 0) {
+        status = fc_set_busy_poll(c->sd, (int)settings.busy_poll);
+        if (status < 0) {
+            log_warn("set busy poll on c %d failed, ignored: %s", sd,
+                     strerror(errno));
+        }
     }
 
     status = event_add_conn(ctx->ep, c);
@@ -114,66 +131,175 @@ server_recv(struct context *ctx, struct conn *conn)
     return FC_OK;
 }
 
-rstatus_t
-server_listen(struct context *ctx)
+/*
+ * Answer a memcache udp request of n bytes in dgram_buf from peer addr.
+ * A request starts with an 8 byte frame header of a request id, the
+ * sequence # of the datagram, the # datagrams and a reserved field, and
+ * has to fit in a single datagram. The requests in it are received on
+ * a connection of their own, which lives until they are answered.
+ */
+static void
+server_dgram(struct context *ctx, struct conn *s, size_t n,
+             struct sockaddr_storage *addr, socklen_t addrlen)
 {
     rstatus_t status;
-    struct sockinfo si;
-    struct string addrstr;
-    int sd, family;
+    struct conn *c;
+    uint16_t id, seq, total;
+
+    if (n < SERVER_DGRAM_HDR) {
+        log_debug(LOG_INFO, "drop udp req of %zu bytes on s %d", n, s->sd);
+        stats_listener(SERVER_UDP, STATS_LISTENER_DROP, 1);
+        return;
+    }
+
+    id = (uint16_t)(dgram_buf[0] << 8 | dgram_buf[1]);
+    seq = (uint16_t)(dgram_buf[2] << 8 | dgram_buf[3]);
+    total = (uint16_t)(dgram_buf[4] << 8 | dgram_buf[5]);
+    if (seq != 0 || total != 1) {
+        log_debug(LOG_INFO, "drop udp req %"PRIu16" datagram %"PRIu16" of "
+                  "%"PRIu16" on s %d", id, seq, total, s->sd);
+        stats_listener(SERVER_UDP, STATS_LISTENER_DROP, 1);
+        return;
+    }
+
+    c = conn_get(s->sd, true);
+    if (c == NULL) {
+        log_error("get conn for udp req %"PRIu16" on s %d failed: %s", id,
+                  s->sd, strerror(errno));
+        stats_listener(SERVER_UDP, STATS_LISTENER_DROP, 1);
+        return;
+    }
+    c->send = msg_send_dgram;
+    c->dgram = 1;
+    c->listener = SERVER_UDP;
+    c->recv_active = 1;
+    c->send_active = 1;
+    c->send_ready = 1;
+    fc_memcpy(&c->peer, addr, addrlen);
+    c->peerlen = addrlen;
+    c->dgram_id = id;
+
+    status = msg_recv_dgram(ctx, c, dgram_buf + SERVER_DGRAM_HDR,
+                            n - SERVER_DGRAM_HDR);
+    if (status != FC_OK || c->done || c->err) {
+        event_del_conn(ctx->ep, c);
+        c->close(ctx, c);
+    }
+}
+
+static rstatus_t
+server_recv_dgram(struct context *ctx, struct conn *s)
+{
+    struct sockaddr_storage addr;
     socklen_t addrlen;
-    struct sockaddr *addr;
-    struct conn *s;
+    ssize_t n;
 
-    string_set_raw(&addrstr, settings.addr);
-    status = fc_resolve(&addrstr, settings.port, &si);
-    if (status != FC_OK) {
-        return FC_ERROR;
+    ASSERT(!s->client);
+    ASSERT(s->recv_active);
+
+    for (;;) {
+        addrlen = sizeof(addr);
+        n = recvfrom(s->sd, dgram_buf, SERVER_DGRAM_SIZE, 0,
+                     (struct sockaddr *)&addr, &addrlen);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_warn("recvfrom on s %d failed, ignored: %s", s->sd,
+                         strerror(errno));
+            }
+
+            return FC_OK;
+        }
+
+        stats_listener(SERVER_UDP, STATS_LISTENER_RECV, (uint64_t)n);
+
+        server_dgram(ctx, s, (size_t)n, &addr, addrlen);
     }
 
-    family = si.family;
-    addrlen = si.addrlen;
-    addr = (struct sockaddr *)&si.addr;
+    NOT_REACHED();
 
-    sd = socket(family, SOCK_STREAM, 0);
+    return FC_OK;
+}
+
+/*
+ * Return a socket of type bound to address si, listening on it if it is
+ * a stream socket, or -1 on failure.
+ */
+static int
+server_socket(struct sockinfo *si, int type)
+{
+    rstatus_t status;
+    int sd;
+
+    sd = socket(si->family, type, 0);
     if (sd < 0) {
         log_error("socket failed: %s", strerror(errno));
-        return FC_ERROR;
+        return -1;
     }
 
     status = fc_set_reuseaddr(sd);
     if (status != FC_OK) {
         log_error("reuse of sd %d failed: %s", sd, strerror(errno));
-        return FC_ERROR;
+        return -1;
+    }
+
+    /*
+     * Every worker listens on a socket of its own bound to the same
+     * address, and the kernel spreads incoming connections and datagrams
+     * across them.
+     */
+    if (settings.threads > 1 && si->family != AF_UNIX) {
+        status = fc_set_reuseport(sd);
+        if (status != FC_OK) {
+            log_error("reuse port of sd %d failed: %s", sd, strerror(errno));
+            return -1;
+        }
     }
 
-    status = bind(sd, addr, addrlen);
+    status = bind(sd, (struct sockaddr *)&si->addr, si->addrlen);
     if (status < 0) {
         log_error("bind on sd %d failed: %s", sd, strerror(errno));
-        return FC_ERROR;
+        return -1;
     }
 
-    status = listen(sd, SERVER_BACKLOG);
-    if (status < 0) {
-        log_error("listen on sd %d failed: %s", sd, strerror(errno));
-        return FC_ERROR;
+    if (type == SOCK_STREAM) {
+        status = listen(sd, SERVER_BACKLOG);
+        if (status < 0) {
+            log_error("listen on sd %d failed: %s", sd, strerror(errno));
+            return -1;
+        }
     }
 
     status = fc_set_nonblocking(sd);
     if (status != FC_OK) {
         log_error("set nonblock on sd %d failed: %s", sd, strerror(errno));
-        return FC_ERROR;
+        return -1;
     }
 
+    return sd;
+}
+
+/*
+ * Add listening socket sd of type listener to the event loop of ctx.
+ */
+static rstatus_t
+server_add(struct context *ctx, int sd, uint8_t listener)
+{
+    rstatus_t status;
+    struct conn *s;
+
     s = conn_get(sd, false);
     if (s == NULL) {
         log_error("get conn for s %d failed: %s", sd, strerror(errno));
-        status = close(sd);
-        if (status < 0) {
-            log_error("close s %d failed, ignored: %s", sd, strerror(errno));
-        }
         return FC_ENOMEM;
     }
+    s->listener = listener;
+    if (listener == SERVER_UDP) {
+        s->recv = server_recv_dgram;
+    }
 
     status = event_add_conn(ctx->ep, s);
     if (status < 0) {
@@ -189,7 +315,92 @@ server_listen(struct context *ctx)
         return status;
     }
 
-    log_debug(LOG_NOTICE, "server listening on s %d", s->sd);
+    log_debug(LOG_NOTICE, "server listening on s %d type %"PRIu8"", s->sd,
+              listener);
+
+    return FC_OK;
+}
+
+rstatus_t
+server_listen(struct context *ctx)
+{
+    rstatus_t status;
+    struct sockinfo si;
+    struct string addrstr;
+    int sd;
+
+    string_set_raw(&addrstr, settings.addr);
+    status = fc_resolve(&addrstr, settings.port, &si);
+    if (status != FC_OK) {
+        return FC_ERROR;
+    }
+
+    sd = server_socket(&si, SOCK_STREAM);
+    if (sd < 0) {
+        return FC_ERROR;
+    }
+
+    status = server_add(ctx, sd, SERVER_TCP);
+    if (status != FC_OK) {
+        return status;
+    }
+
+    if (settings.udp_port != 0) {
+        status = fc_resolve(&addrstr, settings.udp_port, &si);
+        if (status != FC_OK) {
+            return FC_ERROR;
+        }
+
+        dgram_buf = fc_alloc(SERVER_DGRAM_SIZE);
+        if (dgram_buf == NULL) {
+            return FC_ENOMEM;
+        }
+
+        sd = server_socket(&si, SOCK_DGRAM);
+        if (sd < 0) {
+            return FC_ERROR;
+        }
+
+        status = server_add(ctx, sd, SERVER_UDP);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    if (settings.unix_path != NULL) {
+        /*
+         * A unix domain socket cannot be bound by more than one socket, so
+         * the first worker to start creates it, and every worker listens
+         * on it. Workers are started one at a time.
+         */
+        if (unix_sd < 0) {
+            string_set_raw(&addrstr, settings.unix_path);
+            status = fc_resolve(&addrstr, 0, &si);
+            if (status != FC_OK) {
+                log_error("unix socket path '%s' is too long",
+                          settings.unix_path);
+                return FC_ERROR;
+            }
+
+            /* remove the socket left behind by an earlier run */
+            status = unlink(settings.unix_path);
+            if (status < 0 && errno != ENOENT) {
+                log_error("unlink of '%s' failed: %s", settings.unix_path,
+                          strerror(errno));
+                return FC_ERROR;
+            }
+
+            unix_sd = server_socket(&si, SOCK_STREAM);
+            if (unix_sd < 0) {
+                return FC_ERROR;
+            }
+        }
+
+        status = server_add(ctx, unix_sd, SERVER_UNIX);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
 
     return FC_OK;
 }
@@ -20,6 +20,15 @@
 
 #include <fc_core.h>
 
+#define SERVER_TCP          0   /* tcp listener */
+#define SERVER_UNIX         1   /* unix domain socket listener */
+#define SERVER_UDP          2   /* udp listener */
+#define SERVER_NLISTENER    3
+
+#define SERVER_DGRAM_HDR    8       /* memcache udp frame header size */
+#define SERVER_DGRAM_MTU    1400    /* max udp response datagram size */
+#define SERVER_DGRAM_SIZE   65536   /* max udp request datagram size */
+
 rstatus_t server_recv(struct context *ctx, struct conn *conn);
 rstatus_t server_listen(struct context *ctx);
 
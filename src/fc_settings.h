@@ -8,6 +8,8 @@ struct settings {
 
     int      port;                         /* listening port */
     char     *addr;                        /* listening address */
+    int      udp_port;                     /* udp listening port, 0 for none */
+    char     *unix_path;                   /* unix socket path, NULL for none */
 
     int      hash_power;                   /* index hash table size as power of 2 */
 
@@ -25,5 +27,27 @@ struct settings {
 
     uint32_t server_id;                    /* server id */
     uint32_t server_n;                     /* # server */
+
+    uint32_t aio_depth;                    /* io_uring queue depth for disk reads */
+    uint32_t flush_watermark;              /* # free memory slabs to keep by flushing */
+    uint8_t  evict;                        /* disk slab eviction policy */
+
+    uint32_t threads;                      /* # worker threads */
+
+    uint8_t  index_engine;                 /* item index engine */
+    bool     use_cas;                      /* use cas? */
+
+    uint8_t  key_hash;                     /* key digest */
+    uint32_t md_size;                      /* key digest size in bytes */
+
+    char     *checkpoint;                  /* path to checkpoint file */
+    uint32_t recover;                      /* # reader threads of crash recovery */
+
+    uint8_t  event_mode;                   /* when responses are sent */
+    uint32_t busy_poll;                    /* busy poll time in usec */
+
+    char     *trace;                       /* path to workload trace file */
+    uint32_t trace_sample;                 /* trace 1 in trace_sample keys */
+    size_t   trace_size;                   /* max workload trace size in bytes */
 };
 #endif //_FC_SETTINGS_H_
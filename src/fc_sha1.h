@@ -53,6 +53,8 @@
 #ifndef _FC_SHA1_H_
 #define _FC_SHA1_H_
 
+#define SHA1_DIGEST_SIZE    20
+
 struct sha1_ctxt {
     union {
         uint8_t  b8[20];
@@ -0,0 +1,108 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fc_core.h>
+
+extern struct settings settings;
+
+/*
+ * Item index and slabs are split into one shard per worker thread. Every
+ * key belongs to exactly one shard, picked from its digest, so the shards
+ * never share an item and each one only needs its own lock. A worker
+ * takes the lock of the key's shard around every index and slab access,
+ * which also makes that shard current for the itemx and slab modules on
+ * the calling thread.
+ *
+ * Connections are not tied to shards: any worker can serve any key, and
+ * with as many shards as workers the locks are rarely contended.
+ */
+
+static uint32_t nshard;             /* # shard */
+static pthread_mutex_t *locks;      /* per shard lock */
+
+rstatus_t
+shard_init(void)
+{
+    uint32_t i;
+
+    nshard = MAX(settings.threads, 1);
+    ASSERT(nshard <= SHARD_MAX_N);
+
+    locks = fc_calloc(nshard, sizeof(*locks));
+    if (locks == NULL) {
+        return FC_ENOMEM;
+    }
+
+    for (i = 0; i < nshard; i++) {
+        pthread_mutex_init(&locks[i], NULL);
+    }
+
+    log_debug(LOG_NOTICE, "%"PRIu32" index and slab shards", nshard);
+
+    return FC_OK;
+}
+
+void
+shard_deinit(void)
+{
+}
+
+uint32_t
+shard_n(void)
+{
+    return nshard;
+}
+
+/*
+ * Return the shard of the key with message digest md. The index bucket
+ * is picked from the leading digest bytes (see sha1_hash), so the shard
+ * is picked from the bytes that follow to keep the two independent.
+ */
+uint32_t
+shard_id(uint8_t *md)
+{
+    uint32_t h;
+
+    if (nshard == 1) {
+        return 0;
+    }
+
+    h = ((uint32_t) (md[7] & 0xff) << 24) |
+        ((uint32_t) (md[6] & 0xff) << 16) |
+        ((uint32_t) (md[5] & 0xff) << 8)  |
+        (md[4] & 0xff);
+
+    return h % nshard;
+}
+
+void
+shard_lock(uint32_t id)
+{
+    ASSERT(id < nshard);
+
+    pthread_mutex_lock(&locks[id]);
+    itemx_select(id);
+    slab_select(id);
+}
+
+void
+shard_unlock(uint32_t id)
+{
+    ASSERT(id < nshard);
+
+    pthread_mutex_unlock(&locks[id]);
+}
@@ -0,0 +1,31 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FC_SHARD_H_
+#define _FC_SHARD_H_
+
+#define SHARD_MAX_N     64
+
+rstatus_t shard_init(void);
+void shard_deinit(void);
+
+uint32_t shard_n(void);
+uint32_t shard_id(uint8_t *md);
+void shard_lock(uint32_t id);
+void shard_unlock(uint32_t id);
+
+#endif
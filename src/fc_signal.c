@@ -22,6 +22,7 @@
 
 static struct signal signals[] = {
     { SIGUSR1, "SIGUSR1", 0,            signal_handler },
+    { SIGTERM, "SIGTERM", 0,            signal_handler },
     { SIGUSR2, "SIGUSR2", 0,            signal_handler },
     { SIGTTIN, "SIGTTIN", 0,            signal_handler },
     { SIGTTOU, "SIGTTOU", 0,            signal_handler },
@@ -32,11 +33,25 @@ static struct signal signals[] = {
     { 0,        NULL,     0,            NULL }
 };
 
+/*
+ * SIGTERM and SIGUSR1 ask for a clean shutdown, which the main thread
+ * carries out once its event loop is interrupted. Both are blocked until
+ * every other thread is started, so that those inherit the mask and the
+ * signals are always delivered to the main thread.
+ */
+static sigset_t stop_mask;
+static volatile sig_atomic_t stop;
+
 rstatus_t
 signal_init(void)
 {
     struct signal *sig;
 
+    sigemptyset(&stop_mask);
+    sigaddset(&stop_mask, SIGTERM);
+    sigaddset(&stop_mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &stop_mask, NULL);
+
     for (sig = signals; sig->signo != 0; sig++) {
         rstatus_t status;
         struct sigaction sa;
@@ -62,6 +77,25 @@ signal_deinit(void)
 {
 }
 
+/*
+ * Let the calling thread, which must be the main thread, take the clean
+ * shutdown signals once all other threads are started.
+ */
+void
+signal_unblock_stop(void)
+{
+    pthread_sigmask(SIG_UNBLOCK, &stop_mask, NULL);
+}
+
+/*
+ * Return true if a clean shutdown was asked for.
+ */
+bool
+signal_stop(void)
+{
+    return stop != 0;
+}
+
 void
 signal_handler(int signo)
 {
@@ -83,6 +117,9 @@ signal_handler(int signo)
 
     switch (signo) {
     case SIGUSR1:
+    case SIGTERM:
+        stop = 1;
+        actionstr = ", shutting down";
         break;
 
     case SIGUSR2:
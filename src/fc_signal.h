@@ -27,6 +27,8 @@ struct signal {
 
 rstatus_t signal_init(void);
 void signal_deinit(void);
+void signal_unblock_stop(void);
+bool signal_stop(void);
 void signal_handler(int signo);
 
 #endif
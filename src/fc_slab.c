@@ -16,6 +16,7 @@
  */
 
 #include <fc_core.h>
+#include <fc_stats.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -23,53 +24,84 @@
 
 extern struct settings settings;
 
-static uint32_t nfree_msinfoq; /* # free memory slabinfo q */
-static struct slabhinfo free_msinfoq; /* free memory slabinfo q */
-static uint32_t nfull_msinfoq; /* # full memory slabinfo q */
-static struct slabhinfo full_msinfoq; /* # full memory slabinfo q */
-
-static uint32_t nfree_dsinfoq; /* # free disk slabinfo q */
-static struct slabhinfo free_dsinfoq; /* free disk slabinfo q */
-static uint32_t nfull_dsinfoq; /* # full disk slabinfo q */
-static struct slabhinfo full_dsinfoq; /* full disk slabinfo q */
-lru_head* lruh;
-lru_head* lruh_disk;
-
-static uint8_t nctable; /* # class table entry */
-static struct slabclass* ctable; /* table of slabclass indexed by cid */
-
-static uint32_t nstable; /* # slab table entry */
-static struct slabinfo* stable; /* table of slabinfo indexed by sid */
-
-static uint8_t* mstart; /* memory slab start */
-static uint8_t* mend; /* memory slab end */
-
-static off_t dstart; /* disk start */
-static off_t dend; /* disk end */
-static int fd; /* disk file descriptor */
-
-static size_t mspace; /* memory space */
-static size_t dspace; /* disk space */
-static uint32_t nmslab; /* # memory slabs */
-static uint32_t ndslab; /* # disk slabs */
-
-static uint64_t nevict;
-static uint64_t nflush;
-static uint8_t* evictbuf; /* evict buffer */
-static uint8_t* readbuf; /* read buffer */
+/*
+ * Slabs are split into shards, one per worker thread, each with its own
+ * memory slabs, its own partition of the disk and its own flusher. A
+ * shard only ever holds items of the keys that shard_id() maps to it, and
+ * is only touched with its lock held; slab_select() makes it the current
+ * shard of the calling thread.
+ */
+struct slab_shard {
+    uint32_t             nfree_msinfoq; /* # free memory slabinfo q */
+    struct slabhinfo     free_msinfoq;  /* free memory slabinfo q */
+    uint32_t             nfull_msinfoq; /* # full memory slabinfo q */
+    struct slabhinfo     full_msinfoq;  /* # full memory slabinfo q */
+
+    uint32_t             nfree_dsinfoq; /* # free disk slabinfo q */
+    struct slabhinfo     free_dsinfoq;  /* free disk slabinfo q */
+    uint32_t             nfull_dsinfoq; /* # full disk slabinfo q */
+    struct slabhinfo     full_dsinfoq;  /* full disk slabinfo q */
+    lru_head             *lruh;         /* memory slab lru */
+    lru_head             *lruh_disk;    /* disk slab lru */
+
+    uint8_t              nctable;       /* # class table entry */
+    struct slabclass     *ctable;       /* table of slabclass indexed by cid */
+
+    uint32_t             nstable;       /* # slab table entry */
+    struct slabinfo      *stable;       /* table of slabinfo indexed by sid */
+
+    uint8_t              *mstart;       /* memory slab start */
+    uint8_t              *mend;         /* memory slab end */
+
+    off_t                dstart;        /* disk start */
+    off_t                dend;          /* disk end */
+    int                  fd;            /* disk file descriptor */
+
+    size_t               mspace;        /* memory space */
+    size_t               dspace;        /* disk space */
+    uint32_t             nmslab;        /* # memory slabs */
+    uint32_t             ndslab;        /* # disk slabs */
+
+    uint64_t             nevict;        /* # evicted disk slab */
+    uint64_t             ngc;           /* # compacted disk slab */
+    uint64_t             ngc_item;      /* # item moved by compaction */
+    uint64_t             npin;          /* # item sent from memory slab without copy */
+    uint32_t             nrecv;         /* # item a value is being received into */
+    uint64_t             nflush;        /* # flushed memory slab */
+    uint64_t             flush_seq;     /* sequence number of the last flush */
+    struct slabhinfo     *gcq;          /* full disk slabinfo q by # live item */
+    uint32_t             ngcq;          /* # gc q */
+    uint32_t             gc_min;        /* gc q below are empty */
+    uint64_t             *holes;        /* hole bitmap of each memory slab */
+    uint32_t             nhole_word;    /* # hole bitmap word per memory slab */
+
+    uint8_t              *evictbuf;     /* evict buffer */
+    uint8_t              *readbuf;      /* read buffer */
+
+    struct slab_flusher  *flusher;      /* flusher thread state */
+    struct slab_flushq   free_flushq;   /* free slab flush q */
+    uint32_t             nflushing;     /* # memory slab being flushed */
+};
+
+static uint32_t nshard;                     /* # slab shard */
+static struct slab_shard *shards;           /* slab shards */
+static __thread struct slab_shard *shard;   /* current slab shard */
+static uint64_t gen;                        /* generation of slab content */
+
+static rstatus_t slab_gc(void);
 
 /* for itemx to call, itemx can't access stable */
 struct slabinfo*
 sid_to_sinfo(uint32_t sid)
 {
-    return &stable[sid];
+    return &shard->stable[sid];
 }
 
 /* for itemx to call, itemx can't access ctable */
 size_t
 cid_to_size(uint8_t cid)
 {
-    return (&ctable[cid])->size;
+    return (&shard->ctable[cid])->size;
 }
 
 /*
@@ -105,11 +137,13 @@ void slab_print(void)
         settings.slab_size, SLAB_HDR_SIZE,
         ITEM_HDR_SIZE, settings.chunk_size);
 
-    loga("index memory %zu, slab memory %zu, disk space %zu",
-        0, mspace, dspace);
+    loga("%" PRIu32 " shards, each with index memory %zu, slab memory %zu, "
+         "disk space %zu",
+        nshard, settings.max_index_memory / nshard, shard->mspace,
+        shard->dspace);
 
-    for (cid = SLABCLASS_MIN_ID; cid < nctable; cid++) {
-        c = &ctable[cid];
+    for (cid = SLABCLASS_MIN_ID; cid < shard->nctable; cid++) {
+        c = &shard->ctable[cid];
         loga("class %3" PRId8 ": items %7" PRIu32 "  size %7zu  data %7zu  "
              "slack %7zu",
             cid, c->nitem, c->size, c->size - ITEM_HDR_SIZE,
@@ -132,12 +166,12 @@ slab_cid(size_t size)
 
     /* binary search */
     imin = SLABCLASS_MIN_ID;
-    imax = nctable;
+    imax = shard->nctable;
     while (imax >= imin) {
         cid = (imin + imax) / 2;
-        if (size > ctable[cid].size) {
+        if (size > shard->ctable[cid].size) {
             imin = cid + 1;
-        } else if (cid > SLABCLASS_MIN_ID && size <= ctable[cid - 1].size) {
+        } else if (cid > SLABCLASS_MIN_ID && size <= shard->ctable[cid - 1].size) {
             imax = cid - 1;
         } else {
             break;
@@ -161,8 +195,8 @@ slab_full(struct slabinfo* sinfo)
 {
     struct slabclass* c;
 
-    ASSERT(sinfo->cid >= SLABCLASS_MIN_ID && sinfo->cid < nctable);
-    c = &ctable[sinfo->cid];
+    ASSERT(sinfo->cid >= SLABCLASS_MIN_ID && sinfo->cid < shard->nctable);
+    c = &shard->ctable[sinfo->cid];
 
     return (c->nitem == sinfo->nalloc) ? true : false;
 }
@@ -178,14 +212,14 @@ slab_from_maddr(uint32_t addr, bool verify)
     off_t off;
 
     off = (off_t)addr * settings.slab_size;
-    slab = (struct slab*)(mstart + off);
+    slab = (struct slab*)(shard->mstart + off);
     if (verify) {
-        ASSERT(mstart + off < mend);
+        ASSERT(shard->mstart + off < shard->mend);
         ASSERT(slab->magic == SLAB_MAGIC);
-        ASSERT(slab->sid < nstable);
-        ASSERT(stable[slab->sid].sid == slab->sid);
-        ASSERT(stable[slab->sid].cid == slab->cid);
-        ASSERT(stable[slab->sid].mem == 1);
+        ASSERT(slab->sid < shard->nstable);
+        ASSERT(shard->stable[slab->sid].sid == slab->sid);
+        ASSERT(shard->stable[slab->sid].cid == slab->cid);
+        ASSERT(shard->stable[slab->sid].mem == 1);
     }
 
     return slab;
@@ -202,8 +236,8 @@ slab_to_daddr(struct slabinfo* sinfo)
 
     ASSERT(!sinfo->mem);
 
-    off = dstart + ((off_t)sinfo->addr * settings.slab_size);
-    ASSERT(off < dend);
+    off = shard->dstart + ((off_t)sinfo->addr * settings.slab_size);
+    ASSERT(off < shard->dend);
 
     return off;
 }
@@ -220,7 +254,7 @@ slab_to_item(struct slab* slab, uint32_t idx, size_t size, bool verify)
     struct item* it;
 
     ASSERT(slab->magic == SLAB_MAGIC);
-    ASSERT(idx <= stable[slab->sid].nalloc);
+    ASSERT(idx <= shard->stable[slab->sid].nalloc);
     ASSERT(idx * size < settings.slab_size);
 
     it = (struct item*)((uint8_t*)slab->data + (idx * size));
@@ -234,6 +268,38 @@ slab_to_item(struct slab* slab, uint32_t idx, size_t size, bool verify)
     return it;
 }
 
+/*
+ * Under --evict=gc, the full disk slabs are also kept in gc q, one for
+ * each # live item, so that slab_gc() finds the slab with the fewest
+ * live items without walking them all. A slab moves between q as its
+ * live items are counted in slab_incr_chunks_by_sid().
+ */
+static void
+slab_gc_link(struct slabinfo* sinfo)
+{
+    if (shard->gcq == NULL) {
+        return;
+    }
+
+    ASSERT(!sinfo->mem && !sinfo->gc);
+    ASSERT(sinfo->nlive < shard->ngcq);
+
+    TAILQ_INSERT_TAIL(&shard->gcq[sinfo->nlive], sinfo, gc_tqe);
+    sinfo->gc = 1;
+    shard->gc_min = MIN(shard->gc_min, sinfo->nlive);
+}
+
+static void
+slab_gc_unlink(struct slabinfo* sinfo)
+{
+    if (!sinfo->gc) {
+        return;
+    }
+
+    TAILQ_REMOVE(&shard->gcq[sinfo->nlive], sinfo, gc_tqe);
+    sinfo->gc = 0;
+}
+
 //When there is no free indexs or slabs, evict data out of system
 static rstatus_t
 slab_evict(void)
@@ -246,53 +312,66 @@ slab_evict(void)
     off_t off; /* offset */
     int n; /* read bytes */
     uint32_t idx; /* idx^th item */
+    int64_t start; /* read start time */
 
-    ASSERT(!TAILQ_EMPTY(&full_dsinfoq));
-    ASSERT(nfull_dsinfoq > 0);
+    ASSERT(!TAILQ_EMPTY(&shard->full_dsinfoq));
+    ASSERT(shard->nfull_dsinfoq > 0);
 
     // sinfo = TAILQ_FIRST(&full_dsinfoq); //old version
-    if (lruh_disk->head && USE_LRU) {
-        sinfo = lruh_disk->head;
-        lru_remove_head(lruh_disk);
+    if (shard->lruh_disk->head && USE_LRU) {
+        sinfo = shard->lruh_disk->head;
+        lru_remove_head(shard->lruh_disk);
     }else{
-        sinfo = TAILQ_FIRST(&full_dsinfoq);
+        sinfo = TAILQ_FIRST(&shard->full_dsinfoq);
     }
     
-    nfull_dsinfoq--;
-    TAILQ_REMOVE(&full_dsinfoq, sinfo, tqe);
+    shard->nfull_dsinfoq--;
+    TAILQ_REMOVE(&shard->full_dsinfoq, sinfo, tqe);
+    slab_gc_unlink(sinfo);
     ASSERT(!sinfo->mem);
-    ASSERT(sinfo->addr < ndslab);
+    ASSERT(sinfo->addr < shard->ndslab);
 
     /* read the slab */
-    slab = (struct slab*)evictbuf; //already inited
+    slab = (struct slab*)shard->evictbuf; //already inited
     size = settings.slab_size;
     off = slab_to_daddr(sinfo);
-    n = pread(fd, slab, size, off);
+    start = fc_nsec_now();
+    n = pread(shard->fd, slab, size, off);
     if (n < size) {
-        log_error("pread fd %d %zu bytes at offset %" PRIu64 " failed: %s", fd,
+        log_error("pread fd %d %zu bytes at offset %" PRIu64 " failed: %s", shard->fd,
             size, (uint64_t)off, strerror(errno));
         return FC_ERROR;
     }
+    stats_io_record(sinfo->cid, STATS_IO_EVICT, size, size,
+                    fc_nsec_now() - start);
     ASSERT(slab->magic == SLAB_MAGIC);
     ASSERT(slab->sid == sinfo->sid);
     ASSERT(slab->cid == sinfo->cid);
     ASSERT(slab_full(sinfo));
 
     /* evict all items from the slab */
-    for (c = &ctable[slab->cid], idx = 0; idx < c->nitem; idx++) {
-        struct item* it = slab_to_item(slab, idx, c->size, true);
-        if (itemx_getx(it->hash, it->md) != NULL) {
+    for (c = &shard->ctable[slab->cid], idx = 0; idx < c->nitem; idx++) {
+        struct item* it = slab_to_item(slab, idx, c->size, false);
+        struct itemx* itx;
+        if (it->magic != ITEM_MAGIC) {
+            /* removed while the slab was in memory */
+            continue;
+        }
+        /* the index may already point to a newer version of the item */
+        itx = itemx_getx(it->hash, it->md);
+        if (itx != NULL && itx->sid == sinfo->sid && itx->offset == it->offset) {
             itemx_removex(it->hash, it->md);
         }
     }
+    ASSERT(sinfo->nlive == 0);
 
     log_debug(LOG_DEBUG, "evict slab at disk (sid %" PRIu32 ", addr %" PRIu32 ")",
         sinfo->sid, sinfo->addr);
 
     /* move disk slab from full to free q */
-    nfree_dsinfoq++;
-    TAILQ_INSERT_TAIL(&free_dsinfoq, sinfo, tqe);
-    nevict++;
+    shard->nfree_dsinfoq++;
+    TAILQ_INSERT_TAIL(&shard->free_dsinfoq, sinfo, tqe);
+    shard->nevict++;
     c->nevict++;
     c->ndslab--;
 
@@ -317,98 +396,495 @@ slab_swap_addr(struct slabinfo* msinfo, struct slabinfo* dsinfo)
     dsinfo->mem = 1;
 }
 
-//flush to disk
+/*
+ * Return true if memory slab sinfo is referenced by a response in flight.
+ * Pins are dropped by slab_unpin() without the shard lock held.
+ */
+static bool
+slab_pinned(struct slabinfo* sinfo)
+{
+    return __atomic_load_n(&sinfo->npin, __ATOMIC_ACQUIRE) > 0 ? true : false;
+}
+
+/*
+ * Return the hole bitmap of memory slab sinfo, where a set bit marks a
+ * chunk whose item was removed. Bitmaps live in a per shard arena indexed
+ * by memory slab address, sized for the class with the most chunks.
+ */
+static uint64_t *
+slab_holes(struct slabinfo* sinfo)
+{
+    ASSERT(sinfo->mem);
+    ASSERT(sinfo->addr < shard->nmslab);
+
+    return shard->holes + (size_t)sinfo->addr * shard->nhole_word;
+}
+
+/*
+ * Drop the holes of a slabinfo. Holes are only reused in memory slabs,
+ * so they are dropped once the slab moves to disk, where their chunks
+ * count as allocated again.
+ */
+static void
+slab_free_holes(struct slabinfo* sinfo)
+{
+    if (sinfo->nhole == 0) {
+        return;
+    }
+
+    memset(slab_holes(sinfo), 0, sizeof(*shard->holes) * shard->nhole_word);
+    sinfo->nalloc += sinfo->nhole;
+    sinfo->nhole = 0;
+}
+
+/*
+ * Take the lowest hole of memory slab sinfo and return its chunk index.
+ */
+static uint32_t
+slab_get_hole(struct slabinfo* sinfo)
+{
+    uint64_t* holes;
+    uint32_t i, idx;
+
+    ASSERT(sinfo->nhole > 0);
+
+    holes = slab_holes(sinfo);
+    for (i = 0; holes[i] == 0; i++) {
+        ASSERT(i < shard->nhole_word);
+    }
+    idx = i * 64 + (uint32_t)__builtin_ctzll(holes[i]);
+    holes[i] &= holes[i] - 1;
+    sinfo->nhole--;
+
+    return idx;
+}
+
+/*
+ * Write the 512 byte sector at offset sector of memory slab msinfo over
+ * the same sector of disk slab dsinfo, if any.
+ */
+static void
+slab_write_sector(struct slabinfo* msinfo, struct slabinfo* dsinfo,
+                  off_t sector)
+{
+    uint8_t* buf; /* sector in the memory slab */
+    off_t off; /* offset to write at */
+    ssize_t n; /* written bytes */
+    int64_t start; /* write start time */
+
+    if (dsinfo == NULL) {
+        return;
+    }
+
+    buf = (uint8_t*)slab_from_maddr(msinfo->addr, true) + sector;
+    off = slab_to_daddr(dsinfo) + sector;
+    start = fc_nsec_now();
+    n = pwrite(shard->fd, buf, 512, off);
+    if (n < 512) {
+        log_warn("pwrite fd %d 512 bytes at offset %" PRId64 " failed, "
+                 "removed items may be recovered: %s", shard->fd, off,
+                 n < 0 ? strerror(errno) : "short write");
+        return;
+    }
+    stats_io_record(msinfo->cid, STATS_IO_FLUSH, sizeof(uint32_t), 512,
+                    fc_nsec_now() - start);
+}
+
+/*
+ * Mark the items removed while memory slab msinfo was being drained, now
+ * that the slab is no longer being written out. slab_put_hole() made them
+ * holes but left the items untouched, so they are the holes whose item
+ * still has its magic. If the slab made it to disk slab dsinfo, the
+ * sectors holding their magic are written out again, so that crash
+ * recovery does not take them for live items.
+ */
+static void
+slab_kill_drain_holes(struct slabinfo* msinfo, struct slabinfo* dsinfo)
+{
+    struct slab* slab; /* memory slab */
+    struct item* it; /* removed item */
+    uint64_t* holes; /* hole bitmap */
+    uint64_t word; /* hole bitmap word */
+    uint32_t i, idx, offset;
+    off_t sector, pending; /* sector of the item, and the one to write */
+
+    if (msinfo->nhole == 0) {
+        return;
+    }
+
+    slab = slab_from_maddr(msinfo->addr, true);
+    holes = slab_holes(msinfo);
+    pending = -1;
+
+    for (i = 0; i < shard->nhole_word; i++) {
+        for (word = holes[i]; word != 0; word &= word - 1) {
+            idx = i * 64 + (uint32_t)__builtin_ctzll(word);
+            offset = SLAB_HDR_SIZE + idx * shard->ctable[msinfo->cid].size;
+            it = (struct item*)((uint8_t*)slab + offset);
+            if (it->magic != ITEM_MAGIC) {
+                continue;
+            }
+            it->magic = 0;
+
+            sector = ROUND_DOWN(offset, 512);
+            if (pending >= 0 && pending != sector) {
+                slab_write_sector(msinfo, dsinfo, pending);
+            }
+            pending = sector;
+        }
+    }
+
+    if (pending >= 0) {
+        slab_write_sector(msinfo, dsinfo, pending);
+    }
+}
+
+/*
+ * Pick the next full memory slab to drain and reserve a free disk slab
+ * for it, evicting a disk slab if there are none. Both slabinfos are
+ * taken off their q, so that nothing else picks them while the memory
+ * slab is written out. The memory slab stays readable until the drain
+ * completes in _slab_drain_done().
+ */
 static rstatus_t
-_slab_drain(void)
-{   
+_slab_drain_reserve(struct slabinfo** pmsinfo, struct slabinfo** pdsinfo)
+{
+    rstatus_t status;
     struct slabinfo *msinfo, *dsinfo; /* memory and disk slabinfo */
-    struct slab* slab; /* slab to write */
-    size_t size; /* bytes to write */
-    off_t off; /* offset to write at */
-    int n; /* written bytes */
+    struct slab *slab; /* memory slab */
 
-    ASSERT(!TAILQ_EMPTY(&full_msinfoq));
-    ASSERT(nfull_msinfoq > 0);
+    if (TAILQ_EMPTY(&shard->full_msinfoq)) {
+        return FC_EAGAIN;
+    }
+    ASSERT(shard->nfull_msinfoq > 0);
+
+    if (TAILQ_EMPTY(&shard->free_dsinfoq)) {
+        if (TAILQ_EMPTY(&shard->full_dsinfoq)) {
+            /* every disk slab is reserved by an in-flight flush */
+            return FC_EAGAIN;
+        }
 
-    ASSERT(!TAILQ_EMPTY(&free_dsinfoq));
-    ASSERT(nfree_dsinfoq > 0);
+        if (settings.evict == SLAB_EVICT_GC) {
+            status = slab_gc();
+        } else {
+            status = slab_evict();
+        }
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+    ASSERT(!TAILQ_EMPTY(&shard->free_dsinfoq));
+    ASSERT(shard->nfree_dsinfoq > 0);
 
     /* get memory sinfo from full q */
 
     // flush the first item in full queue (FIFO)
     // slab is kindof big granularity, so just use a simple implements instead of clock algorithm...
     // msinfo = TAILQ_FIRST(&full_msinfoq); // old version FIFO
-    if (lruh->head && USE_LRU) {
-        msinfo = lruh->head;
-        lru_remove_head(lruh);
+    // a pinned slab is skipped, as responses in flight still refer to it
+    if (shard->lruh->head && USE_LRU) {
+        msinfo = shard->lruh->head;
+        while (msinfo != NULL && slab_pinned(msinfo)) {
+            msinfo = msinfo->next;
+        }
+        if (msinfo != NULL) {
+            lru_remove(shard->lruh, msinfo);
+        }
     }else{
-        msinfo = TAILQ_FIRST(&full_msinfoq);
+        TAILQ_FOREACH(msinfo, &shard->full_msinfoq, tqe) {
+            if (!slab_pinned(msinfo)) {
+                break;
+            }
+        }
     }
-    
-    
-    nfull_msinfoq--;
-    TAILQ_REMOVE(&full_msinfoq, msinfo, tqe);
+    if (msinfo == NULL) {
+        return FC_EAGAIN;
+    }
+
+    shard->nfull_msinfoq--;
+    TAILQ_REMOVE(&shard->full_msinfoq, msinfo, tqe);
 
     ASSERT(msinfo->mem);
-    ASSERT(slab_full(msinfo));
+    msinfo->drain = 1;
+
+    /* stamp the slab for crash recovery */
+    slab = slab_from_maddr(msinfo->addr, true);
+    slab->gen = gen;
+    slab->seq = ++shard->flush_seq;
 
     /* get disk sinfo from free q */
-    dsinfo = TAILQ_FIRST(&free_dsinfoq);
-    nfree_dsinfoq--;
-    TAILQ_REMOVE(&free_dsinfoq, dsinfo, tqe);
+    dsinfo = TAILQ_FIRST(&shard->free_dsinfoq);
+    shard->nfree_dsinfoq--;
+    TAILQ_REMOVE(&shard->free_dsinfoq, dsinfo, tqe);
     ASSERT(!dsinfo->mem);
 
-    /* drain the memory to disk slab */
-    slab = slab_from_maddr(msinfo->addr, true);
-    size = settings.slab_size;
-    off = slab_to_daddr(dsinfo);
-    n = pwrite(fd, slab, size, off);
-    if (n < size) {
-        log_error("pwrite fd %d %zu bytes at offset %" PRId64 " failed: %s",
-            fd, size, off, strerror(errno));
-        return FC_ERROR;
+    *pmsinfo = msinfo;
+    *pdsinfo = dsinfo;
+
+    return FC_OK;
+}
+
+/*
+ * Undo _slab_drain_reserve() after a failed write.
+ */
+static void
+_slab_drain_cancel(struct slabinfo* msinfo, struct slabinfo* dsinfo)
+{
+    msinfo->drain = 0;
+    slab_kill_drain_holes(msinfo, NULL);
+    shard->nfull_msinfoq++;
+    TAILQ_INSERT_HEAD(&shard->full_msinfoq, msinfo, tqe);
+    if (USE_LRU) {
+        lru_set(shard->lruh, msinfo);
     }
 
-    ctable[msinfo->cid].nmslab--;
-    ctable[msinfo->cid].ndslab++;
+    shard->nfree_dsinfoq++;
+    TAILQ_INSERT_HEAD(&shard->free_dsinfoq, dsinfo, tqe);
+}
+
+/*
+ * Complete the drain of memory slab msinfo, whose content now lives in
+ * the disk slab dsinfo.
+ */
+static void
+_slab_drain_done(struct slabinfo* msinfo, struct slabinfo* dsinfo)
+{
+    shard->ctable[msinfo->cid].nmslab--;
+    shard->ctable[msinfo->cid].ndslab++;
     log_debug(LOG_DEBUG, "drain slab at memory (sid %" PRIu32 " addr %" PRIu32 ") "
                          "to disk (sid %" PRIu32 " addr %" PRIu32 ")",
         msinfo->sid,
         msinfo->addr, dsinfo->sid, dsinfo->addr);
 
+    ASSERT(msinfo->npin == 0);
+    msinfo->drain = 0;
+    slab_kill_drain_holes(msinfo, dsinfo);
+    slab_free_holes(msinfo);
+
     /* swap msinfo <> dsinfo addresses */
     slab_swap_addr(msinfo, dsinfo);
 
     /* move dsinfo (now a memory sinfo) to free q */
-    nfree_msinfoq++;
-    TAILQ_INSERT_TAIL(&free_msinfoq, dsinfo, tqe);
+    shard->nfree_msinfoq++;
+    TAILQ_INSERT_TAIL(&shard->free_msinfoq, dsinfo, tqe);
 
     /* move msinfo (now a disk sinfo) to full q */
-    nfull_dsinfoq++;
-    TAILQ_INSERT_TAIL(&full_dsinfoq, msinfo, tqe);
-    nflush++;
+    shard->nfull_dsinfoq++;
+    TAILQ_INSERT_TAIL(&shard->full_dsinfoq, msinfo, tqe);
+    slab_gc_link(msinfo);
+    shard->nflush++;
+}
+
+//flush to disk
+static rstatus_t
+_slab_drain(void)
+{   
+    rstatus_t status;
+    struct slabinfo *msinfo, *dsinfo; /* memory and disk slabinfo */
+    struct slab* slab; /* slab to write */
+    size_t size; /* bytes to write */
+    off_t off; /* offset to write at */
+    int n; /* written bytes */
+    int64_t start; /* write start time */
+
+    status = _slab_drain_reserve(&msinfo, &dsinfo);
+    if (status != FC_OK) {
+        return status;
+    }
+
+    /* drain the memory to disk slab */
+    slab = slab_from_maddr(msinfo->addr, true);
+    size = settings.slab_size;
+    off = slab_to_daddr(dsinfo);
+    start = fc_nsec_now();
+    n = pwrite(shard->fd, slab, size, off);
+    if (n < size) {
+        log_error("pwrite fd %d %zu bytes at offset %" PRId64 " failed: %s",
+            shard->fd, size, off, strerror(errno));
+        _slab_drain_cancel(msinfo, dsinfo);
+        return FC_ERROR;
+    }
+    stats_io_record(msinfo->cid, STATS_IO_FLUSH, size, size,
+                    fc_nsec_now() - start);
+
+    _slab_drain_done(msinfo, dsinfo);
+
     return FC_OK;
 }
 
+static void *
+slab_flush_loop(void* arg)
+{
+    struct slab_flusher* f = arg;
+    struct slab_flush* sf;
+    ssize_t n;
+    int64_t start;
+
+    for (;;) {
+        pthread_mutex_lock(&f->lock);
+        while (STAILQ_EMPTY(&f->workq)) {
+            pthread_cond_wait(&f->work_cond, &f->lock);
+        }
+        sf = STAILQ_FIRST(&f->workq);
+        STAILQ_REMOVE_HEAD(&f->workq, tqe);
+        pthread_mutex_unlock(&f->lock);
+
+        start = fc_nsec_now();
+        n = pwrite(f->fd, sf->buf, f->size, sf->off);
+        sf->nsec = fc_nsec_now() - start;
+        if (n < (ssize_t)f->size) {
+            sf->err = n < 0 ? errno : EIO;
+        } else {
+            sf->err = 0;
+        }
+
+        pthread_mutex_lock(&f->lock);
+        STAILQ_INSERT_TAIL(&f->doneq, sf, tqe);
+        __atomic_store_n(&f->ndone, f->ndone + 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&f->done_cond);
+        pthread_mutex_unlock(&f->lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Reap slabs written by the flusher thread and complete their drain.
+ * If wait is true, block until at least one flush has completed.
+ */
 static rstatus_t
-slab_drain(void)
+slab_flush_reap(bool wait)
+{
+    struct slab_flushq doneq;
+    struct slab_flush* sf;
+    rstatus_t status;
+
+    if (!wait && __atomic_load_n(&shard->flusher->ndone, __ATOMIC_ACQUIRE) == 0) {
+        return FC_OK;
+    }
+
+    STAILQ_INIT(&doneq);
+
+    pthread_mutex_lock(&shard->flusher->lock);
+    while (wait && STAILQ_EMPTY(&shard->flusher->doneq)) {
+        pthread_cond_wait(&shard->flusher->done_cond, &shard->flusher->lock);
+    }
+    STAILQ_CONCAT(&doneq, &shard->flusher->doneq);
+    __atomic_store_n(&shard->flusher->ndone, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&shard->flusher->lock);
+
+    status = FC_OK;
+    while (!STAILQ_EMPTY(&doneq)) {
+        sf = STAILQ_FIRST(&doneq);
+        STAILQ_REMOVE_HEAD(&doneq, tqe);
+
+        ASSERT(shard->nflushing > 0);
+        shard->nflushing--;
+
+        if (sf->err != 0) {
+            log_error("pwrite fd %d %zu bytes at offset %" PRId64 " failed: %s",
+                shard->fd, shard->flusher->size, sf->off, strerror(sf->err));
+            _slab_drain_cancel(sf->msinfo, sf->dsinfo);
+            status = FC_ERROR;
+        } else {
+            stats_io_record(sf->msinfo->cid, STATS_IO_FLUSH,
+                            shard->flusher->size, shard->flusher->size,
+                            sf->nsec);
+            _slab_drain_done(sf->msinfo, sf->dsinfo);
+        }
+
+        STAILQ_INSERT_HEAD(&shard->free_flushq, sf, tqe);
+    }
+
+    return status;
+}
+
+/*
+ * Hand off the next full memory slab to the flusher thread.
+ */
+static rstatus_t
+slab_flush_start(void)
 {
     rstatus_t status;
+    struct slabinfo *msinfo, *dsinfo; /* memory and disk slabinfo */
+    struct slab_flush* sf;
 
-    // still have some free slabs in SSD
-    if (!TAILQ_EMPTY(&free_dsinfoq)) {
-        ASSERT(nfree_dsinfoq > 0);
-        return _slab_drain();
+    if (STAILQ_EMPTY(&shard->free_flushq)) {
+        sf = fc_alloc(sizeof(*sf));
+        if (sf == NULL) {
+            return FC_ENOMEM;
+        }
+    } else {
+        sf = STAILQ_FIRST(&shard->free_flushq);
+        STAILQ_REMOVE_HEAD(&shard->free_flushq, tqe);
     }
 
-    // no free slabs in SSD, flush + evict
-    status = slab_evict();
+    status = _slab_drain_reserve(&msinfo, &dsinfo);
     if (status != FC_OK) {
+        STAILQ_INSERT_HEAD(&shard->free_flushq, sf, tqe);
         return status;
     }
 
-    ASSERT(!TAILQ_EMPTY(&free_dsinfoq));
-    ASSERT(nfree_dsinfoq > 0);
+    sf->msinfo = msinfo;
+    sf->dsinfo = dsinfo;
+    sf->buf = slab_from_maddr(msinfo->addr, true);
+    sf->off = slab_to_daddr(dsinfo);
+    sf->err = 0;
+
+    log_debug(LOG_DEBUG, "flush slab at memory (sid %" PRIu32 " addr %" PRIu32 ")",
+        msinfo->sid, msinfo->addr);
+
+    shard->nflushing++;
+
+    pthread_mutex_lock(&shard->flusher->lock);
+    STAILQ_INSERT_TAIL(&shard->flusher->workq, sf, tqe);
+    pthread_cond_signal(&shard->flusher->work_cond);
+    pthread_mutex_unlock(&shard->flusher->lock);
+
+    return FC_OK;
+}
+
+/*
+ * Keep the number of free memory slabs, counting the ones on their way
+ * to disk, above the low watermark by handing off full memory slabs to
+ * the flusher thread. Never waits on the device.
+ */
+static void
+slab_flush(void)
+{
+    if (shard->flusher == NULL) {
+        return;
+    }
+
+    slab_flush_reap(false);
+
+    while (shard->nfree_msinfoq + shard->nflushing < settings.flush_watermark &&
+           !TAILQ_EMPTY(&shard->full_msinfoq)) {
+        if (slab_flush_start() != FC_OK) {
+            break;
+        }
+    }
+}
+
+static rstatus_t
+slab_drain(void)
+{
+    rstatus_t status;
+
+    if (shard->flusher != NULL) {
+        /*
+         * Memory slabs ran out before the flusher could keep up; wait
+         * for the oldest flush to complete.
+         */
+        if (shard->nflushing == 0) {
+            status = slab_flush_start();
+            if (status != FC_OK) {
+                return status;
+            }
+        }
+
+        return slab_flush_reap(true);
+    }
 
     return _slab_drain();
 }
@@ -422,8 +898,8 @@ _slab_get_item(uint8_t cid, bool update)
     struct slab* slab;
     struct item* it;
 
-    ASSERT(cid >= SLABCLASS_MIN_ID && cid < nctable);
-    c = &ctable[cid]; // ctable is a global table. get slab class by cid
+    ASSERT(cid >= SLABCLASS_MIN_ID && cid < shard->nctable);
+    c = &shard->ctable[cid]; // ctable is a global table. get slab class by cid
 
     // get slab info
     if (update == true) {
@@ -442,15 +918,11 @@ _slab_get_item(uint8_t cid, bool update)
 
     /* consume an new item from partial slab's end area */
     // use deleted area
-    if (sinfo->hole_head) {
-        uint16_t hole_index = sinfo->hole_head->hole_index;
-        hole_item* tmp = sinfo->hole_head;
-        sinfo->hole_head = sinfo->hole_head->next;
+    if (sinfo->nhole > 0) {
         // use this empty space to create a item
-        it = (struct item*)((uint8_t*)slab->data + (hole_index * c->size));
+        it = (struct item*)((uint8_t*)slab->data + (slab_get_hole(sinfo) * c->size));
         it->offset = (uint32_t)((uint8_t*)it - (uint8_t*)slab);
         log_debug(LOG_VERB, "use deleted area");
-        free(tmp);
     } else {
         it = slab_to_item(slab, sinfo->nalloc, c->size, false);
         it->offset = (uint32_t)((uint8_t*)it - (uint8_t*)slab);
@@ -467,8 +939,8 @@ _slab_get_item(uint8_t cid, bool update)
             /* move memory slab from partial to full q */
             TAILQ_REMOVE(&c->partial_msinfoq, sinfo, tqe);
         }
-        nfull_msinfoq++;
-        TAILQ_INSERT_TAIL(&full_msinfoq, sinfo, tqe);
+        shard->nfull_msinfoq++;
+        TAILQ_INSERT_TAIL(&shard->full_msinfoq, sinfo, tqe);
     }
 
     log_debug(LOG_VERB, "get it at offset %" PRIu32 " with cid %" PRIu8 "",
@@ -478,15 +950,55 @@ _slab_get_item(uint8_t cid, bool update)
     // two LRU double-linked list 
     if (slab_full(sinfo) && USE_LRU) {
         if (sinfo->mem) {
-            lru_set(lruh, sinfo);
+            lru_set(shard->lruh, sinfo);
         } else {
-            lru_set(lruh_disk, sinfo);
+            lru_set(shard->lruh_disk, sinfo);
         }
     }
 
     return it;
 }
 
+/*
+ * Move a free memory slab to the partial q of class cid.
+ */
+static void
+_slab_add_partial(uint8_t cid)
+{
+    struct slabclass* c;
+    struct slabinfo* sinfo;
+    struct slab* slab;
+
+    ASSERT(!TAILQ_EMPTY(&shard->free_msinfoq));
+    c = &shard->ctable[cid];
+
+    /* move memory slab from free to partial q */
+    sinfo = TAILQ_FIRST(&shard->free_msinfoq);
+
+    ASSERT(shard->nfree_msinfoq > 0);
+    shard->nfree_msinfoq--;
+    c->nmslab++;
+    TAILQ_REMOVE(&shard->free_msinfoq, sinfo, tqe);
+
+    /* init partial sinfo */
+    TAILQ_INSERT_HEAD(&c->partial_msinfoq, sinfo, tqe);
+    /* sid is already initialized by slab_init */
+    /* addr is already initialized by slab_init */
+    sinfo->nalloc = 0;
+    // sinfo->nfree = 0;
+    sinfo->cid = cid;
+    /* mem is already initialized by slab_init */
+    ASSERT(sinfo->mem == 1);
+
+    /* init slab of partial sinfo */
+    slab = slab_from_maddr(sinfo->addr, false);
+    slab->magic = SLAB_MAGIC;
+    slab->cid = cid;
+    /* unused[] is left uninitialized */
+    slab->sid = sinfo->sid;
+    /* data[] is initialized on-demand */
+}
+
 // get a proper slab in this slab class, and then get a space from slab to store this item
 // "update" param would decide to store on hot slab or not
 // this func is only for make sure there is a usable slab (partial slab or hot slab)
@@ -498,11 +1010,24 @@ slab_get_item(uint8_t cid, bool update)
     struct slabinfo* sinfo;
     struct slab* slab;
 
-    ASSERT(cid >= SLABCLASS_MIN_ID && cid < nctable);
-    c = &ctable[cid];
+    ASSERT(cid >= SLABCLASS_MIN_ID && cid < shard->nctable);
+    c = &shard->ctable[cid];
+
+    slab_flush();
+
+    /*
+     * index memory space is full; a disk slab whose items were all
+     * removed frees no index entry, so evict until one is free
+     */
+    while (itemx_empty()) {
+        /* a small index can fill up before any slab has reached disk */
+        if (TAILQ_EMPTY(&shard->full_dsinfoq)) {
+            status = slab_drain();
+            if (status != FC_OK || TAILQ_EMPTY(&shard->full_dsinfoq)) {
+                return NULL;
+            }
+        }
 
-    //index memory space is full
-    if (itemx_empty()) {
         status = slab_evict();
         if (status != FC_OK) {
             return NULL;
@@ -512,14 +1037,14 @@ slab_get_item(uint8_t cid, bool update)
     //hot data would return item address in hot slab
     if (update == true) {
         if (c->hot_slabinfo == NULL) { // this class has no hot slab
-            if (!TAILQ_EMPTY(&free_msinfoq)) { // any free slab?
+            if (!TAILQ_EMPTY(&shard->free_msinfoq)) { // any free slab?
                 /* move memory slab from free to partial q */
-                sinfo = TAILQ_FIRST(&free_msinfoq);
+                sinfo = TAILQ_FIRST(&shard->free_msinfoq);
 
-                ASSERT(nfree_msinfoq > 0);
-                nfree_msinfoq--;
+                ASSERT(shard->nfree_msinfoq > 0);
+                shard->nfree_msinfoq--;
                 c->nmslab++;
-                TAILQ_REMOVE(&free_msinfoq, sinfo, tqe);
+                TAILQ_REMOVE(&shard->free_msinfoq, sinfo, tqe);
 
                 /* init hot slab */
                 sinfo->nalloc = 0;
@@ -552,39 +1077,23 @@ slab_get_item(uint8_t cid, bool update)
         return _slab_get_item(cid, update);
     }
     
-    if (!TAILQ_EMPTY(&free_msinfoq)) {
+    if (!TAILQ_EMPTY(&shard->free_msinfoq)) {
         // no partial slabs, use free
-        /* move memory slab from free to partial q */
-        sinfo = TAILQ_FIRST(&free_msinfoq);
-
-        ASSERT(nfree_msinfoq > 0);
-        nfree_msinfoq--;
-        c->nmslab++;
-        TAILQ_REMOVE(&free_msinfoq, sinfo, tqe);
-
-        /* init partial sinfo */
-        TAILQ_INSERT_HEAD(&c->partial_msinfoq, sinfo, tqe);
-        /* sid is already initialized by slab_init */
-        /* addr is already initialized by slab_init */
-        sinfo->nalloc = 0;
-        // sinfo->nfree = 0;
-        sinfo->cid = cid;
-        /* mem is already initialized by slab_init */
-        ASSERT(sinfo->mem == 1);
-
-        /* init slab of partial sinfo */
-        slab = slab_from_maddr(sinfo->addr, false);
-        slab->magic = SLAB_MAGIC;
-        slab->cid = cid;
-        /* unused[] is left uninitialized */
-        slab->sid = sinfo->sid;
-        /* data[] is initialized on-demand */
+        _slab_add_partial(cid);
 
         return _slab_get_item(cid, update);
     }
 
-    ASSERT(!TAILQ_EMPTY(&full_msinfoq));
-    ASSERT(nfull_msinfoq > 0);
+    /*
+     * Memory slabs are all partial or hot slabs of some class, when the
+     * shard has too few of them for the classes in use; there is nothing
+     * to drain then.
+     */
+    if (TAILQ_EMPTY(&shard->full_msinfoq) && shard->nflushing == 0) {
+        log_debug(LOG_VERB, "no full memory slab to drain for class %"PRIu8,
+                  cid);
+        return NULL;
+    }
 
     // memory slabs are all full
     status = slab_drain();
@@ -595,48 +1104,357 @@ slab_get_item(uint8_t cid, bool update)
     return slab_get_item(cid, update);
 }
 
-void slab_put_item(struct item* it)
+/*
+ * Return the # item of class cid that fit in the partial and free memory
+ * slabs.
+ */
+static uint64_t
+slab_gc_room(uint8_t cid)
 {
-    log_debug(LOG_INFO, "put it '%.*s' at offset %" PRIu32 " with cid %" PRIu8,
-        it->nkey, item_key(it), it->offset, it->cid);
+    struct slabclass* c;
+    struct slabinfo* sinfo;
+    uint64_t room;
+
+    c = &shard->ctable[cid];
+    room = (uint64_t)shard->nfree_msinfoq * c->nitem;
+    TAILQ_FOREACH(sinfo, &c->partial_msinfoq, tqe) {
+        room += c->nitem - sinfo->nalloc;
+    }
+
+    return room;
 }
 
-struct item*
-slab_read_item(uint32_t sid, uint32_t addr)
+/*
+ * Free a disk slab by compaction: the full disk slab with the fewest live
+ * items has its live items copied into memory slabs of the same class, to
+ * be flushed again along with new items, and is then freed. Removed and
+ * superseded items are dropped on the way, so the slab with the most of
+ * them gives back the most space for the cost of one slab read. When even
+ * that slab is all live, or memory cannot take its live items without a
+ * drain, the oldest disk slab is evicted instead.
+ */
+static rstatus_t
+slab_gc(void)
 {
     struct slabclass* c; /* slab class */
-    struct item* it; /* item */
-    struct slabinfo* sinfo; /* slab info */
-    int n; /* bytes read */
-    off_t off; /* offset to read from */
-    off_t aligned_off; /* aligned offset to read from */
-    size_t aligned_size; /* aligned size to read */
+    struct slabinfo *sinfo; /* disk slabinfo */
+    struct slab* slab; /* read slab */
+    struct item *it, *nit; /* item and its copy */
+    struct itemx* itx; /* item index */
+    size_t size; /* bytes to read */
+    off_t off; /* offset */
+    ssize_t n; /* read bytes */
+    uint32_t idx; /* idx^th item */
+    uint32_t nsid, noffset; /* copy address */
+    rel_time_t expiry; /* item expiry */
+    uint64_t cas; /* item cas */
+    int64_t start; /* read start time */
+
+    ASSERT(!TAILQ_EMPTY(&shard->full_dsinfoq));
+
+    while (TAILQ_EMPTY(&shard->gcq[shard->gc_min])) {
+        shard->gc_min++;
+        ASSERT(shard->gc_min < shard->ngcq);
+    }
+    sinfo = TAILQ_FIRST(&shard->gcq[shard->gc_min]);
+    c = &shard->ctable[sinfo->cid];
+
+    if (sinfo->nlive >= c->nitem || sinfo->nlive > slab_gc_room(sinfo->cid)) {
+        return slab_evict();
+    }
+
+    shard->nfull_dsinfoq--;
+    TAILQ_REMOVE(&shard->full_dsinfoq, sinfo, tqe);
+    slab_gc_unlink(sinfo);
+    ASSERT(!sinfo->mem);
+    ASSERT(sinfo->addr < shard->ndslab);
+
+    log_debug(LOG_DEBUG, "gc slab at disk (sid %" PRIu32 ", addr %" PRIu32 ") "
+              "with %" PRIu32 " live items", sinfo->sid, sinfo->addr,
+              sinfo->nlive);
+
+    if (sinfo->nlive > 0) {
+        /* read the slab */
+        slab = (struct slab*)shard->evictbuf;
+        size = settings.slab_size;
+        off = slab_to_daddr(sinfo);
+        start = fc_nsec_now();
+        n = pread(shard->fd, slab, size, off);
+        if (n < (ssize_t)size) {
+            log_error("pread fd %d %zu bytes at offset %" PRIu64 " failed: %s",
+                      shard->fd, size, (uint64_t)off, strerror(errno));
+            shard->nfull_dsinfoq++;
+            TAILQ_INSERT_HEAD(&shard->full_dsinfoq, sinfo, tqe);
+            slab_gc_link(sinfo);
+            return FC_ERROR;
+        }
+        stats_io_record(sinfo->cid, STATS_IO_GC, size, size,
+                        fc_nsec_now() - start);
+        ASSERT(slab->magic == SLAB_MAGIC);
+        ASSERT(slab->sid == sinfo->sid);
+        ASSERT(slab->cid == sinfo->cid);
+
+        /* copy live items to memory */
+        for (idx = 0; idx < c->nitem && sinfo->nlive > 0; idx++) {
+            it = slab_to_item(slab, idx, c->size, false);
+            if (it->magic != ITEM_MAGIC) {
+                continue;
+            }
+
+            itx = itemx_getx(it->hash, it->md);
+            if (itx == NULL || itx->sid != sinfo->sid ||
+                itx->offset != it->offset || itemx_expired(itx)) {
+                continue;
+            }
+            expiry = itx->expiry;
+            cas = itx->cas;
+
+            if (TAILQ_EMPTY(&c->partial_msinfoq)) {
+                _slab_add_partial(sinfo->cid);
+            }
+            nit = _slab_get_item(sinfo->cid, false);
+            nsid = nit->sid;
+            noffset = nit->offset;
+            fc_memcpy(nit, it, item_size(it));
+            nit->sid = nsid;
+            nit->offset = noffset;
+
+            itemx_removex(it->hash, it->md);
+            itemx_putx(nit->hash, nit->md, nit->sid, nit->offset, expiry, cas);
+            shard->ngc_item++;
+        }
+    }
+    ASSERT(sinfo->nlive == 0);
+
+    /* move disk slab from full to free q */
+    shard->nfree_dsinfoq++;
+    TAILQ_INSERT_TAIL(&shard->free_dsinfoq, sinfo, tqe);
+    shard->ngc++;
+    c->ndslab--;
+
+    return FC_OK;
+}
+
+/*
+ * Turn the chunk of the removed item at offset of memory slab sinfo into
+ * a hole, to be handed out again before the chunks never allocated. The
+ * item is marked, so that it is not taken for a live item once the slab
+ * is on disk.
+ *
+ * The item of a slab being drained is left untouched, as the flusher
+ * thread may be writing it out, and only marked once the drain completes
+ * or fails in slab_kill_drain_holes().
+ */
+void
+slab_put_hole(struct slabinfo *sinfo, uint32_t offset)
+{
+    struct item *it;
+    uint64_t *holes;
+    uint32_t idx;
+
+    ASSERT(sinfo->mem);
+    ASSERT(offset >= SLAB_HDR_SIZE);
+
+    it = (struct item *)((uint8_t *)slab_from_maddr(sinfo->addr, true) + offset);
+    ASSERT(it->magic == ITEM_MAGIC);
+
+    if (!sinfo->drain) {
+        it->magic = 0;
+    }
+
+    /*
+     * The chunk of a pinned slab may still be referenced by a response
+     * in flight, so it is not handed out again before the slab drains.
+     */
+    if (slab_pinned(sinfo)) {
+        return;
+    }
+
+    idx = (offset - SLAB_HDR_SIZE) / shard->ctable[sinfo->cid].size;
+    holes = slab_holes(sinfo);
+    ASSERT((holes[idx / 64] & (1ULL << (idx % 64))) == 0);
+    holes[idx / 64] |= 1ULL << (idx % 64);
+    sinfo->nhole++;
+    sinfo->nalloc--;
+}
+
+void slab_put_item(struct item* it)
+{
+    log_debug(LOG_INFO, "put it '%.*s' at offset %" PRIu32 " with cid %" PRIu8,
+        it->nkey, item_key(it), it->offset, it->cid);
+}
+
+/*
+ * Return the disk descriptor and fill in the 512-byte aligned disk extent
+ * [aligned_off, aligned_off + aligned_size) that holds the item with
+ * address [sid, addr], so that the caller can issue the read on its own.
+ * Return -1 if the item lives in a memory slab.
+ */
+int
+slab_item_extent(uint32_t sid, uint32_t addr, off_t* aligned_off,
+    size_t* aligned_size)
+{
+    struct slabclass* c; /* slab class */
+    struct slabinfo* sinfo; /* slab info */
+    off_t off; /* offset to read from */
+
+    ASSERT(sid < shard->nstable);
+    ASSERT(addr < settings.slab_size);
+
+    sinfo = &shard->stable[sid];
+    if (sinfo->mem) {
+        return -1;
+    }
+
+    c = &shard->ctable[sinfo->cid];
+    off = slab_to_daddr(sinfo) + addr;
+    *aligned_off = ROUND_DOWN(off, 512);
+    *aligned_size = ROUND_UP((c->size + (off - *aligned_off)), 512);
+
+    return shard->fd;
+}
+
+/*
+ * Return the item with address [sid, addr] in place, if it lives in a
+ * memory slab, or NULL if it lives on disk. The item stays valid only
+ * while the shard lock is held, unless its slab is pinned.
+ */
+struct item *
+slab_peek_item(uint32_t sid, uint32_t addr)
+{
+    struct slabinfo *sinfo; /* slab info */
+    struct item *it; /* item */
+
+    ASSERT(sid < shard->nstable);
+    ASSERT(addr < settings.slab_size);
+
+    sinfo = &shard->stable[sid];
+    if (!sinfo->mem) {
+        return NULL;
+    }
+
+    it = (struct item *)((uint8_t *)slab_from_maddr(sinfo->addr, true) + addr);
+    ASSERT(it->magic == ITEM_MAGIC);
+
+    return it;
+}
+
+/*
+ * Pin the memory slab that holds item it, so that the slab is neither
+ * drained nor has the chunk of it handed out again, until slab_unpin().
+ * Return the pinned slabinfo, or NULL if it is not in a memory slab of
+ * this shard or its slab is already being drained.
+ */
+struct slabinfo *
+slab_pin_item(struct item *it)
+{
+    struct slabinfo *sinfo; /* slab info */
+
+    if ((uint8_t *)it < shard->mstart || (uint8_t *)it >= shard->mend) {
+        return NULL;
+    }
+
+    sinfo = &shard->stable[it->sid];
+    ASSERT(sinfo->mem);
+    if (sinfo->drain) {
+        return NULL;
+    }
+
+    __atomic_add_fetch(&sinfo->npin, 1, __ATOMIC_RELAXED);
+    shard->npin++;
+
+    return sinfo;
+}
+
+/*
+ * Unpin the memory slabinfo arg pinned by slab_pin_item(). Called once
+ * the response is sent, without the shard lock held.
+ */
+void
+slab_unpin(void *arg)
+{
+    struct slabinfo *sinfo = arg;
+
+    ASSERT(sinfo->mem);
+    ASSERT(sinfo->npin > 0);
+
+    __atomic_sub_fetch(&sinfo->npin, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Reserve the pin of an item that a value is to be received into from
+ * the network. The pins of such items last as long as their senders take,
+ * so they are capped to a share of the memory slabs of the shard, which
+ * leaves the rest of them to be drained whatever the senders do. Return
+ * false if the cap is reached.
+ */
+bool
+slab_recv_reserve(void)
+{
+    uint32_t nrecv_max;
+
+    nrecv_max = MAX(shard->nmslab / SLAB_RECV_SHARE, 1);
+    if (__atomic_load_n(&shard->nrecv, __ATOMIC_RELAXED) >= nrecv_max) {
+        return false;
+    }
+
+    __atomic_add_fetch(&shard->nrecv, 1, __ATOMIC_RELAXED);
+
+    return true;
+}
 
-    ASSERT(sid < nstable);
+/*
+ * Release a reservation of slab_recv_reserve() on shard id. Called
+ * without the shard lock held.
+ */
+void
+slab_recv_release(uint32_t id)
+{
+    ASSERT(id < nshard);
+    ASSERT(shards[id].nrecv > 0);
+
+    __atomic_sub_fetch(&shards[id].nrecv, 1, __ATOMIC_RELAXED);
+}
+
+struct item*
+slab_read_item(uint32_t sid, uint32_t addr)
+{
+    struct slabclass* c; /* slab class */
+    struct item* it; /* item */
+    struct slabinfo* sinfo; /* slab info */
+    int n; /* bytes read */
+    off_t off; /* offset to read from */
+    off_t aligned_off; /* aligned offset to read from */
+    size_t aligned_size; /* aligned size to read */
+    int64_t start; /* read start time */
+
+    ASSERT(sid < shard->nstable);
     ASSERT(addr < settings.slab_size);
 
-    sinfo = &stable[sid];
-    c = &ctable[sinfo->cid];
+    sinfo = &shard->stable[sid];
+    c = &shard->ctable[sinfo->cid];
     it = NULL;
 
     if (sinfo->mem) {
         off = (off_t)sinfo->addr * settings.slab_size + addr;
-        fc_memcpy(readbuf, mstart + off, c->size);
-        it = (struct item*)readbuf;
+        fc_memcpy(shard->readbuf, shard->mstart + off, c->size);
+        it = (struct item*)shard->readbuf;
         goto done;
     }
 
     off = slab_to_daddr(sinfo) + addr;
-    aligned_off = ROUND_DOWN(off, 512);
-    aligned_size = ROUND_UP((c->size + (off - aligned_off)), 512);
+    slab_item_extent(sid, addr, &aligned_off, &aligned_size);
 
-    n = pread(fd, readbuf, aligned_size, aligned_off);
+    start = fc_nsec_now();
+    n = pread(shard->fd, shard->readbuf, aligned_size, aligned_off);
     if (n < aligned_size) {
-        log_error("pread fd %d %zu bytes at offset %" PRIu64 " failed: %s", fd,
+        log_error("pread fd %d %zu bytes at offset %" PRIu64 " failed: %s", shard->fd,
             aligned_size, (uint64_t)aligned_off, strerror(errno));
         return NULL;
     }
-    it = (struct item*)(readbuf + (off - aligned_off));
+    stats_io_record(sinfo->cid, STATS_IO_READ, c->size, aligned_size,
+                    fc_nsec_now() - start);
+    it = (struct item*)(shard->readbuf + (off - aligned_off));
 
 done:
     ASSERT(it->magic == ITEM_MAGIC);
@@ -646,6 +1464,41 @@ done:
     return it;
 }
 
+static rstatus_t
+slab_init_flusher(void)
+{
+    struct slab_flusher* f;
+    int status;
+
+    f = fc_alloc(sizeof(*f));
+    if (f == NULL) {
+        return FC_ENOMEM;
+    }
+
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->work_cond, NULL);
+    pthread_cond_init(&f->done_cond, NULL);
+    STAILQ_INIT(&f->workq);
+    STAILQ_INIT(&f->doneq);
+    f->ndone = 0;
+    f->fd = shard->fd;
+    f->size = settings.slab_size;
+
+    status = pthread_create(&f->tid, NULL, slab_flush_loop, f);
+    if (status != 0) {
+        log_error("slab flusher create failed: %s", strerror(status));
+        fc_free(f);
+        return FC_ERROR;
+    }
+
+    shard->flusher = f;
+
+    log_debug(LOG_NOTICE, "slab flusher started with low watermark %" PRIu32
+        " free memory slabs", settings.flush_watermark);
+
+    return FC_OK;
+}
+
 static rstatus_t
 slab_init_ctable(void)
 {
@@ -656,14 +1509,14 @@ slab_init_ctable(void)
     ASSERT(settings.profile_last_id <= SLABCLASS_MAX_ID);
 
     profile = settings.profile;
-    nctable = settings.profile_last_id + 1;
-    ctable = fc_alloc(sizeof(*ctable) * nctable);
-    if (ctable == NULL) {
+    shard->nctable = settings.profile_last_id + 1;
+    shard->ctable = fc_alloc(sizeof(*shard->ctable) * shard->nctable);
+    if (shard->ctable == NULL) {
         return FC_ENOMEM;
     }
 
-    for (cid = SLABCLASS_MIN_ID; cid < nctable; cid++) {
-        c = &ctable[cid];
+    for (cid = SLABCLASS_MIN_ID; cid < shard->nctable; cid++) {
+        c = &shard->ctable[cid];
         c->nitem = slab_data_size() / profile[cid];
         c->size = profile[cid];
         c->slack = slab_data_size() - (c->nitem * c->size);
@@ -687,17 +1540,46 @@ static rstatus_t
 slab_init_stable(void)
 {
     struct slabinfo* sinfo;
-    uint32_t i, j;
+    uint32_t i, j, nitem;
+    uint8_t cid;
+
+    shard->nstable = shard->nmslab + shard->ndslab;
+    shard->stable = fc_alloc(sizeof(*shard->stable) * shard->nstable);
+    if (shard->stable == NULL) {
+        return FC_ENOMEM;
+    }
 
-    nstable = nmslab + ndslab;
-    stable = fc_alloc(sizeof(*stable) * nstable);
-    if (stable == NULL) {
+    /*
+     * Holes of every memory slab are tracked in a bitmap large enough for
+     * the class with the most chunks, so that removing an item or reusing
+     * its chunk never allocates.
+     */
+    for (nitem = 0, cid = SLABCLASS_MIN_ID; cid < shard->nctable; cid++) {
+        nitem = MAX(nitem, shard->ctable[cid].nitem);
+    }
+    shard->nhole_word = (nitem + 63) / 64;
+    shard->holes = fc_calloc((size_t)shard->nmslab * shard->nhole_word,
+                             sizeof(*shard->holes));
+    if (shard->holes == NULL) {
         return FC_ENOMEM;
     }
 
+    /* a disk slab has between 0 and nitem live items */
+    if (settings.evict == SLAB_EVICT_GC) {
+        shard->ngcq = nitem + 1;
+        shard->gcq = fc_alloc(sizeof(*shard->gcq) * shard->ngcq);
+        if (shard->gcq == NULL) {
+            return FC_ENOMEM;
+        }
+        for (i = 0; i < shard->ngcq; i++) {
+            TAILQ_INIT(&shard->gcq[i]);
+        }
+        shard->gc_min = 0;
+    }
+
     /* init memory slabinfo q  */
-    for (i = 0; i < nmslab; i++) {
-        sinfo = &stable[i];
+    for (i = 0; i < shard->nmslab; i++) {
+        sinfo = &shard->stable[i];
 
         sinfo->sid = i;
         sinfo->addr = i;
@@ -706,14 +1588,18 @@ slab_init_stable(void)
         sinfo->cid = SLABCLASS_INVALID_ID;
         sinfo->mem = 1;
         //init hole system
-        sinfo->hole_head = NULL;
-        nfree_msinfoq++;
-        TAILQ_INSERT_TAIL(&free_msinfoq, sinfo, tqe);
+        sinfo->nhole = 0;
+        sinfo->nlive = 0;
+        sinfo->npin = 0;
+        sinfo->drain = 0;
+        sinfo->gc = 0;
+        shard->nfree_msinfoq++;
+        TAILQ_INSERT_TAIL(&shard->free_msinfoq, sinfo, tqe);
     }
 
     /* init disk slabinfo q */
-    for (j = 0; j < ndslab && i < nstable; i++, j++) {
-        sinfo = &stable[i];
+    for (j = 0; j < shard->ndslab && i < shard->nstable; i++, j++) {
+        sinfo = &shard->stable[i];
 
         sinfo->sid = i;
         sinfo->addr = j;
@@ -721,9 +1607,13 @@ slab_init_stable(void)
         // sinfo->nfree = 0;
         sinfo->cid = SLABCLASS_INVALID_ID;
         sinfo->mem = 0;
-        sinfo->hole_head = NULL;
-        nfree_dsinfoq++;
-        TAILQ_INSERT_TAIL(&free_dsinfoq, sinfo, tqe);
+        sinfo->nhole = 0;
+        sinfo->nlive = 0;
+        sinfo->npin = 0;
+        sinfo->drain = 0;
+        sinfo->gc = 0;
+        shard->nfree_dsinfoq++;
+        TAILQ_INSERT_TAIL(&shard->free_dsinfoq, sinfo, tqe);
     }
     sinfo->next = NULL;
     sinfo->pre = NULL;
@@ -735,48 +1625,60 @@ slab_deinit_stable(void)
 {
 }
 
-rstatus_t
-slab_init(void)
+static rstatus_t
+slab_init_shard(uint32_t id)
 {
     rstatus_t status;
     size_t size;
-    uint32_t ndchunk;
-
-    nfree_msinfoq = 0;
-    TAILQ_INIT(&free_msinfoq);
-    nfull_msinfoq = 0;
-    TAILQ_INIT(&full_msinfoq);
-
-    nfree_dsinfoq = 0;
-    TAILQ_INIT(&free_dsinfoq);
-    nfull_dsinfoq = 0;
-    TAILQ_INIT(&full_dsinfoq);
-
-    nctable = 0;
-    ctable = NULL;
-
-    nstable = 0;
-    stable = NULL;
-
-    mstart = NULL;
-    mend = NULL;
-
-    dstart = 0;
-    dend = 0;
-    fd = -1;
-
-    mspace = 0;
-    dspace = 0;
-    nmslab = 0;
-    ndslab = 0;
-
-    evictbuf = NULL;
-    readbuf = NULL;
-
-    if (settings.ssd_device == NULL) {
-        log_error("ssd device file must be specified");
-        return FC_ERROR;
-    }
+    uint32_t ndchunk, npart, part, nclass;
+
+    shard->nfree_msinfoq = 0;
+    TAILQ_INIT(&shard->free_msinfoq);
+    shard->nfull_msinfoq = 0;
+    TAILQ_INIT(&shard->full_msinfoq);
+
+    shard->nfree_dsinfoq = 0;
+    TAILQ_INIT(&shard->free_dsinfoq);
+    shard->nfull_dsinfoq = 0;
+    TAILQ_INIT(&shard->full_dsinfoq);
+
+    shard->nctable = 0;
+    shard->ctable = NULL;
+
+    shard->nstable = 0;
+    shard->stable = NULL;
+    shard->nhole_word = 0;
+    shard->holes = NULL;
+    shard->gcq = NULL;
+    shard->ngcq = 0;
+    shard->gc_min = 0;
+
+    shard->mstart = NULL;
+    shard->mend = NULL;
+
+    shard->dstart = 0;
+    shard->dend = 0;
+    shard->fd = -1;
+
+    shard->mspace = 0;
+    shard->dspace = 0;
+    shard->nmslab = 0;
+    shard->ndslab = 0;
+
+    shard->nevict = 0;
+    shard->ngc = 0;
+    shard->ngc_item = 0;
+    shard->npin = 0;
+    shard->nrecv = 0;
+    shard->nflush = 0;
+    shard->flush_seq = 0;
+
+    shard->evictbuf = NULL;
+    shard->readbuf = NULL;
+
+    shard->flusher = NULL;
+    STAILQ_INIT(&shard->free_flushq);
+    shard->nflushing = 0;
 
     /* init slab class table */
     status = slab_init_ctable();
@@ -785,30 +1687,63 @@ slab_init(void)
     }
 
     /* init nmslab, mstart and mend */
-    nmslab = MAX(nctable, settings.max_slab_memory / settings.slab_size);
-    mspace = nmslab * settings.slab_size;
-    mstart = fc_mmap(mspace);
-    if (mstart == NULL) {
-        log_error("mmap %zu bytes failed: %s", mspace, strerror(errno));
+    shard->nmslab = MAX(shard->nctable,
+                        settings.max_slab_memory / settings.slab_size / nshard);
+    shard->mspace = shard->nmslab * settings.slab_size;
+    shard->mstart = fc_mmap(shard->mspace);
+    if (shard->mstart == NULL) {
+        log_error("mmap %zu bytes failed: %s", shard->mspace, strerror(errno));
         return FC_ENOMEM;
     }
-    mend = mstart + mspace;
+    shard->mend = shard->mstart + shard->mspace;
+
+    /*
+     * Every class in use holds a partial and a hot memory slab, which
+     * are never drained, so a shard with fewer memory slabs than that for
+     * all classes can run out of full slabs to drain. Items are then not
+     * allocated, and sets fail with a server error.
+     */
+    nclass = (uint32_t)(shard->nctable - SLABCLASS_MIN_ID);
+    if (id == 0 && shard->nmslab < 2 * nclass) {
+        log_warn("%"PRIu32" memory slabs per shard are fewer than the %"PRIu32
+                 " that %"PRIu32" slab classes may hold, so sets may fail; "
+                 "raise --max-slab-memory or lower --threads", shard->nmslab,
+                 2 * nclass, nclass);
+    }
 
     /* init ndslab, dstart and dend */
     status = fc_device_size(settings.ssd_device, &size);
     if (status != FC_OK) {
         return status;
     }
+    /*
+     * The disk is partitioned among servers, and the partition of each
+     * server among its shards, so shard id of server server_id owns the
+     * (server_id * nshard + id)^th of server_n * nshard equal parts.
+     */
     ndchunk = size / settings.slab_size;
-    ASSERT(settings.server_n <= ndchunk);
-    ndslab = ndchunk / settings.server_n;
-    dspace = ndslab * settings.slab_size;
-    dstart = (settings.server_id * ndslab) * settings.slab_size;
-    dend = ((settings.server_id + 1) * ndslab) * settings.slab_size;
+    npart = settings.server_n * nshard;
+    part = settings.server_id * nshard + id;
+    if (npart > ndchunk) {
+        log_error("ssd device '%s' of %zu bytes is too small for %"PRIu32
+                  " partitions", settings.ssd_device, size, npart);
+        return FC_ERROR;
+    }
+    shard->ndslab = ndchunk / npart;
+    shard->dspace = shard->ndslab * settings.slab_size;
+    shard->dstart = ((off_t)part * shard->ndslab) * settings.slab_size;
+    shard->dend = ((off_t)(part + 1) * shard->ndslab) * settings.slab_size;
+
+    if ((uint64_t)shard->nmslab + shard->ndslab > itemx_nsid()) {
+        log_error("%"PRIu32" slabs exceed the %"PRIu32" slab ids addressable "
+                  "by the item index; use a larger slab size", shard->nmslab +
+                  shard->ndslab, itemx_nsid());
+        return FC_ERROR;
+    }
 
     /* init disk descriptor */
-    fd = open(settings.ssd_device, O_RDWR | O_DIRECT, 0644);
-    if (fd < 0) {
+    shard->fd = open(settings.ssd_device, O_RDWR | O_DIRECT, 0644);
+    if (shard->fd < 0) {
         log_error("open '%s' failed: %s", settings.ssd_device, strerror(errno));
         return FC_ERROR;
     }
@@ -820,113 +1755,700 @@ slab_init(void)
     }
 
     /* init evictbuf and readbuf */
-    evictbuf = fc_mmap(settings.slab_size);
-    if (evictbuf == NULL) {
+    shard->evictbuf = fc_mmap(settings.slab_size);
+    if (shard->evictbuf == NULL) {
         log_error("mmap %zu bytes failed: %s", settings.slab_size,
             strerror(errno));
         return FC_ENOMEM;
     }
-    memset(evictbuf, 0xff, settings.slab_size);
+    memset(shard->evictbuf, 0xff, settings.slab_size);
 
-    readbuf = fc_mmap(settings.slab_size);
-    if (readbuf == NULL) {
+    shard->readbuf = fc_mmap(settings.slab_size);
+    if (shard->readbuf == NULL) {
         log_error("mmap %zu bytes failed: %s", settings.slab_size,
             strerror(errno));
         return FC_ENOMEM;
     }
-    memset(readbuf, 0xff, settings.slab_size);
+    memset(shard->readbuf, 0xff, settings.slab_size);
 
     //init lru controller
-    lruh = (lru_head*)malloc(sizeof(lru_head));
-    lruh_disk = (lru_head*)malloc(sizeof(lru_head));
-    lruh->head = NULL;
-    lruh->tail = NULL;
-    lruh_disk->head = NULL;
-    lruh_disk->tail = NULL;
+    shard->lruh = (lru_head*)malloc(sizeof(lru_head));
+    shard->lruh_disk = (lru_head*)malloc(sizeof(lru_head));
+    shard->lruh->head = NULL;
+    shard->lruh->tail = NULL;
+    shard->lruh_disk->head = NULL;
+    shard->lruh_disk->tail = NULL;
+
+    /* init flusher thread, unless memory slabs are drained inline */
+    if (settings.flush_watermark > 0) {
+        status = slab_init_flusher();
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    return FC_OK;
+}
+
+rstatus_t
+slab_init(void)
+{
+    rstatus_t status;
+    uint32_t i;
+
+    if (settings.ssd_device == NULL) {
+        log_error("ssd device file must be specified");
+        return FC_ERROR;
+    }
+
+    nshard = MAX(settings.threads, 1);
+    shards = fc_calloc(nshard, sizeof(*shards));
+    if (shards == NULL) {
+        return FC_ENOMEM;
+    }
+
+    /* a cold start begins a new generation */
+    gen = (uint64_t)fc_usec_now();
+
+    for (i = 0; i < nshard; i++) {
+        shard = &shards[i];
+        status = slab_init_shard(i);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    shard = &shards[0];
 
     return FC_OK;
 }
 
+/*
+ * Make shard id the current slab shard of the calling thread.
+ */
+void
+slab_select(uint32_t id)
+{
+    ASSERT(id < nshard);
+
+    shard = &shards[id];
+}
+
 void slab_deinit(void)
 {
     slab_deinit_ctable();
     slab_deinit_stable();
 }
 
+/*
+ * A slab shard is checkpointed as its class counters, its slab table with
+ * the hole bitmaps of the memory slabs, the order of each slabinfo q and lru, and the
+ * content of the memory slabs in use. Disk slabs already live on the
+ * device, so they only need to be current once the flushes in flight
+ * have completed.
+ */
+#define SLAB_CKPT_NONE  UINT32_MAX  /* sid of a missing slabinfo */
+
+struct slab_ckpt_info {
+    uint32_t addr;   /* address as slab_size offset from memory / disk base */
+    uint32_t nalloc; /* # item allocated */
+    uint8_t  cid;    /* class id */
+    uint8_t  mem;    /* memory? */
+    uint16_t unused; /* unused */
+    uint32_t nhole;  /* # hole */
+} __attribute__ ((__packed__));
+
+static void
+slab_checkpoint_q(FILE *f, struct slabhinfo *q)
+{
+    struct slabinfo *sinfo;
+    uint32_t n;
+
+    n = 0;
+    TAILQ_FOREACH(sinfo, q, tqe) {
+        n++;
+    }
+    fwrite(&n, sizeof(n), 1, f);
+
+    TAILQ_FOREACH(sinfo, q, tqe) {
+        fwrite(&sinfo->sid, sizeof(sinfo->sid), 1, f);
+    }
+}
+
+static void
+slab_checkpoint_lru(FILE *f, lru_head *lru)
+{
+    struct slabinfo *sinfo;
+    uint32_t n;
+
+    for (n = 0, sinfo = lru->head; sinfo != NULL; sinfo = sinfo->next) {
+        n++;
+    }
+    fwrite(&n, sizeof(n), 1, f);
+
+    for (sinfo = lru->head; sinfo != NULL; sinfo = sinfo->next) {
+        fwrite(&sinfo->sid, sizeof(sinfo->sid), 1, f);
+    }
+}
+
+static void
+slab_checkpoint_mem(FILE *f, struct slabinfo *sinfo)
+{
+    fwrite(slab_from_maddr(sinfo->addr, true), settings.slab_size, 1, f);
+}
+
+/*
+ * Write the current slab shard to f. Flushes in flight are completed
+ * first; the caller holds the shard lock, so no new one is started.
+ */
+rstatus_t
+slab_checkpoint(FILE *f)
+{
+    struct slab_ckpt_info info;
+    struct slabclass *c;
+    struct slabinfo *sinfo;
+    uint32_t sid, hot;
+    uint8_t cid;
+
+    while (shard->nflushing > 0) {
+        /* a failed flush leaves its memory slab in the full q */
+        slab_flush_reap(true);
+    }
+
+    if (fdatasync(shard->fd) < 0) {
+        log_error("fdatasync '%s' failed: %s", settings.ssd_device,
+                  strerror(errno));
+        return FC_ERROR;
+    }
+
+    fwrite(&shard->nmslab, sizeof(shard->nmslab), 1, f);
+    fwrite(&shard->ndslab, sizeof(shard->ndslab), 1, f);
+    fwrite(&shard->nctable, sizeof(shard->nctable), 1, f);
+    fwrite(&shard->nevict, sizeof(shard->nevict), 1, f);
+    fwrite(&shard->nflush, sizeof(shard->nflush), 1, f);
+    fwrite(&shard->flush_seq, sizeof(shard->flush_seq), 1, f);
+
+    for (cid = SLABCLASS_MIN_ID; cid < shard->nctable; cid++) {
+        c = &shard->ctable[cid];
+        hot = c->hot_slabinfo != NULL ? c->hot_slabinfo->sid : SLAB_CKPT_NONE;
+
+        fwrite(&c->nmslab, sizeof(c->nmslab), 1, f);
+        fwrite(&c->ndslab, sizeof(c->ndslab), 1, f);
+        fwrite(&c->nevict, sizeof(c->nevict), 1, f);
+        fwrite(&hot, sizeof(hot), 1, f);
+    }
+
+    for (sid = 0; sid < shard->nstable; sid++) {
+        sinfo = &shard->stable[sid];
+
+        info.addr = sinfo->addr;
+        info.nalloc = sinfo->nalloc;
+        info.cid = sinfo->cid;
+        info.mem = sinfo->mem;
+        info.unused = 0;
+        info.nhole = sinfo->nhole;
+        fwrite(&info, sizeof(info), 1, f);
+    }
+    fwrite(shard->holes, sizeof(*shard->holes),
+           (size_t)shard->nmslab * shard->nhole_word, f);
+
+    slab_checkpoint_q(f, &shard->free_msinfoq);
+    slab_checkpoint_q(f, &shard->full_msinfoq);
+    slab_checkpoint_q(f, &shard->free_dsinfoq);
+    slab_checkpoint_q(f, &shard->full_dsinfoq);
+    for (cid = SLABCLASS_MIN_ID; cid < shard->nctable; cid++) {
+        slab_checkpoint_q(f, &shard->ctable[cid].partial_msinfoq);
+    }
+    slab_checkpoint_lru(f, shard->lruh);
+    slab_checkpoint_lru(f, shard->lruh_disk);
+
+    /* memory slabs in use are the full, partial and hot ones */
+    TAILQ_FOREACH(sinfo, &shard->full_msinfoq, tqe) {
+        slab_checkpoint_mem(f, sinfo);
+    }
+    for (cid = SLABCLASS_MIN_ID; cid < shard->nctable; cid++) {
+        c = &shard->ctable[cid];
+        TAILQ_FOREACH(sinfo, &c->partial_msinfoq, tqe) {
+            slab_checkpoint_mem(f, sinfo);
+        }
+        if (c->hot_slabinfo != NULL) {
+            slab_checkpoint_mem(f, c->hot_slabinfo);
+        }
+    }
+
+    return ferror(f) ? FC_ERROR : FC_OK;
+}
+
+static rstatus_t
+slab_restore_sid(FILE *f, struct slabinfo **psinfo)
+{
+    uint32_t sid;
+
+    if (fread(&sid, sizeof(sid), 1, f) != 1) {
+        return FC_ERROR;
+    }
+
+    if (sid == SLAB_CKPT_NONE) {
+        *psinfo = NULL;
+    } else if (sid < shard->nstable) {
+        *psinfo = &shard->stable[sid];
+    } else {
+        return FC_ERROR;
+    }
+
+    return FC_OK;
+}
+
+static rstatus_t
+slab_restore_q(FILE *f, struct slabhinfo *q, uint32_t *nq)
+{
+    struct slabinfo *sinfo;
+    uint32_t i, n;
+
+    if (fread(&n, sizeof(n), 1, f) != 1) {
+        return FC_ERROR;
+    }
+
+    TAILQ_INIT(q);
+    for (i = 0; i < n; i++) {
+        if (slab_restore_sid(f, &sinfo) != FC_OK || sinfo == NULL) {
+            return FC_ERROR;
+        }
+        TAILQ_INSERT_TAIL(q, sinfo, tqe);
+    }
+
+    if (nq != NULL) {
+        *nq = n;
+    }
+
+    return FC_OK;
+}
+
+static rstatus_t
+slab_restore_lru(FILE *f, lru_head *lru)
+{
+    struct slabinfo *sinfo;
+    uint32_t i, n;
+
+    if (fread(&n, sizeof(n), 1, f) != 1) {
+        return FC_ERROR;
+    }
+
+    lru->head = NULL;
+    lru->tail = NULL;
+    for (i = 0; i < n; i++) {
+        if (slab_restore_sid(f, &sinfo) != FC_OK || sinfo == NULL) {
+            return FC_ERROR;
+        }
+        lru_set(lru, sinfo);
+    }
+
+    return FC_OK;
+}
+
+static rstatus_t
+slab_restore_mem(FILE *f, struct slabinfo *sinfo)
+{
+    struct slab *slab;
+
+    if (!sinfo->mem || sinfo->addr >= shard->nmslab) {
+        return FC_ERROR;
+    }
+
+    slab = slab_from_maddr(sinfo->addr, false);
+    if (fread(slab, settings.slab_size, 1, f) != 1) {
+        return FC_ERROR;
+    }
+
+    if (slab->magic != SLAB_MAGIC || slab->sid != sinfo->sid ||
+        slab->cid != sinfo->cid) {
+        return FC_ERROR;
+    }
+
+    return FC_OK;
+}
+
+/*
+ * Replace the state of the current, freshly initialized slab shard with
+ * the one written by slab_checkpoint(). The # used item of every class
+ * is left at zero, to be counted again as the item index is restored.
+ */
+rstatus_t
+slab_restore(FILE *f)
+{
+    struct slab_ckpt_info info;
+    struct slabclass *c;
+    struct slabinfo *sinfo;
+    uint32_t nmslab, ndslab, sid;
+    uint8_t nctable, cid;
+
+    if (fread(&nmslab, sizeof(nmslab), 1, f) != 1 ||
+        fread(&ndslab, sizeof(ndslab), 1, f) != 1 ||
+        fread(&nctable, sizeof(nctable), 1, f) != 1) {
+        return FC_ERROR;
+    }
+
+    if (nmslab != shard->nmslab || ndslab != shard->ndslab ||
+        nctable != shard->nctable) {
+        log_error("checkpoint of %"PRIu32" memory and %"PRIu32" disk slabs "
+                  "in %"PRIu8" classes does not match the slab shard", nmslab,
+                  ndslab, nctable);
+        return FC_ERROR;
+    }
+
+    if (fread(&shard->nevict, sizeof(shard->nevict), 1, f) != 1 ||
+        fread(&shard->nflush, sizeof(shard->nflush), 1, f) != 1 ||
+        fread(&shard->flush_seq, sizeof(shard->flush_seq), 1, f) != 1) {
+        return FC_ERROR;
+    }
+
+    for (cid = SLABCLASS_MIN_ID; cid < shard->nctable; cid++) {
+        c = &shard->ctable[cid];
+
+        if (fread(&c->nmslab, sizeof(c->nmslab), 1, f) != 1 ||
+            fread(&c->ndslab, sizeof(c->ndslab), 1, f) != 1 ||
+            fread(&c->nevict, sizeof(c->nevict), 1, f) != 1 ||
+            slab_restore_sid(f, &c->hot_slabinfo) != FC_OK) {
+            return FC_ERROR;
+        }
+        c->nused_item = 0;
+    }
+
+    for (sid = 0; sid < shard->nstable; sid++) {
+        sinfo = &shard->stable[sid];
+
+        if (fread(&info, sizeof(info), 1, f) != 1) {
+            return FC_ERROR;
+        }
+
+        if ((info.cid >= shard->nctable && info.cid != SLABCLASS_INVALID_ID) ||
+            info.addr >= (info.mem ? shard->nmslab : shard->ndslab) ||
+            (info.nhole > 0 && !info.mem)) {
+            return FC_ERROR;
+        }
+
+        sinfo->addr = info.addr;
+        sinfo->nalloc = info.nalloc;
+        sinfo->cid = info.cid;
+        sinfo->mem = info.mem;
+        sinfo->pre = NULL;
+        sinfo->next = NULL;
+        sinfo->nhole = info.nhole;
+        sinfo->nlive = 0;
+        sinfo->gc = 0;
+    }
+    if (fread(shard->holes, sizeof(*shard->holes),
+              (size_t)shard->nmslab * shard->nhole_word, f) !=
+        (size_t)shard->nmslab * shard->nhole_word) {
+        return FC_ERROR;
+    }
+
+    if (slab_restore_q(f, &shard->free_msinfoq, &shard->nfree_msinfoq) != FC_OK ||
+        slab_restore_q(f, &shard->full_msinfoq, &shard->nfull_msinfoq) != FC_OK ||
+        slab_restore_q(f, &shard->free_dsinfoq, &shard->nfree_dsinfoq) != FC_OK ||
+        slab_restore_q(f, &shard->full_dsinfoq, &shard->nfull_dsinfoq) != FC_OK) {
+        return FC_ERROR;
+    }
+    for (cid = SLABCLASS_MIN_ID; cid < shard->nctable; cid++) {
+        if (slab_restore_q(f, &shard->ctable[cid].partial_msinfoq, NULL) != FC_OK) {
+            return FC_ERROR;
+        }
+    }
+    if (slab_restore_lru(f, shard->lruh) != FC_OK ||
+        slab_restore_lru(f, shard->lruh_disk) != FC_OK) {
+        return FC_ERROR;
+    }
+    TAILQ_FOREACH(sinfo, &shard->full_dsinfoq, tqe) {
+        slab_gc_link(sinfo);
+    }
+
+    TAILQ_FOREACH(sinfo, &shard->full_msinfoq, tqe) {
+        if (slab_restore_mem(f, sinfo) != FC_OK) {
+            return FC_ERROR;
+        }
+    }
+    for (cid = SLABCLASS_MIN_ID; cid < shard->nctable; cid++) {
+        c = &shard->ctable[cid];
+        TAILQ_FOREACH(sinfo, &c->partial_msinfoq, tqe) {
+            if (slab_restore_mem(f, sinfo) != FC_OK) {
+                return FC_ERROR;
+            }
+        }
+        if (c->hot_slabinfo != NULL &&
+            slab_restore_mem(f, c->hot_slabinfo) != FC_OK) {
+            return FC_ERROR;
+        }
+    }
+
+    return FC_OK;
+}
+
+uint64_t
+slab_gen(void)
+{
+    return gen;
+}
+
+/*
+ * Carry on with generation g of slab content, on a warm restart or after
+ * crash recovery.
+ */
+void
+slab_set_gen(uint64_t g)
+{
+    gen = g;
+}
+
+/*
+ * Return the offset on the device of the disk slab with the given
+ * slab_size offset from the disk base of the current shard.
+ */
+off_t
+slab_disk_offset(uint32_t addr)
+{
+    ASSERT(addr < shard->ndslab);
+
+    return shard->dstart + ((off_t)addr * settings.slab_size);
+}
+
+static int
+slab_found_cmp(const void *a, const void *b)
+{
+    const struct slab_found *fa = *(struct slab_found * const *)a;
+    const struct slab_found *fb = *(struct slab_found * const *)b;
+
+    return fa->seq < fb->seq ? -1 : fa->seq > fb->seq ? 1 : 0;
+}
+
+/*
+ * Rebuild the current, freshly initialized slab shard from the disk slabs
+ * found by crash recovery, indexed by disk address. Found slabs become
+ * full disk slabs, oldest flush first in the full q, so that they are
+ * evicted in flush order. The slab ids of the lost memory slabs are given
+ * to the memory slabs and to the disk addresses where nothing was found,
+ * all of them free.
+ */
+rstatus_t
+slab_recover(struct slab_found *found)
+{
+    struct slab_found **sorted;
+    struct slabclass *c;
+    struct slabinfo *sinfo;
+    uint8_t *used;
+    uint32_t addr, sid, maddr, daddr, n;
+    uint8_t cid;
+
+    sorted = fc_alloc(sizeof(*sorted) * shard->ndslab);
+    if (sorted == NULL) {
+        return FC_ENOMEM;
+    }
+
+    used = fc_calloc(shard->nstable, sizeof(*used));
+    if (used == NULL) {
+        fc_free(sorted);
+        return FC_ENOMEM;
+    }
+
+    for (n = 0, addr = 0; addr < shard->ndslab; addr++) {
+        sid = found[addr].sid;
+        if (sid == SLAB_FOUND_NONE) {
+            continue;
+        }
+        if (sid >= shard->nstable || used[sid] ||
+            found[addr].cid >= shard->nctable) {
+            fc_free(sorted);
+            fc_free(used);
+            return FC_ERROR;
+        }
+        used[sid] = 1;
+        sorted[n++] = &found[addr];
+    }
+    qsort(sorted, n, sizeof(*sorted), slab_found_cmp);
+
+    shard->nfree_msinfoq = 0;
+    TAILQ_INIT(&shard->free_msinfoq);
+    shard->nfull_msinfoq = 0;
+    TAILQ_INIT(&shard->full_msinfoq);
+    shard->nfree_dsinfoq = 0;
+    TAILQ_INIT(&shard->free_dsinfoq);
+    shard->nfull_dsinfoq = 0;
+    TAILQ_INIT(&shard->full_dsinfoq);
+    shard->lruh->head = NULL;
+    shard->lruh->tail = NULL;
+    shard->lruh_disk->head = NULL;
+    shard->lruh_disk->tail = NULL;
+    for (sid = 0; sid < shard->ngcq; sid++) {
+        TAILQ_INIT(&shard->gcq[sid]);
+    }
+    shard->gc_min = 0;
+
+    for (cid = SLABCLASS_MIN_ID; cid < shard->nctable; cid++) {
+        c = &shard->ctable[cid];
+        TAILQ_INIT(&c->partial_msinfoq);
+        c->nmslab = 0;
+        c->ndslab = 0;
+        c->hot_slabinfo = NULL;
+    }
+
+    for (sid = 0; sid < shard->nstable; sid++) {
+        sinfo = &shard->stable[sid];
+        slab_free_holes(sinfo);
+        sinfo->nalloc = 0;
+        sinfo->nlive = 0;
+        sinfo->gc = 0;
+        sinfo->cid = SLABCLASS_INVALID_ID;
+        sinfo->pre = NULL;
+        sinfo->next = NULL;
+    }
+
+    /* found disk slabs are full */
+    while (n > 0) {
+        struct slab_found *f = sorted[--n];
+
+        sinfo = &shard->stable[f->sid];
+        c = &shard->ctable[f->cid];
+
+        sinfo->addr = (uint32_t)(f - found);
+        sinfo->mem = 0;
+        sinfo->cid = f->cid;
+        sinfo->nalloc = c->nitem;
+        c->ndslab++;
+
+        shard->nfull_dsinfoq++;
+        TAILQ_INSERT_HEAD(&shard->full_dsinfoq, sinfo, tqe);
+        slab_gc_link(sinfo);
+        shard->flush_seq = MAX(shard->flush_seq, f->seq);
+    }
+
+    /* and every other slab id is free */
+    for (maddr = 0, daddr = 0, sid = 0; sid < shard->nstable; sid++) {
+        if (used[sid]) {
+            continue;
+        }
+        sinfo = &shard->stable[sid];
+
+        if (maddr < shard->nmslab) {
+            sinfo->addr = maddr++;
+            sinfo->mem = 1;
+            shard->nfree_msinfoq++;
+            TAILQ_INSERT_TAIL(&shard->free_msinfoq, sinfo, tqe);
+            continue;
+        }
+
+        while (found[daddr].sid != SLAB_FOUND_NONE) {
+            daddr++;
+        }
+        ASSERT(daddr < shard->ndslab);
+        sinfo->addr = daddr++;
+        sinfo->mem = 0;
+        shard->nfree_dsinfoq++;
+        TAILQ_INSERT_TAIL(&shard->free_dsinfoq, sinfo, tqe);
+    }
+
+    fc_free(sorted);
+    fc_free(used);
+
+    return FC_OK;
+}
+
 uint32_t
 slab_msinfo_nalloc(void)
 {
-    return nmslab;
+    return shard->nmslab;
 }
 
 uint32_t
 slab_msinfo_nfree(void)
 {
-    return nfree_msinfoq;
+    return shard->nfree_msinfoq;
 }
 
 uint32_t
 slab_msinfo_nfull(void)
 {
-    return nfull_msinfoq;
+    return shard->nfull_msinfoq;
 }
 
 uint32_t
 slab_msinfo_npartial(void)
 {
-    return nmslab - nfree_msinfoq - nfull_msinfoq;
+    return shard->nmslab - shard->nfree_msinfoq - shard->nfull_msinfoq - shard->nflushing;
+}
+
+uint32_t
+slab_msinfo_nflushing(void)
+{
+    return shard->nflushing;
 }
 
 uint32_t
 slab_dsinfo_nalloc(void)
 {
-    return ndslab;
+    return shard->ndslab;
 }
 
 uint32_t
 slab_dsinfo_nfree(void)
 {
-    return nfree_dsinfoq;
+    return shard->nfree_dsinfoq;
 }
 
 uint32_t
 slab_dsinfo_nfull(void)
 {
-    return nfull_dsinfoq;
+    return shard->nfull_dsinfoq;
 }
 
 uint64_t
 slab_nevict(void)
 {
-    return nevict;
+    return shard->nevict;
+}
+
+uint64_t
+slab_ngc(void)
+{
+    return shard->ngc;
+}
+
+uint64_t
+slab_ngc_item(void)
+{
+    return shard->ngc_item;
 }
 
 uint64_t
-slab_nflsuh(void)
+slab_npin(void)
 {
-    return nflush;
+    return shard->npin;
+}
+
+uint64_t
+slab_nflush(void)
+{
+    return shard->nflush;
 }
 
 uint8_t
 slab_max_cid(void)
 {
-    return nctable;
+    return shard->nctable;
 }
 
 uint8_t
 slab_get_cid(uint32_t sid)
 {
-    ASSERT(sid < nstable);
-    return stable[sid].cid;
+    ASSERT(sid < shard->nstable);
+    return shard->stable[sid].cid;
 }
 
 struct slabclass*
 slab_get_class_by_cid(uint8_t cid)
 {
-    if (cid > nctable) {
+    if (cid > shard->nctable) {
         return NULL;
     }
-    return &ctable[cid];
+    return &shard->ctable[cid];
 }
 
 bool slab_incr_chunks_by_sid(uint32_t sid, int n)
@@ -934,12 +2456,19 @@ bool slab_incr_chunks_by_sid(uint32_t sid, int n)
     struct slabinfo* sinfo;
     struct slabclass* c;
 
-    sinfo = &stable[sid];
+    sinfo = &shard->stable[sid];
     if (sinfo == NULL) {
         return false;
     }
-    c = &ctable[sinfo->cid];
+    c = &shard->ctable[sinfo->cid];
     c->nused_item += n;
+    if (sinfo->gc) {
+        slab_gc_unlink(sinfo);
+        sinfo->nlive += n;
+        slab_gc_link(sinfo);
+    } else {
+        sinfo->nlive += n;
+    }
     return true;
 }
 
@@ -974,20 +2503,38 @@ void lru_set(lru_head* lru, struct slabinfo* item)
     }
 }
 
-void lru_remove_head(lru_head* lruh)
+void lru_remove(lru_head* lru, struct slabinfo* item)
+{
+    if (item->pre) {
+        item->pre->next = item->next;
+    } else {
+        ASSERT(lru->head == item);
+        lru->head = item->next;
+    }
+    if (item->next) {
+        item->next->pre = item->pre;
+    } else {
+        ASSERT(lru->tail == item);
+        lru->tail = item->pre;
+    }
+    item->pre = NULL;
+    item->next = NULL;
+}
+
+void lru_remove_head(lru_head* lru)
 {   
-    ASSERT(lruh->head);
-    log_debug(LOG_DEBUG, "lru remove sid:%d, after remove:", lruh->head->sid);
-    struct slabinfo* new_head = lruh->head->next;
+    ASSERT(lru->head);
+    log_debug(LOG_DEBUG, "lru remove sid:%d, after remove:", lru->head->sid);
+    struct slabinfo* new_head = lru->head->next;
     if (new_head) {
-        lruh->head->next = NULL;
-        lruh->head = new_head;
+        lru->head->next = NULL;
+        lru->head = new_head;
         new_head->pre = NULL;
     } else {
-        lruh->head = NULL;
-        lruh->tail = NULL;
+        lru->head = NULL;
+        lru->tail = NULL;
     }
-    struct slabinfo* tmp = lruh->head;
+    struct slabinfo* tmp = lru->head;
     while (tmp){
         log_debug(LOG_DEBUG, "lru:%d,", tmp->sid);
         tmp = tmp->next;
@@ -18,11 +18,18 @@
 #ifndef _FC_SLAB_H_
 #define _FC_SLAB_H_
 
+/*
+ * A slab is stamped with the generation of its content and a per shard
+ * sequence number when it is flushed, so that crash recovery can tell
+ * the slabs of the last generation apart and order them.
+ */
 struct slab {
     uint32_t  magic;     /* slab magic (const) */
     uint32_t  sid;       /* slab id */
     uint8_t   cid;       /* slab class id */
-    uint8_t   unused[3]; /* unused */
+    uint8_t   unused[7]; /* unused */
+    uint64_t  gen;       /* generation, stamped on flush */
+    uint64_t  seq;       /* flush sequence number, stamped on flush */
     uint8_t   data[1];   /* opaque data */
 };
 
@@ -31,12 +38,11 @@ struct slab {
 #define SLAB_MIN_SIZE   ((size_t) MB)
 #define SLAB_SIZE       MB
 #define SLAB_MAX_SIZE   ((size_t) (512 * MB))
-#define MAX_HOLE_LENGTH      13107     /* 13107 == 1048576 / 80 */
 
-typedef struct Hole_item{
-    uint16_t hole_index;
-    struct Hole_item * next;
-} hole_item;
+#define SLAB_RECV_SHARE 4   /* 1/n of memory slabs that values being received may pin */
+
+#define SLAB_EVICT_FIFO 0   /* evict the oldest disk slab */
+#define SLAB_EVICT_GC   1   /* compact the disk slab with the fewest live items */
 
 typedef struct Lru_head{
     struct slabinfo * head;
@@ -52,7 +58,12 @@ struct slabinfo {
     // uint32_t              nfree;  /* # item freed (monotonic) */ //you can get it from c->nitem == sinfo->nalloc.
     uint8_t               cid;    /* class id */
     unsigned              mem:1;  /* memory? */
-    hole_item*            hole_head;/* hole item queue head node */
+    unsigned              drain:1; /* memory slab being drained? */
+    unsigned              gc:1;   /* full disk slab in a gc q? */
+    uint32_t              nhole;  /* # hole in the hole bitmap of a memory slab */
+    uint32_t              nlive;  /* # live item, that the item index points to */
+    TAILQ_ENTRY(slabinfo) gc_tqe; /* link in gc q of its # live item */
+    uint32_t              npin;   /* # response referencing memory slab data */
     /* below is for simple double-linked LRU */
     struct slabinfo * pre;
     struct slabinfo * next;
@@ -60,6 +71,50 @@ struct slabinfo {
 
 TAILQ_HEAD(slabhinfo, slabinfo);
 
+/*
+ * Disk slab found at a disk address by crash recovery.
+ */
+struct slab_found {
+    uint32_t sid; /* slab id, or SLAB_FOUND_NONE */
+    uint8_t  cid; /* slab class id */
+    uint64_t seq; /* flush sequence number */
+};
+
+#define SLAB_FOUND_NONE UINT32_MAX
+
+/*
+ * A full memory slab handed off to the flusher thread, together with the
+ * disk slab that was reserved for it.
+ */
+struct slab_flush {
+    STAILQ_ENTRY(slab_flush) tqe;    /* link in work / done / free q */
+    struct slabinfo          *msinfo; /* memory slabinfo being flushed */
+    struct slabinfo          *dsinfo; /* reserved disk slabinfo */
+    uint8_t                  *buf;    /* slab memory to write */
+    off_t                    off;     /* disk offset to write at */
+    err_t                    err;     /* errno on failure */
+    int64_t                  nsec;    /* write latency in nsec */
+};
+
+STAILQ_HEAD(slab_flushq, slab_flush);
+
+/*
+ * State shared between the event loop and the flusher thread. The work
+ * and done q are protected by lock; everything else is owned by the
+ * event loop.
+ */
+struct slab_flusher {
+    pthread_t          tid;       /* flusher thread */
+    pthread_mutex_t    lock;      /* work and done q lock */
+    pthread_cond_t     work_cond; /* signalled on new work */
+    pthread_cond_t     done_cond; /* signalled on completed work */
+    struct slab_flushq workq;     /* slabs waiting to be written */
+    struct slab_flushq doneq;     /* slabs written, waiting to be reaped */
+    uint32_t           ndone;     /* # slab flush in done q */
+    int                fd;        /* disk file descriptor */
+    size_t             size;      /* bytes per slab write */
+};
+
 struct slabclass {
     uint32_t         nitem;           /* # item per slab (const), how many items this slab class can store */
     size_t           size;            /* item size (const) */
@@ -91,23 +146,44 @@ struct item *slab_get_item(uint8_t cid, bool update);
 
 void slab_put_item(struct item *it);
 struct item *slab_read_item(uint32_t sid, uint32_t addr);
+struct item *slab_peek_item(uint32_t sid, uint32_t addr);
+struct slabinfo *slab_pin_item(struct item *it);
+void slab_unpin(void *arg);
+bool slab_recv_reserve(void);
+void slab_recv_release(uint32_t id);
+int slab_item_extent(uint32_t sid, uint32_t addr, off_t *aligned_off, size_t *aligned_size);
 
 rstatus_t slab_init(void);
 void slab_deinit(void);
+void slab_select(uint32_t id);
+
+rstatus_t slab_checkpoint(FILE *f);
+rstatus_t slab_restore(FILE *f);
+
+uint64_t slab_gen(void);
+void slab_set_gen(uint64_t gen);
+off_t slab_disk_offset(uint32_t addr);
+rstatus_t slab_recover(struct slab_found *found);
+void slab_put_hole(struct slabinfo *sinfo, uint32_t offset);
 
 uint32_t slab_msinfo_nalloc(void);
 uint32_t slab_msinfo_nfree(void);
 uint32_t slab_msinfo_nfull(void);
 uint32_t slab_msinfo_npartial(void);
+uint32_t slab_msinfo_nflushing(void);
 uint32_t slab_dsinfo_nalloc(void);
 uint32_t slab_dsinfo_nfree(void);
 uint32_t slab_dsinfo_nfull(void);
 
 void lru_set(lru_head* lru, struct slabinfo* item);
-void lru_remove_head(lru_head* lruh);
+void lru_remove_head(lru_head* lru);
+void lru_remove(lru_head* lru, struct slabinfo* item);
 
 
 uint64_t slab_nevict(void);
+uint64_t slab_ngc(void);
+uint64_t slab_ngc_item(void);
+uint64_t slab_npin(void);
 
 uint8_t slab_max_cid(void);
 uint8_t slab_get_cid(uint32_t sd);
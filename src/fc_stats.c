@@ -19,10 +19,84 @@
 #include <stdarg.h>
 #include <string.h>
 #include <fc_stats.h>
+#include <fc_histogram.h>
+#include <fc_server.h>
 
-static stats_info st_info;
-static stats_info sc_st_info[SLABCLASS_MAX_ID+1];
-struct settings settings;
+/*
+ * Disk operations of one kind on slabs of one class.
+ */
+struct stats_io {
+    uint64_t ops;       /* # operation */
+    uint64_t bytes;     /* # byte asked for */
+    uint64_t aligned;   /* # byte transferred, once aligned to sectors */
+    uint64_t nsec;      /* sum of latencies in nsec */
+};
+
+/*
+ * Command stats are counted per worker thread, so that workers never
+ * write to a shared cache line on the request path, and are only summed
+ * up when reported.
+ */
+struct stats_worker {
+    stats_info st_info;                         /* command stats */
+    stats_info sc_st_info[SLABCLASS_MAX_ID+1];  /* slab class command stats */
+    uint64_t send_batch[STATS_NSEND_BATCH];     /* # sendv by # responses */
+    uint64_t listener[SERVER_NLISTENER][STATS_LISTENER_NFIELD]; /* listener stats */
+    uint32_t lat_epoch;                         /* reset epoch of latency */
+    struct histogram latency[STATS_LAT_NCMD][STATS_NTIER]; /* latency stats */
+    struct stats_io io[SLABCLASS_MAX_ID+1][STATS_NIO]; /* disk stats */
+    struct histogram io_latency[STATS_NIO]; /* disk latency stats */
+};
+
+/*
+ * Index and slab stats summed up across all shards.
+ */
+struct stats_shard {
+    uint64_t nalloc_itemx;  /* # allocated itemx */
+    uint64_t nfree_itemx;   /* # free itemx */
+    uint32_t nalloc_ms;     /* # memory slab */
+    uint32_t nfree_ms;      /* # free memory slab */
+    uint32_t nfull_ms;      /* # full memory slab */
+    uint32_t npartial_ms;   /* # partial memory slab */
+    uint32_t nflushing_ms;  /* # memory slab being flushed */
+    uint32_t nalloc_ds;     /* # disk slab */
+    uint32_t nfree_ds;      /* # free disk slab */
+    uint32_t nfull_ds;      /* # full disk slab */
+    uint64_t nevict;        /* # evicted disk slab */
+    uint64_t ngc;           /* # compacted disk slab */
+    uint64_t ngc_item;      /* # item moved by compaction */
+    uint64_t npin;          /* # value sent from memory slab without copy */
+    uint64_t nflush;        /* # flushed memory slab */
+};
+
+static uint32_t nworker;                        /* # worker stats */
+static struct stats_worker *workers;            /* worker stats */
+static __thread struct stats_worker *worker;    /* stats of this worker */
+static uint32_t lat_epoch;                      /* latency reset epoch */
+extern struct settings settings;
+
+rstatus_t
+stats_init(void)
+{
+    nworker = MAX(settings.threads, 1);
+    workers = fc_calloc(nworker, sizeof(*workers));
+    if (workers == NULL) {
+        return FC_ENOMEM;
+    }
+
+    return FC_OK;
+}
+
+/*
+ * Count the commands of the calling thread as those of worker id.
+ */
+void
+stats_worker_init(uint32_t id)
+{
+    ASSERT(id < nworker);
+
+    worker = &workers[id];
+}
 
 buffer *
 stats_alloc_buffer(int n)
@@ -107,13 +181,9 @@ stats_append(buffer *buf, uint8_t cid, const char*name, const char *fmt, ...)
     }
 }
 
-uint64_t
-stats_get(uint8_t cid, msg_type_t type, int is_miss)
+static uint64_t
+_stats_get(stats_info *info, msg_type_t type, int is_miss)
 {
-    stats_info *info;
-
-    info = cid == SLABCLASS_INVALID_ID ? &st_info : &sc_st_info[cid];
-
     switch(type) {
         case MSG_REQ_GET:
         case MSG_REQ_GETS:
@@ -137,12 +207,29 @@ stats_get(uint8_t cid, msg_type_t type, int is_miss)
     }
 }
 
+uint64_t
+stats_get(uint8_t cid, msg_type_t type, int is_miss)
+{
+    stats_info *info;
+    uint64_t n;
+    uint32_t i;
+
+    for (n = 0, i = 0; i < nworker; i++) {
+        info = cid == SLABCLASS_INVALID_ID ? &workers[i].st_info :
+                                             &workers[i].sc_st_info[cid];
+        n += _stats_get(info, type, is_miss);
+    }
+
+    return n;
+}
+
 void
 stats_incr(uint8_t cid, msg_type_t type, int is_hit)
 {
     stats_info *info;
 
-    info = cid == SLABCLASS_INVALID_ID ? &st_info : &sc_st_info[cid];
+    info = cid == SLABCLASS_INVALID_ID ? &worker->st_info :
+                                         &worker->sc_st_info[cid];
 
     switch(type) {
     case MSG_REQ_GET:
@@ -173,10 +260,215 @@ stats_incr(uint8_t cid, msg_type_t type, int is_hit)
     }
 }
 
+/*
+ * Count a sendv of nmsg responses, in the bucket of the largest power of
+ * two not above nmsg.
+ */
+void
+stats_send_batch(uint32_t nmsg)
+{
+    uint32_t i;
+
+    ASSERT(nmsg > 0);
+
+    i = 31 - (uint32_t)__builtin_clz(nmsg);
+    worker->send_batch[MIN(i, STATS_NSEND_BATCH - 1)]++;
+}
+
+/*
+ * Add n to field of the stats of listener type listener.
+ */
+void
+stats_listener(uint8_t listener, int field, uint64_t n)
+{
+    ASSERT(listener < SERVER_NLISTENER);
+    ASSERT(field < STATS_LISTENER_NFIELD);
+
+    worker->listener[listener][field] += n;
+}
+
+/*
+ * Record latency nsec of a request of type type that was served from
+ * tier. Only the histograms of the calling worker are written, without a
+ * lock. A reset is picked up lazily, by clearing them on the first
+ * record after it.
+ */
+void
+stats_latency_record(msg_type_t type, uint8_t tier, int64_t nsec)
+{
+    struct histogram *lat;
+    uint32_t epoch;
+
+    ASSERT(tier < STATS_NTIER);
+
+    if (type < MSG_REQ_GET || type >= MSG_REQ_STATS) {
+        return;
+    }
+
+    epoch = __atomic_load_n(&lat_epoch, __ATOMIC_RELAXED);
+    if (worker->lat_epoch != epoch) {
+        memset(worker->latency, 0, sizeof(worker->latency));
+        worker->lat_epoch = epoch;
+    }
+
+    lat = &worker->latency[type - MSG_REQ_GET][tier];
+    histogram_add(lat, nsec > 0 ? (uint64_t)nsec : 0);
+}
+
+/*
+ * Reset the latency stats of all workers. Each worker clears its own
+ * histograms once it records again; until then they are left out of the
+ * report.
+ */
+void
+stats_latency_reset(void)
+{
+    __atomic_add_fetch(&lat_epoch, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Account a disk operation op on a slab of class cid, that asked for
+ * nbyte bytes, transferred naligned bytes and took nsec. Threads other
+ * than workers, like the ones that checkpoint or recover the cache, are
+ * not accounted.
+ */
+void
+stats_io_record(uint8_t cid, int op, size_t nbyte, size_t naligned, int64_t nsec)
+{
+    struct stats_io *io;
+    uint64_t n;
+
+    ASSERT(op < STATS_NIO);
+
+    if (worker == NULL) {
+        return;
+    }
+
+    n = nsec > 0 ? (uint64_t)nsec : 0;
+    io = &worker->io[cid][op];
+    io->ops++;
+    io->bytes += nbyte;
+    io->aligned += naligned;
+    io->nsec += n;
+    histogram_add(&worker->io_latency[op], n);
+}
+
+static void
+stats_listener_append(buffer *buf, uint8_t listener, const char *prefix)
+{
+    static const char *fields[STATS_LISTENER_NFIELD] = {
+        "connections", "requests", "recv_bytes", "send_bytes", "dropped"
+    };
+    char name[32];
+    uint64_t n;
+    uint32_t id;
+    int field;
+
+    for (field = 0; field < STATS_LISTENER_NFIELD; field++) {
+        if ((listener == SERVER_UDP && field == STATS_LISTENER_CONN) ||
+            (listener != SERVER_UDP && field == STATS_LISTENER_DROP)) {
+            continue;
+        }
+
+        for (n = 0, id = 0; id < nworker; id++) {
+            n += workers[id].listener[listener][field];
+        }
+        fc_snprintf(name, sizeof(name), "%s_%s", prefix, fields[field]);
+        APPEND_STAT(buf, name, "%llu", n);
+    }
+}
+
+static void
+stats_latency_append(buffer *buf, const char *prefix, const struct histogram *lat)
+{
+    static const struct {
+        const char *name;
+        uint32_t   q;
+    } quantiles[] = {
+        { "p50", 500 }, { "p90", 900 }, { "p99", 990 }, { "p999", 999 },
+    };
+    char name[32];
+    uint32_t i;
+
+    fc_snprintf(name, sizeof(name), "%s_mean_us", prefix);
+    APPEND_STAT(buf, name, "%.2f", (double)lat->sum / lat->count / 1000);
+    for (i = 0; i < NELEMS(quantiles); i++) {
+        fc_snprintf(name, sizeof(name), "%s_%s_us", prefix, quantiles[i].name);
+        APPEND_STAT(buf, name, "%.2f",
+                    (double)histogram_quantile(lat, quantiles[i].q) / 1000);
+    }
+    fc_snprintf(name, sizeof(name), "%s_max_us", prefix);
+    APPEND_STAT(buf, name, "%.2f", (double)lat->max / 1000);
+}
+
+static void
+stats_shards(struct stats_shard *ss)
+{
+    uint32_t id;
+
+    memset(ss, 0, sizeof(*ss));
+
+    for (id = 0; id < shard_n(); id++) {
+        shard_lock(id);
+        ss->nalloc_itemx += itemx_nalloc();
+        ss->nfree_itemx += itemx_nfree();
+        ss->nalloc_ms += slab_msinfo_nalloc();
+        ss->nfree_ms += slab_msinfo_nfree();
+        ss->nfull_ms += slab_msinfo_nfull();
+        ss->npartial_ms += slab_msinfo_npartial();
+        ss->nflushing_ms += slab_msinfo_nflushing();
+        ss->nalloc_ds += slab_dsinfo_nalloc();
+        ss->nfree_ds += slab_dsinfo_nfree();
+        ss->nfull_ds += slab_dsinfo_nfull();
+        ss->nevict += slab_nevict();
+        ss->ngc += slab_ngc();
+        ss->ngc_item += slab_ngc_item();
+        ss->npin += slab_npin();
+        ss->nflush += slab_nflush();
+        shard_unlock(id);
+    }
+}
+
+/*
+ * Sum up slab class cid across all shards into sc. Return false if there
+ * is no such slab class.
+ */
+static bool
+stats_slab_class(uint8_t cid, struct slabclass *sc)
+{
+    struct slabclass *c;
+    uint32_t id;
+
+    memset(sc, 0, sizeof(*sc));
+
+    for (id = 0; id < shard_n(); id++) {
+        shard_lock(id);
+        c = slab_get_class_by_cid(cid);
+        if (c == NULL) {
+            shard_unlock(id);
+            return false;
+        }
+        sc->nitem = c->nitem;
+        sc->size = c->size;
+        sc->slack = c->slack;
+        sc->nmslab += c->nmslab;
+        sc->ndslab += c->ndslab;
+        sc->nevict += c->nevict;
+        sc->nused_item += c->nused_item;
+        shard_unlock(id);
+    }
+
+    return true;
+}
+
 buffer*
 stats_server(void)
 {
     buffer *stats_buf;
+    struct stats_shard ss;
+    char name[32];
+    uint64_t n;
+    uint32_t i, id;
 
     stats_buf = stats_alloc_buffer(1024);
     if (stats_buf == NULL) {
@@ -201,17 +493,38 @@ stats_server(void)
     APPEND_STAT(stats_buf, "cmd_incr_miss", "%llu", STATS_GET_MISS(MSG_REQ_INCR));
     APPEND_STAT(stats_buf, "cmd_cas", "%llu", STATS_GET(MSG_REQ_CAS));
     APPEND_STAT(stats_buf, "cmd_cas_miss", "%llu", STATS_GET_MISS(MSG_REQ_CAS));
-    APPEND_STAT(stats_buf, "alloc_itemx", "%llu", itemx_nalloc());
-    APPEND_STAT(stats_buf, "free_itemx", "%llu", itemx_nfree());
-    APPEND_STAT(stats_buf, "total_mem_slab", "%u", slab_msinfo_nalloc());
-    APPEND_STAT(stats_buf, "free_mem_slab", "%u", slab_msinfo_nfree());
-    APPEND_STAT(stats_buf, "full_mem_slab", "%u", slab_msinfo_nfull());
-    APPEND_STAT(stats_buf, "partial_mem_slab", "%u", slab_msinfo_npartial());
-    APPEND_STAT(stats_buf, "total_disk_slab", "%u", slab_dsinfo_nalloc());
-    APPEND_STAT(stats_buf, "free_disk_slab", "%u", slab_dsinfo_nfree());
-    APPEND_STAT(stats_buf, "full_disk_slab", "%u", slab_dsinfo_nfull());
-    APPEND_STAT(stats_buf, "evict_time", "%llu", slab_nevict());
-    // APPEND_STAT(stats_buf, "flush_time", "%llu", slab_nflush());
+    stats_shards(&ss);
+    APPEND_STAT(stats_buf, "alloc_itemx", "%llu", ss.nalloc_itemx);
+    APPEND_STAT(stats_buf, "free_itemx", "%llu", ss.nfree_itemx);
+    APPEND_STAT(stats_buf, "total_mem_slab", "%u", ss.nalloc_ms);
+    APPEND_STAT(stats_buf, "free_mem_slab", "%u", ss.nfree_ms);
+    APPEND_STAT(stats_buf, "full_mem_slab", "%u", ss.nfull_ms);
+    APPEND_STAT(stats_buf, "partial_mem_slab", "%u", ss.npartial_ms);
+    APPEND_STAT(stats_buf, "flushing_mem_slab", "%u", ss.nflushing_ms);
+    APPEND_STAT(stats_buf, "total_disk_slab", "%u", ss.nalloc_ds);
+    APPEND_STAT(stats_buf, "free_disk_slab", "%u", ss.nfree_ds);
+    APPEND_STAT(stats_buf, "full_disk_slab", "%u", ss.nfull_ds);
+    APPEND_STAT(stats_buf, "evict_time", "%llu", ss.nevict);
+    APPEND_STAT(stats_buf, "gc_time", "%llu", ss.ngc);
+    APPEND_STAT(stats_buf, "gc_item", "%llu", ss.ngc_item);
+    APPEND_STAT(stats_buf, "zerocopy_value", "%llu", ss.npin);
+    APPEND_STAT(stats_buf, "aio_inflight", "%u", aio_ninflight());
+    APPEND_STAT(stats_buf, "aio_merged", "%llu", aio_nmerged());
+    APPEND_STAT(stats_buf, "flush_time", "%llu", ss.nflush);
+    for (i = 0; i < STATS_NSEND_BATCH; i++) {
+        for (n = 0, id = 0; id < nworker; id++) {
+            n += workers[id].send_batch[i];
+        }
+        fc_snprintf(name, sizeof(name), "send_batch_%u", 1U << i);
+        APPEND_STAT(stats_buf, name, "%llu", n);
+    }
+    stats_listener_append(stats_buf, SERVER_TCP, "tcp");
+    if (settings.unix_path != NULL) {
+        stats_listener_append(stats_buf, SERVER_UNIX, "unix");
+    }
+    if (settings.udp_port != 0) {
+        stats_listener_append(stats_buf, SERVER_UDP, "udp");
+    }
     APPEND_STAT_END(stats_buf);
 
     return stats_buf;
@@ -223,17 +536,17 @@ stats_slabs(void)
     buffer *stats_buf;
     uint8_t cid, max_cid;
     uint64_t nget, nset, ndel, nincr, ndecr, ncas ;
-    struct slabclass *sc;
+    struct slabclass *sc, sc_sum;
 
     stats_buf = stats_alloc_buffer(512);
     if (stats_buf == NULL) {
         return NULL;
     }
     
-    max_cid = slab_max_cid();
+    max_cid = settings.profile_last_id + 1;
     for (cid = SLABCLASS_MIN_ID; cid < max_cid; cid++) {
-        sc = slab_get_class_by_cid(cid);
-        if (!sc) continue;
+        if (!stats_slab_class(cid, &sc_sum)) continue;
+        sc = &sc_sum;
 
         nget = SC_STATS_GET(cid, MSG_REQ_GET);
         nset = SC_STATS_GET(cid, MSG_REQ_SET);
@@ -276,6 +589,9 @@ stats_settings(void)
 
     APPEND_STAT(stats_buf, "addr", "%s", settings.addr);
     APPEND_STAT(stats_buf, "port", "%d", settings.port);
+    APPEND_STAT(stats_buf, "udp_port", "%d", settings.udp_port);
+    APPEND_STAT(stats_buf, "unix_socket", "%s",
+                settings.unix_path != NULL ? settings.unix_path : "");
     APPEND_STAT(stats_buf, "hash_power", "%d", settings.hash_power);
     APPEND_STAT(stats_buf, "factor", "%f", settings.factor);
     APPEND_STAT(stats_buf, "max_slab_memory", "%u", settings.max_slab_memory);
@@ -286,7 +602,164 @@ stats_settings(void)
     APPEND_STAT(stats_buf, "ssd_device", "%s", settings.ssd_device);
     APPEND_STAT(stats_buf, "server_id", "%u", settings.server_id);
     APPEND_STAT(stats_buf, "server_count", "%u", settings.server_n);
+    APPEND_STAT(stats_buf, "aio_depth", "%u", settings.aio_depth);
+    APPEND_STAT(stats_buf, "flush_watermark", "%u", settings.flush_watermark);
+    APPEND_STAT(stats_buf, "evict", "%s",
+                settings.evict == SLAB_EVICT_FIFO ? "fifo" : "gc");
+    APPEND_STAT(stats_buf, "threads", "%u", settings.threads);
+    APPEND_STAT(stats_buf, "index_engine", "%s",
+                settings.index_engine == ITEMX_ENGINE_CHAIN ? "chain" : "compact");
+    APPEND_STAT(stats_buf, "cas_enabled", "%s", settings.use_cas ? "yes" : "no");
+    APPEND_STAT(stats_buf, "key_hash", "%s",
+                settings.key_hash == ITEM_KEY_HASH_SHA1 ? "sha1" : "murmur3");
+    APPEND_STAT(stats_buf, "checkpoint", "%s",
+                settings.checkpoint != NULL ? settings.checkpoint : "");
+    APPEND_STAT(stats_buf, "recover_threads", "%u", settings.recover);
+    APPEND_STAT(stats_buf, "event_mode", "%s",
+                settings.event_mode == EVENT_MODE_TOGGLE ? "toggle" : "edge");
+    APPEND_STAT(stats_buf, "busy_poll", "%u", settings.busy_poll);
+    APPEND_STAT(stats_buf, "trace", "%s",
+                settings.trace != NULL ? settings.trace : "");
+    APPEND_STAT(stats_buf, "trace_sample", "%u", settings.trace_sample);
+    APPEND_STAT(stats_buf, "trace_size", "%zu", settings.trace_size);
+    APPEND_STAT_END(stats_buf);
+
+    return stats_buf;
+}
+
+/*
+ * Latency stats of each command and tier that served a request since the
+ * last reset, summed up across all workers.
+ */
+buffer*
+stats_latency(void)
+{
+    static const char *cmds[STATS_LAT_NCMD] = {
+        "get", "gets", "delete", "cas", "set", "add", "replace", "append",
+        "prepend", "incr", "decr"
+    };
+    static const char *tiers[STATS_NTIER] = { "mem", "disk", "miss" };
+    buffer *stats_buf;
+    struct histogram *sum;
+    char prefix[24], name[32];
+    uint32_t cmd, tier, id, epoch;
+
+    stats_buf = stats_alloc_buffer(1024);
+    if (stats_buf == NULL) {
+        return NULL;
+    }
+
+    sum = fc_alloc(sizeof(*sum));
+    if (sum == NULL) {
+        stats_dealloc_buffer(stats_buf);
+        return NULL;
+    }
+
+    epoch = __atomic_load_n(&lat_epoch, __ATOMIC_RELAXED);
+    for (cmd = 0; cmd < STATS_LAT_NCMD; cmd++) {
+        for (tier = 0; tier < STATS_NTIER; tier++) {
+            memset(sum, 0, sizeof(*sum));
+            for (id = 0; id < nworker; id++) {
+                if (workers[id].lat_epoch != epoch) {
+                    continue;
+                }
+                histogram_merge(sum, &workers[id].latency[cmd][tier]);
+            }
+            if (sum->count == 0) {
+                continue;
+            }
+            fc_snprintf(prefix, sizeof(prefix), "%s_%s", cmds[cmd], tiers[tier]);
+            fc_snprintf(name, sizeof(name), "%s_count", prefix);
+            APPEND_STAT(stats_buf, name, "%llu", sum->count);
+            stats_latency_append(stats_buf, prefix, sum);
+        }
+    }
+    APPEND_STAT_END(stats_buf);
+
+    fc_free(sum);
+
+    return stats_buf;
+}
+
+/*
+ * Disk stats of each operation, in total and by slab class, summed up
+ * across all workers. The amplification of an operation is the ratio of
+ * bytes transferred, once aligned to sectors, to bytes asked for.
+ */
+buffer*
+stats_io(void)
+{
+    static const char *ops[STATS_NIO] = { "read", "flush", "evict", "gc" };
+    buffer *stats_buf;
+    struct histogram *lat;
+    struct stats_io total[STATS_NIO], io;
+    char name[32];
+    uint8_t cid, max_cid;
+    uint32_t op, id;
+
+    stats_buf = stats_alloc_buffer(1024);
+    if (stats_buf == NULL) {
+        return NULL;
+    }
+
+    lat = fc_alloc(sizeof(*lat));
+    if (lat == NULL) {
+        stats_dealloc_buffer(stats_buf);
+        return NULL;
+    }
+
+    memset(total, 0, sizeof(total));
+    max_cid = settings.profile_last_id + 1;
+    for (cid = SLABCLASS_MIN_ID; cid < max_cid; cid++) {
+        for (op = 0; op < STATS_NIO; op++) {
+            memset(&io, 0, sizeof(io));
+            for (id = 0; id < nworker; id++) {
+                io.ops += workers[id].io[cid][op].ops;
+                io.bytes += workers[id].io[cid][op].bytes;
+                io.aligned += workers[id].io[cid][op].aligned;
+                io.nsec += workers[id].io[cid][op].nsec;
+            }
+            if (io.ops == 0) {
+                continue;
+            }
+            total[op].ops += io.ops;
+            total[op].bytes += io.bytes;
+            total[op].aligned += io.aligned;
+
+            fc_snprintf(name, sizeof(name), "%s_ops", ops[op]);
+            SC_APPEND_STAT(stats_buf, cid, name, "%llu", io.ops);
+            fc_snprintf(name, sizeof(name), "%s_bytes", ops[op]);
+            SC_APPEND_STAT(stats_buf, cid, name, "%llu", io.bytes);
+            fc_snprintf(name, sizeof(name), "%s_aligned_bytes", ops[op]);
+            SC_APPEND_STAT(stats_buf, cid, name, "%llu", io.aligned);
+            fc_snprintf(name, sizeof(name), "%s_mean_us", ops[op]);
+            SC_APPEND_STAT(stats_buf, cid, name, "%.2f",
+                           (double)io.nsec / io.ops / 1000);
+        }
+    }
+
+    for (op = 0; op < STATS_NIO; op++) {
+        fc_snprintf(name, sizeof(name), "%s_ops", ops[op]);
+        APPEND_STAT(stats_buf, name, "%llu", total[op].ops);
+        fc_snprintf(name, sizeof(name), "%s_bytes", ops[op]);
+        APPEND_STAT(stats_buf, name, "%llu", total[op].bytes);
+        fc_snprintf(name, sizeof(name), "%s_aligned_bytes", ops[op]);
+        APPEND_STAT(stats_buf, name, "%llu", total[op].aligned);
+        fc_snprintf(name, sizeof(name), "%s_amplification", ops[op]);
+        APPEND_STAT(stats_buf, name, "%.2f", total[op].bytes == 0 ? 0.0 :
+                    (double)total[op].aligned / total[op].bytes);
+
+        memset(lat, 0, sizeof(*lat));
+        for (id = 0; id < nworker; id++) {
+            histogram_merge(lat, &workers[id].io_latency[op]);
+        }
+        if (lat->count > 0) {
+            stats_latency_append(stats_buf, ops[op], lat);
+        }
+    }
     APPEND_STAT_END(stats_buf);
 
+    fc_free(lat);
+
     return stats_buf;
 }
@@ -43,6 +43,36 @@ typedef struct {
 } stats_info;
 
 
+#define STATS_NSEND_BATCH 11 /* # power of two buckets of send batch sizes */
+
+#define STATS_LISTENER_CONN     0   /* # connection accepted */
+#define STATS_LISTENER_REQ      1   /* # request */
+#define STATS_LISTENER_RECV     2   /* # byte received */
+#define STATS_LISTENER_SEND     3   /* # byte sent */
+#define STATS_LISTENER_DROP     4   /* # udp request datagram dropped */
+#define STATS_LISTENER_NFIELD   5
+
+/*
+ * Tiers that a request is served from, that its latency is recorded under.
+ */
+#define STATS_TIER_MEM          0   /* hit in a memory slab */
+#define STATS_TIER_DISK         1   /* hit in a disk slab */
+#define STATS_TIER_MISS         2   /* miss in the index */
+#define STATS_NTIER             3
+
+/* # command with latency stats, from get to decr */
+#define STATS_LAT_NCMD          (MSG_REQ_STATS - MSG_REQ_GET)
+
+/*
+ * Disk operations, whose ops, bytes and latency are accounted per slab
+ * class.
+ */
+#define STATS_IO_READ           0   /* item read */
+#define STATS_IO_FLUSH          1   /* memory slab written to disk */
+#define STATS_IO_EVICT          2   /* disk slab read to be evicted */
+#define STATS_IO_GC             3   /* disk slab read to be compacted */
+#define STATS_NIO               4
+
 #define STATS_INCR(type) stats_incr(SLABCLASS_INVALID_ID, type, 0)
 #define SC_STATS_INCR(cid, type) stats_incr(cid, type, 0)
 #define STATS_HIT_INCR(type)  stats_incr(SLABCLASS_INVALID_ID, type, 1)
@@ -58,12 +88,21 @@ typedef struct {
 #define APPEND_STAT_END(b) \
     stats_append(b, SLABCLASS_INVALID_ID, NULL, 0, NULL, 0)
 
+rstatus_t stats_init(void);
+void stats_worker_init(uint32_t id);
 buffer *stats_alloc_buffer(int n);
 void stats_dealloc_buffer(buffer *buf);
 void stats_append(buffer *buf, uint8_t cid, const char*name, const char *fmt, ...);
 void stats_incr(uint8_t cid, msg_type_t type, int is_hit);
 uint64_t stats_get(uint8_t cid, msg_type_t type, int is_miss);
+void stats_send_batch(uint32_t nmsg);
+void stats_listener(uint8_t listener, int field, uint64_t n);
+void stats_latency_record(msg_type_t type, uint8_t tier, int64_t nsec);
+void stats_latency_reset(void);
+void stats_io_record(uint8_t cid, int op, size_t nbyte, size_t naligned, int64_t nsec);
 buffer *stats_server(void);
 buffer *stats_slabs(void);
 buffer *stats_settings(void);
+buffer *stats_latency(void);
+buffer *stats_io(void);
 #endif
@@ -0,0 +1,345 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+
+#include <fc_core.h>
+
+/*
+ * Workload trace. Every request that carries a key leaves a fixed size
+ * record of its arrival time, op, key digest and length, value length,
+ * expiry and the tier that served it, once its response is ready. Keys
+ * are sampled by their digest, so that a sampled key has all of its
+ * requests traced. Each worker fills a chunk of records of its own and
+ * writes it out once full, at the next slot of a ring of chunks in the
+ * trace file.
+ */
+
+struct trace_buf {
+    pthread_mutex_t lock;       /* buf lock, against trace_flush() */
+    uint8_t         *chunk;     /* chunk being filled */
+    uint32_t        nrecord;    /* # record in chunk */
+};
+
+static int fd = -1;                         /* trace file descriptor */
+static uint32_t nchunk;                     /* # chunk in the ring */
+static uint32_t sample;                     /* 1 in sample keys is traced */
+static uint64_t seq;                        /* # chunk written */
+static int64_t started;                     /* nsec the trace started at */
+static uint32_t nbuf;                       /* # worker buf */
+static struct trace_buf *bufs;              /* worker bufs */
+static __thread struct trace_buf *buf;      /* buf of this worker */
+
+/*
+ * Open the trace file at path, with a ring of chunks of at most size
+ * bytes, and trace 1 in sample keys for nworker workers. Tracing is off
+ * if path is NULL.
+ */
+rstatus_t
+trace_init(char *path, size_t size, uint32_t nsample, uint8_t key_hash,
+           uint32_t nworker)
+{
+    struct trace_hdr hdr;
+    uint32_t i;
+    ssize_t n;
+
+    if (path == NULL) {
+        return FC_OK;
+    }
+
+    nchunk = (uint32_t)((size - sizeof(hdr)) / TRACE_CHUNK_SIZE);
+    if (size <= sizeof(hdr) || nchunk == 0) {
+        log_error("trace size %zu is less than a chunk of %d bytes", size,
+                  TRACE_CHUNK_SIZE);
+        return FC_ERROR;
+    }
+    sample = MAX(nsample, 1);
+
+    nbuf = nworker;
+    bufs = fc_calloc(nbuf, sizeof(*bufs));
+    if (bufs == NULL) {
+        return FC_ENOMEM;
+    }
+    for (i = 0; i < nbuf; i++) {
+        pthread_mutex_init(&bufs[i].lock, NULL);
+        bufs[i].chunk = fc_calloc(1, TRACE_CHUNK_SIZE);
+        if (bufs[i].chunk == NULL) {
+            return FC_ENOMEM;
+        }
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_error("open trace '%s' failed: %s", path, strerror(errno));
+        return FC_ERROR;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.chunk_size = TRACE_CHUNK_SIZE;
+    hdr.nchunk = nchunk;
+    hdr.record_size = sizeof(struct trace_record);
+    hdr.sample = sample;
+    hdr.key_hash = key_hash;
+    hdr.started = fc_usec_now();
+
+    n = pwrite(fd, &hdr, sizeof(hdr), 0);
+    if (n != sizeof(hdr)) {
+        log_error("write trace '%s' header failed: %s", path,
+                  n < 0 ? strerror(errno) : "short write");
+        return FC_ERROR;
+    }
+
+    started = fc_nsec_now();
+
+    log_debug(LOG_NOTICE, "tracing 1 in %"PRIu32" keys to '%s' in a ring of "
+              "%"PRIu32" chunks", sample, path, nchunk);
+
+    return FC_OK;
+}
+
+/*
+ * Trace the requests of the calling thread in the buf of worker id.
+ */
+void
+trace_worker_init(uint32_t id)
+{
+    if (fd < 0) {
+        return;
+    }
+
+    ASSERT(id < nbuf);
+
+    buf = &bufs[id];
+}
+
+/*
+ * Write out the chunk of buf b at the next slot of the ring. Called with
+ * the buf lock held.
+ */
+static void
+trace_write(struct trace_buf *b)
+{
+    struct trace_chunk *chunk = (struct trace_chunk *)b->chunk;
+    off_t off;
+    ssize_t n;
+
+    chunk->magic = TRACE_MAGIC;
+    chunk->nrecord = b->nrecord;
+    chunk->seq = __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+
+    off = (off_t)sizeof(struct trace_hdr) +
+          (off_t)(chunk->seq % nchunk) * TRACE_CHUNK_SIZE;
+    n = pwrite(fd, chunk, TRACE_CHUNK_SIZE, off);
+    if (n != TRACE_CHUNK_SIZE) {
+        log_warn("write trace chunk at offset %"PRIu64" failed: %s",
+                 (uint64_t)off, n < 0 ? strerror(errno) : "short write");
+    }
+
+    b->nrecord = 0;
+}
+
+static uint8_t
+trace_op(msg_type_t type)
+{
+    switch (type) {
+    case MSG_REQ_GET:
+    case MSG_REQ_GETS:
+        return TRACE_OP_GET;
+
+    case MSG_REQ_DELETE:
+        return TRACE_OP_DELETE;
+
+    case MSG_REQ_INCR:
+    case MSG_REQ_DECR:
+        return TRACE_OP_OTHER;
+
+    default:
+        return TRACE_OP_SET;
+    }
+}
+
+/*
+ * Trace request msg, whose response is ready, if its key is sampled.
+ */
+void
+trace_request(struct msg *msg)
+{
+    struct trace_record *r;
+    uint32_t h;
+
+    if (buf == NULL || msg->type == MSG_UNKNOWN ||
+        msg->type >= MSG_REQ_STATS) {
+        return;
+    }
+
+    /* sample by the digest bytes that neither shard nor index buckets use */
+    if (sample > 1) {
+        memcpy(&h, msg->md + 8, sizeof(h));
+        if (h % sample != 0) {
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&buf->lock);
+
+    r = (struct trace_record *)(buf->chunk + sizeof(struct trace_chunk)) +
+        buf->nrecord;
+    r->nsec = (uint64_t)MAX(msg->stime - started, 0);
+    memcpy(r->md, msg->md, sizeof(r->md));
+    r->type = (uint8_t)msg->type;
+    r->op = trace_op(msg->type);
+    r->tier = msg->tier;
+    r->nkey = (uint8_t)(msg->key_end - msg->key_start);
+    r->vlen = r->op == TRACE_OP_SET ? msg->vlen : 0;
+    r->expiry = r->op == TRACE_OP_SET ? msg->expiry : 0;
+
+    if (++buf->nrecord == TRACE_CHUNK_NRECORD) {
+        trace_write(buf);
+    }
+
+    pthread_mutex_unlock(&buf->lock);
+}
+
+/*
+ * Write out the partial chunks of every worker, on a clean shutdown.
+ */
+void
+trace_flush(void)
+{
+    uint32_t i;
+
+    if (fd < 0) {
+        return;
+    }
+
+    for (i = 0; i < nbuf; i++) {
+        pthread_mutex_lock(&bufs[i].lock);
+        if (bufs[i].nrecord > 0) {
+            trace_write(&bufs[i]);
+        }
+        pthread_mutex_unlock(&bufs[i].lock);
+    }
+
+    fsync(fd);
+}
+
+static int
+trace_record_cmp(const void *a, const void *b)
+{
+    const struct trace_record *ra = a, *rb = b;
+
+    if (ra->nsec != rb->nsec) {
+        return ra->nsec < rb->nsec ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Load every record of the trace file at path in arrival order into
+ * *precords, which the caller frees, and its header into hdr.
+ */
+rstatus_t
+trace_load(char *path, struct trace_hdr *hdr, struct trace_record **precords,
+           uint64_t *pnrecord)
+{
+    struct trace_record *records;
+    struct trace_chunk *chunk;
+    uint8_t *data;
+    uint64_t nrecord;
+    uint32_t i;
+    ssize_t n;
+    int tfd;
+
+    tfd = open(path, O_RDONLY);
+    if (tfd < 0) {
+        log_error("open trace '%s' failed: %s", path, strerror(errno));
+        return FC_ERROR;
+    }
+
+    n = pread(tfd, hdr, sizeof(*hdr), 0);
+    if (n != sizeof(*hdr) || hdr->magic != TRACE_MAGIC ||
+        hdr->version != TRACE_VERSION || hdr->chunk_size != TRACE_CHUNK_SIZE ||
+        hdr->record_size != sizeof(struct trace_record)) {
+        log_error("'%s' is not a version %d trace", path, TRACE_VERSION);
+        close(tfd);
+        return FC_ERROR;
+    }
+
+    data = fc_alloc(TRACE_CHUNK_SIZE);
+    records = fc_alloc((size_t)hdr->nchunk * TRACE_CHUNK_NRECORD *
+                       sizeof(*records));
+    if (data == NULL || records == NULL) {
+        fc_free(data);
+        fc_free(records);
+        close(tfd);
+        return FC_ENOMEM;
+    }
+
+    /* slots past the end of a ring that never wrapped read short */
+    chunk = (struct trace_chunk *)data;
+    for (nrecord = 0, i = 0; i < hdr->nchunk; i++) {
+        n = pread(tfd, data, TRACE_CHUNK_SIZE,
+                  (off_t)sizeof(*hdr) + (off_t)i * TRACE_CHUNK_SIZE);
+        if (n != TRACE_CHUNK_SIZE) {
+            break;
+        }
+        if (chunk->magic != TRACE_MAGIC ||
+            chunk->nrecord > TRACE_CHUNK_NRECORD) {
+            continue;
+        }
+
+        memcpy(&records[nrecord], data + sizeof(*chunk),
+               chunk->nrecord * sizeof(*records));
+        nrecord += chunk->nrecord;
+    }
+
+    fc_free(data);
+    close(tfd);
+
+    qsort(records, nrecord, sizeof(*records), trace_record_cmp);
+
+    *precords = records;
+    *pnrecord = nrecord;
+
+    return FC_OK;
+}
+
+/*
+ * Fill key with the key that stands in for the key of record r on
+ * replay, and return its length. It is the hex of the key digest, as
+ * long as the traced key but no shorter than TRACE_KEY_MIN_LEN, so that
+ * distinct digests make distinct keys. Only the bytes that both the sha1
+ * and murmur3 digests fill are used.
+ */
+uint8_t
+trace_key(const struct trace_record *r, char *key)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint8_t i, nkey, b;
+
+    nkey = MAX(r->nkey, TRACE_KEY_MIN_LEN);
+    for (i = 0; i < nkey; i++) {
+        b = r->md[(i / 2) % TRACE_KEY_MD_SIZE];
+        key[i] = hex[(i % 2 == 0 ? b >> 4 : b) & 0xf];
+    }
+
+    return nkey;
+}
@@ -0,0 +1,85 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _FC_TRACE_H_
+#define _FC_TRACE_H_
+
+#define TRACE_MAGIC         0x52544346  /* "FCTR" */
+#define TRACE_VERSION       1
+#define TRACE_CHUNK_SIZE    (64 * KB)   /* bytes per chunk of the ring */
+#define TRACE_KEY_MIN_LEN   12          /* min length of a replayed key */
+#define TRACE_KEY_MD_SIZE   16          /* digest bytes a replayed key uses */
+
+#define TRACE_OP_GET        0   /* get, gets */
+#define TRACE_OP_SET        1   /* set, add, replace, cas, append, prepend */
+#define TRACE_OP_DELETE     2   /* delete */
+#define TRACE_OP_OTHER      3   /* incr, decr */
+
+/*
+ * Trace file header. It is followed by a ring of nchunk chunks, each
+ * TRACE_CHUNK_SIZE bytes long, that wraps around once the file reaches
+ * the trace size, so that the trace keeps the most recent requests.
+ */
+struct trace_hdr {
+    uint32_t magic;       /* trace magic */
+    uint32_t version;     /* trace format version */
+    uint32_t chunk_size;  /* bytes per chunk */
+    uint32_t nchunk;      /* # chunk in the ring */
+    uint32_t record_size; /* bytes per record */
+    uint32_t sample;      /* 1 in sample keys is traced */
+    uint8_t  key_hash;    /* key digest */
+    uint8_t  unused[7];   /* unused */
+    int64_t  started;     /* unix time in usec the trace started at */
+} __attribute__ ((__packed__));
+
+/*
+ * Chunk header, followed by nrecord records. Chunks are written by each
+ * worker once it has filled one, so that records of a chunk are in order
+ * but chunks of different workers interleave in time.
+ */
+struct trace_chunk {
+    uint32_t magic;       /* trace magic, if the chunk was ever written */
+    uint32_t nrecord;     /* # record */
+    uint64_t seq;         /* # chunk written before this one */
+} __attribute__ ((__packed__));
+
+struct trace_record {
+    uint64_t nsec;        /* nsec since the trace started */
+    uint8_t  md[20];      /* key digest */
+    uint8_t  type;        /* request msg type */
+    uint8_t  op;          /* request op */
+    uint8_t  tier;        /* tier that served the request */
+    uint8_t  nkey;        /* key length */
+    uint32_t vlen;        /* value length of a storage request */
+    uint32_t expiry;      /* expiry of a storage request */
+} __attribute__ ((__packed__));
+
+#define TRACE_CHUNK_NRECORD \
+    ((TRACE_CHUNK_SIZE - sizeof(struct trace_chunk)) / sizeof(struct trace_record))
+
+struct msg;
+
+rstatus_t trace_init(char *path, size_t size, uint32_t sample, uint8_t key_hash, uint32_t nworker);
+void trace_worker_init(uint32_t id);
+void trace_request(struct msg *msg);
+void trace_flush(void);
+
+rstatus_t trace_load(char *path, struct trace_hdr *hdr, struct trace_record **precords, uint64_t *pnrecord);
+uint8_t trace_key(const struct trace_record *r, char *key);
+
+#endif
@@ -21,6 +21,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <time.h>
 #include <execinfo.h>
 
 #include <sys/ioctl.h>
@@ -79,6 +80,18 @@ fc_set_reuseaddr(int sd)
     return setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, len);
 }
 
+int
+fc_set_reuseport(int sd)
+{
+    int reuse;
+    socklen_t len;
+
+    reuse = 1;
+    len = sizeof(reuse);
+
+    return setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &reuse, len);
+}
+
 /*
  * Disable Nagle algorithm on TCP socket.
  *
@@ -111,6 +124,16 @@ fc_set_keepalive(int sd)
     return setsockopt(sd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, len);
 }
 
+int
+fc_set_busy_poll(int sd, int usec)
+{
+    socklen_t len;
+
+    len = sizeof(usec);
+
+    return setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &usec, len);
+}
+
 int
 fc_set_linger(int sd, int timeout)
 {
@@ -256,6 +279,25 @@ fc_usec_now(void)
     return usec;
 }
 
+/*
+ * Return the current time in nanoseconds on the monotonic clock, which is
+ * only meaningful relative to another reading of it
+ */
+int64_t
+fc_nsec_now(void)
+{
+    struct timespec now;
+    int status;
+
+    status = clock_gettime(CLOCK_MONOTONIC, &now);
+    if (status < 0) {
+        log_error("clock_gettime failed: %s", strerror(errno));
+        return -1;
+    }
+
+    return (int64_t)now.tv_sec * 1000000000LL + (int64_t)now.tv_nsec;
+}
+
 rstatus_t
 fc_device_size(const char *path, size_t *size)
 {
@@ -624,6 +666,27 @@ _fc_realloc(void *ptr, size_t size, const char *name, int line)
     return p;
 }
 
+void *
+_fc_memalign(size_t alignment, size_t size, const char *name, int line)
+{
+    void *p;
+    int status;
+
+    ASSERT(size != 0);
+
+    status = posix_memalign(&p, alignment, size);
+    if (status != 0) {
+        log_error("posix_memalign(%zu, %zu) failed @ %s:%d", alignment, size,
+                  name, line);
+        return NULL;
+    }
+
+    log_debug(LOG_VVERB, "memalign(%zu, %zu) at %p @ %s:%d", alignment, size,
+              p, name, line);
+
+    return p;
+}
+
 void
 _fc_free(void *ptr, const char *name, int line)
 {
@@ -105,6 +105,9 @@
 #define fc_realloc(_p, _s)              \
     _fc_realloc(_p, (size_t)(_s), __FILE__, __LINE__)
 
+#define fc_memalign(_a, _s)             \
+    _fc_memalign((size_t)(_a), (size_t)(_s), __FILE__, __LINE__)
+
 #define fc_free(_p) do {                \
     _fc_free(_p, __FILE__, __LINE__);   \
     (_p) = NULL;                        \
@@ -120,6 +123,7 @@ void *_fc_alloc(size_t size, const char *name, int line);
 void *_fc_zalloc(size_t size, const char *name, int line);
 void *_fc_calloc(size_t nmemb, size_t size, const char *name, int line);
 void *_fc_realloc(void *ptr, size_t size, const char *name, int line);
+void *_fc_memalign(size_t alignment, size_t size, const char *name, int line);
 void _fc_free(void *ptr, const char *name, int line);
 void *_fc_mmap(size_t size, const char *name, int line);
 int _fc_munmap(void *p, size_t size, const char *name, int line);
@@ -149,8 +153,10 @@ int fc_set_blocking(int sd);
 int fc_set_nonblocking(int sd);
 int fc_set_directio(int fd);
 int fc_set_reuseaddr(int sd);
+int fc_set_reuseport(int sd);
 int fc_set_tcpnodelay(int sd);
 int fc_set_keepalive(int sd);
+int fc_set_busy_poll(int sd, int usec);
 int fc_set_linger(int sd, int timeout);
 int fc_unset_linger(int sd);
 int fc_set_sndbuf(int sd, int size);
@@ -160,6 +166,7 @@ int fc_get_sndbuf(int sd);
 int fc_get_rcvbuf(int sd);
 void fc_maximize_sndbuf(int sd);
 int64_t fc_usec_now(void);
+int64_t fc_nsec_now(void);
 rstatus_t fc_device_size(const char *path, size_t *size);
 
 /*
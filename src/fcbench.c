@@ -0,0 +1,1286 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <getopt.h>
+
+#include <fc_core.h>
+#include <fc_histogram.h>
+
+/*
+ * fcbench is a closed loop load generator for fatcache. Each thread owns
+ * a share of the connections and keeps up to depth requests in flight on
+ * each of them, issuing the next one as soon as a response comes back.
+ * Keys are drawn from a uniform, zipfian or hotspot distribution over a
+ * fixed key space, value sizes from a fixed, uniform or exponential one,
+ * and commands are gets and sets in a given ratio. Alternatively, the
+ * requests of a workload trace that fatcache wrote are replayed, each
+ * thread taking the keys whose digest falls to it, in arrival order but
+ * as fast as responses come back. The latency of a request runs from when
+ * it is written to the socket buffer until its whole response is read.
+ */
+
+#define BENCH_SERVER        "127.0.0.1:11211"
+#define BENCH_CONNECTIONS   16
+#define BENCH_THREADS       1
+#define BENCH_DEPTH         1
+#define BENCH_DURATION      10
+#define BENCH_KEYS          100000
+#define BENCH_KEY_DIST      "uniform"
+#define BENCH_VALUE_SIZE    "fixed:100"
+#define BENCH_RATIO         "9:1"
+#define BENCH_KEY_PREFIX    "key:"
+#define BENCH_EXPIRY        0
+#define BENCH_SEED          1
+
+#define BENCH_RBUF_SIZE     (64 * 1024)     /* response buffer size */
+#define BENCH_HDR_SIZE      384             /* max request size but value */
+#define BENCH_MAX_VALUE     (1024 * 1024)   /* max value size */
+
+#define BENCH_KEY_UNIFORM   0
+#define BENCH_KEY_ZIPF      1
+#define BENCH_KEY_HOTSPOT   2
+
+#define BENCH_VALUE_FIXED   0
+#define BENCH_VALUE_UNIFORM 1
+#define BENCH_VALUE_EXP     2
+
+#define BENCH_OP_GET        0
+#define BENCH_OP_SET        1
+#define BENCH_OP_DELETE     2
+
+#define BENCH_MAX_EXPIRY    (60 * 60 * 24 * 30) /* max relative expiry */
+
+struct bench_stats {
+    uint64_t         nget;      /* # get */
+    uint64_t         nhit;      /* # get hit */
+    uint64_t         nset;      /* # set */
+    uint64_t         ndelete;   /* # delete */
+    uint64_t         nerror;    /* # error response */
+    struct histogram get;       /* get latency */
+    struct histogram set;       /* set latency */
+    struct histogram delete;    /* delete latency */
+};
+
+struct bench_thread;
+
+struct bench_conn {
+    int                 sd;         /* socket descriptor */
+    struct bench_thread *t;         /* owner thread */
+    uint8_t             *rbuf;      /* response buffer */
+    uint32_t            rpos;       /* parsed up to */
+    uint32_t            rlen;       /* received up to */
+    uint8_t             *wbuf;      /* request buffer */
+    size_t              wpos;       /* sent up to */
+    size_t              wlen;       /* queued up to */
+    size_t              wcap;       /* request buffer capacity */
+    int64_t             *stime;     /* send time of in flight requests */
+    uint8_t             *op;        /* op of in flight requests */
+    uint32_t            head;       /* oldest in flight request */
+    uint32_t            ninflight;  /* # request in flight */
+    uint64_t            vskip;      /* value bytes left to skip */
+    unsigned            hit:1;      /* get response carries a value? */
+    unsigned            out:1;      /* waiting on EPOLLOUT? */
+};
+
+struct bench_thread {
+    pthread_t          tid;         /* thread id */
+    uint32_t           id;          /* thread index */
+    int                ep;          /* epoll descriptor */
+    struct bench_conn  *conn;       /* connections */
+    uint32_t           nconn;       /* # connection */
+    uint64_t           rand;        /* random state */
+    uint64_t           nissued;     /* # request issued */
+    uint64_t           quota;       /* # request to issue, 0 for no limit */
+    uint32_t           load_next;   /* next key to load */
+    bool               loading;     /* loading the key space? */
+    bool               stopping;    /* issuing no more requests? */
+    uint64_t           *replay;     /* index of trace records to replay */
+    uint64_t           nreplay;     /* # trace record to replay */
+    uint64_t           replay_next; /* next trace record to replay */
+    struct bench_stats stats;       /* stats */
+};
+
+static struct {
+    char     *server;       /* host:port */
+    char     *unix_path;    /* unix socket path */
+    uint32_t nconn;         /* # connection */
+    uint32_t nthread;       /* # thread */
+    uint32_t depth;         /* # request in flight per connection */
+    uint32_t duration;      /* run time in sec */
+    uint64_t nrequest;      /* # request to issue, 0 for no limit */
+    uint32_t nkey;          /* # key */
+    int      key_dist;      /* key distribution */
+    double   theta;         /* zipfian skew */
+    double   hot_frac;      /* fraction of keys that are hot */
+    double   hot_prob;      /* fraction of requests to hot keys */
+    int      value_dist;    /* value size distribution */
+    uint32_t vmin;          /* min or fixed value size */
+    uint32_t vmax;          /* max value size */
+    double   vmean;         /* mean value size */
+    uint32_t get_weight;    /* weight of gets */
+    uint32_t set_weight;    /* weight of sets */
+    uint32_t expiry;        /* item expiry */
+    bool     load;          /* load the key space first? */
+    char     *prefix;       /* key prefix */
+    uint64_t seed;          /* random seed */
+    char     *replay;       /* path to trace to replay */
+} opt;
+
+static int show_help;
+static struct sockaddr_storage addr;    /* server address */
+static socklen_t addrlen;               /* server address length */
+static uint8_t *value;                  /* value of every set */
+static double zetan, eta, alpha, half;  /* zipfian constants */
+static volatile bool stop;              /* stop issuing requests? */
+static pthread_barrier_t barrier;       /* start of the measured run */
+static struct trace_record *records;    /* trace records to replay */
+static uint64_t nrecord;                /* # trace record */
+static uint64_t nskip;                  /* # trace record not replayed */
+
+static struct option long_options[] = {
+    { "help",           no_argument,        NULL,   'h' }, /* help */
+    { "server",         required_argument,  NULL,   's' }, /* server host:port */
+    { "unix-socket",    required_argument,  NULL,   'u' }, /* server unix socket */
+    { "connections",    required_argument,  NULL,   'c' }, /* # connection */
+    { "threads",        required_argument,  NULL,   't' }, /* # thread */
+    { "depth",          required_argument,  NULL,   'd' }, /* pipeline depth */
+    { "duration",       required_argument,  NULL,   'T' }, /* run time in sec */
+    { "requests",       required_argument,  NULL,   'n' }, /* # request */
+    { "keys",           required_argument,  NULL,   'k' }, /* # key */
+    { "key-dist",       required_argument,  NULL,   'K' }, /* key distribution */
+    { "value-size",     required_argument,  NULL,   'z' }, /* value size distribution */
+    { "ratio",          required_argument,  NULL,   'r' }, /* get:set ratio */
+    { "expiry",         required_argument,  NULL,   'e' }, /* item expiry */
+    { "load",           no_argument,        NULL,   'l' }, /* load keys first */
+    { "key-prefix",     required_argument,  NULL,   'x' }, /* key prefix */
+    { "seed",           required_argument,  NULL,   'S' }, /* random seed */
+    { "replay",         required_argument,  NULL,   'R' }, /* replay trace */
+    { NULL,             0,                  NULL,    0  }
+};
+
+static char short_options[] =
+    "h"  /* help */
+    "s:" /* server host:port */
+    "u:" /* server unix socket */
+    "c:" /* # connection */
+    "t:" /* # thread */
+    "d:" /* pipeline depth */
+    "T:" /* run time in sec */
+    "n:" /* # request */
+    "k:" /* # key */
+    "K:" /* key distribution */
+    "z:" /* value size distribution */
+    "r:" /* get:set ratio */
+    "e:" /* item expiry */
+    "l"  /* load keys first */
+    "x:" /* key prefix */
+    "S:" /* random seed */
+    "R:" /* replay trace */
+    ;
+
+static void
+bench_show_usage(void)
+{
+    log_stderr(
+        "Usage: fcbench [-hl] [-s host:port] [-u unix socket]" CRLF
+        "               [-c connections] [-t threads] [-d depth]" CRLF
+        "               [-T duration] [-n requests] [-k keys]" CRLF
+        "               [-K key dist] [-z value size] [-r get:set]" CRLF
+        "               [-e expiry] [-x key prefix] [-S seed]" CRLF
+        "               [-R trace]" CRLF
+        " ");
+    log_stderr(
+        "Options:" CRLF
+        "  -h, --help             : this help" CRLF
+        "  -s, --server=S         : set the server host:port (default: %s)" CRLF
+        "  -u, --unix-socket=S    : set the server unix socket, instead of host:port" CRLF
+        "  -c, --connections=N    : set the # connections (default: %d)" CRLF
+        "  -t, --threads=N        : set the # threads sharing the connections (default: %d)" CRLF
+        "  -d, --depth=N          : set the # requests in flight per connection (default: %d)" CRLF
+        "  -T, --duration=N       : set the run time in sec (default: %d)" CRLF
+        "  -n, --requests=N       : set the # requests to issue, instead of a run time",
+        BENCH_SERVER, BENCH_CONNECTIONS, BENCH_THREADS, BENCH_DEPTH,
+        BENCH_DURATION);
+    log_stderr(
+        "  -k, --keys=N           : set the # keys (default: %d)" CRLF
+        "  -K, --key-dist=S       : set the key distribution, uniform, zipf[:THETA] or" CRLF
+        "                           hotspot[:FRAC:PROB] (default: %s)" CRLF
+        "  -z, --value-size=S     : set the value size distribution, fixed:N," CRLF
+        "                           uniform:MIN:MAX or exp:MEAN:MAX (default: %s)" CRLF
+        "  -r, --ratio=G:S        : set the ratio of gets to sets (default: %s)" CRLF
+        "  -e, --expiry=N         : set the expiry of items set (default: %d)" CRLF
+        "  -l, --load             : set every key once before the run" CRLF
+        "  -x, --key-prefix=S     : set the key prefix (default: %s)" CRLF
+        "  -S, --seed=N           : set the random seed (default: %d)" CRLF
+        "  -R, --replay=S         : replay the requests of a fatcache trace file, instead" CRLF
+        "                           of drawing keys, values and commands" CRLF
+        "",
+        BENCH_KEYS, BENCH_KEY_DIST, BENCH_VALUE_SIZE, BENCH_RATIO,
+        BENCH_EXPIRY, BENCH_KEY_PREFIX, BENCH_SEED);
+}
+
+static uint64_t
+bench_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    /* xorshift64* */
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * Return a random double in [0, 1).
+ */
+static double
+bench_uniform(uint64_t *state)
+{
+    return (double)(bench_rand(state) >> 11) / (double)(1ULL << 53);
+}
+
+/*
+ * Precompute the constants of the zipfian generator of Gray et al.,
+ * "Quickly Generating Billion-Record Synthetic Databases", SIGMOD 1994.
+ */
+static void
+bench_zipf_init(void)
+{
+    double zeta2;
+    uint32_t i;
+
+    for (zetan = 0, i = 1; i <= opt.nkey; i++) {
+        zetan += 1.0 / pow((double)i, opt.theta);
+    }
+    zeta2 = 1.0 + 1.0 / pow(2.0, opt.theta);
+
+    alpha = 1.0 / (1.0 - opt.theta);
+    eta = (1.0 - pow(2.0 / opt.nkey, 1.0 - opt.theta)) / (1.0 - zeta2 / zetan);
+    half = 1.0 + pow(0.5, opt.theta);
+}
+
+static uint32_t
+bench_zipf(uint64_t *state)
+{
+    double u, uz;
+    uint32_t k;
+
+    u = bench_uniform(state);
+    uz = u * zetan;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < half) {
+        return 1;
+    }
+
+    k = (uint32_t)(opt.nkey * pow(eta * u - eta + 1.0, alpha));
+
+    return MIN(k, opt.nkey - 1);
+}
+
+static uint32_t
+bench_next_key(struct bench_thread *t)
+{
+    uint32_t nhot;
+
+    switch (opt.key_dist) {
+    case BENCH_KEY_ZIPF:
+        return bench_zipf(&t->rand);
+
+    case BENCH_KEY_HOTSPOT:
+        nhot = MAX((uint32_t)(opt.hot_frac * opt.nkey), 1);
+        if (nhot >= opt.nkey || bench_uniform(&t->rand) < opt.hot_prob) {
+            return (uint32_t)(bench_rand(&t->rand) % nhot);
+        }
+        return nhot + (uint32_t)(bench_rand(&t->rand) % (opt.nkey - nhot));
+
+    default:
+        return (uint32_t)(bench_rand(&t->rand) % opt.nkey);
+    }
+}
+
+static uint32_t
+bench_next_vlen(struct bench_thread *t)
+{
+    double v;
+
+    switch (opt.value_dist) {
+    case BENCH_VALUE_UNIFORM:
+        return opt.vmin +
+               (uint32_t)(bench_rand(&t->rand) % (opt.vmax - opt.vmin + 1));
+
+    case BENCH_VALUE_EXP:
+        v = -opt.vmean * log(1.0 - bench_uniform(&t->rand));
+        return (uint32_t)MIN(MAX(v, 1.0), (double)opt.vmax);
+
+    default:
+        return opt.vmin;
+    }
+}
+
+/*
+ * Return true if thread t has more requests to issue.
+ */
+static bool
+bench_more(struct bench_thread *t)
+{
+    if (t->stopping) {
+        return false;
+    }
+
+    if (t->loading) {
+        return t->load_next < opt.nkey;
+    }
+
+    if (opt.replay != NULL && t->replay_next == t->nreplay) {
+        return false;
+    }
+
+    return t->quota == 0 || t->nissued < t->quota;
+}
+
+static rstatus_t
+bench_issue(struct bench_thread *t, struct bench_conn *c)
+{
+    const struct trace_record *r;
+    char key[BENCH_HDR_SIZE];
+    uint32_t vlen, expiry, slot;
+    uint8_t op, *p;
+    size_t need;
+    int nkey, n;
+
+    expiry = opt.expiry;
+    if (t->loading) {
+        op = BENCH_OP_SET;
+        nkey = sprintf(key, "%s%"PRIu32, opt.prefix, t->load_next);
+        t->load_next += opt.nthread;
+        vlen = bench_next_vlen(t);
+    } else if (opt.replay != NULL) {
+        r = &records[t->replay[t->replay_next++]];
+        op = r->op == TRACE_OP_GET ? BENCH_OP_GET :
+             r->op == TRACE_OP_SET ? BENCH_OP_SET : BENCH_OP_DELETE;
+        nkey = trace_key(r, key);
+        vlen = MIN(r->vlen, BENCH_MAX_VALUE);
+        /* an absolute expiry has long passed by the time it is replayed */
+        expiry = r->expiry <= BENCH_MAX_EXPIRY ? r->expiry : 0;
+    } else {
+        op = (bench_rand(&t->rand) % (opt.get_weight + opt.set_weight) <
+              opt.get_weight) ? BENCH_OP_GET : BENCH_OP_SET;
+        nkey = sprintf(key, "%s%"PRIu32, opt.prefix, bench_next_key(t));
+        vlen = op == BENCH_OP_SET ? bench_next_vlen(t) : 0;
+    }
+
+    need = c->wlen + BENCH_HDR_SIZE + vlen;
+    if (need > c->wcap) {
+        p = fc_realloc(c->wbuf, need);
+        if (p == NULL) {
+            return FC_ENOMEM;
+        }
+        c->wbuf = p;
+        c->wcap = need;
+    }
+
+    p = c->wbuf + c->wlen;
+    if (op == BENCH_OP_GET) {
+        n = snprintf((char *)p, BENCH_HDR_SIZE, "get %.*s\r\n", nkey, key);
+    } else if (op == BENCH_OP_DELETE) {
+        n = snprintf((char *)p, BENCH_HDR_SIZE, "delete %.*s\r\n", nkey, key);
+    } else {
+        n = snprintf((char *)p, BENCH_HDR_SIZE, "set %.*s 0 %"PRIu32
+                     " %"PRIu32"\r\n", nkey, key, expiry, vlen);
+        fc_memcpy(p + n, value, vlen);
+        fc_memcpy(p + n + vlen, CRLF, 2);
+        n += vlen + 2;
+    }
+    c->wlen += (size_t)n;
+
+    slot = (c->head + c->ninflight) % opt.depth;
+    c->op[slot] = op;
+    c->stime[slot] = fc_nsec_now();
+    c->ninflight++;
+    t->nissued++;
+
+    return FC_OK;
+}
+
+static rstatus_t
+bench_event(struct bench_conn *c, bool out)
+{
+    struct epoll_event event;
+
+    if (c->out == out) {
+        return FC_OK;
+    }
+
+    event.events = EPOLLIN | (out ? EPOLLOUT : 0);
+    event.data.ptr = c;
+    if (epoll_ctl(c->t->ep, EPOLL_CTL_MOD, c->sd, &event) < 0) {
+        log_error("epoll ctl on sd %d failed: %s", c->sd, strerror(errno));
+        return FC_ERROR;
+    }
+    c->out = out ? 1 : 0;
+
+    return FC_OK;
+}
+
+static rstatus_t
+bench_send(struct bench_conn *c)
+{
+    ssize_t n;
+
+    while (c->wpos < c->wlen) {
+        n = write(c->sd, c->wbuf + c->wpos, c->wlen - c->wpos);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return bench_event(c, true);
+            }
+            log_error("write on sd %d failed: %s", c->sd, strerror(errno));
+            return FC_ERROR;
+        }
+        c->wpos += (size_t)n;
+    }
+
+    c->wpos = 0;
+    c->wlen = 0;
+
+    return bench_event(c, false);
+}
+
+/*
+ * Issue requests on connection c until depth of them are in flight, and
+ * send them.
+ */
+static rstatus_t
+bench_fill(struct bench_conn *c)
+{
+    rstatus_t status;
+
+    while (c->ninflight < opt.depth && bench_more(c->t)) {
+        status = bench_issue(c->t, c);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    return bench_send(c);
+}
+
+static void
+bench_done(struct bench_conn *c, bool ok)
+{
+    struct bench_thread *t = c->t;
+    uint64_t nsec;
+    uint8_t op;
+
+    op = c->op[c->head];
+    nsec = (uint64_t)MAX(fc_nsec_now() - c->stime[c->head], 0);
+    c->head = (c->head + 1) % opt.depth;
+    c->ninflight--;
+
+    if (t->loading) {
+        return;
+    }
+
+    if (op == BENCH_OP_GET) {
+        t->stats.nget++;
+        if (c->hit) {
+            t->stats.nhit++;
+        }
+        histogram_add(&t->stats.get, nsec);
+    } else if (op == BENCH_OP_SET) {
+        t->stats.nset++;
+        histogram_add(&t->stats.set, nsec);
+    } else {
+        t->stats.ndelete++;
+        histogram_add(&t->stats.delete, nsec);
+    }
+    if (!ok) {
+        t->stats.nerror++;
+    }
+}
+
+/*
+ * Consume the responses in the response buffer of connection c. A get
+ * response is a VALUE line, whose value is skipped over, and END; a set
+ * or delete response is a single line.
+ */
+static rstatus_t
+bench_parse(struct bench_conn *c)
+{
+    uint8_t *line, *eol, *p;
+    size_t len;
+    uint64_t n;
+
+    while (c->rpos < c->rlen) {
+        if (c->vskip > 0) {
+            n = MIN(c->vskip, c->rlen - c->rpos);
+            c->rpos += (uint32_t)n;
+            c->vskip -= n;
+            continue;
+        }
+
+        if (c->ninflight == 0) {
+            log_error("unexpected response on sd %d", c->sd);
+            return FC_ERROR;
+        }
+
+        line = c->rbuf + c->rpos;
+        eol = memchr(line, LF, c->rlen - c->rpos);
+        if (eol == NULL) {
+            break;
+        }
+        len = (size_t)(eol - line) + 1;
+        c->rpos += (uint32_t)len;
+
+        if (c->op[c->head] == BENCH_OP_SET) {
+            bench_done(c, len == 8 && memcmp(line, "STORED\r\n", 8) == 0);
+            continue;
+        }
+
+        if (c->op[c->head] == BENCH_OP_DELETE) {
+            bench_done(c, (len == 9 && memcmp(line, "DELETED\r\n", 9) == 0) ||
+                          (len == 11 && memcmp(line, "NOT_FOUND\r\n", 11) == 0));
+            continue;
+        }
+
+        if (len == 5 && memcmp(line, "END\r\n", 5) == 0) {
+            bench_done(c, true);
+            c->hit = 0;
+            continue;
+        }
+
+        if (len > 8 && memcmp(line, "VALUE ", 6) == 0) {
+            for (p = eol - 2; p > line && *p != ' '; p--) {}
+            c->vskip = strtoull((char *)p + 1, NULL, 10) + 2;
+            c->hit = 1;
+            continue;
+        }
+
+        /* an error ends the get without END */
+        c->hit = 0;
+        bench_done(c, false);
+    }
+
+    if (c->rpos == c->rlen) {
+        c->rpos = 0;
+        c->rlen = 0;
+    } else if (c->rpos > 0) {
+        memmove(c->rbuf, c->rbuf + c->rpos, c->rlen - c->rpos);
+        c->rlen -= c->rpos;
+        c->rpos = 0;
+    } else if (c->rlen == BENCH_RBUF_SIZE) {
+        log_error("response line on sd %d exceeds %d bytes", c->sd,
+                  BENCH_RBUF_SIZE);
+        return FC_ERROR;
+    }
+
+    return FC_OK;
+}
+
+static rstatus_t
+bench_recv(struct bench_conn *c)
+{
+    rstatus_t status;
+    ssize_t n;
+
+    for (;;) {
+        n = read(c->sd, c->rbuf + c->rlen, BENCH_RBUF_SIZE - c->rlen);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return FC_OK;
+            }
+            log_error("read on sd %d failed: %s", c->sd, strerror(errno));
+            return FC_ERROR;
+        }
+        if (n == 0) {
+            log_error("server closed sd %d", c->sd);
+            return FC_ERROR;
+        }
+        c->rlen += (uint32_t)n;
+
+        status = bench_parse(c);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+}
+
+static bool
+bench_idle(struct bench_thread *t)
+{
+    uint32_t i;
+
+    if (bench_more(t)) {
+        return false;
+    }
+
+    for (i = 0; i < t->nconn; i++) {
+        if (t->conn[i].ninflight > 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Drive the connections of thread t until it has no more requests to
+ * issue and none is in flight.
+ */
+static rstatus_t
+bench_run(struct bench_thread *t)
+{
+    struct epoll_event events[64];
+    struct bench_conn *c;
+    rstatus_t status;
+    uint32_t i;
+    int n, j;
+
+    for (i = 0; i < t->nconn; i++) {
+        status = bench_fill(&t->conn[i]);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+
+    while (!bench_idle(t)) {
+        n = epoll_wait(t->ep, events, NELEMS(events), 100);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("epoll wait failed: %s", strerror(errno));
+            return FC_ERROR;
+        }
+
+        if (stop) {
+            t->stopping = true;
+        }
+
+        for (j = 0; j < n; j++) {
+            c = events[j].data.ptr;
+
+            if (events[j].events & (EPOLLERR | EPOLLHUP)) {
+                log_error("error on sd %d", c->sd);
+                return FC_ERROR;
+            }
+
+            if (events[j].events & EPOLLIN) {
+                status = bench_recv(c);
+                if (status != FC_OK) {
+                    return status;
+                }
+            }
+
+            status = bench_fill(c);
+            if (status != FC_OK) {
+                return status;
+            }
+        }
+    }
+
+    return FC_OK;
+}
+
+static void *
+bench_loop(void *arg)
+{
+    struct bench_thread *t = arg;
+    rstatus_t status = FC_OK;
+
+    if (opt.load) {
+        t->loading = true;
+        t->load_next = t->id;
+        status = bench_run(t);
+        t->loading = false;
+        memset(&t->stats, 0, sizeof(t->stats));
+    }
+
+    pthread_barrier_wait(&barrier);
+
+    if (status == FC_OK) {
+        status = bench_run(t);
+    }
+    if (status != FC_OK) {
+        log_stderr("fcbench: thread %"PRIu32" failed", t->id);
+        exit(1);
+    }
+
+    return NULL;
+}
+
+static rstatus_t
+bench_connect(struct bench_thread *t, struct bench_conn *c)
+{
+    struct epoll_event event;
+
+    c->t = t;
+    c->sd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (c->sd < 0) {
+        log_stderr("fcbench: socket failed: %s", strerror(errno));
+        return FC_ERROR;
+    }
+
+    if (connect(c->sd, (struct sockaddr *)&addr, addrlen) < 0) {
+        log_stderr("fcbench: connect failed: %s", strerror(errno));
+        return FC_ERROR;
+    }
+
+    if (fc_set_nonblocking(c->sd) < 0) {
+        log_stderr("fcbench: set nonblock on sd %d failed: %s", c->sd,
+                   strerror(errno));
+        return FC_ERROR;
+    }
+
+    if (addr.ss_family != AF_UNIX) {
+        fc_set_tcpnodelay(c->sd);
+    }
+
+    c->rbuf = fc_alloc(BENCH_RBUF_SIZE);
+    c->wcap = (size_t)opt.depth * (BENCH_HDR_SIZE + opt.vmax);
+    c->wbuf = fc_alloc(c->wcap);
+    c->stime = fc_calloc(opt.depth, sizeof(*c->stime));
+    c->op = fc_calloc(opt.depth, sizeof(*c->op));
+    if (c->rbuf == NULL || c->wbuf == NULL || c->stime == NULL ||
+        c->op == NULL) {
+        return FC_ENOMEM;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = c;
+    if (epoll_ctl(t->ep, EPOLL_CTL_ADD, c->sd, &event) < 0) {
+        log_stderr("fcbench: epoll ctl on sd %d failed: %s", c->sd,
+                   strerror(errno));
+        return FC_ERROR;
+    }
+
+    return FC_OK;
+}
+
+static rstatus_t
+bench_resolve(void)
+{
+    struct sockaddr_un *un;
+    struct addrinfo hints, *ai;
+    char *host, *port;
+    int status;
+
+    if (opt.unix_path != NULL) {
+        un = (struct sockaddr_un *)&addr;
+        if (strlen(opt.unix_path) >= sizeof(un->sun_path)) {
+            log_stderr("fcbench: unix socket path '%s' is too long",
+                       opt.unix_path);
+            return FC_ERROR;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, opt.unix_path);
+        addrlen = sizeof(*un);
+        return FC_OK;
+    }
+
+    host = strdup(opt.server);
+    if (host == NULL) {
+        return FC_ENOMEM;
+    }
+    port = strrchr(host, ':');
+    if (port == NULL) {
+        log_stderr("fcbench: server '%s' is not host:port", opt.server);
+        free(host);
+        return FC_ERROR;
+    }
+    *port++ = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    status = getaddrinfo(host, port, &hints, &ai);
+    if (status != 0) {
+        log_stderr("fcbench: resolve '%s' failed: %s", opt.server,
+                   gai_strerror(status));
+        free(host);
+        return FC_ERROR;
+    }
+
+    memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+    addrlen = ai->ai_addrlen;
+    freeaddrinfo(ai);
+    free(host);
+
+    return FC_OK;
+}
+
+static void
+bench_report_latency(const char *name, const struct histogram *h)
+{
+    static const struct {
+        const char *name;
+        uint32_t   q;
+    } quantiles[] = {
+        { "p50", 500 }, { "p90", 900 }, { "p99", 990 }, { "p999", 999 },
+    };
+    uint32_t i;
+
+    if (h->count == 0) {
+        return;
+    }
+
+    printf("%s_mean_us %.2f\n", name, (double)h->sum / h->count / 1000);
+    for (i = 0; i < NELEMS(quantiles); i++) {
+        printf("%s_%s_us %.2f\n", name, quantiles[i].name,
+               (double)histogram_quantile(h, quantiles[i].q) / 1000);
+    }
+    printf("%s_max_us %.2f\n", name, (double)h->max / 1000);
+}
+
+static void
+bench_report(struct bench_thread *threads, double elapsed)
+{
+    struct bench_stats *sum;
+    uint32_t i;
+
+    sum = fc_calloc(1, sizeof(*sum));
+    if (sum == NULL) {
+        return;
+    }
+
+    for (i = 0; i < opt.nthread; i++) {
+        sum->nget += threads[i].stats.nget;
+        sum->nhit += threads[i].stats.nhit;
+        sum->nset += threads[i].stats.nset;
+        sum->ndelete += threads[i].stats.ndelete;
+        sum->nerror += threads[i].stats.nerror;
+        histogram_merge(&sum->get, &threads[i].stats.get);
+        histogram_merge(&sum->set, &threads[i].stats.set);
+        histogram_merge(&sum->delete, &threads[i].stats.delete);
+    }
+
+    printf("server %s\n", opt.unix_path != NULL ? opt.unix_path : opt.server);
+    printf("connections %"PRIu32"\n", opt.nconn);
+    printf("threads %"PRIu32"\n", opt.nthread);
+    printf("depth %"PRIu32"\n", opt.depth);
+    if (opt.replay != NULL) {
+        printf("replay %s\n", opt.replay);
+        printf("replay_records %"PRIu64"\n", nrecord);
+        printf("replay_skipped %"PRIu64"\n", nskip);
+    }
+    printf("elapsed_s %.3f\n", elapsed);
+    printf("requests %"PRIu64"\n", sum->nget + sum->nset + sum->ndelete);
+    printf("throughput %.1f\n",
+           (sum->nget + sum->nset + sum->ndelete) / elapsed);
+    printf("get %"PRIu64"\n", sum->nget);
+    printf("get_hit %"PRIu64"\n", sum->nhit);
+    printf("get_miss %"PRIu64"\n", sum->nget - sum->nhit);
+    printf("set %"PRIu64"\n", sum->nset);
+    printf("delete %"PRIu64"\n", sum->ndelete);
+    printf("error %"PRIu64"\n", sum->nerror);
+    bench_report_latency("get", &sum->get);
+    bench_report_latency("set", &sum->set);
+    bench_report_latency("delete", &sum->delete);
+
+    fc_free(sum);
+}
+
+static rstatus_t
+bench_parse_key_dist(char *arg)
+{
+    if (strcmp(arg, "uniform") == 0) {
+        opt.key_dist = BENCH_KEY_UNIFORM;
+        return FC_OK;
+    }
+
+    if (strncmp(arg, "zipf", 4) == 0) {
+        opt.key_dist = BENCH_KEY_ZIPF;
+        opt.theta = 0.99;
+        if (arg[4] == ':') {
+            opt.theta = atof(arg + 5);
+        } else if (arg[4] != '\0') {
+            return FC_ERROR;
+        }
+        return opt.theta > 0 && opt.theta < 1 ? FC_OK : FC_ERROR;
+    }
+
+    if (strncmp(arg, "hotspot", 7) == 0) {
+        opt.key_dist = BENCH_KEY_HOTSPOT;
+        opt.hot_frac = 0.2;
+        opt.hot_prob = 0.8;
+        if (arg[7] == ':') {
+            if (sscanf(arg + 8, "%lf:%lf", &opt.hot_frac, &opt.hot_prob) != 2) {
+                return FC_ERROR;
+            }
+        } else if (arg[7] != '\0') {
+            return FC_ERROR;
+        }
+        return opt.hot_frac > 0 && opt.hot_frac <= 1 && opt.hot_prob >= 0 &&
+               opt.hot_prob <= 1 ? FC_OK : FC_ERROR;
+    }
+
+    return FC_ERROR;
+}
+
+static rstatus_t
+bench_parse_value_size(char *arg)
+{
+    unsigned a, b;
+
+    if (sscanf(arg, "fixed:%u", &a) == 1) {
+        opt.value_dist = BENCH_VALUE_FIXED;
+        opt.vmin = opt.vmax = a;
+    } else if (sscanf(arg, "uniform:%u:%u", &a, &b) == 2 && a <= b) {
+        opt.value_dist = BENCH_VALUE_UNIFORM;
+        opt.vmin = a;
+        opt.vmax = b;
+    } else if (sscanf(arg, "exp:%u:%u", &a, &b) == 2 && a > 0 && a <= b) {
+        opt.value_dist = BENCH_VALUE_EXP;
+        opt.vmean = a;
+        opt.vmin = 1;
+        opt.vmax = b;
+    } else {
+        return FC_ERROR;
+    }
+
+    return opt.vmax <= BENCH_MAX_VALUE ? FC_OK : FC_ERROR;
+}
+
+static rstatus_t
+bench_get_options(int argc, char **argv)
+{
+    int c, value;
+    long long n;
+
+    opterr = 0;
+
+    for (;;) {
+        c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'h':
+            show_help = 1;
+            break;
+
+        case 's':
+            opt.server = optarg;
+            break;
+
+        case 'u':
+            opt.unix_path = optarg;
+            break;
+
+        case 'c':
+        case 't':
+        case 'd':
+        case 'T':
+        case 'k':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value <= 0) {
+                log_stderr("fcbench: option -%c requires a non zero number", c);
+                return FC_ERROR;
+            }
+            if (c == 'c') {
+                opt.nconn = (uint32_t)value;
+            } else if (c == 't') {
+                opt.nthread = (uint32_t)value;
+            } else if (c == 'd') {
+                opt.depth = (uint32_t)value;
+            } else if (c == 'T') {
+                opt.duration = (uint32_t)value;
+            } else {
+                opt.nkey = (uint32_t)value;
+            }
+            break;
+
+        case 'n':
+            n = atoll(optarg);
+            if (n <= 0) {
+                log_stderr("fcbench: option -n requires a non zero number");
+                return FC_ERROR;
+            }
+            opt.nrequest = (uint64_t)n;
+            break;
+
+        case 'K':
+            if (bench_parse_key_dist(optarg) != FC_OK) {
+                log_stderr("fcbench: option -K value '%s' is not uniform, "
+                           "zipf[:THETA] with 0 < THETA < 1 or "
+                           "hotspot[:FRAC:PROB]", optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'z':
+            if (bench_parse_value_size(optarg) != FC_OK) {
+                log_stderr("fcbench: option -z value '%s' is not fixed:N, "
+                           "uniform:MIN:MAX or exp:MEAN:MAX of at most %d "
+                           "bytes", optarg, BENCH_MAX_VALUE);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'r':
+            if (sscanf(optarg, "%u:%u", &opt.get_weight, &opt.set_weight) != 2 ||
+                opt.get_weight + opt.set_weight == 0) {
+                log_stderr("fcbench: option -r value '%s' is not G:S", optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'e':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("fcbench: option -e requires a number");
+                return FC_ERROR;
+            }
+            opt.expiry = (uint32_t)value;
+            break;
+
+        case 'l':
+            opt.load = true;
+            break;
+
+        case 'x':
+            if (strlen(optarg) > 200) {
+                log_stderr("fcbench: option -x value is too long");
+                return FC_ERROR;
+            }
+            opt.prefix = optarg;
+            break;
+
+        case 'S':
+            opt.seed = (uint64_t)atoll(optarg);
+            break;
+
+        case 'R':
+            opt.replay = optarg;
+            break;
+
+        case '?':
+            log_stderr("fcbench: invalid option -- '%c'", optopt);
+            return FC_ERROR;
+
+        default:
+            log_stderr("fcbench: invalid option -- '%c'", c);
+            return FC_ERROR;
+        }
+    }
+
+    return FC_OK;
+}
+
+static void
+bench_set_default_options(void)
+{
+    opt.server = BENCH_SERVER;
+    opt.unix_path = NULL;
+    opt.nconn = BENCH_CONNECTIONS;
+    opt.nthread = BENCH_THREADS;
+    opt.depth = BENCH_DEPTH;
+    opt.duration = BENCH_DURATION;
+    opt.nrequest = 0;
+    opt.nkey = BENCH_KEYS;
+    bench_parse_key_dist(BENCH_KEY_DIST);
+    bench_parse_value_size(BENCH_VALUE_SIZE);
+    sscanf(BENCH_RATIO, "%u:%u", &opt.get_weight, &opt.set_weight);
+    opt.expiry = BENCH_EXPIRY;
+    opt.load = false;
+    opt.prefix = BENCH_KEY_PREFIX;
+    opt.seed = BENCH_SEED;
+    opt.replay = NULL;
+}
+
+/*
+ * Load the trace to replay and hand its records out to threads by key
+ * digest, so that the requests of a key are issued by one thread in the
+ * order they arrived. Incr and decr are not replayed, as the trace does
+ * not record their delta.
+ */
+static rstatus_t
+bench_replay_init(struct bench_thread *threads)
+{
+    struct trace_hdr hdr;
+    struct bench_thread *t;
+    const uint8_t *md;
+    uint64_t i;
+    uint32_t id;
+
+    if (trace_load(opt.replay, &hdr, &records, &nrecord) != FC_OK) {
+        log_stderr("fcbench: load trace '%s' failed", opt.replay);
+        return FC_ERROR;
+    }
+
+    for (id = 0; id < opt.nthread; id++) {
+        threads[id].replay = fc_alloc(MAX(nrecord, 1) * sizeof(uint64_t));
+        if (threads[id].replay == NULL) {
+            return FC_ENOMEM;
+        }
+    }
+
+    opt.vmax = 0;
+    for (nskip = 0, i = 0; i < nrecord; i++) {
+        if (records[i].op == TRACE_OP_OTHER) {
+            nskip++;
+            continue;
+        }
+
+        md = records[i].md;
+        id = (((uint32_t)md[3] << 24) | ((uint32_t)md[2] << 16) |
+              ((uint32_t)md[1] << 8) | md[0]) % opt.nthread;
+        t = &threads[id];
+        t->replay[t->nreplay++] = i;
+
+        opt.vmax = MAX(opt.vmax, MIN(records[i].vlen, BENCH_MAX_VALUE));
+    }
+
+    return FC_OK;
+}
+
+static void
+bench_stop(int signo)
+{
+    stop = true;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench_thread *threads, *t;
+    int64_t start, deadline;
+    uint32_t i;
+
+    bench_set_default_options();
+
+    if (bench_get_options(argc, argv) != FC_OK) {
+        bench_show_usage();
+        exit(1);
+    }
+
+    if (show_help) {
+        bench_show_usage();
+        exit(0);
+    }
+
+    if (log_init(LOG_WARN, NULL) != FC_OK) {
+        exit(1);
+    }
+
+    if (bench_resolve() != FC_OK) {
+        exit(1);
+    }
+
+    if (opt.replay != NULL && opt.load) {
+        log_stderr("fcbench: option -l cannot be used with -R");
+        exit(1);
+    }
+
+    opt.nthread = MIN(opt.nthread, opt.nconn);
+    if (opt.key_dist == BENCH_KEY_ZIPF && opt.replay == NULL) {
+        bench_zipf_init();
+    }
+
+    threads = fc_calloc(opt.nthread, sizeof(*threads));
+    if (threads == NULL) {
+        log_stderr("fcbench: out of memory");
+        exit(1);
+    }
+
+    if (opt.replay != NULL && bench_replay_init(threads) != FC_OK) {
+        exit(1);
+    }
+
+    value = fc_alloc(MAX(opt.vmax, 1));
+    if (value == NULL) {
+        log_stderr("fcbench: out of memory");
+        exit(1);
+    }
+    memset(value, 'x', MAX(opt.vmax, 1));
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, bench_stop);
+    pthread_barrier_init(&barrier, NULL, opt.nthread + 1);
+
+    for (i = 0; i < opt.nthread; i++) {
+        t = &threads[i];
+        t->id = i;
+        t->rand = (opt.seed + i + 1) * 0x9E3779B97F4A7C15ULL;
+        t->nconn = opt.nconn / opt.nthread + (i < opt.nconn % opt.nthread);
+        if (opt.nrequest != 0) {
+            t->quota = opt.nrequest / opt.nthread +
+                       (i < opt.nrequest % opt.nthread);
+        }
+        t->conn = fc_calloc(t->nconn, sizeof(*t->conn));
+        t->ep = epoll_create(t->nconn);
+        if (t->conn == NULL || t->ep < 0) {
+            log_stderr("fcbench: thread %"PRIu32" setup failed", i);
+            exit(1);
+        }
+    }
+
+    /* connect every connection before any thread starts loading */
+    for (i = 0; i < opt.nthread; i++) {
+        uint32_t j;
+
+        for (j = 0; j < threads[i].nconn; j++) {
+            if (bench_connect(&threads[i], &threads[i].conn[j]) != FC_OK) {
+                exit(1);
+            }
+        }
+    }
+
+    for (i = 0; i < opt.nthread; i++) {
+        if (pthread_create(&threads[i].tid, NULL, bench_loop, &threads[i]) != 0) {
+            log_stderr("fcbench: create thread failed: %s", strerror(errno));
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&barrier);
+    start = fc_nsec_now();
+
+    /* a replay runs until the trace is exhausted */
+    if (opt.nrequest == 0 && opt.replay == NULL) {
+        deadline = start + (int64_t)opt.duration * 1000000000LL;
+        while (!stop && fc_nsec_now() < deadline) {
+            usleep(10000);
+        }
+        stop = true;
+    }
+
+    for (i = 0; i < opt.nthread; i++) {
+        pthread_join(threads[i].tid, NULL);
+    }
+
+    bench_report(threads, (double)(fc_nsec_now() - start) / 1e9);
+
+    return 0;
+}
@@ -0,0 +1,581 @@
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fc_core.h>
+#include <fc_memcache.h>
+
+/*
+ * memcache_parse_test runs the fast path and the state machine of the
+ * ascii request parser over the same request buffers and fails on the
+ * first field that they parse differently. The buffers are edge cases
+ * written out below and requests generated at random from the grammar,
+ * some of them mangled. Each buffer is also parsed as it would come in
+ * over a connection, in two reads, and has to end up parsed as in one.
+ *
+ * The fast path may give up on any buffer, but then it must leave the
+ * request untouched, as the state machine goes on from there.
+ */
+
+#define TEST_SEED       1
+#define TEST_NREQ       200000      /* # generated request buffer */
+#define TEST_BUF_SIZE   2048        /* max request buffer length */
+
+struct settings settings;           /* fatcache settings */
+
+static uint64_t rand_state;         /* random state */
+static uint64_t nfast;              /* # buffer parsed by the fast path */
+static uint64_t nbuf;               /* # buffer parsed */
+
+static uint64_t
+test_rand(void)
+{
+    uint64_t x = rand_state;
+
+    /* xorshift64* */
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rand_state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* return a random number in [0, n) */
+static uint32_t
+test_rand_n(uint32_t n)
+{
+    return (uint32_t)(test_rand() % n);
+}
+
+static void
+test_dump(const char *what, uint8_t *buf, size_t len)
+{
+    size_t i;
+
+    fprintf(stderr, "memcache_parse_test: %s in %zu byte buffer:\n", what,
+            len);
+    for (i = 0; i < len; i++) {
+        if (buf[i] >= 0x20 && buf[i] < 0x7f) {
+            fputc(buf[i], stderr);
+        } else {
+            fprintf(stderr, "\\x%02x", buf[i]);
+        }
+    }
+    fputc('\n', stderr);
+}
+
+/*
+ * Set up request r over mbuf b, the way msg_get() hands it to the parser.
+ */
+static void
+test_msg_init(struct msg *r, struct mbuf *b)
+{
+    memset(r, 0, sizeof(*r));
+    STAILQ_INIT(&r->mhdr);
+    mbuf_insert(&r->mhdr, b);
+    r->pos = b->pos;
+    r->parser = memcache_parse_req;
+    r->result = MSG_PARSE_OK;
+    r->type = MSG_UNKNOWN;
+    r->request = 1;
+}
+
+#define TEST_FIELD(_a, _b, _field, _name) do {                              \
+    if ((_a)->_field != (_b)->_field) {                                     \
+        *(_name) = #_field;                                                 \
+        return false;                                                       \
+    }                                                                       \
+} while (0)
+
+/*
+ * Return true if requests a and b are parsed alike, or false with the
+ * first field that differs in name.
+ */
+static bool
+test_msg_same(struct msg *a, struct msg *b, const char **name)
+{
+    TEST_FIELD(a, b, result, name);
+    TEST_FIELD(a, b, state, name);
+    TEST_FIELD(a, b, pos, name);
+    TEST_FIELD(a, b, token, name);
+    TEST_FIELD(a, b, type, name);
+    TEST_FIELD(a, b, key_start, name);
+    TEST_FIELD(a, b, key_end, name);
+    TEST_FIELD(a, b, flags, name);
+    TEST_FIELD(a, b, expiry, name);
+    TEST_FIELD(a, b, vlen, name);
+    TEST_FIELD(a, b, rvlen, name);
+    TEST_FIELD(a, b, value, name);
+    TEST_FIELD(a, b, cas, name);
+    TEST_FIELD(a, b, num, name);
+    TEST_FIELD(a, b, mflags, name);
+    TEST_FIELD(a, b, opaque_start, name);
+    TEST_FIELD(a, b, opaque_end, name);
+    TEST_FIELD(a, b, noreply, name);
+    TEST_FIELD(a, b, quiet, name);
+    TEST_FIELD(a, b, meta, name);
+    TEST_FIELD(a, b, vwait, name);
+
+    return true;
+}
+
+/*
+ * Return true if request a, parsed from a buffer in one read, and request
+ * b, parsed from the same buffer in two, agree on the outcome. How far
+ * the state machine got through a value with rvlen and where it stopped
+ * differ by read, unless the request was parsed in full.
+ */
+static bool
+test_msg_same_split(struct msg *a, struct msg *b, const char **name)
+{
+    TEST_FIELD(a, b, result, name);
+    if (a->result == MSG_PARSE_ERROR) {
+        return true;
+    }
+
+    TEST_FIELD(a, b, pos, name);
+    TEST_FIELD(a, b, type, name);
+    TEST_FIELD(a, b, key_start, name);
+    TEST_FIELD(a, b, key_end, name);
+    TEST_FIELD(a, b, flags, name);
+    TEST_FIELD(a, b, expiry, name);
+    TEST_FIELD(a, b, vlen, name);
+    TEST_FIELD(a, b, value, name);
+    TEST_FIELD(a, b, cas, name);
+    TEST_FIELD(a, b, num, name);
+    TEST_FIELD(a, b, mflags, name);
+    TEST_FIELD(a, b, noreply, name);
+
+    return true;
+}
+
+/*
+ * Copy buffer [buf, buf + len) into mbuf b and fill the space after it
+ * with bytes that a parser reading past the data would trip over.
+ */
+static void
+test_mbuf_fill(struct mbuf *b, uint8_t *buf, size_t len)
+{
+    static const uint8_t junk[] = { ' ', CR, LF, '0', 'x' };
+
+    ASSERT(len < (size_t)(b->end - b->start));
+
+    b->pos = b->start;
+    b->last = b->start + len;
+    fc_memcpy(b->start, buf, len);
+    memset(b->last, junk[test_rand_n(NELEMS(junk))], (size_t)(b->end - b->last));
+}
+
+/*
+ * Parse buffer [buf, buf + len) with the fast path and with the state
+ * machine, and then with the parser entry point in two reads split at a
+ * random offset. Exit on the first difference.
+ */
+static void
+test_parse(struct mbuf *b, uint8_t *buf, size_t len)
+{
+    struct msg pre, fast, fsa, split;
+    const char *name;
+    size_t cut;
+    bool parsed;
+
+    nbuf++;
+
+    test_mbuf_fill(b, buf, len);
+
+    test_msg_init(&pre, b);
+    fast = pre;
+    parsed = memcache_parse_req_fast(&fast) == FC_OK;
+    if (parsed) {
+        nfast++;
+    } else if (!test_msg_same(&fast, &pre, &name)) {
+        test_dump("fast path gave up but changed the request", buf, len);
+        fprintf(stderr, "field %s\n", name);
+        exit(1);
+    }
+
+    test_msg_init(&fsa, b);
+    memcache_parse_req_fsa(&fsa);
+
+    if (parsed && !test_msg_same(&fast, &fsa, &name)) {
+        test_dump("fast path and state machine differ", buf, len);
+        fprintf(stderr, "field %s: result %d %d type %d %d vlen %"PRIu32" "
+                "%"PRIu32" flags %"PRIu32" %"PRIu32" expiry %"PRIu32" "
+                "%"PRIu32" cas %"PRIu64" %"PRIu64"\n", name, fast.result,
+                fsa.result, fast.type, fsa.type, fast.vlen, fsa.vlen,
+                fast.flags, fsa.flags, fast.expiry, fsa.expiry, fast.cas,
+                fsa.cas);
+        exit(1);
+    }
+
+    /* the same buffer, in two reads */
+    cut = len == 0 ? 0 : test_rand_n((uint32_t)len);
+    test_mbuf_fill(b, buf, cut);
+    test_msg_init(&split, b);
+    memcache_parse_req(&split);
+    if (split.result == MSG_PARSE_AGAIN) {
+        fc_memcpy(b->last, buf + cut, len - cut);
+        b->last += len - cut;
+        memcache_parse_req(&split);
+    }
+
+    if (!test_msg_same_split(&fsa, &split, &name)) {
+        test_dump("parsed differently when split", buf, len);
+        fprintf(stderr, "split at %zu, field %s: result %d %d\n", cut, name,
+                fsa.result, split.result);
+        exit(1);
+    }
+}
+
+static size_t
+test_put(uint8_t *buf, size_t n, const char *s)
+{
+    size_t len = strlen(s);
+
+    if (n + len > TEST_BUF_SIZE) {
+        return n;
+    }
+    fc_memcpy(buf + n, s, len);
+
+    return n + len;
+}
+
+static size_t
+test_put_key(uint8_t *buf, size_t n, size_t klen, uint8_t c)
+{
+    if (n + klen > TEST_BUF_SIZE) {
+        return n;
+    }
+    memset(buf + n, c, klen);
+
+    return n + klen;
+}
+
+/*
+ * Edge cases: keys around the max length, numbers around the overflow of
+ * their fields, noreply and things that look like it, partial values and
+ * stray CRs where the grammar has none.
+ */
+static void
+test_edge(struct mbuf *b)
+{
+    static const char *edges[] = {
+        "get k\r\n",
+        "gets k\r\n",
+        "get a b c\r\n",
+        "get k \r\n",
+        "get  k\r\n",
+        "get k noreply\r\n",
+        "get\r\n",
+        "get \r\n",
+        "get k\n",
+        "get k\r",
+        "get k\rx\n",
+        "get k\r\r\n",
+        "ge\rt k\r\n",
+        "get k\r\nget l\r\n",
+        "delete k\r\n",
+        "delete k noreply\r\n",
+        "delete k norepl\r\n",
+        "delete k noreplyy\r\n",
+        "delete k NOREPLY\r\n",
+        "delete k 0\r\n",
+        "delete k noreply \r\n",
+        "delete k noreply\r\r\n",
+        "set k 0 0 1\r\nv\r\n",
+        "set k 0 0 1 noreply\r\nv\r\n",
+        "set k 0 0 1  noreply\r\nv\r\n",
+        "set k 0 0 1 noreply\rv\r\n",
+        "set k 0 0 0\r\n\r\n",
+        "set k 0 0 1\r\n\r\r\n",
+        "set k 0 0 2\r\nv\r\n",
+        "set k 0 0 1\r\nvv\r\n",
+        "set k 0 0 1\r\nv\n",
+        "set k 0 0 1\r\nv\r",
+        "set k 0 0 1\r\nv",
+        "set k 0 0 10\r\nvvvv",
+        "set k 0 0 3\r\n\r\n\r\r\n",
+        "set k 0 0 1\r\nv\rx\r\n",
+        "set k 0 0 1\r\nv\rget k\r\n",
+        "set k 0 0 1\r\nv\r\r\n",
+        "set k\r 0 0 1\r\nv\r\n",
+        "set k 0 0 1\r\nv\r\nget k\r\n",
+        "set k 4294967295 0 1\r\nv\r\n",
+        "set k 4294967296 0 1\r\nv\r\n",
+        "set k 99999999999 0 1\r\nv\r\n",
+        "set k 0 4294967295 1\r\nv\r\n",
+        "set k 0 4294967297 1\r\nv\r\n",
+        "set k 0 0 4294967297\r\nv\r\n",
+        "set k 0 0 4294967296\r\n\r\n",
+        "set k 0 0 01\r\nv\r\n",
+        "set k -1 0 1\r\nv\r\n",
+        "set k 0 0 1x\r\nv\r\n",
+        "set k 0 0\r\nv\r\n",
+        "set k 0 0 \r\nv\r\n",
+        "set k 0 0 1 \r\nv\r\n",
+        "set k  0 0 1\r\nv\r\n",
+        "set k 0\r0 1\r\nv\r\n",
+        "cas k 0 0 1 18446744073709551615\r\nv\r\n",
+        "cas k 0 0 1 18446744073709551616\r\nv\r\n",
+        "cas k 0 0 1 99999999999999999999999\r\nv\r\n",
+        "cas k 0 0 1 1 noreply\r\nv\r\n",
+        "cas k 0 0 1\r\nv\r\n",
+        "cas k 0 0 1 \r\nv\r\n",
+        "add k 0 0 1\r\nv\r\n",
+        "replace k 0 0 1 noreply\r\nv\r\n",
+        "append k 0 0 1\r\nv\r\n",
+        "prepend k 0 0 1\r\nv\r\n",
+        "incr k 1\r\n",
+        "decr k 18446744073709551616\r\n",
+        "incr k 1 noreply\r\n",
+        "version\r\n",
+        "quit\r\n",
+        "stats\r\n",
+        "GET k\r\n",
+        "mg k v\r\n",
+        "\r\n",
+        " get k\r\n",
+    };
+    uint8_t buf[TEST_BUF_SIZE];
+    size_t i, n, klen;
+
+    for (i = 0; i < NELEMS(edges); i++) {
+        n = test_put(buf, 0, edges[i]);
+        test_parse(b, buf, n);
+    }
+
+    /* keys around the max length, for each command */
+    for (klen = MEMCACHE_MAX_KEY_LENGTH - 1;
+         klen <= MEMCACHE_MAX_KEY_LENGTH + 1; klen++) {
+        static const char *cmds[] = { "get ", "gets ", "delete ", "set ",
+                                      "cas ", "incr " };
+        static const char *args[] = { "\r\n", "\r\n", " noreply\r\n",
+                                      " 1 2 3\r\nvvv\r\n",
+                                      " 1 2 3 4\r\nvvv\r\n", " 5\r\n" };
+
+        for (i = 0; i < NELEMS(cmds); i++) {
+            n = test_put(buf, 0, cmds[i]);
+            n = test_put_key(buf, n, klen, 'k');
+            n = test_put(buf, n, args[i]);
+            test_parse(b, buf, n);
+        }
+    }
+}
+
+static size_t
+test_gen_num(uint8_t *buf, size_t n)
+{
+    static const char *nums[] = {
+        "0", "1", "007", "4294967295", "4294967296", "4294967297",
+        "99999999999", "18446744073709551615", "18446744073709551616",
+        "-1", "", "1x", " 1", "1\r",
+    };
+    char num[32];
+    uint32_t i, ndigit;
+
+    if (test_rand_n(2) == 0) {
+        return test_put(buf, n, nums[test_rand_n(NELEMS(nums))]);
+    }
+
+    ndigit = 1 + test_rand_n(22);
+    for (i = 0; i < ndigit; i++) {
+        num[i] = (char)('0' + test_rand_n(10));
+    }
+    num[ndigit] = '\0';
+
+    return test_put(buf, n, num);
+}
+
+static size_t
+test_gen_key(uint8_t *buf, size_t n)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789:_-.";
+    uint32_t klen, i;
+
+    switch (test_rand_n(4)) {
+    case 0:
+        klen = MEMCACHE_MAX_KEY_LENGTH - 1 + test_rand_n(3);
+        break;
+
+    default:
+        klen = 1 + test_rand_n(40);
+        break;
+    }
+
+    if (n + klen > TEST_BUF_SIZE) {
+        return n;
+    }
+    for (i = 0; i < klen; i++) {
+        buf[n + i] = (uint8_t)chars[test_rand_n(sizeof(chars) - 1)];
+    }
+
+    return n + klen;
+}
+
+/*
+ * Generate a request into buf, mostly well formed, and return its length.
+ */
+static size_t
+test_gen(uint8_t *buf)
+{
+    static const char *cmds[] = {
+        "get", "gets", "delete", "set", "add", "replace", "append",
+        "prepend", "cas", "incr", "decr", "get", "set", "quit", "version",
+    };
+    static const char *noreplys[] = {
+        " noreply", " noreply", " noreply", " norepl", " noreplyy",
+        " NOREPLY", "  noreply", " noreply ",
+    };
+    static const char *crlfs[] = {
+        "\r\n", "\r\n", "\r\n", "\r\n", "\n", "\r", "\r\r\n", " \r\n",
+    };
+    static const uint8_t mangles[] = { ' ', CR, LF, '0', 'a', '\0' };
+    const char *cmd;
+    size_t n, vstart;
+    uint32_t i, vlen, nkey;
+    bool storage, cas;
+    char num[16];
+
+    cmd = cmds[test_rand_n(NELEMS(cmds))];
+    storage = strcmp(cmd, "set") == 0 || strcmp(cmd, "add") == 0 ||
+              strcmp(cmd, "replace") == 0 || strcmp(cmd, "append") == 0 ||
+              strcmp(cmd, "prepend") == 0 || strcmp(cmd, "cas") == 0;
+    cas = strcmp(cmd, "cas") == 0;
+
+    n = test_put(buf, 0, cmd);
+    if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "version") == 0) {
+        return test_put(buf, n, crlfs[test_rand_n(NELEMS(crlfs))]);
+    }
+
+    n = test_put(buf, n, test_rand_n(16) == 0 ? "  " : " ");
+    n = test_gen_key(buf, n);
+
+    if (strncmp(cmd, "get", 3) == 0 && test_rand_n(4) == 0) {
+        nkey = 1 + test_rand_n(3);
+        for (i = 0; i < nkey; i++) {
+            n = test_put(buf, n, " ");
+            n = test_gen_key(buf, n);
+        }
+    }
+
+    if (strcmp(cmd, "incr") == 0 || strcmp(cmd, "decr") == 0) {
+        n = test_put(buf, n, " ");
+        n = test_gen_num(buf, n);
+    }
+
+    vlen = test_rand_n(8) == 0 ? test_rand_n(1024) : test_rand_n(64);
+    if (storage) {
+        n = test_put(buf, n, " ");
+        n = test_gen_num(buf, n);
+        n = test_put(buf, n, " ");
+        n = test_gen_num(buf, n);
+        n = test_put(buf, n, " ");
+        if (test_rand_n(8) == 0) {
+            n = test_gen_num(buf, n);
+        } else {
+            snprintf(num, sizeof(num), "%"PRIu32"", vlen);
+            n = test_put(buf, n, num);
+        }
+        if (cas) {
+            n = test_put(buf, n, " ");
+            n = test_gen_num(buf, n);
+        }
+    }
+
+    if (test_rand_n(3) == 0) {
+        n = test_put(buf, n, noreplys[test_rand_n(NELEMS(noreplys))]);
+    }
+    n = test_put(buf, n, test_rand_n(8) == 0 ?
+                 crlfs[test_rand_n(NELEMS(crlfs))] : "\r\n");
+
+    if (storage && n + vlen + CRLF_LEN <= TEST_BUF_SIZE) {
+        vstart = n;
+        for (i = 0; i < vlen; i++) {
+            buf[n++] = (uint8_t)('a' + test_rand_n(26));
+        }
+        /* values are opaque, crlf and all */
+        if (vlen > 0 && test_rand_n(4) == 0) {
+            buf[vstart + test_rand_n(vlen)] = mangles[test_rand_n(3)];
+        }
+        n = test_put(buf, n, test_rand_n(8) == 0 ?
+                     crlfs[test_rand_n(NELEMS(crlfs))] : "\r\n");
+    }
+
+    /* a stray byte anywhere */
+    if (n > 0 && test_rand_n(8) == 0) {
+        buf[test_rand_n((uint32_t)n)] = mangles[test_rand_n(NELEMS(mangles))];
+    }
+
+    /* a partial request */
+    if (n > 0 && test_rand_n(8) == 0) {
+        n = test_rand_n((uint32_t)n);
+    }
+
+    /* a pipelined request after it */
+    if (test_rand_n(8) == 0) {
+        n = test_put(buf, n, "get k\r\n");
+    }
+
+    return n;
+}
+
+int
+main(void)
+{
+    uint8_t buf[TEST_BUF_SIZE];
+    struct mbuf *b;
+    uint32_t i;
+
+    if (log_init(LOG_WARN, NULL) != FC_OK) {
+        exit(1);
+    }
+
+    mbuf_init();
+    memcache_init();
+    rand_state = TEST_SEED;
+
+    b = mbuf_get();
+    if (b == NULL) {
+        log_stderr("memcache_parse_test: out of memory");
+        exit(1);
+    }
+    ASSERT(mbuf_size(b) > TEST_BUF_SIZE);
+
+    test_edge(b);
+
+    for (i = 0; i < TEST_NREQ; i++) {
+        test_parse(b, buf, test_gen(buf));
+    }
+
+    mbuf_put(b);
+
+    /* the fast path has to have been taken, or it was not tested */
+    if (nfast < nbuf / 8) {
+        log_stderr("memcache_parse_test: fast path parsed only %"PRIu64" of "
+                   "%"PRIu64" buffers", nfast, nbuf);
+        exit(1);
+    }
+
+    printf("memcache_parse_test: %"PRIu64" buffers, %"PRIu64" parsed by the "
+           "fast path, all parsed alike\n", nbuf, nfast);
+
+    return 0;
+}
@@ -1,72 +1,458 @@
-//#include <fc_core.h>
+/*
+ * fatcache - memcache on ssd.
+ * Copyright (C) 2013 Twitter, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <fc_common.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
 
-#include <fc_queue.h>
-#include <fc_log.h>
+#include <fc_core.h>
+#include <fc_histogram.h>
 
+/*
+ * stg_ins_test runs the storage engine, the item index and the slabs, in
+ * process with no networking, on a regular file or a block device as the
+ * ssd, and times it with a set of microbenchmarks:
+ *
+ *  index : insert, lookup hit, lookup miss and remove of the item index
+ *  alloc : fill memory slabs, remove every other item and fill the holes
+ *  drain : sets over the key space that flush memory slabs to disk until
+ *          the disk wrapped around twice, under the eviction policy
+ *  mixed : gets and sets with uniform or zipfian keys over a loaded cache
+ *  replay: the gets, sets and deletes of a workload trace that fatcache
+ *          wrote, with the tier each get is served from compared to the
+ *          tier the server served it from
+ *
+ * Results are printed to stdout as "name value" lines, to be compared
+ * from one build of the engine to the next.
+ */
 
-#include <fc_sha1.h>
-#include <fc_time.h>
-#include <fc_util.h>
+#define BENCH_LOG_FILE      NULL
+#define BENCH_LOG_DEFAULT   LOG_WARN
+#define BENCH_LOG_MIN       LOG_EMERG
+#define BENCH_LOG_MAX       LOG_PVERB
 
-#include <fc_slab.h>
-#include <fc_itemx.h>
-#include <fc_item.h>
-#include <fc_settings.h>
+#define BENCH_SSD_DEVICE    "stg_ins_test.img"
+#define BENCH_DEVICE_SIZE   512
+#define BENCH_INDEX_MEMORY  64
+#define BENCH_SLAB_MEMORY   64
+#define BENCH_BENCHES       "index,alloc,drain,mixed"
+#define BENCH_ITEMS         100000
+#define BENCH_OPS           1000000
+#define BENCH_VALUE_LEN     100
+#define BENCH_KEY_DIST      "zipf"
+#define BENCH_RATIO         "9:1"
+#define BENCH_SEED          1
 
-struct settings settings;          /* fatcache settings */
+#define BENCH_INDEX         (1 << 0)
+#define BENCH_ALLOC         (1 << 1)
+#define BENCH_DRAIN         (1 << 2)
+#define BENCH_MIXED         (1 << 3)
+#define BENCH_REPLAY        (1 << 4)
 
-static void set_options(){
+#define BENCH_BATCH         64      /* # item published per timed batch */
+#define BENCH_KEY_LEN       32      /* max key length */
 
-#define FC_CHUNK_SIZE       ITEM_CHUNK_SIZE
-#define FC_SLAB_SIZE        SLAB_SIZE
+struct settings settings;          /* fatcache settings */
 
-#define FC_DAEMONIZE        true
+/* disk stats are only kept by the server */
+void stats_io_record(uint8_t cid, int op, size_t nbyte, size_t naligned, int64_t nsec);
 
-//#define FC_LOG_FILE         NULL
-#define FC_LOG_FILE         "/root/log_stg"
-#define FC_LOG_DEFAULT      LOG_INFO
-#define FC_LOG_MIN          LOG_EMERG
-#define FC_LOG_MAX          LOG_PVERB
+void
+stats_io_record(uint8_t cid, int op, size_t nbyte, size_t naligned, int64_t nsec)
+{
+}
 
-#define FC_PORT             11212
-#define FC_ADDR             "0.0.0.0"
+struct bench_key {
+    uint8_t  md[SHA1_DIGEST_SIZE];  /* key digest */
+    uint32_t hash;                  /* key hash */
+};
 
-#define FC_HASH_POWER       ITEMX_HASH_POWER
+static struct {
+    uint32_t benches;       /* benchmarks to run */
+    size_t   device_size;   /* size of a created device file in bytes */
+    uint32_t nitem;         /* # item */
+    uint64_t nop;           /* # op of the mixed benchmark */
+    uint32_t vlen;          /* value length */
+    bool     zipf;          /* zipfian keys? */
+    double   theta;         /* zipfian skew */
+    uint32_t get_weight;    /* weight of gets */
+    uint32_t set_weight;    /* weight of sets */
+    uint64_t seed;          /* random seed */
+    char     *replay;       /* path to trace to replay */
+} opt;
 
-#define FC_FACTOR           1.25
+static int show_help;
+static uint8_t *value;                  /* value of every set */
+static uint8_t *rvalue;                 /* value of every get */
+static uint64_t rand_state;             /* random state */
+static double zetan, eta, alpha, half;  /* zipfian constants */
 
-#define FC_INDEX_MEMORY     (64 * MB)
-#define FC_SLAB_MEMORY      (64 * MB)
+static struct option long_options[] = {
+    { "help",               no_argument,        NULL,   'h' }, /* help */
+    { "output",             required_argument,  NULL,   'o' }, /* output logfile */
+    { "verbosity",          required_argument,  NULL,   'v' }, /* log verbosity level */
+    { "ssd-device",         required_argument,  NULL,   'D' }, /* path to ssd device file */
+    { "device-size",        required_argument,  NULL,   'd' }, /* size of a created device file in MB */
+    { "max-index-memory",   required_argument,  NULL,   'i' }, /* max memory for item index in MB */
+    { "max-slab-memory",    required_argument,  NULL,   'm' }, /* max memory for slab in MB */
+    { "slab-size",          required_argument,  NULL,   'I' }, /* slab size in MB */
+    { "flush-watermark",    required_argument,  NULL,   'W' }, /* free memory slabs kept by the flusher */
+    { "evict",              required_argument,  NULL,   'E' }, /* disk slab eviction policy */
+    { "index-engine",       required_argument,  NULL,   'x' }, /* item index engine */
+    { "key-hash",           required_argument,  NULL,   'k' }, /* key digest */
+    { "benches",            required_argument,  NULL,   'b' }, /* benchmarks to run */
+    { "items",              required_argument,  NULL,   'N' }, /* # item */
+    { "ops",                required_argument,  NULL,   'O' }, /* # op of the mixed benchmark */
+    { "value-length",       required_argument,  NULL,   'l' }, /* value length */
+    { "key-dist",           required_argument,  NULL,   'K' }, /* key distribution */
+    { "ratio",              required_argument,  NULL,   'r' }, /* get:set ratio */
+    { "seed",               required_argument,  NULL,   'S' }, /* random seed */
+    { "replay",             required_argument,  NULL,   'R' }, /* path to trace to replay */
+    { NULL,                 0,                  NULL,    0  }
+};
 
-#define FC_SERVER_ID        0
-#define FC_SERVER_N         1
-    
-    settings.daemonize = FC_DAEMONIZE;
+static char short_options[] =
+    "h"  /* help */
+    "o:" /* output logfile */
+    "v:" /* log verbosity level */
+    "D:" /* path to ssd device file */
+    "d:" /* size of a created device file in MB */
+    "i:" /* max memory for item index in MB */
+    "m:" /* max memory for slab in MB */
+    "I:" /* slab size in MB */
+    "W:" /* free memory slabs kept by the flusher */
+    "E:" /* disk slab eviction policy */
+    "x:" /* item index engine */
+    "k:" /* key digest */
+    "b:" /* benchmarks to run */
+    "N:" /* # item */
+    "O:" /* # op of the mixed benchmark */
+    "l:" /* value length */
+    "K:" /* key distribution */
+    "r:" /* get:set ratio */
+    "S:" /* random seed */
+    "R:" /* path to trace to replay */
+    ;
 
-    settings.log_filename = FC_LOG_FILE;
-    settings.verbose = 6;//11;//FC_LOG_DEFAULT;
+static void
+bench_show_usage(void)
+{
+    log_stderr(
+        "Usage: stg_ins_test [-h] [-o output file] [-v verbosity level]" CRLF
+        "           [-D ssd device] [-d device size] [-i max index memory]" CRLF
+        "           [-m max slab memory] [-I slab size] [-W flush watermark]" CRLF
+        "           [-E evict policy] [-x index engine] [-k key hash]" CRLF
+        "           [-b benches] [-N items] [-O ops] [-l value length]" CRLF
+        "           [-K key dist] [-r get:set] [-S seed] [-R trace]" CRLF
+        " ");
+    log_stderr(
+        "Options:" CRLF
+        "  -h, --help             : this help" CRLF
+        "  -o, --output=S         : set the logging file (default: stderr)" CRLF
+        "  -v, --verbosity=N      : set the logging level (default: %d, min: %d, max: %d)" CRLF
+        "  -D, --ssd-device=S     : set the path to the ssd device file, created if" CRLF
+        "                           missing (default: %s)" CRLF
+        "  -d, --device-size=N    : set the size in MB a device file is created or" CRLF
+        "                           extended to (default: %d)" CRLF
+        "  -i, --max-index-memory=N : set the maximum memory to use for item indexes in MB (default: %d MB)" CRLF
+        "  -m, --max-slab-memory=N  : set the maximum memory to use for slabs in MB (default: %d MB)" CRLF
+        "  -I, --slab-size=N      : set slab size in MB (default: %d MB)",
+        BENCH_LOG_DEFAULT, BENCH_LOG_MIN, BENCH_LOG_MAX, BENCH_SSD_DEVICE,
+        BENCH_DEVICE_SIZE, BENCH_INDEX_MEMORY, BENCH_SLAB_MEMORY,
+        (int)(SLAB_SIZE / MB));
+    log_stderr(
+        "  -W, --flush-watermark=N : set the # free memory slabs the flusher keeps, 0 to" CRLF
+        "                           drain inline (default: 0)" CRLF
+        "  -E, --evict=S          : set the disk slab eviction policy, fifo or gc (default: fifo)" CRLF
+        "  -x, --index-engine=S   : set the item index engine, chain or compact (default: chain)" CRLF
+        "  -k, --key-hash=S       : set the key digest, sha1 or murmur3 (default: sha1)");
+    log_stderr(
+        "  -b, --benches=S        : set the benchmarks to run, a list of index, alloc," CRLF
+        "                           drain, mixed and replay (default: %s)" CRLF
+        "  -N, --items=N          : set the # items (default: %d)" CRLF
+        "  -O, --ops=N            : set the # ops of the mixed benchmark (default: %d)" CRLF
+        "  -l, --value-length=N   : set the value length (default: %d)" CRLF
+        "  -K, --key-dist=S       : set the key distribution of the mixed benchmark," CRLF
+        "                           uniform or zipf[:THETA] (default: %s)" CRLF
+        "  -r, --ratio=G:S        : set the ratio of gets to sets of the mixed benchmark" CRLF
+        "                           (default: %s)" CRLF
+        "  -S, --seed=N           : set the random seed (default: %d)" CRLF
+        "  -R, --replay=S         : set the fatcache trace file the replay benchmark runs" CRLF
+        "",
+        BENCH_BENCHES, BENCH_ITEMS, BENCH_OPS, BENCH_VALUE_LEN, BENCH_KEY_DIST,
+        BENCH_RATIO, BENCH_SEED);
+}
 
-    settings.port = FC_PORT;
-    settings.addr = FC_ADDR;
-    settings.hash_power = FC_HASH_POWER;
+static void
+bench_set_default_options(void)
+{
+    settings.log_filename = BENCH_LOG_FILE;
+    settings.verbose = BENCH_LOG_DEFAULT;
 
-    settings.factor = FC_FACTOR;
-    settings.max_index_memory = FC_INDEX_MEMORY;
-    settings.max_slab_memory = FC_SLAB_MEMORY;
-    settings.chunk_size = FC_CHUNK_SIZE;
-    settings.slab_size = FC_SLAB_SIZE;
+    settings.hash_power = ITEMX_HASH_POWER;
+
+    settings.factor = 1.25;
+    settings.max_index_memory = BENCH_INDEX_MEMORY * MB;
+    settings.max_slab_memory = BENCH_SLAB_MEMORY * MB;
+    settings.chunk_size = ITEM_CHUNK_SIZE;
+    settings.slab_size = SLAB_SIZE;
 
     memset(settings.profile, 0, sizeof(settings.profile));
     settings.profile_last_id = SLABCLASS_MAX_ID;
 
-    settings.ssd_device = "/dev/sdc"; //NULL;
+    settings.ssd_device = BENCH_SSD_DEVICE;
+
+    settings.server_id = 0;
+    settings.server_n = 1;
+
+    settings.aio_depth = 0;
+    settings.flush_watermark = 0;
+    settings.evict = SLAB_EVICT_FIFO;
+
+    settings.threads = 1;
+
+    settings.index_engine = ITEMX_ENGINE_CHAIN;
+    settings.use_cas = true;
+
+    settings.key_hash = ITEM_KEY_HASH_SHA1;
+    settings.md_size = SHA1_DIGEST_SIZE;
+
+    opt.benches = BENCH_INDEX | BENCH_ALLOC | BENCH_DRAIN | BENCH_MIXED;
+    opt.device_size = (size_t)BENCH_DEVICE_SIZE * MB;
+    opt.nitem = BENCH_ITEMS;
+    opt.nop = BENCH_OPS;
+    opt.vlen = BENCH_VALUE_LEN;
+    opt.zipf = true;
+    opt.theta = 0.99;
+    sscanf(BENCH_RATIO, "%u:%u", &opt.get_weight, &opt.set_weight);
+    opt.seed = BENCH_SEED;
+    opt.replay = NULL;
+}
+
+static rstatus_t
+bench_parse_benches(char *arg)
+{
+    char *name;
 
-    settings.server_id = FC_SERVER_ID;
-    settings.server_n = FC_SERVER_N;
-    return;
+    opt.benches = 0;
+    for (name = strtok(arg, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (strcmp(name, "index") == 0) {
+            opt.benches |= BENCH_INDEX;
+        } else if (strcmp(name, "alloc") == 0) {
+            opt.benches |= BENCH_ALLOC;
+        } else if (strcmp(name, "drain") == 0) {
+            opt.benches |= BENCH_DRAIN;
+        } else if (strcmp(name, "mixed") == 0) {
+            opt.benches |= BENCH_MIXED;
+        } else if (strcmp(name, "replay") == 0) {
+            opt.benches |= BENCH_REPLAY;
+        } else {
+            return FC_ERROR;
+        }
+    }
+
+    return opt.benches != 0 ? FC_OK : FC_ERROR;
+}
+
+static rstatus_t
+bench_get_options(int argc, char **argv)
+{
+    int c, value;
+    long long n;
+
+    opterr = 0;
+
+    for (;;) {
+        c = getopt_long(argc, argv, short_options, long_options, NULL);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'h':
+            show_help = 1;
+            break;
+
+        case 'o':
+            settings.log_filename = optarg;
+            break;
+
+        case 'v':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("stg_ins_test: option -v requires a number");
+                return FC_ERROR;
+            }
+            settings.verbose = value;
+            break;
+
+        case 'D':
+            settings.ssd_device = optarg;
+            break;
+
+        case 'd':
+        case 'i':
+        case 'm':
+        case 'I':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value <= 0) {
+                log_stderr("stg_ins_test: option -%c requires a non zero number",
+                           c);
+                return FC_ERROR;
+            }
+            if (c == 'd') {
+                opt.device_size = (size_t)value * MB;
+            } else if (c == 'i') {
+                settings.max_index_memory = (size_t)value * MB;
+            } else if (c == 'm') {
+                settings.max_slab_memory = (size_t)value * MB;
+            } else {
+                settings.slab_size = (size_t)value * MB;
+                if (settings.slab_size > SLAB_MAX_SIZE) {
+                    log_stderr("stg_ins_test: slab size cannot be larger than "
+                               "%zu bytes", SLAB_MAX_SIZE);
+                    return FC_ERROR;
+                }
+            }
+            break;
+
+        case 'W':
+            value = fc_atoi(optarg, strlen(optarg));
+            if (value < 0) {
+                log_stderr("stg_ins_test: option -W requires a number");
+                return FC_ERROR;
+            }
+            settings.flush_watermark = (uint32_t)value;
+            break;
+
+        case 'E':
+            if (strcmp(optarg, "fifo") == 0) {
+                settings.evict = SLAB_EVICT_FIFO;
+            } else if (strcmp(optarg, "gc") == 0) {
+                settings.evict = SLAB_EVICT_GC;
+            } else {
+                log_stderr("stg_ins_test: option -E value '%s' is not fifo or "
+                           "gc", optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'x':
+            if (strcmp(optarg, "chain") == 0) {
+                settings.index_engine = ITEMX_ENGINE_CHAIN;
+            } else if (strcmp(optarg, "compact") == 0) {
+                settings.index_engine = ITEMX_ENGINE_COMPACT;
+            } else {
+                log_stderr("stg_ins_test: option -x value '%s' is not chain or "
+                           "compact", optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'k':
+            if (strcmp(optarg, "sha1") == 0) {
+                settings.key_hash = ITEM_KEY_HASH_SHA1;
+                settings.md_size = SHA1_DIGEST_SIZE;
+            } else if (strcmp(optarg, "murmur3") == 0) {
+                settings.key_hash = ITEM_KEY_HASH_MURMUR3;
+                settings.md_size = MURMUR3_DIGEST_SIZE;
+            } else {
+                log_stderr("stg_ins_test: option -k value '%s' is not sha1 or "
+                           "murmur3", optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'b':
+            if (bench_parse_benches(optarg) != FC_OK) {
+                log_stderr("stg_ins_test: option -b value is not a list of "
+                           "index, alloc, drain and mixed");
+                return FC_ERROR;
+            }
+            break;
+
+        case 'N':
+        case 'O':
+        case 'l':
+            n = atoll(optarg);
+            if (n <= 0 || (c != 'O' && n > UINT32_MAX)) {
+                log_stderr("stg_ins_test: option -%c requires a non zero number",
+                           c);
+                return FC_ERROR;
+            }
+            if (c == 'N') {
+                opt.nitem = (uint32_t)n;
+            } else if (c == 'O') {
+                opt.nop = (uint64_t)n;
+            } else {
+                opt.vlen = (uint32_t)n;
+            }
+            break;
+
+        case 'K':
+            if (strcmp(optarg, "uniform") == 0) {
+                opt.zipf = false;
+            } else if (strncmp(optarg, "zipf", 4) == 0 &&
+                       (optarg[4] == '\0' || optarg[4] == ':')) {
+                opt.zipf = true;
+                opt.theta = optarg[4] == ':' ? atof(optarg + 5) : 0.99;
+                if (opt.theta <= 0 || opt.theta >= 1) {
+                    log_stderr("stg_ins_test: option -K zipf skew must be "
+                               "between 0 and 1");
+                    return FC_ERROR;
+                }
+            } else {
+                log_stderr("stg_ins_test: option -K value '%s' is not uniform "
+                           "or zipf[:THETA]", optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'r':
+            if (sscanf(optarg, "%u:%u", &opt.get_weight, &opt.set_weight) != 2 ||
+                opt.get_weight + opt.set_weight == 0) {
+                log_stderr("stg_ins_test: option -r value '%s' is not G:S",
+                           optarg);
+                return FC_ERROR;
+            }
+            break;
+
+        case 'S':
+            opt.seed = (uint64_t)atoll(optarg);
+            break;
+
+        case 'R':
+            opt.replay = optarg;
+            break;
+
+        case '?':
+            log_stderr("stg_ins_test: invalid option -- '%c'", optopt);
+            return FC_ERROR;
+
+        default:
+            log_stderr("stg_ins_test: invalid option -- '%c'", c);
+            return FC_ERROR;
+        }
+    }
+
+    return FC_OK;
 }
 
 static rstatus_t
@@ -107,24 +493,69 @@ fc_generate_profile(void)
     return FC_OK;
 }
 
-rstatus_t init(){
+/*
+ * Create the regular file that stands in for the ssd if it is missing,
+ * and extend it to the device size if it is smaller. A block device is
+ * used as is.
+ */
+static rstatus_t
+bench_device(void)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(settings.ssd_device, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        log_stderr("stg_ins_test: open '%s' failed: %s", settings.ssd_device,
+                   strerror(errno));
+        return FC_ERROR;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        log_stderr("stg_ins_test: fstat '%s' failed: %s", settings.ssd_device,
+                   strerror(errno));
+        close(fd);
+        return FC_ERROR;
+    }
+
+    if (S_ISREG(st.st_mode) && (size_t)st.st_size < opt.device_size &&
+        ftruncate(fd, (off_t)opt.device_size) < 0) {
+        log_stderr("stg_ins_test: truncate '%s' to %zu bytes failed: %s",
+                   settings.ssd_device, opt.device_size, strerror(errno));
+        close(fd);
+        return FC_ERROR;
+    }
+
+    close(fd);
+
+    return FC_OK;
+}
+
+static rstatus_t
+init(void)
+{
     rstatus_t status;
 
     status = log_init(settings.verbose, settings.log_filename);
     if (status != FC_OK) {
         return status;
     }
-    
+
+    status = bench_device();
+    if (status != FC_OK) {
+        return status;
+    }
+
     status = time_init();
     if (status != FC_OK) {
         return status;
     }
-    
+
     status = itemx_init();
     if (status != FC_OK) {
         return status;
     }
-    
+
     item_init();
 
     status = slab_init();
@@ -135,188 +566,655 @@ rstatus_t init(){
     return FC_OK;
 }
 
-int put(char* key, int nkey, char* value, int vlen, int expiry, int flags){
-    uint8_t  md[20];
-    uint32_t hash;
+static uint64_t
+bench_rand(void)
+{
+    uint64_t x = rand_state;
+
+    /* xorshift64* */
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rand_state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double
+bench_uniform(void)
+{
+    return (double)(bench_rand() >> 11) / (double)(1ULL << 53);
+}
+
+/*
+ * Precompute the constants of the zipfian generator of Gray et al.,
+ * "Quickly Generating Billion-Record Synthetic Databases", SIGMOD 1994.
+ */
+static void
+bench_zipf_init(uint32_t n)
+{
+    double zeta2;
+    uint32_t i;
+
+    for (zetan = 0, i = 1; i <= n; i++) {
+        zetan += 1.0 / pow((double)i, opt.theta);
+    }
+    zeta2 = 1.0 + 1.0 / pow(2.0, opt.theta);
+
+    alpha = 1.0 / (1.0 - opt.theta);
+    eta = (1.0 - pow(2.0 / n, 1.0 - opt.theta)) / (1.0 - zeta2 / zetan);
+    half = 1.0 + pow(0.5, opt.theta);
+}
+
+static uint32_t
+bench_next_key(uint32_t n)
+{
+    double u, uz;
+    uint32_t k;
+
+    if (!opt.zipf) {
+        return (uint32_t)(bench_rand() % n);
+    }
+
+    u = bench_uniform();
+    uz = u * zetan;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < half) {
+        return 1;
+    }
+
+    k = (uint32_t)(n * pow(eta * u - eta + 1.0, alpha));
+
+    return MIN(k, n - 1);
+}
+
+/*
+ * Compute the digest and hash of key the way the server does.
+ */
+static void
+bench_digest(uint8_t *key, uint8_t nkey, uint8_t *md, uint32_t *hash)
+{
+    switch (settings.key_hash) {
+    case ITEM_KEY_HASH_MURMUR3:
+        murmur3_128(key, nkey, 0, md);
+        memset(md + MURMUR3_DIGEST_SIZE, 0, SHA1_DIGEST_SIZE - MURMUR3_DIGEST_SIZE);
+        break;
 
-    uint8_t * tmp_key = key;
-    sha1(tmp_key, nkey, md);
-    hash = sha1_hash(md);
+    case ITEM_KEY_HASH_SHA1:
+    default:
+        sha1(key, nkey, md);
+        break;
+    }
+
+    *hash = sha1_hash(md);
+}
+
+static uint8_t
+bench_key(char *key, const char *prefix, uint32_t i)
+{
+    return (uint8_t)snprintf(key, BENCH_KEY_LEN, "%s%"PRIu32, prefix, i);
+}
+
+static rstatus_t
+put(uint8_t *key, uint8_t nkey, uint8_t *value, uint32_t vlen)
+{
+    uint8_t md[SHA1_DIGEST_SIZE];
+    uint32_t hash;
     uint8_t cid;
     struct item *it;
-    
+    bool update;
+
+    bench_digest(key, nkey, md, &hash);
+
     cid = item_slabcid(nkey, vlen);
     if (cid == SLABCLASS_INVALID_ID) {
-        return -1;
+        return FC_ERROR;
     }
 
-    itemx_removex(hash, md);
-    it = item_get(key, nkey, cid, vlen, time_reltime(expiry),
-                  flags, md, hash, false);
+    update = itemx_removex(hash, md);
+    it = item_get(key, nkey, cid, vlen, time_reltime(0), 0, md, hash, update);
     if (it == NULL) {
-        return -1;
+        return FC_ENOMEM;
     }
-    memcpy(item_data(it), value, (size_t)(vlen));
-    return 0;
+    fc_memcpy(item_data(it), value, vlen);
+
+    return FC_OK;
 }
 
-int get(char* key, int nkey, char* value){
-    uint8_t  md[20];
+/*
+ * Read the value of key into value and return the tier it was served
+ * from, 0 for memory, 1 for disk or 2 for a miss, or -1 on error.
+ */
+static int
+get(uint8_t *key, uint8_t nkey, uint8_t *value)
+{
+    uint8_t md[SHA1_DIGEST_SIZE];
     uint32_t hash;
-
     struct itemx *itx;
     struct item *it;
+    int tier;
 
-    uint8_t * tmp_key = key;
-    sha1(tmp_key, nkey, md);
-    hash = sha1_hash(md);
-    
-    itx = itemx_getx(hash,md);
-    if (itx == NULL) {
-        return 1;
-    }
-    if (itemx_expired(itx)) {
+    bench_digest(key, nkey, md, &hash);
+
+    itx = itemx_getx(hash, md);
+    if (itx == NULL || itemx_expired(itx)) {
         return 2;
     }
+
+    tier = sid_to_sinfo(itx->sid)->mem ? 0 : 1;
     it = slab_read_item(itx->sid, itx->offset);
     if (it == NULL) {
-        //        rsp_send_error(ctx, conn, msg, MSG_RSP_SERVER_ERROR, errno);
         return -1;
     }
-    memcpy(value, item_data(it), it->ndata);
-    return 0;
+    fc_memcpy(value, item_data(it), it->ndata);
+
+    return tier;
 }
-int delete(char* key, int nkey){
-    uint8_t  md[20];
+
+static void
+delete(uint8_t *key, uint8_t nkey)
+{
+    uint8_t md[SHA1_DIGEST_SIZE];
     uint32_t hash;
-    uint8_t * tmp_key = key;
-    sha1(tmp_key, nkey, md);
-    hash = sha1_hash(md);
-    
-    uint8_t cid;
-    struct itemx *itx;
 
-    itx = itemx_getx(hash, md);
-    if (itx == NULL) {
-        // rsp_send_status(ctx, conn, msg, MSG_RSP_NOT_FOUND);
-        return 0;
+    bench_digest(key, nkey, md, &hash);
+    itemx_removex(hash, md);
+}
+
+static void
+bench_report(const char *bench, const char *phase, uint64_t nop, int64_t nsec)
+{
+    double sec = (double)MAX(nsec, 1) / 1e9;
+
+    printf("%s_%s_ops %"PRIu64"\n", bench, phase, nop);
+    printf("%s_%s_sec %.6f\n", bench, phase, sec);
+    printf("%s_%s_ops_per_sec %.1f\n", bench, phase, nop / sec);
+    printf("%s_%s_ns_per_op %.1f\n", bench, phase,
+           nop == 0 ? 0.0 : (double)nsec / nop);
+}
+
+static void
+bench_report_latency(const char *name, const struct histogram *h)
+{
+    static const struct {
+        const char *name;
+        uint32_t   q;
+    } quantiles[] = {
+        { "p50", 500 }, { "p90", 900 }, { "p99", 990 }, { "p999", 999 },
+    };
+    uint32_t i;
+
+    if (h->count == 0) {
+        return;
     }
-    cid = slab_get_cid(itx->sid);
-    itemx_removex(hash, md);   
-    return 0;
+
+    printf("%s_mean_us %.3f\n", name, (double)h->sum / h->count / 1000);
+    for (i = 0; i < NELEMS(quantiles); i++) {
+        printf("%s_%s_us %.3f\n", name, quantiles[i].name,
+               (double)histogram_quantile(h, quantiles[i].q) / 1000);
+    }
+    printf("%s_max_us %.3f\n", name, (double)h->max / 1000);
 }
 
-int num(char *src_key, int src_key_len, int num, int expiry, int flags){
+static uint32_t
+bench_msinfo_nused(void)
+{
+    return slab_msinfo_nalloc() - slab_msinfo_nfree();
+}
+
+/*
+ * Time the item index on its own: items are allocated and pinned in
+ * batches outside of the clock, and only their indexing is timed, as are
+ * lookups of the digests precomputed for present and absent keys and
+ * their removal.
+ */
+static rstatus_t
+bench_index(void)
+{
+    struct bench_key *keys, *miss;
+    struct item *batch[BENCH_BATCH];
+    struct slabinfo *pin[BENCH_BATCH];
+    char key[BENCH_KEY_LEN];
+    uint8_t nkey, cid;
+    uint32_t i, j, m, nhit;
+    int64_t start, nsec;
+
+    keys = fc_alloc(sizeof(*keys) * opt.nitem);
+    miss = fc_alloc(sizeof(*miss) * opt.nitem);
+    if (keys == NULL || miss == NULL) {
+        return FC_ENOMEM;
+    }
+
+    for (i = 0; i < opt.nitem; i++) {
+        nkey = bench_key(key, "i:", i);
+        bench_digest((uint8_t *)key, nkey, keys[i].md, &keys[i].hash);
+        nkey = bench_key(key, "i:miss:", i);
+        bench_digest((uint8_t *)key, nkey, miss[i].md, &miss[i].hash);
+    }
+
+    for (nsec = 0, i = 0; i < opt.nitem; i += m) {
+        m = MIN(BENCH_BATCH, opt.nitem - i);
+        for (j = 0; j < m; j++) {
+            nkey = bench_key(key, "i:", i + j);
+            cid = item_slabcid(nkey, opt.vlen);
+            batch[j] = item_alloc((uint8_t *)key, nkey, cid, opt.vlen, 0, 0,
+                                  keys[i + j].md, keys[i + j].hash, false);
+            if (batch[j] == NULL) {
+                return FC_ENOMEM;
+            }
+            pin[j] = slab_pin_item(batch[j]);
+        }
+
+        start = fc_nsec_now();
+        for (j = 0; j < m; j++) {
+            item_publish(batch[j], 0);
+        }
+        nsec += fc_nsec_now() - start;
+
+        for (j = 0; j < m; j++) {
+            if (pin[j] != NULL) {
+                slab_unpin(pin[j]);
+            }
+        }
+    }
+    bench_report("index", "insert", opt.nitem, nsec);
+
+    start = fc_nsec_now();
+    for (nhit = 0, i = 0; i < opt.nitem; i++) {
+        nhit += itemx_getx(keys[i].hash, keys[i].md) != NULL;
+    }
+    bench_report("index", "lookup_hit", opt.nitem, fc_nsec_now() - start);
+    printf("index_lookup_hit_found %"PRIu32"\n", nhit);
+
+    start = fc_nsec_now();
+    for (nhit = 0, i = 0; i < opt.nitem; i++) {
+        nhit += itemx_getx(miss[i].hash, miss[i].md) != NULL;
+    }
+    bench_report("index", "lookup_miss", opt.nitem, fc_nsec_now() - start);
+    printf("index_lookup_miss_found %"PRIu32"\n", nhit);
+
+    start = fc_nsec_now();
+    for (nhit = 0, i = 0; i < opt.nitem; i++) {
+        nhit += itemx_removex(keys[i].hash, keys[i].md);
+    }
+    bench_report("index", "remove", opt.nitem, fc_nsec_now() - start);
+    printf("index_remove_found %"PRIu32"\n", nhit);
+
+    fc_free(keys);
+    fc_free(miss);
+
+    return FC_OK;
+}
+
+/*
+ * Time the allocation of item chunks: a fill of fresh chunks, the removal
+ * of every other item, which turns its chunk into a hole, and a refill
+ * that should land in those holes without taking new memory slabs.
+ */
+static rstatus_t
+bench_alloc(void)
+{
+    char key[BENCH_KEY_LEN];
+    uint8_t nkey;
+    uint32_t i, nused;
+    int64_t start;
     rstatus_t status;
-    uint8_t *pkey, nkey, cid;
-    struct item *it;
-    struct itemx *itx;
-    uint64_t cnum;
-    int64_t nnum;
-    char numstr[FC_UINT64_MAXLEN];
-    int n;
-    
-    pkey = (uint8_t *)src_key;
-    nkey = (uint8_t)(src_key_len);
-
-    uint8_t  md[20];
-    uint32_t hash;
-    sha1(pkey, nkey, md);
-    hash = sha1_hash(md);
-    
-    /* 1). look up existing itemx */
-    itx = itemx_getx(hash, md);
-    if (itx == NULL || itemx_expired(itx)) {
-        /* 2a). miss -> return NOT_FOUND */
-        //rsp_send_status(ctx, conn, msg, MSG_RSP_NOT_FOUND);
-        return -1;
+
+    nused = bench_msinfo_nused();
+    start = fc_nsec_now();
+    for (i = 0; i < opt.nitem; i++) {
+        nkey = bench_key(key, "a:", i);
+        status = put((uint8_t *)key, nkey, value, opt.vlen);
+        if (status != FC_OK) {
+            return status;
+        }
     }
+    bench_report("alloc", "fill", opt.nitem, fc_nsec_now() - start);
+    printf("alloc_fill_slabs %"PRIu32"\n", bench_msinfo_nused() - nused);
 
-    /* 2b). hit -> read existing item into it */
-    it = slab_read_item(itx->sid, itx->offset);
-    if (it == NULL) {
-        //rsp_send_error(ctx, conn, msg, MSG_RSP_SERVER_ERROR, errno);
-        return -2;
+    start = fc_nsec_now();
+    for (i = 0; i < opt.nitem; i += 2) {
+        nkey = bench_key(key, "a:", i);
+        delete((uint8_t *)key, nkey);
+    }
+    bench_report("alloc", "punch", (opt.nitem + 1) / 2, fc_nsec_now() - start);
+
+    nused = bench_msinfo_nused();
+    start = fc_nsec_now();
+    for (i = 0; i < opt.nitem; i += 2) {
+        nkey = bench_key(key, "b:", i);
+        status = put((uint8_t *)key, nkey, value, opt.vlen);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+    bench_report("alloc", "refill", (opt.nitem + 1) / 2, fc_nsec_now() - start);
+    printf("alloc_refill_slabs %"PRIu32"\n", bench_msinfo_nused() - nused);
+
+    return FC_OK;
+}
+
+/*
+ * Time sets that cycle over the key space until twice as many slabs as
+ * the disk holds have been flushed, so that the disk wraps around and
+ * every flush past the first pass has to evict or compact a disk slab.
+ * A key space larger than the disk makes every disk slab live.
+ */
+static rstatus_t
+bench_drain(void)
+{
+    char key[BENCH_KEY_LEN];
+    uint8_t nkey;
+    uint64_t nflush, nevict, ngc, ngc_item, target, nset;
+    int64_t start, nsec;
+    rstatus_t status;
+
+    nflush = slab_nflush();
+    nevict = slab_nevict();
+    ngc = slab_ngc();
+    ngc_item = slab_ngc_item();
+    target = 2 * (uint64_t)slab_dsinfo_nalloc();
+
+    start = fc_nsec_now();
+    for (nset = 0; slab_nflush() - nflush < target; nset++) {
+        nkey = bench_key(key, "d:", (uint32_t)(nset % opt.nitem));
+        status = put((uint8_t *)key, nkey, value, opt.vlen);
+        if (status != FC_OK) {
+            return status;
+        }
     }
+    nsec = fc_nsec_now() - start;
+
+    nflush = slab_nflush() - nflush;
+    bench_report("drain", "set", nset, nsec);
+    printf("drain_flush %"PRIu64"\n", nflush);
+    printf("drain_flush_mb_per_sec %.1f\n",
+           (double)nflush * settings.slab_size / MB / ((double)nsec / 1e9));
+    printf("drain_evict %"PRIu64"\n", slab_nevict() - nevict);
+    printf("drain_gc %"PRIu64"\n", slab_ngc() - ngc);
+    printf("drain_gc_item %"PRIu64"\n", slab_ngc_item() - ngc_item);
 
-    /* 3). sanity check item data to be a number */
-    status = fc_atou64(item_data(it), it->ndata, &cnum);
+    return FC_OK;
+}
+
+/*
+ * Load the key space, then time a mix of gets and sets with keys drawn
+ * uniformly or from a zipfian, each op on its own clock.
+ */
+static rstatus_t
+bench_mixed(void)
+{
+    struct histogram *lat;
+    char key[BENCH_KEY_LEN];
+    uint8_t nkey;
+    uint32_t i, k;
+    uint64_t n, nget, nset, ntier[3];
+    int64_t start, op_start;
+    rstatus_t status;
+    int tier;
+
+    /* get and set latency */
+    lat = fc_calloc(2, sizeof(*lat));
+    if (lat == NULL) {
+        return FC_ENOMEM;
+    }
+
+    if (opt.zipf) {
+        bench_zipf_init(opt.nitem);
+    }
+
+    start = fc_nsec_now();
+    for (i = 0; i < opt.nitem; i++) {
+        nkey = bench_key(key, "m:", i);
+        status = put((uint8_t *)key, nkey, value, opt.vlen);
+        if (status != FC_OK) {
+            return status;
+        }
+    }
+    bench_report("mixed", "load", opt.nitem, fc_nsec_now() - start);
+
+    nget = nset = 0;
+    memset(ntier, 0, sizeof(ntier));
+    start = fc_nsec_now();
+    for (n = 0; n < opt.nop; n++) {
+        k = bench_next_key(opt.nitem);
+        nkey = bench_key(key, "m:", k);
+
+        op_start = fc_nsec_now();
+        if (bench_rand() % (opt.get_weight + opt.set_weight) < opt.get_weight) {
+            tier = get((uint8_t *)key, nkey, rvalue);
+            if (tier < 0) {
+                return FC_ERROR;
+            }
+            histogram_add(&lat[0], (uint64_t)(fc_nsec_now() - op_start));
+            ntier[tier]++;
+            nget++;
+        } else {
+            status = put((uint8_t *)key, nkey, value, opt.vlen);
+            if (status != FC_OK) {
+                return status;
+            }
+            histogram_add(&lat[1], (uint64_t)(fc_nsec_now() - op_start));
+            nset++;
+        }
+    }
+    bench_report("mixed", "op", opt.nop, fc_nsec_now() - start);
+    printf("mixed_get %"PRIu64"\n", nget);
+    printf("mixed_get_mem %"PRIu64"\n", ntier[0]);
+    printf("mixed_get_disk %"PRIu64"\n", ntier[1]);
+    printf("mixed_get_miss %"PRIu64"\n", ntier[2]);
+    printf("mixed_set %"PRIu64"\n", nset);
+    bench_report_latency("mixed_get", &lat[0]);
+    bench_report_latency("mixed_set", &lat[1]);
+
+    fc_free(lat);
+
+    return FC_OK;
+}
+
+/*
+ * Replay the gets, sets and deletes of a trace in the order they arrived
+ * at the server, on keys that stand in for the traced ones. Incr and
+ * decr, and sets of values that fit no slab, are skipped. Expiry is not
+ * replayed, as the engine is driven faster than the server was.
+ */
+static rstatus_t
+bench_replay(void)
+{
+    struct trace_hdr hdr;
+    struct trace_record *records, *r;
+    struct histogram *lat;
+    char key[UINT8_MAX + 1];
+    uint8_t nkey, *rbuf, *wbuf;
+    uint32_t vmax;
+    uint64_t i, n, nskip, nget, nset, ndelete, ntier[3], ntrace[3];
+    int64_t start, op_start;
+    rstatus_t status;
+    int tier;
+
+    status = trace_load(opt.replay, &hdr, &records, &n);
     if (status != FC_OK) {
-        //rsp_send_error(ctx, conn, msg, MSG_RSP_CLIENT_ERROR, EINVAL);
-        return -3;
+        return status;
     }
 
-    /* 4). remove existing itemx of it */
-    itemx_removex(hash, md);
+    for (vmax = 1, i = 0; i < n; i++) {
+        if (records[i].op == TRACE_OP_SET) {
+            vmax = MAX(vmax, records[i].vlen);
+        }
+    }
+    vmax = MIN(vmax, settings.slab_size);
 
-    /* 5). compute the new incr/decr number nnum and numstr */
-    nnum = cnum + num;
-    if (nnum<0)
-        nnum = 0;
-    n = _scnprintf(numstr, sizeof(numstr), "%"PRIu64"", (uint64_t)nnum);
+    /* get, set and delete latency */
+    lat = fc_calloc(3, sizeof(*lat));
+    rbuf = fc_alloc(vmax);
+    wbuf = fc_alloc(vmax);
+    if (lat == NULL || rbuf == NULL || wbuf == NULL) {
+        return FC_ENOMEM;
+    }
+    memset(wbuf, 'x', vmax);
 
-    /* 6). alloc new item that can hold n worth of bytes */
-    cid = item_slabcid(nkey, n);
-    ASSERT(cid != SLABCLASS_INVALID_ID);
+    nskip = nget = nset = ndelete = 0;
+    memset(ntier, 0, sizeof(ntier));
+    memset(ntrace, 0, sizeof(ntrace));
+    start = fc_nsec_now();
+    for (i = 0; i < n; i++) {
+        r = &records[i];
+        nkey = trace_key(r, key);
 
-    it = item_get(pkey, nkey, cid, n, time_reltime(expiry), flags,
-                   md, hash, false);
-    if (it == NULL) {
-        //rsp_send_error(ctx, conn, msg, MSG_RSP_SERVER_ERROR, ENOMEM);
-        return -2;
+        if (r->op == TRACE_OP_OTHER ||
+            (r->op == TRACE_OP_SET &&
+             item_slabcid(nkey, r->vlen) == SLABCLASS_INVALID_ID)) {
+            nskip++;
+            continue;
+        }
+
+        op_start = fc_nsec_now();
+        switch (r->op) {
+        case TRACE_OP_GET:
+            tier = get((uint8_t *)key, nkey, rbuf);
+            if (tier < 0) {
+                return FC_ERROR;
+            }
+            histogram_add(&lat[0], (uint64_t)(fc_nsec_now() - op_start));
+            ntier[tier]++;
+            if (r->tier < NELEMS(ntrace)) {
+                ntrace[r->tier]++;
+            }
+            nget++;
+            break;
+
+        case TRACE_OP_SET:
+            status = put((uint8_t *)key, nkey, wbuf, r->vlen);
+            if (status != FC_OK) {
+                return status;
+            }
+            histogram_add(&lat[1], (uint64_t)(fc_nsec_now() - op_start));
+            nset++;
+            break;
+
+        default:
+            delete((uint8_t *)key, nkey);
+            histogram_add(&lat[2], (uint64_t)(fc_nsec_now() - op_start));
+            ndelete++;
+            break;
+        }
     }
+    bench_report("replay", "op", n - nskip, fc_nsec_now() - start);
+    printf("replay_records %"PRIu64"\n", n);
+    printf("replay_skipped %"PRIu64"\n", nskip);
+    printf("replay_get %"PRIu64"\n", nget);
+    printf("replay_get_mem %"PRIu64"\n", ntier[0]);
+    printf("replay_get_disk %"PRIu64"\n", ntier[1]);
+    printf("replay_get_miss %"PRIu64"\n", ntier[2]);
+    printf("replay_trace_get_mem %"PRIu64"\n", ntrace[0]);
+    printf("replay_trace_get_disk %"PRIu64"\n", ntrace[1]);
+    printf("replay_trace_get_miss %"PRIu64"\n", ntrace[2]);
+    printf("replay_set %"PRIu64"\n", nset);
+    printf("replay_delete %"PRIu64"\n", ndelete);
+    bench_report_latency("replay_get", &lat[0]);
+    bench_report_latency("replay_set", &lat[1]);
+    bench_report_latency("replay_delete", &lat[2]);
 
-    /* 7). copy numstr to it */
-    memcpy(item_data(it), numstr, n);
-    return 0;
+    fc_free(wbuf);
+    fc_free(rbuf);
+    fc_free(lat);
+    fc_free(records);
+
+    return FC_OK;
 }
-int main(int argc, char** argv){
-    set_options();
+
+static void
+bench_report_config(void)
+{
+    printf("ssd_device %s\n", settings.ssd_device);
+    printf("max_index_memory %zu\n", settings.max_index_memory);
+    printf("max_slab_memory %zu\n", settings.max_slab_memory);
+    printf("slab_size %zu\n", settings.slab_size);
+    printf("memory_slabs %"PRIu32"\n", slab_msinfo_nalloc());
+    printf("disk_slabs %"PRIu32"\n", slab_dsinfo_nalloc());
+    printf("flush_watermark %"PRIu32"\n", settings.flush_watermark);
+    printf("evict %s\n", settings.evict == SLAB_EVICT_GC ? "gc" : "fifo");
+    printf("index_engine %s\n",
+           settings.index_engine == ITEMX_ENGINE_COMPACT ? "compact" : "chain");
+    printf("key_hash %s\n",
+           settings.key_hash == ITEM_KEY_HASH_SHA1 ? "sha1" : "murmur3");
+    printf("items %"PRIu32"\n", opt.nitem);
+    printf("value_length %"PRIu32"\n", opt.vlen);
+    printf("item_chunk_size %zu\n",
+           cid_to_size(item_slabcid(BENCH_KEY_LEN / 2, opt.vlen)));
+}
+
+int
+main(int argc, char **argv)
+{
+    static const struct {
+        uint32_t   bench;
+        rstatus_t  (*run)(void);
+    } benches[] = {
+        { BENCH_INDEX, bench_index },
+        { BENCH_ALLOC, bench_alloc },
+        { BENCH_DRAIN, bench_drain },
+        { BENCH_MIXED, bench_mixed },
+        { BENCH_REPLAY, bench_replay },
+    };
+    uint32_t i;
+
+    bench_set_default_options();
+
+    if (bench_get_options(argc, argv) != FC_OK) {
+        bench_show_usage();
+        exit(1);
+    }
+
+    if (show_help) {
+        bench_show_usage();
+        exit(0);
+    }
+
+    if ((opt.benches & BENCH_REPLAY) && opt.replay == NULL) {
+        log_stderr("stg_ins_test: the replay benchmark requires a trace, "
+                   "see option -R");
+        exit(1);
+    }
+
     fc_generate_profile();
-    init();
-    char key[5]= "test1";
-    //char value[3]="100";
-    char *value=NULL;
-    char *ret=NULL;
-    int vl = 0;
-    if (argc > 1){
-        printf("%u\n", strlen(argv[1]));
-        vl =  strlen(argv[1]);
-        value = malloc((strlen(argv[1])+1) * sizeof(char));
-        ret = malloc((strlen(argv[1])+1) * sizeof(char));
-        memcpy(value, argv[1], strlen(argv[1]));
-    }else{
-        ret = malloc(10 * sizeof(char));
-    }
-    
-    if (get(key, 5, ret) == 1){
-        printf("no data\n");
-    }
-    if (put(key, 5, value, strlen(value), 0, 1) == 0){
-        printf("set data ok\n");
-    }
-    if (get(key, 5, ret) == 0){
-        printf("get data %s\n", ret);
-    }
-    delete(key, 5);
-    if (get(key, 5, ret) == 1){
-        printf("delete no data\n");
-    }
-    if (put(key, 5, value, strlen(value), 0, 1) == 0){
-        printf("set data ok\n");
-    }
-    if (get(key, 5, ret) == 1){
-        printf("error, no data\n");
-    }else{
-        printf("get data: %s\n", ret);
-    }
-    if (num(key, 5, 12, 0, 1) == 0){
-        printf("num data ok\n");
-    }
-    if (get(key, 5, ret) == 1){
-        printf("get data: %s\n", ret);
-    }
-
-    
+
+    if (init() != FC_OK) {
+        log_stderr("stg_ins_test: init failed, see the log for details");
+        exit(1);
+    }
+
+    if (item_slabcid(BENCH_KEY_LEN, opt.vlen) == SLABCLASS_INVALID_ID) {
+        log_stderr("stg_ins_test: value length %"PRIu32" does not fit in a "
+                   "slab", opt.vlen);
+        exit(1);
+    }
+
+    value = fc_alloc(opt.vlen);
+    rvalue = fc_alloc(opt.vlen);
+    if (value == NULL || rvalue == NULL) {
+        log_stderr("stg_ins_test: out of memory");
+        exit(1);
+    }
+    memset(value, 'x', opt.vlen);
+    rand_state = (opt.seed + 1) * 0x9E3779B97F4A7C15ULL;
+
+    bench_report_config();
+
+    for (i = 0; i < NELEMS(benches); i++) {
+        if (!(opt.benches & benches[i].bench)) {
+            continue;
+        }
+
+        if (benches[i].run() != FC_OK) {
+            log_stderr("stg_ins_test: benchmark failed, see the log for "
+                       "details");
+            exit(1);
+        }
+        fflush(stdout);
+    }
+
     return 0;
 }